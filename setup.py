@@ -51,10 +51,12 @@ mcell_module = Extension(
     sources=[
         './src/argparse.c',
         './src/chkpt.c',
+        './src/compress_util.c',
         './src/count_util.c',
         './src/diffuse.c',
         './src/diffuse_trimol.c',
         './src/diffuse_util.c',
+        './src/domain_ranks.c',
         './src/dyngeom.c',
         './src/dyngeom_lex.c',
         './src/dyngeom_parse_extras.c',
@@ -72,23 +74,33 @@ mcell_module = Extension(
         './src/mcell_reactions.c',
         './src/mcell_release.c',
         './src/mcell_run.c',
+        './src/mcell_snapshot.c',
         './src/mcell_species.c',
         './src/mcell_surfclass.c',
         './src/mcell_viz.c',
         './src/mem_util.c',
+        './src/mol_index.c',
+        './src/nfsim_cache.c',
         './src/nfsim_func.c',
+        './src/packed_mols.c',
+        './src/packed_walls.c',
+        './src/philox.c',
         './src/pymcell.i',
         './src/react_cond.c',
         './src/react_outc.c',
         './src/react_outc_nfsim.c',
         './src/react_outc_trimol.c',
         './src/react_output.c',
+        './src/react_output_bin.c',
+        './src/react_table.c',
         './src/react_trig.c',
         './src/react_trig_nfsim.c',
         './src/react_util.c',
         './src/react_util_nfsim.c',
+        './src/repartition.c',
         './src/rng.c',
         './src/sched_util.c',
+        './src/storage_threads.c',
         './src/strfunc.c',
         './src/sym_table.c',
         './src/triangle_overlap.c',
@@ -98,6 +110,7 @@ mcell_module = Extension(
         './src/viz_output.c',
         './src/vol_util.c',
         './src/volume_output.c',
+        './src/wall_bvh.c',
         './src/wall_util.c',
         ],
     swig_opts=['-py3'],
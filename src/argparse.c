@@ -27,6 +27,7 @@
 
 #include "mcell_structs.h" /* for struct volume */
 #include "logging.h"
+#include "nfsim_cache.h"
 #include "version_info.h" /* for print_version, print_full_version */
 
 #include <stdarg.h>       /* for va_start, va_end, va_list */
@@ -69,6 +70,18 @@ static struct option long_options[] = { { "help", 0, 0, 'h' },
                                         { "quiet", 0, 0, 'q' },
                                         { "with_checks", 1, 0, 'w' },
                                         { "rules", 1, 0, 'r'},
+                                        { "threads", 1, 0, 't' },
+                                        { "ranks", 1, 0, 'n' },
+                                        { "packed_molecules", 0, 0, 'p' },
+                                        { "wall_bvh", 0, 0, 'B' },
+                                        { "packed_walls", 0, 0, 'P' },
+                                        { "huge_pages", 0, 0, 'H' },
+                                        { "binary_reaction_output", 0, 0, 'R' },
+                                        { "binary_volume_output", 0, 0, 'O' },
+                                        { "background_checkpoints", 0, 0, 'k' },
+                                        { "adaptive_partitions", 1, 0, 'a' },
+                                        { "nfsim_cache", 1, 0, 'N' },
+                                        { "nfsim_cache_size", 1, 0, 'M' },
                                         { NULL, 0, 0, 0 } };
 
 /* print_usage: Write the usage message for mcell to a file handle.
@@ -97,6 +110,18 @@ void print_usage(FILE *f, char const *argv0) {
       "     [-quiet]                 suppress all unrequested output except for errors\n"
       "     [-with_checks ('yes'/'no', default 'yes')]   performs check of the geometry for coincident walls\n"
       "     [-rules rules_file_name] run in MCell-R mode\n"
+      "     [-threads n]             run memory partitions on n threads (default: 1)\n"
+      "     [-ranks n]               split the world across n processes (default: 1; needs ACCURATE_3D_REACTIONS = FALSE, no checkpoints)\n"
+      "     [-packed_molecules]      scan packed copies of the molecule lists for reaction partners\n"
+      "     [-wall_bvh]              cull ray-wall tests with a bounding volume hierarchy per subvolume\n"
+      "     [-packed_walls]          test displacements against packed wall planes in one loop\n"
+      "     [-huge_pages]            back large memory pool blocks with huge pages\n"
+      "     [-binary_reaction_output] write reaction data files in binary (see rxn_bin2txt)\n"
+      "     [-binary_volume_output]  write the nonzero voxels of volume output in binary (see vol_bin2txt)\n"
+      "     [-background_checkpoints] write periodic checkpoints while the simulation goes on\n"
+      "     [-adaptive_partitions n] move the automatic partitions after n iterations to even out the load\n"
+      "     [-nfsim_cache file_name] keep NFSim query results in a file from one run to the next\n"
+      "     [-nfsim_cache_size n]    memory bound of the NFSim reaction cache in MB (default: 256, 0 for none)\n"
       "\n");
 }
 
@@ -277,6 +302,101 @@ int argparse_init(int argc, char *const argv[], struct volume *vol) {
       vol->chkpt_flag = 1;
       break;
 
+    case 't': /* -threads */
+      vol->num_threads = (int)strtol(optarg, &endptr, 0);
+      if (endptr == optarg || *endptr != '\0') {
+        argerror("Thread count must be an integer: %s", optarg);
+        return 1;
+      }
+
+      if (vol->num_threads < 1) {
+        argerror("Thread count %d is less than 1", vol->num_threads);
+        return 1;
+      }
+      break;
+
+    case 'n': /* -ranks */
+      vol->num_ranks = (int)strtol(optarg, &endptr, 0);
+      if (endptr == optarg || *endptr != '\0') {
+        argerror("Rank count must be an integer: %s", optarg);
+        return 1;
+      }
+
+      if (vol->num_ranks < 1) {
+        argerror("Rank count %d is less than 1", vol->num_ranks);
+        return 1;
+      }
+      break;
+
+    case 'p': /* -packed_molecules */
+      vol->use_packed_molecules = 1;
+      break;
+
+    case 'B': /* -wall_bvh */
+      vol->use_wall_bvh = 1;
+      break;
+
+    case 'P': /* -packed_walls */
+      vol->use_packed_walls = 1;
+      break;
+
+    case 'H': /* -huge_pages */
+      vol->use_huge_pages = 1;
+      break;
+
+    case 'R': /* -binary_reaction_output */
+      vol->use_binary_reaction_output = 1;
+      break;
+
+    case 'O': /* -binary_volume_output */
+      vol->use_binary_volume_output = 1;
+      break;
+
+    case 'k': /* -background_checkpoints */
+      vol->use_background_checkpoints = 1;
+      break;
+
+    case 'a': /* -adaptive_partitions */
+      vol->adaptive_partition_iterations = (int)strtol(optarg, &endptr, 0);
+      if (endptr == optarg || *endptr != '\0') {
+        argerror("Adaptive partition iteration count must be an integer: %s",
+                 optarg);
+        return 1;
+      }
+
+      if (vol->adaptive_partition_iterations < 1) {
+        argerror("Adaptive partition iteration count %d is less than 1",
+                 vol->adaptive_partition_iterations);
+        return 1;
+      }
+      break;
+
+    case 'N': /* -nfsim_cache */
+      free(vol->nfsim_cache_file);
+      vol->nfsim_cache_file = strdup(optarg);
+      if (vol->nfsim_cache_file == NULL) {
+        argerror("File '%s', Line %u: Out of memory while parsing "
+                 "command-line arguments: %s\n",
+                 __FILE__, __LINE__, optarg);
+        return 1;
+      }
+      break;
+
+    case 'M': /* -nfsim_cache_size */
+    {
+      long size = strtol(optarg, &endptr, 0);
+      if (endptr == optarg || *endptr != '\0') {
+        argerror("NFSim reaction cache size must be an integer: %s", optarg);
+        return 1;
+      }
+      if (size < 0) {
+        argerror("NFSim reaction cache size %ld is negative", size);
+        return 1;
+      }
+      vol->nfsim_cache_bytes = (size_t)size << 20;
+      break;
+    }
+
     case 'r': /* nfsim */
       vol->nfsim_flag = 1;
       rules_xml_file = strdup(optarg);
@@ -376,6 +496,7 @@ int argparse_init(int argc, char *const argv[], struct volume *vol) {
   /* Initialize NFSim if requested */
   if (vol->nfsim_flag) {
     int nfsimStatus = setupNFSim_c(rules_xml_file, vol->seed_seq, 0);
+    vol->nfsim_rules_fingerprint = nfsim_rules_fingerprint(rules_xml_file);
     free(rules_xml_file);
     if (nfsimStatus != 0){
       argerror("nfsim model could not be properly initialized: %s", optarg);
@@ -37,6 +37,13 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include "mcell_structs.h"
 #include "mcell_reactions.h"
@@ -48,9 +55,13 @@
 #include "count_util.h"
 #include "react.h"
 #include "strfunc.h"
+#include "compress_util.h"
+#include "react_output.h"
+#include "react_output_bin.h"
+#include "storage_threads.h"
 
 /* MCell checkpoint API version */
-#define CHECKPOINT_API 1
+#define CHECKPOINT_API 3
 
 /* Endian-ness markers */
 #define MCELL_BIG_ENDIAN 16
@@ -68,6 +79,15 @@
 #define NUM_CHKPT_CMDS 9
 #define CHECKPOINT_API_CMD 10
 
+/* Molecule chunks (API version 3 and up) */
+#define MOL_CHUNK_MAX_MOLS 65536
+#define MOL_CHUNK_BYTES_PER_MOL                                                \
+  (6 * sizeof(double) + sizeof(uint32_t) + sizeof(int16_t) + sizeof(byte))
+#define MOL_CHUNK_SHUFFLED 0   /* Columns with shuffled bytes */
+#define MOL_CHUNK_COMPRESSED 1 /* Same, compressed with block_compress */
+#define MOL_CHUNK_ACT_NEWBIE 1
+#define MOL_CHUNK_ACT_CHANGE 2
+
 /* Newbie flags */
 #define HAS_ACT_NEWBIE 1
 #define HAS_NOT_ACT_NEWBIE 0
@@ -205,6 +225,55 @@ struct chkpt_read_state {
   byte byte_order_mismatch;
 };
 
+/* Molecules of a storage, or a part of them, in columns */
+struct mol_chunk {
+  struct mol_chunk *next;
+  u_int n_mols;
+  double *t, *t2, *birthday;
+  double *x, *y, *z;
+  uint32_t *species;
+  int16_t *orient;
+  byte *flags;
+  byte *raw;          /* Buffer holding the columns */
+  uint32_t method;    /* MOL_CHUNK_SHUFFLED or MOL_CHUNK_COMPRESSED */
+  byte *stored;       /* Data as in the checkpoint file */
+  size_t stored_size;
+};
+
+/* State shared by the threads writing the molecule chunks */
+struct chunk_writer {
+  FILE *fs;
+  double simulation_start_seconds;
+  double start_iterations;
+  double time_unit;
+  struct storage **stores; /* In the order their chunks are written */
+  int n_stores;
+
+  pthread_mutex_t lock;      /* Guards the fields below and fs */
+  struct mol_chunk **chunks; /* Built but not yet written, by storage */
+  byte *done;                /* Whether the chunks of a storage are built */
+  int next_write;            /* First storage whose chunks are not written */
+  int write_errno;
+};
+
+/* State shared by the threads unpacking the molecule chunks */
+struct chunk_reader {
+  struct mol_chunk *chunks;
+  int n_chunks;
+  int first; /* First chunk of the ones being unpacked */
+  byte byte_order_mismatch;
+};
+
+/* Jobs run concurrently by run_chkpt_jobs */
+struct chkpt_jobs {
+  pthread_mutex_t lock;
+  int next_job;
+  int n_jobs;
+  int (*run)(void *arg, int job);
+  void *arg;
+  int failed;
+};
+
 /* Handlers for individual checkpoint commands */
 static int read_current_time_seconds(struct volume *world, FILE *fs,
                                      struct chkpt_read_state *state);
@@ -213,7 +282,8 @@ static int read_current_iteration(struct volume *world, FILE *fs,
 static int read_chkpt_seq_num(struct volume *world, FILE *fs,
                               struct chkpt_read_state *state);
 static int read_rng_state(struct volume *world, FILE *fs,
-                          struct chkpt_read_state *state);
+                          struct chkpt_read_state *state,
+                          uint32_t api_version);
 static int read_byte_order(FILE *fs, struct chkpt_read_state *state);
 static int read_mcell_version(FILE *fs, struct chkpt_read_state *state);
 static int read_api_version(FILE *fs, struct chkpt_read_state *state,
@@ -222,19 +292,23 @@ static int read_species_table(struct volume *world, FILE *fs);
 static int read_mol_scheduler_state_real(struct volume *world, FILE *fs,
                                          struct chkpt_read_state *state,
                                          uint32_t api_version);
+static int read_mol_chunks(struct volume *world, FILE *fs,
+                           struct chkpt_read_state *state,
+                           uint32_t api_version);
 static int write_mcell_version(FILE *fs, const char *mcell_version);
 static int write_current_time_seconds(FILE *fs, double current_time_seconds);
 static int write_current_iteration(FILE *fs, long long current_iterations,
                                    double current_time_seconds);
 static int write_chkpt_seq_num(FILE *fs, u_int chkpt_seq_num);
-static int write_rng_state(FILE *fs, u_int seed_seq, struct rng_state *rng);
+static int write_rng_state(FILE *fs, u_int seed_seq, struct rng_state *rng,
+                           struct storage_list *storage_head);
 static int write_species_table(FILE *fs, int n_species,
                                struct species **species_list);
 static int write_mol_scheduler_state_real(FILE *fs,
                                           struct storage_list *storage_head,
                                           double simulation_start_seconds,
                                           double start_iterations,
-                                          double time_unit);
+                                          double time_unit, int n_threads);
 static int write_byte_order(FILE *fs);
 
 static int write_api_version(FILE *fs);
@@ -293,13 +367,31 @@ void chkpt_signal_handler(int signo) {
 }
 
 /***************************************************************************
- create_chkpt:
+ advance_chkpt_start:
+ In:  world - simulation state
+ Out: No return value.  The current time is brought up to date, and the
+      current iteration becomes the start of the simulation as far as the
+      checkpoint is concerned.
+***************************************************************************/
+static void advance_chkpt_start(struct volume *world) {
+  world->current_time_seconds = world->current_time_seconds +
+      (world->current_iterations - world->start_iterations) * world->time_unit;
+  // These are normally set when reading a checkpoint. They need to be set here
+  // in case we checkpoint without exiting (i.e. using NOEXIT). Otherwise,
+  // world->current_time_seconds will be set incorrectly upon subsequent calls
+  // to create_chkpt
+  world->start_iterations = world->current_iterations;
+  world->simulation_start_seconds = world->current_time_seconds;
+}
+
+/***************************************************************************
+ write_chkpt_file:
  In:  filename - the name of the checkpoint file to create
  Out: returns 1 on failure, 0 on success.  On success, checkpoint file is
       written to the appropriate filename.  On failure, the old checkpoint file
       is left unmolested.
 ***************************************************************************/
-int create_chkpt(struct volume *world, char const *filename) {
+static int write_chkpt_file(struct volume *world, char const *filename) {
   FILE *outfs = NULL;
 
   /* Create temporary filename */
@@ -314,14 +406,6 @@ int create_chkpt(struct volume *world, char const *filename) {
     mcell_perror(errno, "Failed to write checkpoint file '%s'", tmpname);
 
   /* Write checkpoint */
-  world->current_time_seconds = world->current_time_seconds +
-      (world->current_iterations - world->start_iterations) * world->time_unit;
-  // These are normally set when reading a checkpoint. They need to be set here
-  // in case we checkpoint without exiting (i.e. using NOEXIT). Otherwise,
-  // world->current_time_seconds will be set incorrectly upon subsequent calls
-  // to create_chkpt
-  world->start_iterations = world->current_iterations;
-  world->simulation_start_seconds = world->current_time_seconds;
   if (write_chkpt(world, outfs))
     mcell_error("Failed to write checkpoint file %s\n", filename);
   fclose(outfs);
@@ -356,6 +440,111 @@ int create_chkpt(struct volume *world, char const *filename) {
   return 0;
 }
 
+/***************************************************************************
+ create_chkpt:
+ In:  filename - the name of the checkpoint file to create
+ Out: returns 1 on failure, 0 on success.  On success, checkpoint file is
+      written to the appropriate filename.  On failure, the old checkpoint file
+      is left unmolested.
+***************************************************************************/
+int create_chkpt(struct volume *world, char const *filename) {
+  advance_chkpt_start(world);
+  return write_chkpt_file(world, filename);
+}
+
+/***************************************************************************
+ create_chkpt_in_background:
+ In:  filename - the name of the checkpoint file to create
+ Out: returns 1 on failure, 0 on success.  A copy of the process is forked
+      which writes the checkpoint as create_chkpt does and exits, while this
+      process carries on; the copy sees the simulation as it was at the
+      time of the call.  A checkpoint still being written in the background
+      is waited for first, so that checkpoint files replace each other in
+      order.  If the copy cannot be started, the checkpoint is written
+      right away.
+
+ Note: The storage worker threads and the reaction data writer are brought
+       to a stop and buffered output is flushed before the fork, so that
+       the copy, which has only the calling thread, inherits no held lock
+       and has nothing left to write but the checkpoint.  Errors in the copy
+       end it with _Exit (see mcell_die_immediately), so that it runs no
+       exit handlers of the simulation.
+***************************************************************************/
+int create_chkpt_in_background(struct volume *world, char const *filename) {
+#ifdef _WIN32 /* fixme: Windows does not support fork */
+  return create_chkpt(world, filename);
+#else
+  wait_for_chkpt_writer(world, 1);
+  advance_chkpt_start(world);
+
+  storage_threads_before_fork(world);
+  binary_reaction_output_before_fork();
+  fflush(NULL);
+  pid_t pid = fork();
+  binary_reaction_output_after_fork();
+  storage_threads_after_fork(world);
+  if (pid < 0) {
+    mcell_perror_nodie(errno, "Failed to start a process for writing checkpoint "
+                              "file '%s' in the background",
+                       filename);
+    return write_chkpt_file(world, filename);
+  }
+
+  if (pid == 0) {
+    /* Reaction output and other open files belong to the simulation, not
+     * to this copy */
+    mcell_die_immediately();
+    emergency_output_hook_enabled = 0;
+    int status = write_chkpt_file(world, filename);
+    fflush(mcell_get_log_file());
+    fflush(mcell_get_error_file());
+    _exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  world->chkpt_writer_pid = pid;
+  gettimeofday(&world->chkpt_writer_start, NULL);
+  return 0;
+#endif
+}
+
+/***************************************************************************
+ wait_for_chkpt_writer:
+ In:  block - whether to wait for a checkpoint being written in the
+              background to be done
+ Out: No return value.  If the process writing a checkpoint in the
+      background has finished, it is reaped and reported.  Exits with an
+      error if it failed, as create_chkpt does.
+***************************************************************************/
+void wait_for_chkpt_writer(struct volume *world, int block) {
+#ifndef _WIN32
+  if (world->chkpt_writer_pid == 0)
+    return;
+
+  int status;
+  pid_t pid;
+  do {
+    pid = waitpid(world->chkpt_writer_pid, &status, block ? 0 : WNOHANG);
+  } while (pid < 0 && errno == EINTR);
+  if (pid == 0)
+    return;
+
+  world->chkpt_writer_pid = 0;
+  if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    mcell_error("Failed to write checkpoint file %s in the background.",
+                world->chkpt_outfile);
+
+  if (world->notify->checkpoint_report != NOTIFY_NONE) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    mcell_log("MCell: checkpoint file %s written in the background in "
+              "%.2f s.",
+              world->chkpt_outfile,
+              (now.tv_sec - world->chkpt_writer_start.tv_sec) +
+                  1e-6 * (now.tv_usec - world->chkpt_writer_start.tv_usec));
+  }
+#endif
+}
+
 /***************************************************************************
  write_varintl: Size- and endian-agnostic saving of unsigned long long values.
  In:  fs - file handle to which to write
@@ -503,11 +692,12 @@ int write_chkpt(struct volume *world, FILE *fs) {
           write_current_iteration(fs, world->current_iterations,
                                   world->current_time_seconds) ||
           write_chkpt_seq_num(fs, world->chkpt_seq_num) ||
-          write_rng_state(fs, world->seed_seq, world->rng) ||
+          write_rng_state(fs, world->seed_seq, world->rng,
+                          world->storage_head) ||
           write_species_table(fs, world->n_species, world->species_list) ||
           write_mol_scheduler_state_real(fs, world->storage_head,
               world->simulation_start_seconds, world->start_iterations,
-              world->time_unit));
+              world->time_unit, world->num_threads));
 }
 
 /***************************************************************************
@@ -635,7 +825,7 @@ int read_chkpt(struct volume *world, FILE *fs, bool only_time_and_iter) {
       break;
 
     case RNG_STATE_CMD:
-      if (read_rng_state(world, fs, &state))
+      if (read_rng_state(world, fs, &state, api_version))
         return 1;
       break;
 
@@ -651,7 +841,11 @@ int read_chkpt(struct volume *world, FILE *fs, bool only_time_and_iter) {
       DATACHECK(
           !seen_section[SPECIES_TABLE_CMD],
           "Species table command must precede molecule scheduler command.");
-      if (read_mol_scheduler_state_real(world, fs, &state, api_version))
+      if (api_version >= 3) {
+        if (read_mol_chunks(world, fs, &state, api_version))
+          return 1;
+      } else if (read_mol_scheduler_state_real(world, fs, &state,
+                                               api_version))
         return 1;
       break;
 
@@ -921,6 +1115,14 @@ static int write_an_rng_state(FILE *fs, struct rng_state *rng) {
   WRITEFIELD(rng->b);
   WRITEFIELD(rng->c);
   WRITEFIELD(rng->d);
+#elif defined(USE_PHILOX_RNG)
+  static const char RNG_PHILOX = 'P';
+  WRITEFIELD(RNG_PHILOX);
+  WRITEFIELD(rng->key[0]);
+  WRITEFIELD(rng->key[1]);
+  WRITEFIELD(rng->stream);
+  WRITEFIELD(rng->counter);
+  WRITEUINT(rng->randcnt);
 #else
   static const char RNG_ISAAC = 'I';
   WRITEFIELD(RNG_ISAAC);
@@ -937,10 +1139,15 @@ static int write_an_rng_state(FILE *fs, struct rng_state *rng) {
 /***************************************************************************
  write_rng_state:
  In:  fs - checkpoint file to write to.
- Out: Writes random number generator state to the checkpoint file.
+      seed_seq - seed of the run
+      rng - the world's random number generator
+      storage_head - list of storages
+ Out: Writes random number generator state to the checkpoint file, followed
+      by the private streams of the storages if they have any.
       Returns 1 on error, and 0 - on success.
 ***************************************************************************/
-static int write_rng_state(FILE *fs, u_int seed_seq, struct rng_state *rng) {
+static int write_rng_state(FILE *fs, u_int seed_seq, struct rng_state *rng,
+                           struct storage_list *storage_head) {
   static const char SECTNAME[] = "RNG state";
   static const byte cmd = RNG_STATE_CMD;
 
@@ -948,6 +1155,17 @@ static int write_rng_state(FILE *fs, u_int seed_seq, struct rng_state *rng) {
   WRITEUINT(seed_seq);
   if (write_an_rng_state(fs, rng))
     return 1;
+
+  /* Either all storages have a private stream or none of them has */
+  u_int n_streams = 0;
+  if (storage_head != NULL && storage_head->store->rng != NULL)
+    for (struct storage_list *l = storage_head; l != NULL; l = l->next)
+      n_streams++;
+  WRITEUINT(n_streams);
+  if (n_streams != 0)
+    for (struct storage_list *l = storage_head; l != NULL; l = l->next)
+      if (write_an_rng_state(fs, l->store->rng))
+        return 1;
   return 0;
 }
 
@@ -975,6 +1193,23 @@ static int read_an_rng_state(FILE *fs, struct chkpt_read_state *state,
   READFIELD(rng->c);
   READFIELD(rng->d);
 
+#elif defined(USE_PHILOX_RNG)
+  static const char RNG_PHILOX = 'P';
+  char rngtype;
+  READFIELD(rngtype);
+  DATACHECK(rngtype != RNG_PHILOX, "Invalid RNG type stored in checkpoint file "
+                                   "(in this version of MCell, only "
+                                   "Philox4x32-10 is supported).");
+  READFIELD(rng->key[0]);
+  READFIELD(rng->key[1]);
+  READFIELD(rng->stream);
+  READFIELD(rng->counter);
+  READUINT(rng->randcnt);
+  DATACHECK(rng->randcnt > PHILOX_RANDMAX ||
+                (rng->randcnt != 0 && rng->counter < PHILOX_BLOCKS),
+            "Invalid Philox4x32-10 position stored in checkpoint file.");
+  philox_restore(rng);
+
 #else
   static const char RNG_ISAAC = 'I';
   char rngtype;
@@ -998,11 +1233,15 @@ static int read_an_rng_state(FILE *fs, struct chkpt_read_state *state,
 /***************************************************************************
  read_rng_state:
  In:  fs - checkpoint file to read from.
- Out: Reads random number generator state from the checkpoint file.
+      state - contextual state for reading checkpoint file
+      api_version - checkpoint API version of the file
+ Out: Reads random number generator state from the checkpoint file, and the
+      private streams of the storages if it has them.
       Returns 1 on error, and 0 - on success.
 ***************************************************************************/
 static int read_rng_state(struct volume *world, FILE *fs,
-                          struct chkpt_read_state *state) {
+                          struct chkpt_read_state *state,
+                          uint32_t api_version) {
   static const char SECTNAME[] = "RNG state";
 
   /* Load seed_seq from chkpt file to compare with seed_seq from command line.
@@ -1022,6 +1261,45 @@ static int read_rng_state(struct volume *world, FILE *fs,
   if (world->seed_seq != old_seed)
     rng_init(world->rng, world->seed_seq);
 
+  if (api_version < 2)
+    return 0;
+
+  /* The storages' streams are only kept if the seed and the partitioning
+   * are the same; otherwise the storages start their streams afresh. */
+  unsigned int n_streams;
+  READUINT(n_streams);
+  int n_storages = 0;
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next)
+    n_storages++;
+  int keep = (world->seed_seq == old_seed && (int)n_streams == n_storages);
+
+  struct storage_list *l = world->storage_head;
+  struct rng_state *discard = NULL;
+  for (unsigned int i = 0; i < n_streams; i++) {
+    struct rng_state *rng;
+    if (keep) {
+      if (l->store->rng == NULL)
+        l->store->rng = CHECKED_MALLOC_STRUCT(struct rng_state,
+                                              "random number generator state");
+      rng = l->store->rng;
+      l = l->next;
+    } else {
+      if (discard == NULL)
+        discard = CHECKED_MALLOC_STRUCT(struct rng_state,
+                                        "random number generator state");
+      rng = discard;
+    }
+    if (read_an_rng_state(fs, state, rng)) {
+      free(discard);
+      return 1;
+    }
+  }
+  free(discard);
+
+  if (n_streams != 0 && !keep && (int)n_streams != n_storages)
+    mcell_warn("The checkpoint file has random number streams for %u memory "
+               "partitions, but the model has %d; starting new streams.",
+               n_streams, n_storages);
   return 0;
 }
 
@@ -1149,110 +1427,478 @@ count_items_in_scheduler(struct storage_list *storage_head) {
   return total_items;
 }
 
+/***************************************************************************
+ run_chkpt_worker:
+ In:  arg - jobs to run
+ Out: NULL.  Runs jobs until there are none left.
+***************************************************************************/
+static void *run_chkpt_worker(void *arg) {
+  struct chkpt_jobs *jobs = (struct chkpt_jobs *)arg;
+  while (1) {
+    pthread_mutex_lock(&jobs->lock);
+    int job = jobs->next_job++;
+    pthread_mutex_unlock(&jobs->lock);
+    if (job >= jobs->n_jobs)
+      break;
+
+    if (jobs->run(jobs->arg, job)) {
+      pthread_mutex_lock(&jobs->lock);
+      jobs->failed = 1;
+      pthread_mutex_unlock(&jobs->lock);
+    }
+  }
+  return NULL;
+}
+
+/***************************************************************************
+ run_chkpt_jobs:
+ In:  n_threads - number of threads to use, including the calling thread
+      n_jobs - number of jobs
+      run - function running one job, returning 1 on failure
+      arg - first argument to 'run'
+ Out: Returns 1 if any job failed, and 0 otherwise.  The jobs are run on up
+      to n_threads threads, in no particular order.
+***************************************************************************/
+static int run_chkpt_jobs(int n_threads, int n_jobs,
+                          int (*run)(void *arg, int job), void *arg) {
+  struct chkpt_jobs jobs;
+  pthread_mutex_init(&jobs.lock, NULL);
+  jobs.next_job = 0;
+  jobs.n_jobs = n_jobs;
+  jobs.run = run;
+  jobs.arg = arg;
+  jobs.failed = 0;
+
+  int n_workers = ((n_threads < n_jobs) ? n_threads : n_jobs) - 1;
+  pthread_t workers[(n_workers > 0) ? n_workers : 1];
+  int n_started = 0;
+  for (; n_started < n_workers; n_started++)
+    if (pthread_create(&workers[n_started], NULL, run_chkpt_worker, &jobs))
+      break;
+
+  run_chkpt_worker(&jobs);
+  for (int i = 0; i < n_started; i++)
+    pthread_join(workers[i], NULL);
+  pthread_mutex_destroy(&jobs.lock);
+  return jobs.failed;
+}
+
+/***************************************************************************
+ set_chunk_columns:
+ In:  chunk - molecule chunk
+      raw - buffer of MOL_CHUNK_BYTES_PER_MOL bytes per molecule
+      n_mols - number of molecules the buffer is for
+ Out: No return value.  The columns of the chunk point into the buffer.
+      Columns are laid out from the widest to the narrowest so that all of
+      them are aligned.
+***************************************************************************/
+static void set_chunk_columns(struct mol_chunk *chunk, byte *raw,
+                              size_t n_mols) {
+  chunk->raw = raw;
+  chunk->t = (double *)raw;
+  chunk->t2 = chunk->t + n_mols;
+  chunk->birthday = chunk->t2 + n_mols;
+  chunk->x = chunk->birthday + n_mols;
+  chunk->y = chunk->x + n_mols;
+  chunk->z = chunk->y + n_mols;
+  chunk->species = (uint32_t *)(chunk->z + n_mols);
+  chunk->orient = (int16_t *)(chunk->species + n_mols);
+  chunk->flags = (byte *)(chunk->orient + n_mols);
+}
+
+/* Columns of a molecule chunk, in the order they are laid out */
+static const size_t mol_chunk_column_sizes[] = {
+  sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+  sizeof(double), sizeof(double), sizeof(uint32_t), sizeof(int16_t),
+  sizeof(byte)
+};
+#define N_MOL_CHUNK_COLUMNS                                                    \
+  (sizeof(mol_chunk_column_sizes) / sizeof(mol_chunk_column_sizes[0]))
+
+/***************************************************************************
+ seal_mol_chunk:
+ In:  chunk - molecule chunk holding chunk->n_mols molecules in columns
+              sized for MOL_CHUNK_MAX_MOLS molecules
+ Out: No return value.  The columns are shuffled and compressed into
+      chunk->stored, which is what goes into the checkpoint file.
+***************************************************************************/
+static void seal_mol_chunk(struct mol_chunk *chunk) {
+  size_t n = chunk->n_mols;
+  size_t raw_size = n * MOL_CHUNK_BYTES_PER_MOL;
+  byte *shuffled = CHECKED_MALLOC_ARRAY(byte, raw_size, "checkpoint chunk");
+  byte *packed = CHECKED_MALLOC_ARRAY(byte, raw_size, "checkpoint chunk");
+  size_t packed_size =
+      pack_columns(chunk->raw, MOL_CHUNK_MAX_MOLS, n, mol_chunk_column_sizes,
+                   N_MOL_CHUNK_COLUMNS, shuffled, packed);
+
+  /* Keep the shuffled bytes if they do not compress */
+  if (packed_size == 0) {
+    free(packed);
+    chunk->method = MOL_CHUNK_SHUFFLED;
+    chunk->stored = shuffled;
+    chunk->stored_size = raw_size;
+  } else {
+    free(shuffled);
+    chunk->method = MOL_CHUNK_COMPRESSED;
+    chunk->stored = packed;
+    chunk->stored_size = packed_size;
+  }
+}
+
+/***************************************************************************
+ gather_storage_chunks:
+ In:  cw - checkpoint chunk writer
+      store - storage whose scheduled molecules to gather
+      chunks - receives the list of chunks
+ Out: Returns 1 on error, and 0 - on success.  The molecules in the
+      scheduler of the storage are gathered into sealed chunks, in
+      scheduler order.
+***************************************************************************/
+static int gather_storage_chunks(struct chunk_writer *cw,
+                                 struct storage *store,
+                                 struct mol_chunk **chunks) {
+  struct mol_chunk **tail = chunks;
+  struct mol_chunk *chunk = NULL;
+  byte *raw = NULL;
+
+  for (struct schedule_helper *shp = store->timer; shp != NULL;
+       shp = shp->next_scale) {
+    for (int n = -1; n < shp->buf_len; n++) {
+      for (struct abstract_element *aep = (n < 0) ? shp->current
+                                                  : shp->circ_buf_head[n];
+           aep != NULL; aep = aep->next) {
+        struct abstract_molecule *amp = (struct abstract_molecule *)aep;
+        if (amp->properties == NULL)
+          continue;
+
+        /* Grab the location and orientation for this molecule */
+        struct vector3 where;
+        short orient = 0;
+        if ((amp->properties->flags & NOT_FREE) == 0) {
+          struct volume_molecule *vmp = (struct volume_molecule *)amp;
+          INTERNALCHECK(vmp->previous_wall != NULL && vmp->index >= 0,
+                        "The value of 'previous_grid' is not NULL.");
+          where = vmp->pos;
+        } else if ((amp->properties->flags & ON_GRID) != 0) {
+          struct surface_molecule *smp = (struct surface_molecule *)amp;
+          uv2xyz(&smp->s_pos, smp->grid->surface, &where);
+          orient = smp->orient;
+        } else
+          continue;
+
+        /* Check for valid chkpt_species ID. */
+        INTERNALCHECK(amp->properties->chkpt_species_id == UINT_MAX,
+                      "Attempted to write out a molecule of species '%s', "
+                      "which has not been assigned a checkpoint species id.",
+                      amp->properties->sym->name);
+
+        if (chunk == NULL) {
+          chunk = CHECKED_MALLOC_STRUCT(struct mol_chunk, "checkpoint chunk");
+          memset(chunk, 0, sizeof(struct mol_chunk));
+          if (raw == NULL)
+            raw = CHECKED_MALLOC_ARRAY(byte, MOL_CHUNK_MAX_MOLS *
+                                                 MOL_CHUNK_BYTES_PER_MOL,
+                                       "checkpoint chunk");
+          set_chunk_columns(chunk, raw, MOL_CHUNK_MAX_MOLS);
+        }
+
+        // NOTE: we write all times as real times (seconds) *not* as
+        // "iterations" (or "scaled times") in order to be able to
+        // re-schedule them properly upon restart
+
+        // The scheduling time (t) is essentially iterations, and since time
+        // steps can change when checkpointing, we can't directly convert
+        // iterations to real time (seconds). We need to correct for this by
+        // only converting the iterations of the current simulation
+        // [(t-start_iterations)*time_unit] and adding the real time at the
+        // start of the simulation (simulation_start_seconds).
+        // We do a simple conversion for the lifetime t2, since this
+        // corresponds to some event in the future and can be directly
+        // computed without using an offset.
+        // Birthday is now always treated as real time in seconds, not
+        // "scaled" time or iterations.
+        u_int i = chunk->n_mols++;
+        chunk->species[i] = amp->properties->chkpt_species_id;
+        chunk->flags[i] =
+            ((amp->flags & ACT_NEWBIE) ? MOL_CHUNK_ACT_NEWBIE : 0) |
+            ((amp->flags & ACT_CHANGE) ? MOL_CHUNK_ACT_CHANGE : 0);
+        chunk->orient[i] = orient;
+        chunk->t[i] = convert_iterations_to_seconds(
+            cw->start_iterations, cw->time_unit, cw->simulation_start_seconds,
+            amp->t);
+        chunk->t2[i] = amp->t2 * cw->time_unit;
+        chunk->birthday[i] = amp->birthday;
+        chunk->x[i] = where.x;
+        chunk->y[i] = where.y;
+        chunk->z[i] = where.z;
+
+        if (chunk->n_mols == MOL_CHUNK_MAX_MOLS) {
+          seal_mol_chunk(chunk);
+          *tail = chunk;
+          tail = &chunk->next;
+          chunk = NULL;
+        }
+      }
+    }
+  }
+
+  if (chunk != NULL) {
+    seal_mol_chunk(chunk);
+    *tail = chunk;
+  }
+  free(raw);
+  return 0;
+}
+
+/***************************************************************************
+ write_storage_chunks:
+ In:  arg - checkpoint chunk writer
+      job - index of the storage to write
+ Out: Returns 1 on error, and 0 - on success.  The chunks of the storage are
+      built; they, and those of any storages after it whose chunks were
+      already built, are written as soon as the chunks of all storages
+      before it have been written.  Write errors are left in
+      cw->write_errno.
+***************************************************************************/
+static int write_storage_chunks(void *arg, int job) {
+  struct chunk_writer *cw = (struct chunk_writer *)arg;
+  FILE *fs = cw->fs;
+
+  struct mol_chunk *chunks = NULL;
+  int failed = gather_storage_chunks(cw, cw->stores[job], &chunks);
+
+  pthread_mutex_lock(&cw->lock);
+  cw->chunks[job] = chunks;
+  cw->done[job] = 1;
+  for (; cw->next_write < cw->n_stores && cw->done[cw->next_write];
+       cw->next_write++) {
+    struct mol_chunk *next;
+    for (chunks = cw->chunks[cw->next_write]; chunks != NULL; chunks = next) {
+      next = chunks->next;
+      if (cw->write_errno == 0) {
+        uint32_t n_mols = chunks->n_mols;
+        uint32_t method = chunks->method;
+        uint64_t stored_size = chunks->stored_size;
+        if (fwrite(&n_mols, sizeof(n_mols), 1, fs) != 1 ||
+            fwrite(&method, sizeof(method), 1, fs) != 1 ||
+            fwrite(&stored_size, sizeof(stored_size), 1, fs) != 1 ||
+            fwrite(chunks->stored, 1, chunks->stored_size, fs) !=
+                chunks->stored_size)
+          cw->write_errno = (errno != 0) ? errno : EIO;
+      }
+      free(chunks->stored);
+      free(chunks);
+    }
+    cw->chunks[cw->next_write] = NULL;
+  }
+  pthread_mutex_unlock(&cw->lock);
+
+  return failed;
+}
+
 /***************************************************************************
  write_mol_scheduler_state_real:
  In:  fs - checkpoint file to write to.
+      n_threads - number of threads to build the chunks on
  Out: Writes molecule scheduler data to the checkpoint file.
       Returns 1 on error, and 0 - on success.
+
+ Note: The molecules of each storage are stored in chunks of up to
+       MOL_CHUNK_MAX_MOLS molecules, each holding the molecule fields in
+       columns which are shuffled and compressed independently of the other
+       chunks.  Storages are turned into chunks concurrently, and the chunks
+       are written in storage order as they become ready.  The section ends
+       with the header of an empty chunk.  Chunk layout (native byte order):
+         uint32_t n_mols
+         uint32_t method         MOL_CHUNK_SHUFFLED or MOL_CHUNK_COMPRESSED
+         uint64_t stored_size    followed by as many bytes of data
+       Once unpacked, the data are the columns t, t2, birthday, x, y, z
+       (doubles), species id (uint32_t), orientation (int16_t) and flags
+       (MOL_CHUNK_ACT_*, one byte).
 ***************************************************************************/
 static int write_mol_scheduler_state_real(FILE *fs,
                                           struct storage_list *storage_head,
                                           double simulation_start_seconds,
                                           double start_iterations,
-                                          double time_unit) {
+                                          double time_unit, int n_threads) {
   static const char SECTNAME[] = "molecule scheduler state";
   static const byte cmd = MOL_SCHEDULER_STATE_CMD;
 
   WRITEFIELD(cmd);
 
-  /* write total number of items in the scheduler */
-  unsigned long long total_items = count_items_in_scheduler(storage_head);
-  WRITEUINT64(total_items);
+  struct chunk_writer cw;
+  memset(&cw, 0, sizeof(struct chunk_writer));
+  cw.fs = fs;
+  cw.simulation_start_seconds = simulation_start_seconds;
+  cw.start_iterations = start_iterations;
+  cw.time_unit = time_unit;
+  for (struct storage_list *slp = storage_head; slp != NULL; slp = slp->next)
+    cw.n_stores++;
+  if (cw.n_stores != 0) {
+    cw.stores = CHECKED_MALLOC_ARRAY(struct storage *, cw.n_stores,
+                                     "checkpoint storage list");
+    cw.chunks = CHECKED_MALLOC_ARRAY(struct mol_chunk *, cw.n_stores,
+                                     "checkpoint chunk lists");
+    cw.done = CHECKED_MALLOC_ARRAY(byte, cw.n_stores, "checkpoint chunk lists");
+    memset(cw.done, 0, cw.n_stores * sizeof(byte));
+    int i = 0;
+    for (struct storage_list *slp = storage_head; slp != NULL; slp = slp->next)
+      cw.stores[i++] = slp->store;
+  }
+  pthread_mutex_init(&cw.lock, NULL);
 
-  /* Iterate over all molecules in the scheduler to produce checkpoint */
-  for (struct storage_list *slp = storage_head; slp != NULL; slp = slp->next) {
-    for (struct schedule_helper *shp = slp->store->timer; shp != NULL;
-         shp = shp->next_scale) {
-      for (int i = -1; i < shp->buf_len; i++) {
-        for (struct abstract_element *aep = (i < 0) ? shp->current
-                                                    : shp->circ_buf_head[i];
-             aep != NULL; aep = aep->next) {
-          struct abstract_molecule *amp = (struct abstract_molecule *)aep;
-          if (amp->properties == NULL)
-            continue;
+  int failed =
+      run_chkpt_jobs(n_threads, cw.n_stores, write_storage_chunks, &cw);
 
-          /* Grab the location and orientation for this molecule */
-          struct vector3 where;
-          short orient = 0;
-          byte act_newbie_flag =
-              (amp->flags & ACT_NEWBIE) ? HAS_ACT_NEWBIE : HAS_NOT_ACT_NEWBIE;
-          byte act_change_flag =
-              (amp->flags & ACT_CHANGE) ? HAS_ACT_CHANGE : HAS_NOT_ACT_CHANGE;
-          if ((amp->properties->flags & NOT_FREE) == 0) {
-            struct volume_molecule *vmp = (struct volume_molecule *)amp;
-            INTERNALCHECK(vmp->previous_wall != NULL && vmp->index >= 0,
-                          "The value of 'previous_grid' is not NULL.");
-            where.x = vmp->pos.x;
-            where.y = vmp->pos.y;
-            where.z = vmp->pos.z;
-            orient = 0;
-          } else if ((amp->properties->flags & ON_GRID) != 0) {
-            struct surface_molecule *smp = (struct surface_molecule *)amp;
-            uv2xyz(&smp->s_pos, smp->grid->surface, &where);
-            orient = smp->orient;
-          } else
-            continue;
+  pthread_mutex_destroy(&cw.lock);
+  free(cw.stores);
+  free(cw.chunks);
+  free(cw.done);
+  if (failed)
+    return 1;
+  errno = cw.write_errno;
+  WRITECHECK(cw.write_errno != 0, SECTNAME);
+
+  uint32_t end_n_mols = 0;
+  uint32_t end_method = MOL_CHUNK_SHUFFLED;
+  uint64_t end_size = 0;
+  WRITEFIELD(end_n_mols);
+  WRITEFIELD(end_method);
+  WRITEFIELD(end_size);
+  return 0;
+}
 
-          /* Check for valid chkpt_species ID. */
-          INTERNALCHECK(amp->properties->chkpt_species_id == UINT_MAX,
-                        "Attempted to write out a molecule of species '%s', "
-                        "which has not been assigned a checkpoint species id.",
-                        amp->properties->sym->name);
-
-          /* write molecule fields */
-          WRITEUINT(amp->properties->chkpt_species_id);
-          WRITEFIELD(act_newbie_flag);
-          WRITEFIELD(act_change_flag);
-
-          // NOTE: we write all times as real times (seconds) *not* as
-          // "iterations" (or "scaled times") in order to be able to
-          // re-schedule them properly upon restart
-
-          // The scheduling time (t) is essentially iterations, and since time
-          // steps can change when checkpointing, we can't directly convert
-          // iterations to real time (seconds). We need to correct for this by
-          // only converting the iterations of the current simulation
-          // [(t-start_iterations)*time_unit] and adding the real time at the
-          // start of the simulation (simulation_start_seconds).
-          double t = convert_iterations_to_seconds(
-              start_iterations, time_unit, simulation_start_seconds, amp->t);
-          WRITEFIELD(t);
-          // We do a simple conversion for the lifetime t2, since this
-          // corresponds to some event in the future and can be directly
-          // computed without using an offset.
-          double t2 = amp->t2 * time_unit;
-          WRITEFIELD(t2);
-          // Birthday is now always treated as real time in seconds, not
-          // "scaled" time or iterations.
-          double bday = amp->birthday;
-          WRITEFIELD(bday);
-          WRITEFIELD(where);
-          WRITEINT(orient);
-
-          static const unsigned char NON_COMPLEX = '\0';
-          WRITEFIELD(NON_COMPLEX);
-        }
-      }
-    }
+/***************************************************************************
+ chkpt_species_table:
+ In:  world - simulation state, after the species table has been read
+      n_ids - receives the size of the table
+ Out: Table of the species by their external species id.  Ids which are not
+      used by any species map to NULL.
+***************************************************************************/
+static struct species **chkpt_species_table(struct volume *world,
+                                            u_int *n_ids) {
+  *n_ids = 0;
+  for (int i = 0; i < world->n_species; i++) {
+    u_int id = world->species_list[i]->chkpt_species_id;
+    if (id != UINT_MAX && id >= *n_ids)
+      *n_ids = id + 1;
   }
 
-  return 0;
+  struct species **table = CHECKED_MALLOC_ARRAY(
+      struct species *, *n_ids + 1, "checkpoint species table");
+  memset(table, 0, (*n_ids + 1) * sizeof(struct species *));
+  for (int i = world->n_species - 1; i >= 0; i--) {
+    u_int id = world->species_list[i]->chkpt_species_id;
+    if (id != UINT_MAX)
+      table[id] = world->species_list[i];
+  }
+  return table;
+}
+
+/***************************************************************************
+ restore_molecule:
+ In:  world - simulation state
+      properties - species of the molecule
+      act_newbie_flag, act_change_flag - flags of the molecule
+      sched_time, lifetime, birthday - times as stored in the checkpoint
+      where - location of the molecule
+      orient - orientation of the molecule
+      api_version - checkpoint API version of the file
+      guess - subvolume of the last volume molecule, updated
+ Out: No return value.  The molecule is added to the world and scheduled.
+***************************************************************************/
+static void restore_molecule(struct volume *world, struct species *properties,
+                             byte act_newbie_flag, byte act_change_flag,
+                             double sched_time, double lifetime,
+                             double birthday, struct vector3 *where,
+                             int orient, uint32_t api_version,
+                             struct volume_molecule **guess) {
+  // starting with API version 1, convert the sched_time, lifetime and
+  // birthday into scaled time based on the current timestep
+  if (api_version >= 1) {
+    // This will force lifetimes to be recomputed. This is necessary if
+    // unimolecular rate constants change between checkpoints.
+    lifetime = 0;
+    sched_time = world->start_iterations;
+    act_change_flag = HAS_ACT_CHANGE;
+  }
+
+  /* Create and add molecule to scheduler */
+  struct periodic_image periodic_box = { .x = 0,
+                                         .y = 0,
+                                         .z = 0
+                                       };
+  if ((properties->flags & NOT_FREE) == 0) { /* 3D molecule */
+    struct volume_molecule vm;
+    struct volume_molecule *vmp = &vm;
+    struct abstract_molecule *amp = (struct abstract_molecule *)vmp;
+    memset(&vm, 0, sizeof(struct volume_molecule));
+
+    /* set molecule characteristics */
+    amp->t = sched_time;
+    amp->t2 = lifetime;
+    amp->birthday = birthday;
+    amp->properties = properties;
+    if(amp->properties->flags & EXTERNAL_SPECIES)
+      properties_nfsim(world, amp);
+    vmp->previous_wall = NULL;
+    vmp->index = -1;
+    vmp->pos = *where;
+    amp->periodic_box = &periodic_box;
+
+    /* Set molecule flags */
+    amp->flags = TYPE_VOL | IN_VOLUME;
+    if (act_newbie_flag == HAS_ACT_NEWBIE)
+      amp->flags |= ACT_NEWBIE;
+
+    if (act_change_flag == HAS_ACT_CHANGE)
+      amp->flags |= ACT_CHANGE;
+
+    amp->flags |= IN_SCHEDULE;
+    if ((amp->properties->flags & CAN_SURFWALL) != 0 ||
+        trigger_unimolecular(world->reaction_hash, world->rx_hashsize,
+                             amp->properties->hashval, amp) != NULL)
+      amp->flags |= ACT_REACT;
+    if (mol_space_step(amp) > 0.0)
+      amp->flags |= ACT_DIFFUSE;
+
+    /* Insert copy of vm into world */
+    *guess = insert_volume_molecule(world, vmp, *guess);
+    if (*guess == NULL) {
+      mcell_error("Cannot insert copy of molecule of species '%s' into "
+                  "world.\nThis may be caused by a shortage of memory.",
+                  vmp->properties->sym->name);
+    }
+
+  } else { /* surface_molecule */
+    struct surface_molecule *smp = insert_surface_molecule(
+        world, properties, where, orient, CHKPT_GRID_TOLERANCE, sched_time,
+        NULL, NULL, NULL, &periodic_box);
+
+    if (smp == NULL) {
+      mcell_warn("Could not place molecule %s at (%f,%f,%f).",
+                 properties->sym->name, where->x * world->length_unit,
+                 where->y * world->length_unit,
+                 where->z * world->length_unit);
+      return;
+    }
+
+    smp->t2 = lifetime;
+    smp->birthday = birthday;
+    if (act_newbie_flag == HAS_NOT_ACT_NEWBIE)
+      smp->flags &= ~ACT_NEWBIE;
+
+    if (act_change_flag == HAS_ACT_CHANGE) {
+      smp->flags |= ACT_CHANGE;
+    }
+  }
 }
 
 /***************************************************************************
  read_mol_scheduler_state_real:
  In:  fs - checkpoint file to read from.
- Out: Reads molecule scheduler data from the checkpoint file.
+ Out: Reads molecule scheduler data from the checkpoint file written with
+      API version 2 or older.
       Returns 0 on success. Error message and exit on failure.
 ***************************************************************************/
 static int read_mol_scheduler_state_real(struct volume *world, FILE *fs,
@@ -1260,15 +1906,9 @@ static int read_mol_scheduler_state_real(struct volume *world, FILE *fs,
                                          uint32_t api_version) {
   static const char SECTNAME[] = "molecule scheduler state";
 
-  struct volume_molecule vm;
-  struct volume_molecule *vmp = NULL;
-  struct abstract_molecule *amp = NULL;
   struct volume_molecule *guess = NULL;
-
-  /* Clear template vol mol structure */
-  memset(&vm, 0, sizeof(struct volume_molecule));
-  vmp = &vm;
-  amp = (struct abstract_molecule *)vmp;
+  u_int n_ids;
+  struct species **species_by_id = chkpt_species_table(world, &n_ids);
 
   /* read total number of items in the scheduler. */
   unsigned long long total_items;
@@ -1282,7 +1922,7 @@ static int read_mol_scheduler_state_real(struct volume *world, FILE *fs,
     double sched_time;
     double lifetime;
     double birthday;
-    double x_coord, y_coord, z_coord;
+    struct vector3 where;
     int orient;
 
     /* read molecule fields */
@@ -1292,113 +1932,250 @@ static int read_mol_scheduler_state_real(struct volume *world, FILE *fs,
     READFIELD(sched_time);
     READFIELD(lifetime);
     READFIELD(birthday);
-    READFIELD(x_coord);
-    READFIELD(y_coord);
-    READFIELD(z_coord);
+    READFIELD(where.x);
+    READFIELD(where.y);
+    READFIELD(where.z);
     READINT(orient);
 
-    // starting with API version 1, convert the sched_time, lifetime and
-    // birthday into scaled time based on the current timestep
-    if (api_version >= 1) {
-      // This will force lifetimes to be recomputed. This is necessary if
-      // unimolecular rate constants change between checkpoints.
-      lifetime = 0;
-      sched_time = world->start_iterations;
-      act_change_flag = HAS_ACT_CHANGE;
-    }
-
     unsigned int complex_no = 0;
     READUINT(complex_no);
 
     /* Find this species by its external species id */
-    struct species *properties = NULL;
-    for (int species_idx = 0; species_idx < world->n_species; species_idx++) {
-      if (world->species_list[species_idx]->chkpt_species_id ==
-          external_species_id) {
-        properties = world->species_list[species_idx];
-        break;
-      }
-    }
+    struct species *properties = (external_species_id < n_ids)
+                                     ? species_by_id[external_species_id]
+                                     : NULL;
     DATACHECK(properties == NULL,
               "Found molecule with unknown species id (%d).",
               external_species_id);
 
-    /* Create and add molecule to scheduler */
-    struct periodic_image periodic_box = { .x = 0,
-                                           .y = 0,
-                                           .z = 0
-                                         };
-    if ((properties->flags & NOT_FREE) == 0) { /* 3D molecule */
-
-      /* set molecule characteristics */
-      amp->t = sched_time;
-      amp->t2 = lifetime;
-      amp->birthday = birthday;
-      amp->properties = properties;
-      initialize_diffusion_function(amp);
-      if(amp->properties->flags & EXTERNAL_SPECIES)
-        properties_nfsim(world, amp);
-      vmp->previous_wall = NULL;
-      vmp->index = -1;
-      vmp->pos.x = x_coord;
-      vmp->pos.y = y_coord;
-      vmp->pos.z = z_coord;
-      amp->periodic_box = &periodic_box;
-
-      /* Set molecule flags */
-      amp->flags = TYPE_VOL | IN_VOLUME;
-      if (act_newbie_flag == HAS_ACT_NEWBIE)
-        amp->flags |= ACT_NEWBIE;
-
-      if (act_change_flag == HAS_ACT_CHANGE)
-        amp->flags |= ACT_CHANGE;
-
-      amp->flags |= IN_SCHEDULE;
-      if ((amp->properties->flags & CAN_SURFWALL) != 0 ||
-          trigger_unimolecular(world->reaction_hash, world->rx_hashsize,
-                               amp->properties->hashval, amp) != NULL)
-        amp->flags |= ACT_REACT;
-      if (amp->get_space_step(amp) > 0.0)
-        amp->flags |= ACT_DIFFUSE;
-
-      /* Insert copy of vm into world */
-      guess = insert_volume_molecule(world, vmp, guess);
-      if (guess == NULL) {
-        mcell_error("Cannot insert copy of molecule of species '%s' into "
-                    "world.\nThis may be caused by a shortage of memory.",
-                    vmp->properties->sym->name);
-      }
+    restore_molecule(world, properties, act_newbie_flag, act_change_flag,
+                     sched_time, lifetime, birthday, &where, orient,
+                     api_version, &guess);
+  }
 
-    } else { /* surface_molecule */
-      struct vector3 where;
+  free(species_by_id);
+  return 0;
+}
 
-      where.x = x_coord;
-      where.y = y_coord;
-      where.z = z_coord;
+/***************************************************************************
+ decode_mol_chunk:
+ In:  arg - checkpoint chunk reader
+      job - index of the chunk to decode
+ Out: Returns 1 if the chunk is corrupt, and 0 - on success.  The chunk is
+      unpacked into its own buffer of columns, in native byte order.
+***************************************************************************/
+static int decode_mol_chunk(void *arg, int job) {
+  struct chunk_reader *cr = (struct chunk_reader *)arg;
+  struct mol_chunk *chunk = &cr->chunks[cr->first + job];
+  size_t n = chunk->n_mols;
+  size_t raw_size = n * MOL_CHUNK_BYTES_PER_MOL;
+
+  int compressed = (chunk->method == MOL_CHUNK_COMPRESSED);
+  byte *unpacked = NULL;
+  if (compressed)
+    unpacked = CHECKED_MALLOC_ARRAY(byte, raw_size, "checkpoint chunk");
+  byte *raw = CHECKED_MALLOC_ARRAY(byte, raw_size, "checkpoint chunk");
+  int corrupt = unpack_columns(chunk->stored, chunk->stored_size, compressed,
+                               n, mol_chunk_column_sizes, N_MOL_CHUNK_COLUMNS,
+                               unpacked, raw);
+  free(unpacked);
+  if (corrupt) {
+    free(raw);
+    return 1;
+  }
 
+  if (cr->byte_order_mismatch) {
+    byte *col = raw;
+    for (size_t c = 0; c < N_MOL_CHUNK_COLUMNS; c++) {
+      size_t size = mol_chunk_column_sizes[c];
+      if (size > 1)
+        for (size_t i = 0; i < n; i++)
+          byte_swap(col + i * size, (int)size);
+      col += n * size;
+    }
+  }
 
-      struct surface_molecule *smp = insert_surface_molecule(
-          world, properties, &where, orient, CHKPT_GRID_TOLERANCE, sched_time,
-          NULL, NULL, NULL, &periodic_box);
+  set_chunk_columns(chunk, raw, n);
+  return 0;
+}
 
-      if (smp == NULL) {
-        mcell_warn("Could not place molecule %s at (%f,%f,%f).",
-                   properties->sym->name, where.x * world->length_unit,
-                   where.y * world->length_unit,
-                   where.z * world->length_unit);
-        continue;
-      }
+/***************************************************************************
+ map_chkpt_rest:
+ In:  fs - checkpoint file
+      start - current position in the file
+      base - receives the start of the mapping or buffer
+      len - receives the number of bytes from 'start' to the end of the file
+      mapped - receives whether the file was mapped
+ Out: Pointer to the contents of the file from 'start' on, or NULL on
+      failure.  The file is mapped into memory if possible, and read into
+      a buffer otherwise.
+***************************************************************************/
+static const byte *map_chkpt_rest(FILE *fs, off_t start, void **base,
+                                  size_t *len, int *mapped) {
+  struct stat buf;
+  if (fstat(fileno(fs), &buf) != 0 || buf.st_size < start)
+    return NULL;
+  *len = (size_t)(buf.st_size - start);
+
+#ifndef _WIN32
+  if (buf.st_size > 0) {
+    void *map = mmap(NULL, (size_t)buf.st_size, PROT_READ, MAP_PRIVATE,
+                     fileno(fs), 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)buf.st_size, MADV_SEQUENTIAL);
+      *base = map;
+      *mapped = 1;
+      return (const byte *)map + start;
+    }
+  }
+#endif
+
+  *mapped = 0;
+  *base = CHECKED_MALLOC_ARRAY(byte, *len + 1, "checkpoint molecule data");
+  if (fread(*base, 1, *len, fs) != *len) {
+    free(*base);
+    return NULL;
+  }
+  return (const byte *)*base;
+}
+
+/***************************************************************************
+ unmap_chkpt_rest:
+ In:  base, len, mapped - as returned by map_chkpt_rest
+      start - position in the file passed to map_chkpt_rest
+ Out: No return value.  The mapping or buffer is released.
+***************************************************************************/
+static void unmap_chkpt_rest(void *base, off_t start, size_t len,
+                             int mapped) {
+#ifndef _WIN32
+  if (mapped) {
+    munmap(base, (size_t)start + len);
+    return;
+  }
+#endif
+  free(base);
+}
+
+/***************************************************************************
+ read_mol_chunks:
+ In:  fs - checkpoint file to read from.
+      state - contextual state for reading checkpoint file
+      api_version - checkpoint API version of the file
+ Out: Reads the chunked molecule scheduler data of API version 3 and up
+      (see write_mol_scheduler_state_real).
+      Returns 1 on error, and 0 - on success.
 
-      smp->t2 = lifetime;
-      smp->birthday = birthday;
-      if (act_newbie_flag == HAS_NOT_ACT_NEWBIE)
-        smp->flags &= ~ACT_NEWBIE;
+ Note: The rest of the file is mapped into memory and the chunks are
+       unpacked a few at a time on up to world->num_threads threads, while
+       the molecules are added to the world in the order they were written.
+***************************************************************************/
+static int read_mol_chunks(struct volume *world, FILE *fs,
+                           struct chkpt_read_state *state,
+                           uint32_t api_version) {
+  static const char SECTNAME[] = "molecule scheduler state";
 
-      if (act_change_flag == HAS_ACT_CHANGE) {
-        smp->flags |= ACT_CHANGE;
+  off_t start = ftello(fs);
+  void *base = NULL;
+  size_t len = 0;
+  int mapped = 0;
+  const byte *data = map_chkpt_rest(fs, start, &base, &len, &mapped);
+  READCHECK(data == NULL, SECTNAME);
+
+  /* Find the chunks */
+  struct chunk_reader cr;
+  memset(&cr, 0, sizeof(struct chunk_reader));
+  cr.byte_order_mismatch = state->byte_order_mismatch;
+  int capacity = 0;
+  size_t pos = 0;
+  int corrupt = 0;
+  while (1) {
+    uint32_t n_mols, method;
+    uint64_t stored_size;
+    if (len - pos < sizeof(n_mols) + sizeof(method) + sizeof(stored_size)) {
+      corrupt = 1;
+      break;
+    }
+    memcpy(&n_mols, data + pos, sizeof(n_mols));
+    memcpy(&method, data + pos + 4, sizeof(method));
+    memcpy(&stored_size, data + pos + 8, sizeof(stored_size));
+    READBSWAP(n_mols);
+    READBSWAP(method);
+    READBSWAP(stored_size);
+    pos += sizeof(n_mols) + sizeof(method) + sizeof(stored_size);
+    if (n_mols == 0)
+      break;
+
+    if (n_mols > MOL_CHUNK_MAX_MOLS || stored_size > len - pos ||
+        (method != MOL_CHUNK_SHUFFLED && method != MOL_CHUNK_COMPRESSED) ||
+        (method == MOL_CHUNK_SHUFFLED &&
+         stored_size != (uint64_t)n_mols * MOL_CHUNK_BYTES_PER_MOL)) {
+      corrupt = 1;
+      break;
+    }
+
+    if (cr.n_chunks == capacity) {
+      capacity = (capacity == 0) ? 64 : 2 * capacity;
+      struct mol_chunk *chunks = (struct mol_chunk *)realloc(
+          cr.chunks, capacity * sizeof(struct mol_chunk));
+      if (chunks == NULL)
+        mcell_allocfailed("Failed to allocate checkpoint chunk list.");
+      cr.chunks = chunks;
+    }
+    struct mol_chunk *chunk = &cr.chunks[cr.n_chunks++];
+    memset(chunk, 0, sizeof(struct mol_chunk));
+    chunk->n_mols = n_mols;
+    chunk->method = method;
+    chunk->stored = (byte *)(data + pos);
+    chunk->stored_size = (size_t)stored_size;
+    pos += (size_t)stored_size;
+  }
+
+  u_int n_ids;
+  struct species **species_by_id = chkpt_species_table(world, &n_ids);
+  struct volume_molecule *guess = NULL;
+  int n_threads = world->num_threads;
+  int window = 4 * n_threads;
+  for (cr.first = 0; !corrupt && cr.first < cr.n_chunks; cr.first += window) {
+    int n_jobs = cr.n_chunks - cr.first;
+    if (n_jobs > window)
+      n_jobs = window;
+    if (run_chkpt_jobs(n_threads, n_jobs, decode_mol_chunk, &cr)) {
+      corrupt = 1;
+    }
+
+    for (int c = cr.first; c < cr.first + n_jobs; c++) {
+      struct mol_chunk *chunk = &cr.chunks[c];
+      for (u_int i = 0; !corrupt && i < chunk->n_mols; i++) {
+        u_int id = chunk->species[i];
+        if (id >= n_ids || species_by_id[id] == NULL) {
+          mcell_warn("Corrupted checkpoint data: "
+                     "Found molecule with unknown species id (%u).", id);
+          corrupt = 2;
+          break;
+        }
+        struct vector3 where = { chunk->x[i], chunk->y[i], chunk->z[i] };
+        restore_molecule(
+            world, species_by_id[id],
+            (chunk->flags[i] & MOL_CHUNK_ACT_NEWBIE) ? HAS_ACT_NEWBIE
+                                                     : HAS_NOT_ACT_NEWBIE,
+            (chunk->flags[i] & MOL_CHUNK_ACT_CHANGE) ? HAS_ACT_CHANGE
+                                                     : HAS_NOT_ACT_CHANGE,
+            chunk->t[i], chunk->t2[i], chunk->birthday[i], &where,
+            chunk->orient[i], api_version, &guess);
       }
+      free(chunk->raw);
+      chunk->raw = NULL;
     }
   }
 
+  free(species_by_id);
+  free(cr.chunks);
+  unmap_chkpt_rest(base, start, len, mapped);
+  if (corrupt == 2)
+    return 1;
+  DATACHECK(corrupt, "Molecule chunks cannot be decoded.");
+
+  /* Carry on reading after the molecules */
+  READCHECK(fseeko(fs, start + (off_t)pos, SEEK_SET) != 0, SECTNAME);
   return 0;
 }
@@ -30,6 +30,8 @@
 /* header file for chkpt.c, MCell checkpointing functions */
 
 int create_chkpt(struct volume *world, char const *filename);
+int create_chkpt_in_background(struct volume *world, char const *filename);
+void wait_for_chkpt_writer(struct volume *world, int block);
 int write_chkpt(struct volume *world, FILE *fs);
 int read_chkpt(struct volume *world, FILE *fs, bool only_time_and_iter);
 void chkpt_signal_handler(int signo);
@@ -0,0 +1,331 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "compress_util.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/* Read four bytes without caring about alignment */
+static inline uint32_t read_u32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*************************************************************************
+put_length:
+  In: dst: output buffer
+      op: position in the output buffer
+      dst_cap: size of the output buffer
+      len: length beyond the 15 stored in the token
+  Out: New position in the output buffer, or dst_cap + 1 if the length did
+       not fit.
+*************************************************************************/
+static size_t put_length(unsigned char *dst, size_t op, size_t dst_cap,
+                         size_t len) {
+  while (len >= 255) {
+    if (op >= dst_cap)
+      return dst_cap + 1;
+    dst[op++] = 255;
+    len -= 255;
+  }
+  if (op >= dst_cap)
+    return dst_cap + 1;
+  dst[op++] = (unsigned char)len;
+  return op;
+}
+
+/*************************************************************************
+put_sequence:
+  In: dst: output buffer
+      op: position in the output buffer
+      dst_cap: size of the output buffer
+      lit: literals to copy
+      n_lit: number of literals
+      offset: distance back to the match, or 0 for the last sequence
+      match_len: length of the match (at least LZ_MIN_MATCH unless offset
+                 is 0)
+  Out: New position in the output buffer, or dst_cap + 1 if the sequence
+       did not fit.
+*************************************************************************/
+static size_t put_sequence(unsigned char *dst, size_t op, size_t dst_cap,
+                           const unsigned char *lit, size_t n_lit,
+                           size_t offset, size_t match_len) {
+  if (op >= dst_cap)
+    return dst_cap + 1;
+  size_t token_at = op++;
+  unsigned char token = (unsigned char)((n_lit < 15 ? n_lit : 15) << 4);
+  if (n_lit >= 15 && (op = put_length(dst, op, dst_cap, n_lit - 15)) > dst_cap)
+    return op;
+  if (n_lit > dst_cap - op)
+    return dst_cap + 1;
+  memcpy(dst + op, lit, n_lit);
+  op += n_lit;
+
+  if (offset != 0) {
+    size_t m = match_len - LZ_MIN_MATCH;
+    token |= (unsigned char)(m < 15 ? m : 15);
+    if (dst_cap - op < 2)
+      return dst_cap + 1;
+    dst[op++] = (unsigned char)(offset & 0xff);
+    dst[op++] = (unsigned char)(offset >> 8);
+    if (m >= 15 && (op = put_length(dst, op, dst_cap, m - 15)) > dst_cap)
+      return op;
+  }
+  dst[token_at] = token;
+  return op;
+}
+
+/*************************************************************************
+block_compress_bound:
+  In: n: size of a block
+  Out: Size of the output buffer which always holds the compressed block.
+*************************************************************************/
+size_t block_compress_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+/*************************************************************************
+block_compress:
+  In: src: data to compress
+      n: size of the data
+      dst: output buffer
+      dst_cap: size of the output buffer
+  Out: Size of the compressed data, or 0 if it does not fit into the output
+       buffer.
+*************************************************************************/
+size_t block_compress(const unsigned char *src, size_t n, unsigned char *dst,
+                      size_t dst_cap) {
+  uint32_t table[1 << LZ_HASH_BITS]; /* Position + 1 of the last occurrence */
+  memset(table, 0, sizeof(table));
+
+  size_t ip = 0, anchor = 0, op = 0;
+  while (n >= LZ_MIN_MATCH && ip <= n - LZ_MIN_MATCH) {
+    uint32_t v = read_u32(src + ip);
+    uint32_t h = lz_hash(v);
+    size_t cand = table[h];
+    table[h] = (uint32_t)(ip + 1);
+    if (cand == 0 || ip - (cand - 1) > LZ_MAX_OFFSET ||
+        read_u32(src + cand - 1) != v) {
+      /* Skip faster through data which does not compress */
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    cand--;
+    size_t len = LZ_MIN_MATCH;
+    while (ip + len < n && src[cand + len] == src[ip + len])
+      len++;
+    op = put_sequence(dst, op, dst_cap, src + anchor, ip - anchor, ip - cand,
+                      len);
+    if (op > dst_cap)
+      return 0;
+    ip += len;
+    anchor = ip;
+  }
+
+  op = put_sequence(dst, op, dst_cap, src + anchor, n - anchor, 0, 0);
+  if (op > dst_cap)
+    return 0;
+  return op;
+}
+
+/*************************************************************************
+get_length:
+  In: src: compressed data
+      ip: position in the compressed data
+      n: size of the compressed data
+      len: length to add to
+  Out: 0 on success, 1 if the data ends early.  The extra length bytes are
+       added to len and skipped.
+*************************************************************************/
+static int get_length(const unsigned char *src, size_t *ip, size_t n,
+                      size_t *len) {
+  unsigned char b;
+  do {
+    if (*ip >= n)
+      return 1;
+    b = src[(*ip)++];
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+/*************************************************************************
+block_decompress:
+  In: src: compressed data
+      n: size of the compressed data
+      dst: output buffer
+      dst_len: size of the data once decompressed
+  Out: 0 on success, 1 if the compressed data is corrupt.  Data which end
+       after a match rather than with a sequence of literals only were cut
+       short, and are corrupt as well.
+*************************************************************************/
+int block_decompress(const unsigned char *src, size_t n, unsigned char *dst,
+                     size_t dst_len) {
+  size_t ip = 0, op = 0;
+  while (1) {
+    if (ip >= n)
+      return 1;
+    unsigned char token = src[ip++];
+
+    size_t n_lit = token >> 4;
+    if (n_lit == 15 && get_length(src, &ip, n, &n_lit))
+      return 1;
+    if (n_lit > n - ip || n_lit > dst_len - op)
+      return 1;
+    memcpy(dst + op, src + ip, n_lit);
+    ip += n_lit;
+    op += n_lit;
+    if (ip == n)
+      break;
+
+    if (n - ip < 2)
+      return 1;
+    size_t offset = src[ip] | ((size_t)src[ip + 1] << 8);
+    ip += 2;
+    size_t len = token & 15;
+    if (len == 15 && get_length(src, &ip, n, &len))
+      return 1;
+    len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || len > dst_len - op)
+      return 1;
+
+    if (offset >= len) {
+      memcpy(dst + op, dst + op - offset, len);
+      op += len;
+    } else {
+      /* Overlapping match: repeats the last 'offset' bytes */
+      for (size_t i = 0; i < len; i++, op++)
+        dst[op] = dst[op - offset];
+    }
+  }
+  return (op == dst_len) ? 0 : 1;
+}
+
+/*************************************************************************
+shuffle_bytes:
+  In: src: array of fields
+      dst: output buffer of the same size
+      n_elems: number of fields
+      elem_size: size of a field
+  Out: No return value.  Byte b of field i is stored at
+       dst[b * n_elems + i].
+*************************************************************************/
+void shuffle_bytes(const unsigned char *src, unsigned char *dst,
+                   size_t n_elems, size_t elem_size) {
+  for (size_t i = 0; i < n_elems; i++)
+    for (size_t b = 0; b < elem_size; b++)
+      dst[b * n_elems + i] = src[i * elem_size + b];
+}
+
+/*************************************************************************
+unshuffle_bytes:
+  In: src: shuffled array of fields
+      dst: output buffer of the same size
+      n_elems: number of fields
+      elem_size: size of a field
+  Out: No return value.  The inverse of shuffle_bytes.
+*************************************************************************/
+void unshuffle_bytes(const unsigned char *src, unsigned char *dst,
+                     size_t n_elems, size_t elem_size) {
+  for (size_t i = 0; i < n_elems; i++)
+    for (size_t b = 0; b < elem_size; b++)
+      dst[i * elem_size + b] = src[b * n_elems + i];
+}
+
+/*************************************************************************
+pack_columns:
+  In: cols: columns of fields; column c starts 'capacity' times the sizes
+            of the columns before it into the buffer
+      capacity: number of fields each column has room for
+      n_elems: number of fields in each column
+      col_sizes: size of a field of each column
+      n_cols: number of columns
+      shuffled: output buffer for the shuffled columns, as large as the
+                fields
+      packed: output buffer of the same size for the compressed columns
+  Out: Size of the data in 'packed', or 0 if they would not be smaller than
+       the fields, in which case 'shuffled' holds what is to be stored.  The
+       columns are shuffled one after the other (see shuffle_bytes) and
+       then compressed as one block.
+*************************************************************************/
+size_t pack_columns(const unsigned char *cols, size_t capacity,
+                    size_t n_elems, const size_t *col_sizes, size_t n_cols,
+                    unsigned char *shuffled, unsigned char *packed) {
+  size_t raw_size = 0;
+  unsigned char *out = shuffled;
+  for (size_t c = 0; c < n_cols; c++) {
+    shuffle_bytes(cols, out, n_elems, col_sizes[c]);
+    cols += capacity * col_sizes[c];
+    out += n_elems * col_sizes[c];
+    raw_size += n_elems * col_sizes[c];
+  }
+  return block_compress(shuffled, raw_size, packed, raw_size);
+}
+
+/*************************************************************************
+unpack_columns:
+  In: stored: data as produced by pack_columns
+      stored_size: size of the data
+      compressed: whether the data are the compressed ('packed') ones
+      n_elems, col_sizes, n_cols: as given to pack_columns
+      scratch: buffer as large as the fields, used if compressed
+      cols: output buffer as large as the fields
+  Out: 0 on success, 1 if the data are corrupt or do not hold n_elems
+       fields per column.  The columns are laid out one after the other,
+       each with room for exactly n_elems fields.
+*************************************************************************/
+int unpack_columns(const unsigned char *stored, size_t stored_size,
+                   int compressed, size_t n_elems, const size_t *col_sizes,
+                   size_t n_cols, unsigned char *scratch,
+                   unsigned char *cols) {
+  size_t raw_size = 0;
+  for (size_t c = 0; c < n_cols; c++)
+    raw_size += n_elems * col_sizes[c];
+
+  if (compressed) {
+    if (block_decompress(stored, stored_size, scratch, raw_size))
+      return 1;
+    stored = scratch;
+  } else if (stored_size != raw_size)
+    return 1;
+
+  for (size_t c = 0; c < n_cols; c++) {
+    unshuffle_bytes(stored, cols, n_elems, col_sizes[c]);
+    stored += n_elems * col_sizes[c];
+    cols += n_elems * col_sizes[c];
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+
+/* Lossless compression of blocks of binary data, used for the molecule
+ * chunks of checkpoint files.
+ *
+ * Arrays of fixed-size fields compress much better once their bytes are
+ * regrouped so that all first bytes come first, then all second bytes and so
+ * on (shuffle_bytes); the compressor itself is a small LZ77 coder in the
+ * style of LZ4:
+ *   sequence: token, [literal length bytes], literals,
+ *             [offset (2 bytes, little endian), [match length bytes]]
+ *   token: literal length (high nibble), match length - 4 (low nibble); a
+ *          nibble of 15 is followed by bytes of 255 and one final byte < 255
+ *          which are added to it.
+ * The last sequence of a block only has literals. */
+
+size_t block_compress_bound(size_t n);
+size_t block_compress(const unsigned char *src, size_t n, unsigned char *dst,
+                      size_t dst_cap);
+int block_decompress(const unsigned char *src, size_t n, unsigned char *dst,
+                     size_t dst_len);
+
+void shuffle_bytes(const unsigned char *src, unsigned char *dst,
+                   size_t n_elems, size_t elem_size);
+void unshuffle_bytes(const unsigned char *src, unsigned char *dst,
+                     size_t n_elems, size_t elem_size);
+
+size_t pack_columns(const unsigned char *cols, size_t capacity,
+                    size_t n_elems, const size_t *col_sizes, size_t n_cols,
+                    unsigned char *shuffled, unsigned char *packed);
+int unpack_columns(const unsigned char *stored, size_t stored_size,
+                   int compressed, size_t n_elems, const size_t *col_sizes,
+                   size_t n_cols, unsigned char *scratch,
+                   unsigned char *cols);
@@ -133,6 +133,73 @@ static struct region_list *dup_region_list(struct region_list *r,
   return r0;
 }
 
+/*************************************************************************
+reverse_region_list:
+   In: a list of regions
+       skip_null: whether to leave out entries without a region
+       memory handler to use for the new list
+   Out: A copy of the list in reverse order (NULL if it is empty).
+*************************************************************************/
+static struct region_list *reverse_region_list(struct region_list *r,
+                                               int skip_null,
+                                               struct mem_helper *mh) {
+  struct region_list *r0 = NULL;
+  for (; r != NULL; r = r->next) {
+    if (skip_null && r->reg == NULL)
+      continue;
+    struct region_list *nr =
+        (struct region_list *)CHECKED_MEM_GET(mh, "region list entry");
+    nr->reg = r->reg;
+    nr->next = r0;
+    r0 = nr;
+  }
+  return r0;
+}
+
+/*************************************************************************
+n_counted_regions:
+   In: world: simulation state
+       hashval: hash value of what we're counting
+       rl: list of regions
+   Out: The number of regions in the list that something with this hash
+        value may be counted in, but at most 2.
+*************************************************************************/
+static int n_counted_regions(struct volume *world, int hashval,
+                             struct region_list *rl) {
+  int n = 0;
+  for (; rl != NULL && n < 2; rl = rl->next) {
+    int hash_bin = (hashval + rl->reg->hashval) & world->count_hashmask;
+    if (world->count_hash[hash_bin] != NULL)
+      n++;
+  }
+  return n;
+}
+
+/*************************************************************************
+cached_region_lists:
+   In: world: simulation state
+       hashval: hash value of what we're counting
+       wp: a waypoint with cached lists
+       regs, antiregs: set to the lists to count in
+   Out: No return value.  The lists are the waypoint's own, taken in the
+        order clean_region_lists would have left copies of them in; regions
+        without counters are passed over when counting, as they would have
+        been left out of the copies.
+*************************************************************************/
+static void cached_region_lists(struct volume *world, int hashval,
+                                struct waypoint *wp,
+                                struct region_list **regs,
+                                struct region_list **antiregs) {
+  int n_regs = n_counted_regions(world, hashval, wp->rev_regions);
+  int n_antiregs = n_counted_regions(world, hashval, wp->rev_antiregions);
+  int sorted = (n_regs > 0 && n_antiregs > 0);
+  *regs = NULL;
+  if (n_regs > 0)
+    *regs = (sorted && n_regs > 1) ? wp->sorted_regions : wp->rev_regions;
+  *antiregs = (sorted && n_antiregs > 1) ? wp->sorted_antiregions
+                                         : wp->rev_antiregions;
+}
+
 /*************************************************************************
 region_listed:
    In: list of regions
@@ -148,6 +215,107 @@ int region_listed(struct region_list *rl, struct region *r) {
   return 0;
 }
 
+/*************************************************************************
+create_count_shards:
+   In: world: simulation state
+       n_shards: number of shards to create
+   Out: Array of n_shards empty count shards, one slot per counter in the
+        count hash.  Every counter is given its slot number.
+   Note: All shards share the list of counters.
+*************************************************************************/
+struct count_shard *create_count_shards(struct volume *world, int n_shards) {
+  int n_counters = 0;
+  for (int i = 0; i <= world->count_hashmask; i++)
+    for (struct counter *c = world->count_hash[i]; c != NULL; c = c->next)
+      c->shard_index = n_counters++;
+
+  struct counter **counters =
+      CHECKED_MALLOC_ARRAY(struct counter *, n_counters + 1, "counter list");
+  for (int i = 0; i <= world->count_hashmask; i++)
+    for (struct counter *c = world->count_hash[i]; c != NULL; c = c->next)
+      counters[c->shard_index] = c;
+
+  struct count_shard *shards =
+      CHECKED_MALLOC_ARRAY(struct count_shard, n_shards, "count shards");
+  for (int i = 0; i < n_shards; i++) {
+    struct count_shard *cs = &shards[i];
+    cs->n_counters = n_counters;
+    cs->counters = counters;
+    cs->delta = CHECKED_MALLOC_ARRAY(union counter_data, n_counters + 1,
+                                     "count shard changes");
+    cs->touched = CHECKED_MALLOC_ARRAY(byte, n_counters + 1,
+                                       "count shard touched flags");
+    cs->touched_list = CHECKED_MALLOC_ARRAY(int, n_counters + 1,
+                                            "count shard touched list");
+    memset(cs->delta, 0, (n_counters + 1) * sizeof(union counter_data));
+    memset(cs->touched, 0, (n_counters + 1) * sizeof(byte));
+    cs->n_touched = 0;
+  }
+  return shards;
+}
+
+/*************************************************************************
+merge_count_shard:
+   In: cs: count shard
+   Out: Returns none.  The changes collected in the shard are added to the
+        counters and the shard is emptied.
+   Note: Hits, crossings and enclosed counts are whole numbers, so they
+         come out exactly as if the counters had been updated directly.
+         Only the sums of scaled hits may differ in the last bits.
+*************************************************************************/
+void merge_count_shard(struct count_shard *cs) {
+  for (int i = 0; i < cs->n_touched; i++) {
+    int idx = cs->touched_list[i];
+    struct counter *c = cs->counters[idx];
+    union counter_data *d = &cs->delta[idx];
+    if (c->counter_type & RXN_COUNTER) {
+      c->data.rx.n_rxn_at += d->rx.n_rxn_at;
+      c->data.rx.n_rxn_enclosed += d->rx.n_rxn_enclosed;
+    } else {
+      c->data.move.n_at += d->move.n_at;
+      c->data.move.n_enclosed += d->move.n_enclosed;
+      c->data.move.front_hits += d->move.front_hits;
+      c->data.move.back_hits += d->move.back_hits;
+      c->data.move.front_to_back += d->move.front_to_back;
+      c->data.move.back_to_front += d->move.back_to_front;
+      c->data.move.scaled_hits += d->move.scaled_hits;
+    }
+    memset(d, 0, sizeof(union counter_data));
+    cs->touched[idx] = 0;
+  }
+  cs->n_touched = 0;
+}
+
+/*************************************************************************
+count_update_needs_lock:
+   In: world: simulation state
+       sp: species of the molecule being counted
+   Out: 1 if updating the counters of this species touches state shared
+        with other storages, 0 if it only goes to the caller's count shard.
+*************************************************************************/
+int count_update_needs_lock(struct volume *world, struct species *sp) {
+  return world->count_shard == NULL || (sp->flags & COUNT_TRIGGER) != 0;
+}
+
+/*************************************************************************
+count_data:
+   In: world: simulation state
+       c: a (non-trigger) counter
+   Out: The data to update for this counter: the counter's own data, or its
+        slot in the count shard if the world is a storage's view.
+*************************************************************************/
+static inline union counter_data *count_data(struct volume *world,
+                                             struct counter *c) {
+  struct count_shard *cs = world->count_shard;
+  if (cs == NULL)
+    return &c->data;
+  if (!cs->touched[c->shard_index]) {
+    cs->touched[c->shard_index] = 1;
+    cs->touched_list[cs->n_touched++] = c->shard_index;
+  }
+  return &cs->delta[c->shard_index];
+}
+
 /*************************************************************************
 count_region_update:
    In: world: simulation state 
@@ -181,10 +349,10 @@ void count_region_update(
   double hits_to_ccn = 0;
   if ((sp->flags & COUNT_HITS) && ((sp->flags & NOT_FREE) == 0)) {
     count_hits = 1;
-    /*hits_to_ccn = vm->get_time_step(vm) **/
+    /*hits_to_ccn = mol_time_step(vm) **/
     hits_to_ccn = sp->time_step *
                   2.9432976599069717358e-3 / /* 1e6*sqrt(MY_PI)/(1e-15*N_AV) */
-                  /*(vm->get_space_step(vm) * world->length_unit * world->length_unit **/
+                  /*(mol_space_step(vm) * world->length_unit * world->length_unit **/
                   (sp->space_step * world->length_unit * world->length_unit *
                    world->length_unit);
   }
@@ -244,12 +412,13 @@ void count_region_update(
                                    REPORT_TRIGGER, id);
             }
           } else {
+            union counter_data *data = count_data(world, hit_count);
             if (rl->reg->flags & sp->flags & COUNT_HITS) {
-              hit_count->data.move.front_hits++;
-              hit_count->data.move.front_to_back++;
+              data->move.front_hits++;
+              data->move.front_to_back++;
             }
             if (rl->reg->flags & sp->flags & COUNT_CONTENTS) {
-              hit_count->data.move.n_enclosed++;
+              data->move.n_enclosed++;
             }
           }
         } else {
@@ -268,12 +437,13 @@ void count_region_update(
                   REPORT_ENCLOSED | REPORT_CONTENTS | REPORT_TRIGGER, id);
             }
           } else {
+            union counter_data *data = count_data(world, hit_count);
             if (rl->reg->flags & sp->flags & COUNT_HITS) {
-              hit_count->data.move.back_hits++;
-              hit_count->data.move.back_to_front++;
+              data->move.back_hits++;
+              data->move.back_to_front++;
             }
             if (rl->reg->flags & sp->flags & COUNT_CONTENTS) {
-              hit_count->data.move.n_enclosed--;
+              data->move.n_enclosed--;
             }
           }
         }
@@ -286,7 +456,7 @@ void count_region_update(
             fire_count_event(world, hit_count, 1, loc,
                              REPORT_FRONT_HITS | REPORT_TRIGGER, id);
           } else {
-            hit_count->data.move.front_hits++;
+            count_data(world, hit_count)->move.front_hits++;
           }
         } else {
           if (hit_count->counter_type & TRIG_COUNTER) {
@@ -295,13 +465,14 @@ void count_region_update(
             fire_count_event(world, hit_count, 1, loc,
                              REPORT_BACK_HITS | REPORT_TRIGGER, id);
           } else
-            hit_count->data.move.back_hits++;
+            count_data(world, hit_count)->move.back_hits++;
         }
       }
       if ((count_hits && rl->reg->area != 0.0) &&
           ((sp->flags & NOT_FREE) == 0)) {
         if ((hit_count->counter_type & TRIG_COUNTER) == 0) {
-          hit_count->data.move.scaled_hits += hits_to_ccn / rl->reg->area;
+          count_data(world, hit_count)->move.scaled_hits +=
+              hits_to_ccn / rl->reg->area;
         }
       }
     }
@@ -399,7 +570,9 @@ count_region_from_scratch:
          inputs are NULL, sensible values will be guessed (which may themselves
          be NULL). This routine is not super-fast for volume counts (enclosed
          counts) since it has to dynamically create and test lists of enclosing
-         regions.
+         regions, unless no counted wall lies between the location and the
+         waypoint of its subvolume; then the lists cached with the waypoint
+         are used.
 *************************************************************************/
 void count_region_from_scratch(struct volume *world,
                                struct abstract_molecule *am,
@@ -512,95 +685,114 @@ void count_region_from_scratch(struct volume *world,
     struct region_list *all_regs = NULL;
     struct region_list *all_antiregs = NULL;
 
-    /* Copy all the potentially relevant regions from the nearest waypoint */
-    for (rl = wp->regions; rl != NULL; rl = rl->next) {
-      if (rl->reg == NULL)
-        continue;
-      int hash_bin = (hashval + rl->reg->hashval) & world->count_hashmask;
-      if (world->count_hash[hash_bin] == NULL)
-        continue; /* Won't count on this region so ignore it */
-
-      nrl = (struct region_list *)CHECKED_MEM_GET(
-          my_sv->local_storage->regl, "list of enclosing regions for count");
-      nrl->reg = rl->reg;
-      nrl->next = all_regs;
-      all_regs = nrl;
-    }
-
-    /* And all the antiregions (regions crossed from inside to outside only) */
-    for (arl = wp->antiregions; arl != NULL; arl = arl->next) {
-      int hash_bin = (hashval + arl->reg->hashval) & world->count_hashmask;
-      if (world->count_hash[hash_bin] == NULL)
-        continue; /* Won't count on this region so ignore it */
-
-      narl = (struct region_list *)CHECKED_MEM_GET(
-          my_sv->local_storage->regl, "list of enclosing regions for count");
-      narl->reg = arl->reg;
-      narl->next = all_antiregs;
-      all_antiregs = narl;
-    }
-
-    /* Raytrace across any walls from waypoint to us and add to region lists */
-    for (struct subvolume *sv = &(world->subvol[this_sv]); sv != NULL;
-         sv = next_subvol(&here, &delta, sv, world->x_fineparts,
-                          world->y_fineparts, world->z_fineparts,
-                          world->ny_parts, world->nz_parts)) {
-      delta.x = loc->x - here.x;
-      delta.y = loc->y - here.y;
-      delta.z = loc->z - here.z;
-
-      t_sv_hit = collide_sv_time(&here, &delta, sv, world->x_fineparts,
-                                 world->y_fineparts, world->z_fineparts);
-      if (t_sv_hit > 1.0)
-        t_sv_hit = 1.0;
-
-      for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next) {
-        /* Skip wall that we are on unless we're a volume molecule */
-        if (my_wall == wl->this_wall &&
-            (am == NULL || (am->properties->flags & NOT_FREE))) {
-          continue;
-        }
-
-        if (wl->this_wall->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) {
-          int hit_code = collide_wall(&here, &delta, wl->this_wall, &t_hit,
-                                      &hit, 0, world->rng, world->notify,
-                                      &(world->ray_polygon_tests));
-          if (hit_code == COLLIDE_MISS) {
+    /* Everything in a uniform subvolume is enclosed like the waypoint */
+    int borrowed = wp->uniform;
+    if (!wp->uniform) {
+      /* Raytrace across any walls from waypoint to us and add to region lists */
+      for (struct subvolume *sv = &(world->subvol[this_sv]); sv != NULL;
+           sv = next_subvol(&here, &delta, sv, world->x_fineparts,
+                            world->y_fineparts, world->z_fineparts,
+                            world->ny_parts, world->nz_parts)) {
+        delta.x = loc->x - here.x;
+        delta.y = loc->y - here.y;
+        delta.z = loc->z - here.z;
+
+        t_sv_hit = collide_sv_time(&here, &delta, sv, world->x_fineparts,
+                                   world->y_fineparts, world->z_fineparts);
+        if (t_sv_hit > 1.0)
+          t_sv_hit = 1.0;
+
+        for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next) {
+          /* Skip wall that we are on unless we're a volume molecule */
+          if (my_wall == wl->this_wall &&
+              (am == NULL || (am->properties->flags & NOT_FREE))) {
             continue;
           }
 
-          world->ray_polygon_colls++;
-          if (t_hit <= t_sv_hit && (hit.x - loc->x) * delta.x +
-            (hit.y - loc->y) * delta.y + (hit.z - loc->z) * delta.z < 0) {
-            for (rl = wl->this_wall->counting_regions; rl != NULL;
-                 rl = rl->next) {
-              if ((rl->reg->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) != 0) {
-                int hash_bin =
-                    (hashval + rl->reg->hashval) & world->count_hashmask;
-                if (world->count_hash[hash_bin] == NULL) {
-                  continue; /* Won't count on this region so ignore it */
-                }
-                nrl = (struct region_list *)CHECKED_MEM_GET(
-                    my_sv->local_storage->regl,
-                    "list of enclosing regions for count");
-                nrl->reg = rl->reg;
-                if (hit_code == COLLIDE_FRONT) {
-                  nrl->next = all_regs;
-                  all_regs = nrl;
-                } else if (hit_code == COLLIDE_BACK) {
-                  nrl->next = all_antiregs;
-                  all_antiregs = nrl;
+          if (wl->this_wall->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) {
+            int hit_code = collide_wall(&here, &delta, wl->this_wall, &t_hit,
+                                        &hit, 0, world->rng, world->notify,
+                                        &(world->ray_polygon_tests));
+            if (hit_code == COLLIDE_MISS) {
+              continue;
+            }
+
+            world->ray_polygon_colls++;
+            if (t_hit <= t_sv_hit && (hit.x - loc->x) * delta.x +
+              (hit.y - loc->y) * delta.y + (hit.z - loc->z) * delta.z < 0) {
+              for (rl = wl->this_wall->counting_regions; rl != NULL;
+                   rl = rl->next) {
+                if ((rl->reg->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) != 0) {
+                  int hash_bin =
+                      (hashval + rl->reg->hashval) & world->count_hashmask;
+                  if (world->count_hash[hash_bin] == NULL) {
+                    continue; /* Won't count on this region so ignore it */
+                  }
+                  nrl = (struct region_list *)CHECKED_MEM_GET(
+                      my_sv->local_storage->regl,
+                      "list of enclosing regions for count");
+                  nrl->reg = rl->reg;
+                  if (hit_code == COLLIDE_FRONT) {
+                    nrl->next = all_regs;
+                    all_regs = nrl;
+                  } else if (hit_code == COLLIDE_BACK) {
+                    nrl->next = all_antiregs;
+                    all_antiregs = nrl;
+                  }
                 }
               }
             }
           }
         }
       }
-    }
 
-    /* Clean up region lists */
-    if (all_regs != NULL && all_antiregs != NULL)
-      clean_region_lists(my_sv, &all_regs, &all_antiregs);
+      if (all_regs == NULL && all_antiregs == NULL && wp->cached) {
+        /* No counted wall between the waypoint and us */
+        borrowed = 1;
+      } else {
+        /* Copy all the potentially relevant regions from the nearest
+         * waypoint, behind the ones of the walls crossed */
+        struct region_list **regs_tail = &all_regs;
+        while (*regs_tail != NULL)
+          regs_tail = &(*regs_tail)->next;
+        for (rl = wp->regions; rl != NULL; rl = rl->next) {
+          if (rl->reg == NULL)
+            continue;
+          int hash_bin = (hashval + rl->reg->hashval) & world->count_hashmask;
+          if (world->count_hash[hash_bin] == NULL)
+            continue; /* Won't count on this region so ignore it */
+
+          nrl = (struct region_list *)CHECKED_MEM_GET(
+              my_sv->local_storage->regl, "list of enclosing regions for count");
+          nrl->reg = rl->reg;
+          nrl->next = *regs_tail;
+          *regs_tail = nrl;
+        }
+
+        /* And all the antiregions (regions crossed from inside to outside
+         * only) */
+        struct region_list **antiregs_tail = &all_antiregs;
+        while (*antiregs_tail != NULL)
+          antiregs_tail = &(*antiregs_tail)->next;
+        for (arl = wp->antiregions; arl != NULL; arl = arl->next) {
+          int hash_bin = (hashval + arl->reg->hashval) & world->count_hashmask;
+          if (world->count_hash[hash_bin] == NULL)
+            continue; /* Won't count on this region so ignore it */
+
+          narl = (struct region_list *)CHECKED_MEM_GET(
+              my_sv->local_storage->regl, "list of enclosing regions for count");
+          narl->reg = arl->reg;
+          narl->next = *antiregs_tail;
+          *antiregs_tail = narl;
+        }
+
+        /* Clean up region lists */
+        if (all_regs != NULL && all_antiregs != NULL)
+          clean_region_lists(my_sv, &all_regs, &all_antiregs);
+      }
+    }
+    if (borrowed)
+      cached_region_lists(world, hashval, wp, &all_regs, &all_antiregs);
 
     /* Actually check the regions here */
     count_flags |= REPORT_ENCLOSED;
@@ -656,10 +848,12 @@ void count_region_from_scratch(struct volume *world,
     }
 
     /* Free region memory */
-    if (all_regs != NULL)
-      mem_put_list(my_sv->local_storage->regl, all_regs);
-    if (all_antiregs != NULL)
-      mem_put_list(my_sv->local_storage->regl, all_antiregs);
+    if (!borrowed) {
+      if (all_regs != NULL)
+        mem_put_list(my_sv->local_storage->regl, all_regs);
+      if (all_antiregs != NULL)
+        mem_put_list(my_sv->local_storage->regl, all_antiregs);
+    }
   }
 }
 
@@ -1183,6 +1377,50 @@ static int find_enclosing_regions(struct volume *world,
   return 0;
 }
 
+/*************************************************************************
+cache_waypoint_regions:
+   In: sv: subvolume
+       wp: its waypoint, with its enclosing regions found
+   Out: No return value.  The lists count_region_from_scratch reads for
+        points no counted wall separates from the waypoint are built, and
+        the waypoint is marked uniform if no counted wall cuts the
+        subvolume.
+   Note: The lists must not hold the same region, since clean_region_lists
+         would take such pairs out.  They don't for closed regions; for
+         other meshes nothing is cached.
+*************************************************************************/
+static void cache_waypoint_regions(struct subvolume *sv, struct waypoint *wp) {
+  struct mem_helper *mh = sv->local_storage->regl;
+
+  wp->cached = 0;
+  wp->uniform = 0;
+  wp->rev_regions = NULL;
+  wp->rev_antiregions = NULL;
+  wp->sorted_regions = NULL;
+  wp->sorted_antiregions = NULL;
+
+  for (struct region_list *rl = wp->regions; rl != NULL; rl = rl->next) {
+    if (rl->reg != NULL && region_listed(wp->antiregions, rl->reg))
+      return;
+  }
+
+  wp->rev_regions = reverse_region_list(wp->regions, 1, mh);
+  wp->rev_antiregions = reverse_region_list(wp->antiregions, 0, mh);
+  if (wp->rev_regions != NULL && wp->rev_antiregions != NULL) {
+    wp->sorted_regions = (struct region_list *)void_list_sort(
+        (struct void_list *)dup_region_list(wp->rev_regions, mh));
+    wp->sorted_antiregions = (struct region_list *)void_list_sort(
+        (struct void_list *)dup_region_list(wp->rev_antiregions, mh));
+  }
+  wp->cached = 1;
+
+  for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next) {
+    if (wl->this_wall->flags & (COUNT_CONTENTS | COUNT_ENCLOSED))
+      return;
+  }
+  wp->uniform = 1;
+}
+
 /*************************************************************************
 place_waypoints:
    In: world: simulation state
@@ -1277,6 +1515,8 @@ int place_waypoints(struct volume *world) {
                                      sv->local_storage->regl))
             return 1;
         }
+
+        cache_waypoint_regions(sv, wp);
       }
     }
   }
@@ -29,6 +29,10 @@
 
 int region_listed(struct region_list *rl, struct region *r);
 
+struct count_shard *create_count_shards(struct volume *world, int n_shards);
+void merge_count_shard(struct count_shard *cs);
+int count_update_needs_lock(struct volume *world, struct species *sp);
+
 void count_region_update(
     struct volume *world,
     struct volume_molecule *vm,
@@ -36,10 +36,23 @@
 #include "vol_util.h"
 #include "wall_util.h"
 #include "react.h"
+#include "react_table.h"
 #include "react_nfsim.h"
 #include "nfsim_func.h"
-
-
+#include "storage_threads.h"
+#include "domain_ranks.h"
+#include "packed_mols.h"
+#include "mol_index.h"
+#include "wall_bvh.h"
+#include "packed_walls.h"
+
+
+/* A molecule done with (part of) its step holds the last collision records
+ * in use from its storage's pool, so the whole pool is taken back at once
+ * instead of walking the lists. */
+#if MEM_UTIL_BULK_RECLAIM
+#define FREE_COLLISION_LISTS() mem_reclaim_all(sv->local_storage->coll)
+#else
 #define FREE_COLLISION_LISTS()                                                 \
   do {                                                                         \
     if (shead2 != NULL)                                                        \
@@ -47,6 +60,7 @@
     if (shead != NULL)                                                         \
       mem_put_list(sv->local_storage->coll, shead);                            \
   } while (0)
+#endif
 
 
 static const int inert_to_mol = 1;
@@ -104,7 +118,7 @@ int reflect_absorb_outside_in(
     int *absorb_now,
     int this_wall_edge_region_border);
 
-void collide_and_react_with_subvol(
+struct subvolume *collide_and_react_with_subvol(
   struct volume* world, struct collision *smash, struct vector3* displacement,
   struct volume_molecule** mol, struct collision** tentative, double* t_steps);
 
@@ -112,11 +126,21 @@ void compute_displacement(
   struct volume* world, struct collision* shead, struct volume_molecule* vm,
   struct vector3* displacement, struct vector3* displacement2,
   double* rate_factor, double* r_rate_factor, double* steps, double* t_steps,
-  double max_time);
+  double max_time, int inertness);
 
 void determine_mol_mol_reactions(
-  struct volume* world, struct volume_molecule* vm, struct collision** shead,
-  struct collision** stail, int interness);
+  struct volume* world, struct volume_molecule* vm, struct vector3* move,
+  struct collision** shead, struct collision** stail, int interness);
+
+static int defer_mol_mol_reactions(struct volume_molecule *vm, int inertness);
+
+static double nearest_packed_partner(struct volume *world,
+  struct volume_molecule *vm, int inertness);
+
+static void redo_packed_collision_list(struct volume* world,
+  struct collision** shead, struct collision** stail,
+  struct collision* shead_exp, struct volume_molecule* m,
+  struct vector3* displacement, int inertness);
 
 void set_inertness_and_maxtime(
   struct volume* world, struct volume_molecule* vm, double* maxtime,
@@ -211,9 +235,9 @@ void pick_clamped_displacement(struct vector3 *v, struct volume_molecule *vm,
   double p = one_over_2_to_20th * ((n >> 12) + 0.5);
   double t = r_n / erfcinv(p * erfc(r_n));
   struct vector2 r_uv;
-  pick_2D_displacement(&r_uv, sqrt(t) * vm->get_space_step(vm), rng);
+  pick_2D_displacement(&r_uv, sqrt(t) * mol_space_step(vm), rng);
 
-  r_n *= vm->index * vm->get_space_step(vm);
+  r_n *= vm->index * mol_space_step(vm);
   v->x = r_n * w->normal.x + r_uv.u * w->unit_u.x + r_uv.v * w->unit_v.x;
   v->y = r_n * w->normal.y + r_uv.u * w->unit_u.y + r_uv.v * w->unit_v.y;
   v->z = r_n * w->normal.z + r_uv.u * w->unit_u.z + r_uv.v * w->unit_v.z;
@@ -950,6 +974,28 @@ struct wall *ray_trace_2D(
   return NULL;
 }
 
+/*************************************************************************
+walls_to_test:
+  In: world: simulation state
+      sv: subvolume the molecule is in
+      pos: position of the molecule
+      v: its displacement
+  Out: The walls of the subvolume that collide_wall has to look at for
+       this displacement, in the order of the subvolume's wall list.  This
+       is the wall list itself unless the subvolume has a wall hierarchy or
+       packed wall planes to narrow it down with.
+*************************************************************************/
+struct wall_list *walls_to_test(struct volume *world, struct subvolume *sv,
+                                struct vector3 *pos, struct vector3 *v) {
+  if (sv->wall_bvh != NULL)
+    return wall_bvh_query(sv->wall_bvh, pos, v, world->notify,
+                          &(world->ray_polygon_culls));
+  if (sv->packed_walls != NULL)
+    return packed_walls_query(sv->packed_walls, pos, v, world->notify,
+                              &(world->ray_polygon_tests));
+  return sv->wall_head;
+}
+
 /*************************************************************************
 ray_trace:
   In: world: simulation state
@@ -976,11 +1022,13 @@ struct collision *ray_trace(struct volume *world, struct vector3 *init_pos,
   struct collision *smash = (struct collision *)CHECKED_MEM_GET(
       sv->local_storage->coll, "collision structure");
 
+  struct wall_list *walls = walls_to_test(world, sv, init_pos, v);
+
   struct wall_list fake_wlp;
-  fake_wlp.next = sv->wall_head;
+  fake_wlp.next = walls;
 
   // Check wall collisions
-  for (struct wall_list *wlp = sv->wall_head; wlp != NULL; wlp = wlp->next) {
+  for (struct wall_list *wlp = walls; wlp != NULL; wlp = wlp->next) {
     if (wlp->this_wall == reflectee)
       continue;
 
@@ -990,6 +1038,8 @@ struct collision *ray_trace(struct volume *world, struct vector3 *init_pos,
       if (shead != NULL)
         mem_put_list(sv->local_storage->coll, shead);
       shead = NULL;
+      /* The displacement has changed, so the candidates may have too */
+      fake_wlp.next = walls_to_test(world, sv, init_pos, v);
       wlp = &fake_wlp;
       continue;
     } else if (i != COLLIDE_MISS) {
@@ -2221,6 +2271,8 @@ double exact_disk(struct volume *world, struct vector3 *loc, struct vector3 *mv,
 safe_diffusion_step:
   In: vm: molecule that is moving
       shead: linked list of potential collisions with molecules from the
+      d2_mols: squared distance to the nearest reaction partner that isn't
+               in shead, or GIGANTIC
       radial_subdivisions:
       r_step:
       x_fineparts:
@@ -2242,12 +2294,12 @@ safe_diffusion_step:
         this off entirely, aside from the TIME_STEP_MAX= directive.
 ****************************************************************************/
 double safe_diffusion_step(struct volume_molecule *vm, struct collision *shead,
-                           u_int radial_subdivisions, double *r_step,
-                           double *x_fineparts, double *y_fineparts,
-                           double *z_fineparts) {
+                           double d2_mols, u_int radial_subdivisions,
+                           double *r_step, double *x_fineparts,
+                           double *y_fineparts, double *z_fineparts) {
   double d2;
   double d2_nearmax;
-  double d2min = GIGANTIC;
+  double d2min = d2_mols;
   struct subvolume *sv = vm->subvol;
   struct wall *w;
   struct wall_list *wl;
@@ -2255,7 +2307,7 @@ double safe_diffusion_step(struct volume_molecule *vm, struct collision *shead,
   double steps;
   struct volume_molecule *mp;
 
-  d2_nearmax = vm->get_space_step(vm) *
+  d2_nearmax = mol_space_step(vm) *
                r_step[(int)(radial_subdivisions * MULTISTEP_PERCENTILE)];
   d2_nearmax *= d2_nearmax;
 
@@ -2322,6 +2374,72 @@ double safe_diffusion_step(struct volume_molecule *vm, struct collision *shead,
   return steps;
 }
 
+/****************************************************************************
+add_neighbor_collisions:
+  This is a helper function for expand_collision_list_for_neighbor.
+
+  In: sv: the "current" subvolume
+      vm: the current molecule
+      mp: a molecule in range in an adjacent subvolume
+      shead1: current list head
+      rx_hashsize:
+      reaction_hash:
+  Out: Returns the list with a collision added for each reaction between
+       vm and mp.
+****************************************************************************/
+static struct collision *add_neighbor_collisions(struct volume *world,
+    struct subvolume *sv, struct volume_molecule *vm,
+    struct volume_molecule *mp, struct collision *shead1, int rx_hashsize,
+    struct rxn **reaction_hash) {
+  int num_matching_rxns = 0;
+  struct rxn *matching_rxns[MAX_MATCHING_RXNS];
+
+  // count only in the relevant periodic box
+  if (!periodic_boxes_are_identical(vm->periodic_box, mp->periodic_box)) {
+    return shead1;
+  }
+
+  /* check for possible reactions */
+  if(vm->properties->flags & EXTERNAL_SPECIES){
+    num_matching_rxns = trigger_bimolecular_nfsim(world, (struct abstract_molecule *)vm,
+      (struct abstract_molecule *)mp, 0, 0, matching_rxns);
+  }
+  else{
+    num_matching_rxns = trigger_bimolecular(
+        reaction_hash, rx_hashsize, vm->properties->hashval,
+        mp->properties->hashval, (struct abstract_molecule *)vm,
+        (struct abstract_molecule *)mp, 0, 0, matching_rxns);
+  }
+
+  /* Add a collision for each matching reaction */
+  for (int i = 0; i < num_matching_rxns; i++) {
+    struct collision *smash = (struct collision *)CHECKED_MEM_GET(
+        sv->local_storage->coll, "collision data");
+    smash->target = (void *)mp;
+    smash->intermediate = matching_rxns[i];
+    smash->next = shead1;
+    smash->what = 0;
+    smash->what |= COLLIDE_VOL;
+    shead1 = smash;
+  }
+
+  return shead1;
+}
+
+/*************************************************************************
+owns_species_lists:
+  In: sv: the subvolume of the moving molecule
+      new_sv: a neighboring subvolume
+  Out: 1 if the per-species lists of new_sv may be modified while scanning
+       it for sv, 0 otherwise.  When storages run on worker threads, another
+       worker may be scanning or filling the lists of a neighbor in a
+       different storage at the same time.
+*************************************************************************/
+static int owns_species_lists(struct subvolume *sv, struct subvolume *new_sv) {
+  return sv->local_storage == new_sv->local_storage ||
+         sv->local_storage->world_view == NULL;
+}
+
 /****************************************************************************
 expand_collision_list_for_neighbor:
   This is a helper function to reduce duplicated code in expand_collision_list.
@@ -2361,9 +2479,6 @@ static struct collision *expand_collision_list_for_neighbor(struct volume *world
     struct collision *shead1, double trim_x, double trim_y, double trim_z,
     double *x_fineparts, double *y_fineparts, double *z_fineparts,
     int rx_hashsize, struct rxn **reaction_hash) {
-  int num_matching_rxns = 0;
-  struct rxn *matching_rxns[MAX_MATCHING_RXNS];
-
   /* Grab the subvolume boundaries */
   struct vector3 new_sv_llf, new_sv_urb;
   new_sv_llf.x = x_fineparts[new_sv->llf.x];
@@ -2421,10 +2536,16 @@ static struct collision *expand_collision_list_for_neighbor(struct volume *world
       continue;
     }
 
-    /* Garbage collection of empty per-species lists */
+    /* Garbage collection of empty per-species lists.  Only the thread
+     * running the neighbor's storage may do this. */
     if (psl->head == NULL) {
+      if (!owns_species_lists(sv, new_sv)) {
+        psl_head = &psl->next;
+        continue;
+      }
       *psl_head = psl->next;
       ht_remove(&new_sv->mol_by_species, psl);
+      packed_list_free(psl);
       mem_put(new_sv->local_storage->pslv, psl);
       continue;
     } else
@@ -2443,6 +2564,19 @@ static struct collision *expand_collision_list_for_neighbor(struct volume *world
              psl->properties->hashval, vm->properties, psl->properties))
       continue;
     }
+    if (new_sv->local_storage->packed_molecules) {
+      /* Only the packed positions are read until a molecule is in range */
+      struct vector3 const *pos = psl->packed_pos;
+      for (int k = 0; k < psl->n_packed; k++) {
+        if (pos[k].x < x_min || pos[k].x > x_max || pos[k].y < y_min ||
+            pos[k].y > y_max || pos[k].z < z_min || pos[k].z > z_max)
+          continue;
+        shead1 = add_neighbor_collisions(world, sv, vm, psl->packed_mol[k],
+                                         shead1, rx_hashsize, reaction_hash);
+      }
+      continue;
+    }
+
     for (struct volume_molecule *mp = psl->head; mp != NULL; mp = mp->next_v) {
       /* Skip defunct molecules */
       if (mp->properties == NULL)
@@ -2455,43 +2589,9 @@ static struct collision *expand_collision_list_for_neighbor(struct volume *world
         continue;
       if (mp->pos.z < z_min || mp->pos.z > z_max)
         continue;
-      // count only in the relevant periodic box
-      if (!periodic_boxes_are_identical(vm->periodic_box, mp->periodic_box)) {
-        continue;
-      }
-
-      /* check for possible reactions */
-      /*num_matching_rxns = trigger_bimolecular(
-          reaction_hash, rx_hashsize, vm->properties->hashval,
-          mp->properties->hashval, (struct abstract_molecule *)vm,
-          (struct abstract_molecule *)mp, 0, 0, matching_rxns);*/
-
-        if(vm->properties->flags & EXTERNAL_SPECIES){
-          num_matching_rxns = trigger_bimolecular_nfsim(world, (struct abstract_molecule *)vm,
-            (struct abstract_molecule *)mp, 0, 0, matching_rxns);
-        } 
-        else{     
-          num_matching_rxns = trigger_bimolecular(
-              reaction_hash, rx_hashsize, vm->properties->hashval,
-              mp->properties->hashval, (struct abstract_molecule *)vm,
-              (struct abstract_molecule *)mp, 0, 0, matching_rxns);
-        }
-
-
-      if (num_matching_rxns <= 0)
-        continue;
 
-      /* Add a collision for each matching reaction */
-      for (int i = 0; i < num_matching_rxns; i++) {
-        struct collision *smash = (struct collision *)CHECKED_MEM_GET(
-            sv->local_storage->coll, "collision data");
-        smash->target = (void *)mp;
-        smash->intermediate = matching_rxns[i];
-        smash->next = shead1;
-        smash->what = 0;
-        smash->what |= COLLIDE_VOL;
-        shead1 = smash;
-      }
+      shead1 = add_neighbor_collisions(world, sv, vm, mp, shead1, rx_hashsize,
+                                       reaction_hash);
     }
   }
 
@@ -2827,10 +2927,16 @@ struct sp_collision *expand_collision_partner_list_for_neighbor(
       continue;
     }
 
-    /* Garbage collection of empty per-species lists */
+    /* Garbage collection of empty per-species lists.  Only the thread
+     * running the neighbor's storage may do this. */
     if (psl->head == NULL) {
+      if (!owns_species_lists(sv, new_sv)) {
+        psl_head = &psl->next;
+        continue;
+      }
       *psl_head = psl->next;
       ht_remove(&new_sv->mol_by_species, psl);
+      packed_list_free(psl);
       mem_put(new_sv->local_storage->pslv, psl);
       continue;
     } else
@@ -2912,16 +3018,24 @@ diffuse_3D:
   In: world: simulation state
       vm: molecule that is moving
       max_time: maximum time we can spend diffusing
+      resume: remainder of a step handed off by another storage, or NULL
+              to start a new step
   Out: Pointer to the molecule if it still exists (may have been
        reallocated), NULL otherwise.
        Position and time are updated, but molecule is not rescheduled.
+       NULL is also returned if the molecule was handed off to a storage
+       run by another worker thread.
   Note: This version takes into account only 2-way reactions and 3-way
         reactions of type MOL_GRID_GRID
+        The collision pool of the molecule's storage is reclaimed as a
+        whole when the step ends, so callers must not hold any collision
+        records from it.
 *************************************************************************/
 struct volume_molecule *diffuse_3D(
     struct volume *world,
     struct volume_molecule *vm,
-    double max_time) {
+    double max_time,
+    struct mol_handoff *resume) {
 
   struct species* spec = vm->properties;
   if (spec == NULL) {
@@ -2934,13 +3048,14 @@ struct volume_molecule *diffuse_3D(
   int mol_grid_flag = ((spec->flags & CAN_VOLSURF) == CAN_VOLSURF);
   int mol_grid_grid_flag = ((spec->flags & CAN_VOLSURFSURF) == CAN_VOLSURFSURF);
 
-  if (vm->get_space_step(vm) <= 0.0) {
+  if (resume == NULL && mol_space_step(vm) <= 0.0) {
     vm->t += max_time;
     return vm;
   }
 
   int inertness = 0;
-  set_inertness_and_maxtime(world, vm, &max_time, &inertness);
+  if (resume == NULL)
+    set_inertness_and_maxtime(world, vm, &max_time, &inertness);
 
   /* Done housekeeping, now let's do something fun! */
   int calculate_displacement = 1;
@@ -2954,9 +3069,23 @@ struct volume_molecule *diffuse_3D(
   double t_steps = 1.0;
   double rate_factor = 1.0;
   double r_rate_factor = 1.0;
+  double t_start = vm->t;
   struct vector3 displacement;  /* Molecule moves along this vector */
   struct vector3 displacement2; /* Used for 3D mol-mol unbinding */
 
+  /* pick up where the storage that handed us this molecule left off */
+  if (resume != NULL) {
+    displacement = resume->displacement;
+    displacement2 = resume->displacement2;
+    t_steps = resume->t_steps;
+    rate_factor = resume->rate_factor;
+    r_rate_factor = resume->r_rate_factor;
+    t_start = resume->t_start;
+    inertness = resume->inertness;
+    redo_expand_collision_list_flag = resume->redo_expand_collision_list_flag;
+    calculate_displacement = 0;
+  }
+
 pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
 
   struct subvolume *sv = vm->subvol;
@@ -2965,15 +3094,25 @@ pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
                                      tail of the collision linked list) */
   struct collision *shead_exp = NULL; /* Things we might hit (can interact with)
                                          from neighbor subvolumes */
+  /* With packed lists the partners in the subvolume are only collected once
+   * the displacement is known, and again after each reflection. */
+  int deferred_mol_mol = defer_mol_mol_reactions(vm, inertness);
+  int redo_packed_list_flag = 0;
+
   /* scan subvolume for possible mol-mol reactions with vm */
   if ((spec->flags & (CAN_VOLVOL | CANT_INITIATE)) == CAN_VOLVOL &&
-      inertness < inert_to_all) {
-    determine_mol_mol_reactions(world, vm, &shead, &stail, inertness);
+      inertness < inert_to_all && !deferred_mol_mol) {
+    determine_mol_mol_reactions(world, vm, NULL, &shead, &stail, inertness);
   }
 
   if (calculate_displacement) {
     compute_displacement(world, shead, vm, &displacement, &displacement2,
-      &rate_factor, &r_rate_factor, &steps, &t_steps, max_time);
+      &rate_factor, &r_rate_factor, &steps, &t_steps, max_time, inertness);
+  }
+
+  if (deferred_mol_mol) {
+    determine_mol_mol_reactions(world, vm, &displacement, &shead, &stail,
+      inertness);
   }
 
   if (world->use_expanded_list &&
@@ -3001,6 +3140,11 @@ pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
     if (world->use_expanded_list && redo_expand_collision_list_flag) {
       redo_collision_list(world, &shead, &stail, &shead_exp, vm, &displacement, sv);
     }
+    if (redo_packed_list_flag) {
+      redo_packed_collision_list(world, &shead, &stail, shead_exp, vm,
+        &displacement, inertness);
+      redo_packed_list_flag = 0;
+    }
 
     struct collision* shead2 = ray_trace(world, &(vm->pos), shead, sv, &displacement, reflectee);
     if (shead2 == NULL) {
@@ -3091,12 +3235,36 @@ pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
         }
         // Only useful if using expanded lists, but easier to always set it
         redo_expand_collision_list_flag = 1; 
+        redo_packed_list_flag = deferred_mol_mol;
                                              
         break;
       } else if ((smash->what & COLLIDE_SUBVOL) != 0) {
-        collide_and_react_with_subvol(
+        struct subvolume *handoff_sv = collide_and_react_with_subvol(
           world, smash, &displacement, &vm, &tentative, &t_steps);
         FREE_COLLISION_LISTS();
+        if (handoff_sv != NULL) {
+          /* The rest of the step is taken by the worker owning handoff_sv.
+           * Until then the molecule stays where it is, pinned by
+           * IN_SCHEDULE so that it isn't freed if something reacts with it. */
+          struct mol_handoff *h = (struct mol_handoff *)CHECKED_MEM_GET(
+              sv->local_storage->handoff, "molecule hand-off");
+          h->vm = vm;
+          h->dest = handoff_sv;
+          h->displacement = displacement;
+          h->displacement2 = displacement2;
+          h->t_steps = t_steps;
+          h->rate_factor = rate_factor;
+          h->r_rate_factor = r_rate_factor;
+          h->t_start = t_start;
+          h->inertness = inertness;
+          h->redo_expand_collision_list_flag = redo_expand_collision_list_flag;
+          h->next = sv->local_storage->handoff_out;
+          sv->local_storage->handoff_out = h;
+          vm->flags |= IN_SCHEDULE;
+          if (vm->subvol->local_storage->packed_molecules)
+            packed_list_update(vm);
+          return NULL;
+        }
         calculate_displacement = 0;
 
         if (vm->properties == NULL) {
@@ -3121,7 +3289,7 @@ pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
   if (inertness == inert_to_all) 
   {
     inertness = inert_to_mol;
-    t_steps = vm->get_time_step(vm);
+    t_steps = mol_time_step(vm);
     displacement = displacement2;
     calculate_displacement = 0;
     goto pretend_to_call_diffuse_3D;
@@ -3129,9 +3297,15 @@ pretend_to_call_diffuse_3D: ; /* Label to allow fake recursion */
 
   vm->index = -1;
   vm->previous_wall = NULL;
+  if (vm->subvol->local_storage->packed_molecules)
+    packed_list_update(vm);
 
+#if MEM_UTIL_BULK_RECLAIM
+  mem_reclaim_all(sv->local_storage->coll);
+#else
   if (shead != NULL)
     mem_put_list(sv->local_storage->coll, shead);
+#endif
 
   return vm;
 }
@@ -3177,10 +3351,12 @@ int move_sm_on_same_triangle(
     }
 
     remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+    update_tile_occupancy(sm->grid, sm->grid_index);
     sm->grid_index = new_idx;
     sm->grid->sm_list[new_idx] = add_surfmol_with_unique_pb_to_list(
       sm->grid->sm_list[new_idx], sm);
     assert(sm->grid->sm_list[new_idx] != NULL);
+    update_tile_occupancy(sm->grid, new_idx);
     count_moved_surface_mol(
       state, sm, sm->grid, new_loc, state->count_hashmask,
       state->count_hash, &state->ray_polygon_colls, previous_box);
@@ -3248,12 +3424,14 @@ int move_sm_to_new_triangle(
     state->count_hash, &state->ray_polygon_colls, previous_box);
 
   remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+  update_tile_occupancy(sm->grid, sm->grid_index);
   sm->grid->n_occupied--;
   sm->grid = new_wall->grid;
   sm->grid_index = new_idx;
   sm_list = add_surfmol_with_unique_pb_to_list(sm->grid->sm_list[new_idx], sm);
   assert(sm_list != NULL);
   sm->grid->sm_list[sm->grid_index] = sm_list;
+  update_tile_occupancy(sm->grid, sm->grid_index);
   sm->grid->n_occupied++;
 
   sm->s_pos.u = new_loc->u;
@@ -3288,12 +3466,12 @@ struct surface_molecule *diffuse_2D(
   }
 
   // XXX: When would this ever happen, and shouldn't it just be an error?
-  if (sm->get_space_step(sm) <= 0.0) {
+  if (mol_space_step(sm) <= 0.0) {
     sm->t += max_time;
     return sm;
   }
   // Using global SPACE_STEP or per species CUSTOM_SPACE_STEP/CUSTOM_TIME_STEP
-  if (sm->get_time_step(sm) > 1.0) {
+  if (mol_time_step(sm) > 1.0) {
     double sched_time = convert_iterations_to_seconds(
         world->start_iterations, world->time_unit,
         world->simulation_start_seconds, sm->t);
@@ -3312,22 +3490,22 @@ struct surface_molecule *diffuse_2D(
   double t_steps = 0.0;
   double space_factor = 0.0;
   /* Where are we going? */
-  if (sm->get_time_step(sm) > max_time) {
+  if (mol_time_step(sm) > max_time) {
     t_steps = max_time;
-    steps = max_time / sm->get_time_step(sm);
+    steps = max_time / mol_time_step(sm);
   } else {
-    t_steps = sm->get_time_step(sm);
+    t_steps = mol_time_step(sm);
     steps = 1.0;
   }
   if (steps < EPS_C) {
     steps = EPS_C;
-    t_steps = EPS_C * sm->get_time_step(sm);
+    t_steps = EPS_C * mol_time_step(sm);
   }
 
   if (steps == 1.0)
-    space_factor = sm->get_space_step(sm);
+    space_factor = mol_space_step(sm);
   else
-    space_factor = sm->get_space_step(sm) * sqrt(steps);
+    space_factor = mol_space_step(sm) * sqrt(steps);
 
   world->diffusion_number++;
   world->diffusion_cumtime += steps;
@@ -3446,22 +3624,22 @@ react_2D_all_neighbors(struct volume *world, struct surface_molecule *sm,
   int num_matching_rxns = 0;
   struct rxn *matching_rxns[MAX_MATCHING_RXNS];
 
-  /* linked list of the tile neighbors */
-  struct tile_neighbor *tile_nbr_head = NULL, *curr;
-  int list_length = 0; /* length of the linked lists above */
+  /* the tile neighbors */
+  struct tile_nbr_set nbrs;
 
   if ((u_int)sm->grid_index >= sm->grid->n_tiles) {
     mcell_internal_error("tile index %u is greater or equal number_of_tiles %u",
                          (u_int)sm->grid_index, sm->grid->n_tiles);
   }
 
-  find_neighbor_tiles(world, sm, sm->grid, sm->grid_index, 0, 1, &tile_nbr_head,
-                      &list_length);
+  get_neighbor_tiles(world, sm, &nbrs);
 
-  if (tile_nbr_head == NULL)
+  if (nbrs.n == 0) {
+    release_neighbor_tiles(&nbrs);
     return sm; /* no reaction may happen */
+  }
 
-  const int num_nbrs = list_length;
+  const int num_nbrs = nbrs.n;
   int max_size = num_nbrs * MAX_MATCHING_RXNS;
   struct rxn *rxn_array[max_size]; /* array of reaction objects with neighbor
                                      molecules */
@@ -3483,12 +3661,24 @@ react_2D_all_neighbors(struct volume *world, struct surface_molecule *sm,
     cf[kk] = 0;
   }
 
+  /* Partners whose species can't react with ours are skipped using the
+     grids' occupancy, without touching the molecules themselves */
+  struct species *spec = sm->properties;
+  int use_table = !(spec->flags & EXTERNAL_SPECIES);
+
   /* step through the neighbors */
-  for (curr = tile_nbr_head; curr != NULL; curr = curr->next) {
-    /* Neighboring molecule */
-    struct surface_molecule_list *sm_list = curr->grid->sm_list[curr->idx]; 
-    if (sm_list == NULL || sm_list->sm == NULL)
+  for (int kk = 0; kk < num_nbrs; kk++) {
+    struct tile_nbr_ref *curr = &nbrs.tiles[kk];
+    if (!tile_occupied(curr->grid, curr->idx))
       continue;
+    u_int nbr_species = curr->grid->tile_species[curr->idx];
+    if (use_table && nbr_species != 0) {
+      struct rxn **pair_rxns = bimolecular_rxns_by_id(spec, nbr_species - 1);
+      if (pair_rxns != NULL && pair_rxns[0] == NULL)
+        continue;
+    }
+
+    /* Neighboring molecule */
     struct surface_molecule *smp = curr->grid->sm_list[curr->idx]->sm;
 
     /* check whether the neighbor molecule is behind
@@ -3539,7 +3729,7 @@ react_2D_all_neighbors(struct volume *world, struct surface_molecule *sm,
     }
   }
 
-  delete_tile_neighbor_list(tile_nbr_head);
+  release_neighbor_tiles(&nbrs);
 
   if (n == 0) {
     return sm; /* Nobody to react with */
@@ -3617,6 +3807,7 @@ void reschedule_surface_molecules(
     memcpy(sm_new, sm, sizeof(struct surface_molecule));
     sm_new->next = NULL;
     sm_new->birthplace = sv->local_storage->smol;
+    mol_index_moved((struct abstract_molecule *)sm_new);
     if (sm->grid->sm_list[sm->grid_index] && 
         (sm->grid->sm_list[sm->grid_index]->sm == sm)) {
       sm->grid->sm_list[sm->grid_index]->sm = sm_new;
@@ -3637,6 +3828,34 @@ void reschedule_surface_molecules(
   }
 }
 
+/*************************************************************************
+reschedule_molecule:
+  In: state: simulation state
+      local: local storage area to use
+      am: molecule which has just been updated
+  Out: No return value.  The molecule is put back into the scheduler of the
+       storage it now belongs to.
+*************************************************************************/
+static void reschedule_molecule(struct volume *state, struct storage *local,
+                                struct abstract_molecule *am) {
+  am->flags |= IN_SCHEDULE;
+
+  /* If we're near an integer boundary, advance to the next integer */
+  double t = ceil(am->t) * (1.0 + 0.1 * EPS_C);
+  if (!distinguishable(t, am->t, EPS_C))
+    am->t = t;
+
+  if (am->flags & TYPE_SURF) {
+    reschedule_surface_molecules(state, local, am);
+  } else {
+    if (schedule_add(
+            ((struct volume_molecule *)am)->subvol->local_storage->timer, am))
+      mcell_allocfailed("Failed to add a '%s' volume molecule to scheduler "
+                        "after taking a diffusion step.",
+                        am->properties->sym->name);
+  }
+}
+
 /*************************************************************************
 run_timestep:
   In: state: simulation state
@@ -3674,12 +3893,22 @@ void run_timestep(struct volume *state, struct storage *local,
       continue;
     }
 
+    /* Products and released molecules may land on another rank */
+    if (state->ranks != NULL && (am->flags & TYPE_VOL) != 0 &&
+        !domain_owns_subvol(state, ((struct volume_molecule *)am)->subvol)) {
+      domain_export_molecule((struct volume_molecule *)am);
+      continue;
+    }
+
     am->flags &= ~IN_SCHEDULE;
 
     // Check for unimolecular reactions
     // If molec is new or need rescheduled, this just computes a new lifetime
     if (am->t2 < EPS_C || am->t2 < EPS_C * am->t) {
-      if (!check_for_unimolecular_reaction(state, am)) {
+      SHARED_STATE_LOCK(state);
+      int still_exists = check_for_unimolecular_reaction(state, am);
+      SHARED_STATE_UNLOCK(state);
+      if (!still_exists) {
         continue;
       }
     }
@@ -3707,7 +3936,7 @@ void run_timestep(struct volume *state, struct storage *local,
               state, (struct volume_molecule *)am, max_time);
         else
           am = (struct abstract_molecule *)diffuse_3D(
-              state, (struct volume_molecule *)am, max_time);
+              state, (struct volume_molecule *)am, max_time, NULL);
         if (am != NULL) /* We still exist */
         {
           // Perform only for unimolecular reactions
@@ -3737,7 +3966,7 @@ void run_timestep(struct volume *state, struct storage *local,
 
     //int can_surface_mol_react =
     //    (am->properties->flags & (CAN_SURFSURFSURF | CAN_SURFSURF));
-    int can_surface_mol_react = (am->get_flags(am) & (CAN_SURFSURFSURF | CAN_SURFSURF));
+    int can_surface_mol_react = (mol_flags(am) & (CAN_SURFSURFSURF | CAN_SURFSURF));
     if (((am->flags & TYPE_SURF) != 0) && can_surface_mol_react) {
       // Didn't move, so we need to figure out how long to react for
       if (!can_diffuse) 
@@ -3747,8 +3976,8 @@ void run_timestep(struct volume *state, struct storage *local,
           max_time = am->t2;
         if (max_time > release_time - am->t)
           max_time = release_time - am->t;
-        if (am->get_time_step(am) < max_time)
-          max_time = am->get_time_step(am);
+        if (mol_time_step(am) < max_time)
+          max_time = mol_time_step(am);
         surface_mol_advance_time = max_time;
       } else
         max_time = surface_mol_advance_time;
@@ -3822,28 +4051,44 @@ void run_timestep(struct volume *state, struct storage *local,
       }
     }
 
-    am->flags |= IN_SCHEDULE;
-
-    /* If we're near an integer boundary, advance to the next integer */
-    double t = ceil(am->t) * (1.0 + 0.1 * EPS_C);
-    if (!distinguishable(t, am->t, EPS_C))
-      am->t = t;
-
-    if (am->flags & TYPE_SURF) {
-      reschedule_surface_molecules(state, local, am);
-    } else {
-      if (schedule_add(
-              ((struct volume_molecule *)am)->subvol->local_storage->timer, am))
-        mcell_allocfailed("Failed to add a '%s' volume molecule to scheduler "
-                          "after taking a diffusion step.",
-                          am->properties->sym->name);
-    }
+    reschedule_molecule(state, local, am);
   }
   if (local->timer->error)
     mcell_internal_error("Scheduler reported an out-of-memory error while "
                          "retrieving molecules, but this should never happen.");
 }
 
+/*************************************************************************
+resume_handed_off_molecules:
+  In: state: simulation state
+      local: local storage area to use
+  Out: No return value.  Every volume molecule which was handed off to this
+       storage by a neighboring one finishes its diffusion step and is
+       rescheduled.
+*************************************************************************/
+void resume_handed_off_molecules(struct volume *state, struct storage *local) {
+  while (local->handoff_in != NULL) {
+    struct mol_handoff *h = local->handoff_in;
+    local->handoff_in = h->next;
+
+    struct abstract_molecule *am = (struct abstract_molecule *)diffuse_3D(
+        state, h->vm, 0.0, h);
+    double save_sched_time = h->t_start;
+    mem_put(local->handoff, h);
+    if (am == NULL)
+      continue;
+
+    // Perform only for unimolecular reactions
+    if ((am->flags & ACT_REACT) != 0) {
+      am->t2 -= am->t - save_sched_time;
+      if (am->t2 < 0)
+        am->t2 = 0;
+    }
+
+    reschedule_molecule(state, local, am);
+  }
+}
+
 
 /*************************************************************************
 run_concentration_clamp:
@@ -3877,7 +4122,6 @@ void run_concentration_clamp(struct volume *world, double t_now) {
         vm.flags = IN_SCHEDULE | ACT_NEWBIE | TYPE_VOL | IN_VOLUME |
                   ACT_CLAMPED | ACT_DIFFUSE;
         vm.properties = ccdm->mol;
-        initialize_diffusion_function((struct abstract_molecule*)&vm);
 
         vm.mesh_name = NULL;
         vm.birthplace = NULL;
@@ -4042,6 +4286,13 @@ static int collide_and_react_with_vol_mol(struct volume* world,
 
   double scaling = factor * r_rate_factor;
   struct rxn* rx = smash->intermediate;
+  SHARED_STATE_LOCK(world);
+  /* A partner in a neighboring storage may have been destroyed by another
+   * worker since the collision was found */
+  if (am->properties == NULL) {
+    SHARED_STATE_UNLOCK(world);
+    return 0;
+  }
   if ((rx != NULL) && (rx->prob_t != NULL)) {
     update_probs(world, rx, m->t);
   }
@@ -4052,6 +4303,7 @@ static int collide_and_react_with_vol_mol(struct volume* world,
     rx, scaling, 0, am, (struct abstract_molecule *)m, world->rng);
 
   if (i < RX_LEAST_VALID_PATHWAY) {
+    SHARED_STATE_UNLOCK(world);
     return 0;
   }
 
@@ -4059,6 +4311,7 @@ static int collide_and_react_with_vol_mol(struct volume* world,
     0, 0, m->t + t_steps * smash->t, &(smash->loc), loc_certain);
 
   if (j != RX_DESTROY) {
+    SHARED_STATE_UNLOCK(world);
     return 0;
   } else {
     /* Count the hits up until we were destroyed */
@@ -4084,6 +4337,7 @@ static int collide_and_react_with_vol_mol(struct volume* world,
     }
     *tentative = ttv;
   }
+  SHARED_STATE_UNLOCK(world);
   return 1;
 }
 
@@ -4391,6 +4645,7 @@ int collide_and_react_with_walls(struct volume* world, struct collision* smash,
     return -1;
   }
 
+  SHARED_STATE_LOCK(world);
   int is_transp_flag = 0;
   struct rxn *transp_rx = NULL;
   for (int ii = 0; ii < num_matching_rxns; ii++) {
@@ -4421,6 +4676,7 @@ int collide_and_react_with_walls(struct volume* world, struct collision* smash,
         *loc_certain = &(ttv->loc);
       }
     }
+    SHARED_STATE_UNLOCK(world);
     return 0; /* Ignore this wall and keep going */
   } else if (inertness < inert_to_all) {
     /* Collisions with the surfaces declared REFLECTIVE are treated similar to
@@ -4457,6 +4713,7 @@ int collide_and_react_with_walls(struct volume* world, struct collision* smash,
         }
         *loc_certain = &(ttv->loc);
         *tentative = ttv;
+        SHARED_STATE_UNLOCK(world);
         return 0; /* pass through */
       } else if (j == RX_DESTROY) {
         if ((mflags & COUNT_ME) != 0 && (spec->flags & COUNT_HITS) != 0) {
@@ -4466,10 +4723,12 @@ int collide_and_react_with_walls(struct volume* world, struct collision* smash,
             world, tentative, smash, m, spec, smash->t, destroy_flag,
             periodic_box, m->id);
         }
+        SHARED_STATE_UNLOCK(world);
         return 1;
       }
     }
   }
+  SHARED_STATE_UNLOCK(world);
   return -1;
 }
 
@@ -4732,6 +4991,9 @@ int reflect_or_periodic_bc(
 
     /* Now, since we're reflecting before passing through these surfaces,
      * register them as hits, but not as crossings. */
+    int lock = count_update_needs_lock(world, spec);
+    if (lock)
+      SHARED_STATE_LOCK(world);
     for (; ttv != NULL && ttv->t <= smash->t; ttv = ttv->next) {
       if (!(ttv->what & COLLIDE_WALL)) {
         continue;
@@ -4746,6 +5008,8 @@ int reflect_or_periodic_bc(
       if (ttv == smash)
         break;
     }
+    if (lock)
+      SHARED_STATE_UNLOCK(world);
   }
   *tentative = ttv;
 
@@ -4765,13 +5029,19 @@ int reflect_or_periodic_bc(
  *
  * Return values:
  *
- * No return value. We just have to ensure that we update the counts properly
- * and then migrate the molecule to the proper subvolume.
+ * NULL if the molecule was migrated to the new subvolume. We just have to
+ * ensure that we update the counts properly and then migrate the molecule to
+ * the proper subvolume.
+ *
+ * If storages are run on worker threads and the new subvolume belongs to
+ * another storage, or if the new subvolume belongs to another rank, the
+ * molecule is left on the boundary and the new subvolume is returned so that
+ * the caller can hand the molecule off.
  *
  ******************************************************************************/
-void collide_and_react_with_subvol(struct volume* world, struct collision *smash,
-  struct vector3* displacement, struct volume_molecule** mol,
-  struct collision** tentative, double* t_steps) {
+struct subvolume *collide_and_react_with_subvol(struct volume* world,
+  struct collision *smash, struct vector3* displacement,
+  struct volume_molecule** mol, struct collision** tentative, double* t_steps) {
 
   struct collision* ttv = *tentative;
   struct volume_molecule* m = *mol;
@@ -4779,6 +5049,9 @@ void collide_and_react_with_subvol(struct volume* world, struct collision *smash
   if ((m->flags & COUNT_ME) != 0 && (spec->flags & COUNT_SOME_MASK) != 0) {
     /* We're leaving the SV so we actually crossed everything we thought
      * we might have crossed */
+    int lock = count_update_needs_lock(world, spec);
+    if (lock)
+      SHARED_STATE_LOCK(world);
     for (; ttv != NULL && ttv != smash; ttv = ttv->next) {
       if (!(ttv->what & COLLIDE_WALL)) {
         continue;
@@ -4790,6 +5063,8 @@ void collide_and_react_with_subvol(struct volume* world, struct collision *smash
           ((struct wall *)ttv->target)->counting_regions,
           ((ttv->what & COLLIDE_MASK) == COLLIDE_FRONT) ? 1 : -1, 1, &(ttv->loc), ttv->t);
     }
+    if (lock)
+      SHARED_STATE_UNLOCK(world);
   }
 
   m->pos.x = smash->loc.x;
@@ -4809,17 +5084,23 @@ void collide_and_react_with_subvol(struct volume* world, struct collision *smash
   struct subvolume *nsv = traverse_subvol(
     m->subvol, smash->what - COLLIDE_SV_NX - COLLIDE_SUBVOL, world->ny_parts,
     world->nz_parts);
+  struct subvolume *handoff_sv = NULL;
   if (nsv == NULL) {
     mcell_internal_error(
         "A %s molecule escaped the world at [%.2f, %.2f, %.2f]",
         spec->sym->name, m->pos.x * world->length_unit,
         m->pos.y * world->length_unit, m->pos.z * world->length_unit);
+  } else if ((world->threads != NULL &&
+              nsv->local_storage != m->subvol->local_storage) ||
+             (world->ranks != NULL && !domain_owns_subvol(world, nsv))) {
+    handoff_sv = nsv;
   } else {
     m = migrate_volume_molecule(m, nsv);
   }
 
   *mol = m;
   *tentative = ttv;
+  return handoff_sv;
 }
 
 
@@ -4836,12 +5117,12 @@ void collide_and_react_with_subvol(struct volume* world, struct collision *smash
 void compute_displacement(struct volume* world, struct collision* shead,
   struct volume_molecule* m, struct vector3* displacement,
   struct vector3* displacement2, double* rate_factor, double* r_rate_factor,
-  double* steps, double* t_steps, double max_time) {
+  double* steps, double* t_steps, double max_time, int inertness) {
 
   struct species* spec = m->properties;
   if (m->flags & ACT_CLAMPED) { /* Surface clamping and microscopic reversibility */
     if (m->index <= DISSOCIATION_MAX) { /* Volume microscopic reversibility */
-      pick_release_displacement(displacement, displacement2, m->get_space_step(m),
+      pick_release_displacement(displacement, displacement2, mol_space_step(m),
         world->r_step_release, world->d_step, world->radial_subdivisions,
         world->directions_mask, world->num_directions, world->rx_radius_3d,
         world->rng);
@@ -4849,7 +5130,7 @@ void compute_displacement(struct volume* world, struct collision* shead,
     } else { /* Clamping or surface microscopic reversibility */
       pick_clamped_displacement(displacement, m, world->r_step_surface,
         world->rng, world->radial_subdivisions);
-      *t_steps = m->get_time_step(m);
+      *t_steps = mol_time_step(m);
       m->previous_wall = NULL;
       m->index = -1;
     }
@@ -4859,29 +5140,32 @@ void compute_displacement(struct volume* world, struct collision* shead,
     *steps = 1.0;
   } else {
     if (max_time > MULTISTEP_WORTHWHILE) {
-      *steps = safe_diffusion_step(m, shead, world->radial_subdivisions,
+      double d2_mols = GIGANTIC;
+      if (defer_mol_mol_reactions(m, inertness))
+        d2_mols = nearest_packed_partner(world, m, inertness);
+      *steps = safe_diffusion_step(m, shead, d2_mols, world->radial_subdivisions,
         world->r_step, world->x_fineparts, world->y_fineparts, world->z_fineparts);
     } else {
       *steps = 1.0;
     }
 
-    *t_steps = *steps * m->get_time_step(m);
+    *t_steps = *steps * mol_time_step(m);
     if (*t_steps > max_time) {
       *t_steps = max_time;
-      *steps = max_time / m->get_time_step(m);
+      *steps = max_time / mol_time_step(m);
     }
     if (*steps < EPS_C) {
       *steps = EPS_C;
-      *t_steps = EPS_C * m->get_time_step(m);
+      *t_steps = EPS_C * mol_time_step(m);
     }
 
     if (*steps == 1.0) {
-      pick_displacement(displacement, m->get_space_step(m), world->rng);
+      pick_displacement(displacement, mol_space_step(m), world->rng);
       *r_rate_factor = *rate_factor = 1.0;
     } else {
       *rate_factor = sqrt(*steps);
       *r_rate_factor = 1.0 / *rate_factor;
-      pick_displacement(displacement, *rate_factor * m->get_space_step(m), world->rng);
+      pick_displacement(displacement, *rate_factor * mol_space_step(m), world->rng);
     }
   }
 
@@ -4899,19 +5183,144 @@ void compute_displacement(struct volume* world, struct collision* shead,
 }
 
 
+/*************************************************************************
+defer_mol_mol_reactions:
+  In: vm: molecule about to diffuse
+      inertness: how inert vm is for this part of its step
+  Out: 1 if the partners of vm in its subvolume are taken from the packed
+       lists and only collected once its displacement is known, 0 if they
+       are collected up front by determine_mol_mol_reactions.
+*************************************************************************/
+static int defer_mol_mol_reactions(struct volume_molecule *vm, int inertness) {
+  return vm->subvol->local_storage->packed_molecules &&
+         (vm->properties->flags & (CAN_VOLVOL | CANT_INITIATE)) == CAN_VOLVOL &&
+         inertness < inert_to_all;
+}
+
+/*************************************************************************
+in_swept_capsule:
+  In: start: where the moving molecule starts
+      move: its displacement
+      move_len2: squared length of move
+      pos: position of a potential partner
+      r2: squared interaction radius
+  Out: 1 if pos is within the interaction radius of the segment from start
+       to start + move, 0 otherwise.
+  Note: Every partner collide_mol can hit along move is inside the capsule.
+        A zero displacement keeps everything, as collide_mol does.
+*************************************************************************/
+static int in_swept_capsule(struct vector3 const *start,
+                            struct vector3 const *move, double move_len2,
+                            struct vector3 const *pos, double r2) {
+  if (move_len2 == 0.0)
+    return 1;
+
+  double dx = pos->x - start->x;
+  double dy = pos->y - start->y;
+  double dz = pos->z - start->z;
+  double t = (dx * move->x + dy * move->y + dz * move->z) / move_len2;
+  if (t > 1.0)
+    t = 1.0;
+  else if (t < 0.0)
+    t = 0.0;
+
+  dx -= t * move->x;
+  dy -= t * move->y;
+  dz -= t * move->z;
+  return dx * dx + dy * dy + dz * dz <= r2;
+}
+
+/*************************************************************************
+nearest_packed_partner:
+  In: world: simulation state
+      vm: molecule about to diffuse, whose partners are deferred
+      inertness: how inert vm is for this part of its step
+  Out: squared distance from vm to the nearest molecule in its subvolume
+       that it can react with, or GIGANTIC if there is none.  This is what
+       safe_diffusion_step would have found in the collision list.
+*************************************************************************/
+static double nearest_packed_partner(struct volume *world,
+                                     struct volume_molecule *vm,
+                                     int inertness) {
+  struct rxn *matching_rxns[MAX_MATCHING_RXNS];
+  struct species *spec = vm->properties;
+  double d2min = GIGANTIC;
+  for (struct per_species_list *psl = vm->subvol->species_head; psl != NULL;
+       psl = psl->next) {
+    if (psl->properties == NULL || psl->head == NULL)
+      continue;
+
+    if (!trigger_bimolecular_preliminary(world->reaction_hash,
+          world->rx_hashsize, spec->hashval, psl->properties->hashval, spec,
+          psl->properties))
+      continue;
+
+    if (trigger_bimolecular(world->reaction_hash, world->rx_hashsize,
+          spec->hashval, psl->properties->hashval,
+          (struct abstract_molecule *)vm, (struct abstract_molecule *)psl->head,
+          0, 0, matching_rxns) == 0)
+      continue;
+
+    for (int k = 0; k < psl->n_packed; k++) {
+      if (psl->packed_mol[k] == vm ||
+          (inertness == inert_to_mol && vm->index == psl->packed_index[k]))
+        continue;
+
+      struct vector3 *p = &psl->packed_pos[k];
+      double d2 = (vm->pos.x - p->x) * (vm->pos.x - p->x) +
+                  (vm->pos.y - p->y) * (vm->pos.y - p->y) +
+                  (vm->pos.z - p->z) * (vm->pos.z - p->z);
+      if (d2 < d2min)
+        d2min = d2;
+    }
+  }
+  return d2min;
+}
+
+/******************************************************************************
+ *
+ * redo_packed_collision_list is a helper function used in diffuse_3D to
+ * collect the partners in the subvolume again after the molecule was
+ * reflected and continues along a new displacement.  The list of partners
+ * from neighboring subvolumes, shead_exp, is kept.
+ *
+ ******************************************************************************/
+static void redo_packed_collision_list(struct volume* world,
+  struct collision** shead, struct collision** stail,
+  struct collision* shead_exp, struct volume_molecule* m,
+  struct vector3* displacement, int inertness) {
+
+  if (*stail != NULL) {
+    (*stail)->next = NULL;
+    mem_put_list(m->subvol->local_storage->coll, *shead);
+  }
+  *shead = NULL;
+  *stail = NULL;
+  determine_mol_mol_reactions(world, m, displacement, shead, stail, inertness);
+  if (*stail != NULL)
+    (*stail)->next = shead_exp;
+  else
+    *shead = shead_exp;
+}
+
 /******************************************************************************
  *
  * the determine_mol_mol_reactions helper function is used in diffuse_3D to
  * compute all possible molecule molecule reactions between the diffusing
  * molecule m and all other volume molecules in the subvolume.
  *
+ * With packed lists m's displacement move must be given, and only the
+ * partners within the interaction radius of its path are added; the others
+ * could not be hit by collide_mol anyway.
+ *
  * Return values:
  *
  * this function does not return anything
  *
  ******************************************************************************/
 void determine_mol_mol_reactions(struct volume* world, struct volume_molecule* m,
-  struct collision** shead, struct collision** stail, int inertness) {
+  struct vector3* move, struct collision** shead, struct collision** stail,
+  int inertness) {
 
   struct subvolume* sv = m->subvol;
   struct rxn *matching_rxns[MAX_MATCHING_RXNS];
@@ -4929,6 +5338,7 @@ void determine_mol_mol_reactions(struct volume* world, struct volume_molecule* m
     if (psl->head == NULL) {
       *psl_head = psl->next;
       ht_remove(&sv->mol_by_species, psl);
+      packed_list_free(psl);
       mem_put(sv->local_storage->pslv, psl);
       continue;
     } else
@@ -4949,6 +5359,49 @@ void determine_mol_mol_reactions(struct volume* world, struct volume_molecule* m
       }
     }
 
+    if (sv->local_storage->packed_molecules) {
+      /* Without NFSim and periodic boxes the reactions between two volume
+       * molecules only depend on their species, so look them up once and
+       * read nothing but the packed list for the partners. */
+      num_matching_rxns = trigger_bimolecular(world->reaction_hash,
+        world->rx_hashsize, spec->hashval, psl->properties->hashval,
+        (struct abstract_molecule *)m, (struct abstract_molecule *)psl->head,
+        0, 0, matching_rxns);
+      double move_len2 = move->x * move->x + move->y * move->y +
+                         move->z * move->z;
+      /* a little slack so that rounding never drops a partner */
+      double r2 = 1.01 * world->rx_radius_3d * world->rx_radius_3d;
+      for (int k = 0; k < psl->n_packed && num_matching_rxns > 0; k++) {
+        struct volume_molecule *mp = psl->packed_mol[k];
+        if (mp == m) {
+          continue;
+        }
+
+        if (inertness == inert_to_mol && m->index == psl->packed_index[k]) {
+          continue;
+        }
+
+        if (!in_swept_capsule(&m->pos, move, move_len2, &psl->packed_pos[k],
+              r2)) {
+          continue;
+        }
+
+        for (int i = 0; i < num_matching_rxns; i++) {
+          struct collision* smash =
+           (struct collision *)CHECKED_MEM_GET(sv->local_storage->coll,
+            "collision data");
+          smash->target = (void *)mp;
+          smash->what = COLLIDE_VOL;
+          smash->intermediate = matching_rxns[i];
+          smash->next = *shead;
+          *shead = smash;
+          if (*stail == NULL)
+            *stail = *shead;
+        }
+      }
+      continue;
+    }
+
     for (struct volume_molecule* mp = psl->head; mp != NULL; mp = mp->next_v) {
       if (mp == m) {
         continue;
@@ -5019,16 +5472,16 @@ void set_inertness_and_maxtime(
       }
     } else if (!world->surface_reversibility) {
       if (m->flags & ACT_CLAMPED) { /* Pretend we were already moving */
-        m->birthday -= 5 * m->get_time_step(m); /* Pretend to be old */
+        m->birthday -= 5 * mol_time_step(m); /* Pretend to be old */
       }
     }
   } else {
     if (m->flags & ACT_CLAMPED) { /* Pretend we were already moving */
-      m->birthday -= 5 * m->get_time_step(m); /* Pretend to be old */
+      m->birthday -= 5 * mol_time_step(m); /* Pretend to be old */
     } else if ((m->flags & MATURE_MOLECULE) == 0) {
       /* Newly created particles that have long time steps gradually increase */
       /* their timestep to the full value */
-      if (m->get_time_step(m) > 1.0) {
+      if (mol_time_step(m) > 1.0) {
         double f = 1.0 + 0.2 * (m->t - m->birthday);
         if (f < 1)
           mcell_internal_error("A %s molecule is scheduled to move before it "
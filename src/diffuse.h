@@ -59,6 +59,9 @@ struct wall *ray_trace_2D(struct volume *world, struct surface_molecule *sm,
                           int *kill_me, struct rxn **rxp,
                           struct hit_data **hd_info);
 
+struct wall_list *walls_to_test(struct volume *world, struct subvolume *sv,
+                                struct vector3 *pos, struct vector3 *v);
+
 struct collision *ray_trace(struct volume *world, struct vector3 *init_pos,
                             struct collision *c, struct subvolume *sv,
                             struct vector3 *v, struct wall *reflectee);
@@ -71,7 +74,8 @@ struct sp_collision *ray_trace_trimol(struct volume *world,
                                       double walk_start_time);
 
 struct volume_molecule *diffuse_3D(struct volume *world,
-                                   struct volume_molecule *m, double max_time);
+                                   struct volume_molecule *m, double max_time,
+                                   struct mol_handoff *resume);
 
 struct volume_molecule *diffuse_3D_big_list(struct volume *world,
                                             struct volume_molecule *m,
@@ -105,6 +109,7 @@ void reschedule_surface_molecules(
 
 void run_timestep(struct volume *world, struct storage *local,
                   double release_time, double checkpt_time);
+void resume_handed_off_molecules(struct volume *world, struct storage *local);
 
 void run_concentration_clamp(struct volume *world, double t_now);
 
@@ -116,9 +121,9 @@ struct sp_collision *expand_collision_partner_list_for_neighbor(
     double *z_fineparts, int rx_hashsize, struct rxn **reaction_hash);
 
 double safe_diffusion_step(struct volume_molecule *m, struct collision *shead,
-                           u_int radial_subdivisions, double *r_step,
-                           double *x_fineparts, double *y_fineparts,
-                           double *z_fineparts);
+                           double d2_mols, u_int radial_subdivisions,
+                           double *r_step, double *x_fineparts,
+                           double *y_fineparts, double *z_fineparts);
 
 double exact_disk(struct volume *world, struct vector3 *loc, struct vector3 *mv,
                   double R, struct subvolume *sv,
@@ -41,6 +41,7 @@
 #include "wall_util.h"
 #include "react.h"
 #include "react_output.h"
+#include "packed_mols.h"
 
 /**********************************************************************
 ray_trace_trimol:
@@ -81,9 +82,9 @@ struct sp_collision *ray_trace_trimol(struct volume *world,
   smash = (struct sp_collision *)CHECKED_MEM_GET(sv->local_storage->sp_coll,
                                                  "collision structure");
 
-  fake_wlp.next = sv->wall_head;
+  fake_wlp.next = walls_to_test(world, sv, &(m->pos), v);
 
-  for (wlp = sv->wall_head; wlp != NULL; wlp = wlp->next) {
+  for (wlp = fake_wlp.next; wlp != NULL; wlp = wlp->next) {
     if (wlp->this_wall == reflectee)
       continue;
 
@@ -93,6 +94,7 @@ struct sp_collision *ray_trace_trimol(struct volume *world,
       if (shead != NULL)
         mem_put_list(sv->local_storage->sp_coll, shead);
       shead = NULL;
+      fake_wlp.next = walls_to_test(world, sv, &(m->pos), v);
       wlp = &fake_wlp;
       continue;
     } else if (i != COLLIDE_MISS) {
@@ -501,6 +503,8 @@ diffuse_3D_big_list:
         reallocated), NULL otherwise.
         Position and time are updated, but molecule is not rescheduled.
   Note: This version takes into account both 2-way and 3-way reactions
+        Like diffuse_3D, it reclaims the storage's sp_coll and tri_coll
+        pools as a whole when the step ends.
 ***************************************************************************/
 struct volume_molecule *diffuse_3D_big_list(struct volume *world,
                                             struct volume_molecule *m,
@@ -650,9 +654,10 @@ pretend_to_call_diffuse_3D_big_list: /* Label to allow fake recursion */
       /* XXX: I don't think this is safe.  We probably need to pass in a list
        * of nearby molecules... */
       if (max_time > MULTISTEP_WORTHWHILE)
-        steps = safe_diffusion_step(m, NULL, world->radial_subdivisions,
-                                    world->r_step, world->x_fineparts,
-                                    world->y_fineparts, world->z_fineparts);
+        steps = safe_diffusion_step(m, NULL, GIGANTIC,
+                                    world->radial_subdivisions, world->r_step,
+                                    world->x_fineparts, world->y_fineparts,
+                                    world->z_fineparts);
       else
         steps = 1.0;
 
@@ -716,6 +721,7 @@ pretend_to_call_diffuse_3D_big_list: /* Label to allow fake recursion */
       if (psl->head == NULL) {
         *psl_head = psl->next;
         ht_remove(&sv->mol_by_species, psl);
+        packed_list_free(psl);
         mem_put(sv->local_storage->pslv, psl);
         continue;
       } else
@@ -807,6 +813,14 @@ pretend_to_call_diffuse_3D_big_list: /* Label to allow fake recursion */
 
   reflectee = NULL;
 
+#if MEM_UTIL_BULK_RECLAIM
+#define TRI_CLEAN_AND_RETURN(x)                                                \
+  do {                                                                         \
+    mem_reclaim_all(sv->local_storage->tri_coll);                              \
+    mem_reclaim_all(sv->local_storage->sp_coll);                               \
+    return (x);                                                                \
+  } while (0)
+#else
 #define TRI_CLEAN_AND_RETURN(x)                                                \
   do {                                                                         \
     if (main_tri_shead != NULL)                                                \
@@ -815,6 +829,7 @@ pretend_to_call_diffuse_3D_big_list: /* Label to allow fake recursion */
       mem_put_list(sv->local_storage->sp_coll, main_shead2);                   \
     return (x);                                                                \
   } while (0)
+#endif
 
   do {
     if (world->use_expanded_list && redo_expand_collision_list_flag) {
@@ -1720,11 +1735,18 @@ pretend_to_call_diffuse_3D_big_list: /* Label to allow fake recursion */
 
   m->index = -1;
   m->previous_wall = NULL;
+  if (m->subvol->local_storage->packed_molecules)
+    packed_list_update(m);
 
+#if MEM_UTIL_BULK_RECLAIM
+  mem_reclaim_all(sv->local_storage->tri_coll);
+  mem_reclaim_all(sv->local_storage->sp_coll);
+#else
   if (main_tri_shead != NULL)
     mem_put_list(sv->local_storage->tri_coll, main_tri_shead);
   if (main_shead2 != NULL)
     mem_put_list(sv->local_storage->sp_coll, main_shead2);
+#endif
 
   return m;
 }
@@ -1758,10 +1780,8 @@ struct surface_molecule *react_2D_trimol_all_neighbors(
   int num_matching_rxns = 0;
   struct rxn *matching_rxns[MAX_MATCHING_RXNS];
 
-  /* linked lists of the tile neighbors (first and second level) */
-  struct tile_neighbor *tile_nbr_head_f = NULL, *tile_nbr_head_s = NULL,
-                       *curr_f, *curr_s;
-  int list_length_f, list_length_s; /* length of the linked lists above */
+  /* the tile neighbors (first and second level) */
+  struct tile_nbr_set nbrs_f, nbrs_s;
 
   int max_size = 12 * 12 * MAX_MATCHING_RXNS; /* reasonable assumption */
   struct rxn *rxn_array[max_size]; /* array of reaction objects with neighbor
@@ -1784,23 +1804,24 @@ struct surface_molecule *react_2D_trimol_all_neighbors(
   }
 
   /* find first level neighbor molecules to react with */
-  find_neighbor_tiles(world, sm, sm->grid, sm->grid_index, 0, 1,
-                      &tile_nbr_head_f, &list_length_f);
+  get_neighbor_tiles(world, sm, &nbrs_f);
 
-  if (tile_nbr_head_f == NULL)
+  if (nbrs_f.n == 0) {
+    release_neighbor_tiles(&nbrs_f);
     return sm;
+  }
 
   /* Calculate local_prob_factor for the reaction probability.
      Here we convert from 3 neighbor tiles (upper probability
      limit) to the real number of neighbor tiles. */
-  local_prob_factor_f = 1.0 / list_length_f;
+  local_prob_factor_f = 1.0 / nbrs_f.n;
 
   /* step through the neighbors */
-  for (curr_f = tile_nbr_head_f; curr_f != NULL; curr_f = curr_f->next) {
-    struct surface_molecule_list *sm_list = curr_f->grid->sm_list[curr_f->idx]; 
-    if (sm_list == NULL || sm_list->sm == NULL)
+  for (int n_f = 0; n_f < nbrs_f.n; n_f++) {
+    struct tile_nbr_ref *curr_f = &nbrs_f.tiles[n_f];
+    if (!tile_occupied(curr_f->grid, curr_f->idx))
       continue;
-    gm_f = sm_list->sm;
+    gm_f = curr_f->grid->sm_list[curr_f->idx]->sm;
 
     /* check whether the neighbor molecule is behind
        the restrictive region boundary   */
@@ -1819,17 +1840,18 @@ struct surface_molecule *react_2D_trimol_all_neighbors(
     }
 
     /* find nearest neighbor molecules to react with (2nd level) */
-    find_neighbor_tiles(world, gm_f, gm_f->grid, gm_f->grid_index, 0, 1,
-                        &tile_nbr_head_s, &list_length_s);
+    get_neighbor_tiles(world, gm_f, &nbrs_s);
 
-    if (tile_nbr_head_s == NULL)
+    if (nbrs_s.n == 0) {
+      release_neighbor_tiles(&nbrs_s);
       continue;
+    }
 
-    local_prob_factor_s = 1.0 / (list_length_s - 1);
+    local_prob_factor_s = 1.0 / (nbrs_s.n - 1);
 
-    for (curr_s = tile_nbr_head_s; curr_s != NULL; curr_s = curr_s->next) {
-      sm_list = curr_s->grid->sm_list[curr_s->idx]; 
-      if (sm_list == NULL || sm_list->sm == NULL)
+    for (int n_s = 0; n_s < nbrs_s.n; n_s++) {
+      struct tile_nbr_ref *curr_s = &nbrs_s.tiles[n_s];
+      if (!tile_occupied(curr_s->grid, curr_s->idx))
         continue;
       gm_s = curr_s->grid->sm_list[curr_s->idx]->sm;
       if (gm_s == NULL)
@@ -1895,12 +1917,10 @@ struct surface_molecule *react_2D_trimol_all_neighbors(
         n += num_matching_rxns;
       }
     }
-    if (tile_nbr_head_s != NULL)
-      delete_tile_neighbor_list(tile_nbr_head_s);
+    release_neighbor_tiles(&nbrs_s);
   }
 
-  if (tile_nbr_head_f != NULL)
-    delete_tile_neighbor_list(tile_nbr_head_f);
+  release_neighbor_tiles(&nbrs_f);
 
   if (n > max_size)
     mcell_internal_error("The size of the reactions array in the function "
@@ -0,0 +1,812 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Splits the world across several ranks (processes), each of which owns a
+ * slab of the coarse partitions along x and simulates only the volume
+ * molecules inside it.
+ *
+ * A molecule which diffuses into a subvolume owned by another rank is parked
+ * on the boundary of its own subvolume exactly as for a storage hand-off
+ * (see storage_threads.c).  Once no rank has anything left to do in the
+ * current time slot, the parked molecules are packed together with the rest
+ * of their diffusion step, sent to the rank owning the subvolume they were
+ * entering, and finish their step there.  This repeats until no molecule
+ * crosses a rank boundary any more.
+ *
+ * Scheduled releases and concentration clamps are run by every rank with an
+ * identical random number generator; every rank then discards the released
+ * molecules which landed outside its slab.  Counts are kept per rank and are
+ * summed over all ranks when reaction output is produced, in one exchange
+ * for all the output blocks of a time slot; only rank 0 writes output
+ * files.  test_domain_ranks.c runs the hand-over and the sums on two
+ * ranks.
+ *
+ * The transport between ranks is a set of stream sockets, one per pair of
+ * ranks.  The ranks are forked from a single process after initialization,
+ * so the whole model is identical on every rank.  Carrying the same exchange
+ * over MPI only requires replacing send_to_rank and recv_from_rank.
+ *
+ * Subvolumes next to the boundary of a slab are not mirrored on the
+ * neighboring rank (there is no halo exchange), so molecules only react with
+ * molecules in their own subvolume.  Models which need to look into
+ * neighboring subvolumes (ACCURATE_3D_REACTIONS) or use other features which
+ * cross subvolume boundaries run on a single rank, with a warning; so do
+ * models that write checkpoints, since no rank holds the whole world.
+ * Checkpoint signals received while split are ignored (see mcell_run.c). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "rng.h"
+#include "count_util.h"
+#include "vol_util.h"
+#include "nfsim_func.h"
+#include "mol_index.h"
+#include "domain_ranks.h"
+
+/* A volume molecule travelling to another rank.  Species and subvolume are
+ * sent as indices, which are the same on every rank. */
+struct domain_migrant {
+  u_long id;
+  double t;
+  double t2;
+  double birthday;
+  struct vector3 pos;
+  u_int species;
+  int subvol;
+  int flags;
+  int index;
+
+  /* Rest of the diffusion step, if the molecule crossed a slab boundary */
+  int resume;
+  int inertness;
+  int redo_expand_collision_list_flag;
+  struct vector3 displacement;
+  struct vector3 displacement2;
+  double t_steps;
+  double rate_factor;
+  double r_rate_factor;
+  double t_start;
+};
+
+struct migrant_buffer {
+  struct domain_migrant *items;
+  u_long n_items;
+  u_long size;
+};
+
+struct domain_ranks {
+  int rank;
+  int n_ranks;
+  int *peer_fd;    /* Socket to every other rank, -1 for this one */
+  pid_t *children; /* Process of every other rank (rank 0 only) */
+
+  int *x_lo;     /* First x partition of every rank, plus the end */
+  int yz_parts;  /* Number of subvolumes in an x partition */
+
+  struct migrant_buffer *outbox; /* Molecules for every other rank */
+  struct migrant_buffer inbox;
+
+  /* Generator shared by all ranks for scheduled releases and clamps */
+  struct rng_state *release_rng;
+  struct rng_state *own_rng;
+  int replicating;
+
+  /* Released molecules outside of this rank's slab */
+  struct volume_molecule **replicas;
+  u_long n_replicas;
+  u_long replicas_size;
+
+  long long other_rng_uses; /* Random numbers drawn by the other ranks */
+};
+
+/*************************************************************************
+domain_ineligible:
+  In: world: simulation state
+  Out: NULL if the model may be split across ranks, otherwise a short
+       description of the reason why it may not.
+*************************************************************************/
+static char const *domain_ineligible(struct volume *world) {
+  if (world->nfsim_flag)
+    return "NFSim models are not supported";
+  if (world->dynamic_geometry_head != NULL)
+    return "dynamic geometry is not supported";
+  if (world->periodic_box_obj != NULL)
+    return "periodic boundary conditions are not supported";
+  if (world->use_expanded_list)
+    return "ACCURATE_3D_REACTIONS must be set to FALSE";
+  if (world->chkpt_iterations || world->chkpt_infile != NULL ||
+      world->chkpt_outfile != NULL || world->checkpoint_alarm_time != 0)
+    return "checkpointing is not supported";
+  if (world->viz_blocks != NULL || world->volume_output_head != NULL)
+    return "visualization and volume output are not supported";
+  if (world->nx_parts - 1 < world->num_ranks)
+    return "there are fewer partitions along x than ranks";
+
+  for (struct output_block *block = world->output_block_head; block != NULL;
+       block = block->next) {
+    for (struct output_set *set = block->data_set_head; set != NULL;
+         set = set->next) {
+      if (set->column_head != NULL &&
+          set->column_head->buffer[0].data_type == COUNT_TRIG_STRUCT)
+        return "triggers are not supported";
+    }
+  }
+
+  for (int i = 0; i < world->n_species; i++) {
+    struct species *sp = world->species_list[i];
+    if (sp == world->all_mols || sp == world->all_volume_mols ||
+        sp == world->all_surface_mols || (sp->flags & IS_SURFACE) != 0)
+      continue;
+    if (sp->flags & ON_GRID)
+      return "surface molecules are not supported";
+    if (sp->flags & (CAN_VOLVOLVOL | CAN_VOLVOLSURF))
+      return "trimolecular reactions are not supported";
+  }
+  return NULL;
+}
+
+/*************************************************************************
+send_to_rank:
+  In: dr: distributed run state
+      peer: rank to send to
+      buf: data to send
+      len: number of bytes to send
+  Out: No return value.  The data is sent; losing the connection to the
+       other rank is fatal.
+*************************************************************************/
+static void send_to_rank(struct domain_ranks *dr, int peer, void const *buf,
+                         size_t len) {
+  char const *p = (char const *)buf;
+  while (len > 0) {
+    ssize_t n = write(dr->peer_fd[peer], p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      mcell_error("Rank %d lost its connection to rank %d: %s", dr->rank, peer,
+                  n < 0 ? strerror(errno) : "connection closed");
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+/*************************************************************************
+recv_from_rank:
+  In: dr: distributed run state
+      peer: rank to receive from
+      buf: where to put the data
+      len: number of bytes to receive
+  Out: No return value.  The data is received; losing the connection to the
+       other rank is fatal.
+*************************************************************************/
+static void recv_from_rank(struct domain_ranks *dr, int peer, void *buf,
+                           size_t len) {
+  char *p = (char *)buf;
+  while (len > 0) {
+    ssize_t n = read(dr->peer_fd[peer], p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      mcell_error("Rank %d lost its connection to rank %d: %s", dr->rank, peer,
+                  n < 0 ? strerror(errno) : "connection closed");
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+/*************************************************************************
+reserve_migrants:
+  In: buf: migrant buffer
+      n_items: number of molecules the buffer must be able to hold
+  Out: No return value.  The buffer is grown if needed.
+*************************************************************************/
+static void reserve_migrants(struct migrant_buffer *buf, u_long n_items) {
+  if (n_items <= buf->size)
+    return;
+
+  u_long size = buf->size ? buf->size : 64;
+  while (size < n_items)
+    size *= 2;
+  struct domain_migrant *items = CHECKED_MALLOC_ARRAY(
+      struct domain_migrant, size, "molecules migrating between ranks");
+  if (buf->n_items > 0)
+    memcpy(items, buf->items, buf->n_items * sizeof(struct domain_migrant));
+  free(buf->items);
+  buf->items = items;
+  buf->size = size;
+}
+
+/*************************************************************************
+exchange_with_rank:
+  In: dr: distributed run state
+      peer: the other rank
+  Out: No return value.  The molecules for the other rank are sent to it,
+       and the molecules it has for us are appended to our inbox.  Of every
+       pair of ranks the lower one sends first, so the exchange can't
+       deadlock when the peers are visited in increasing order.
+*************************************************************************/
+static void exchange_with_rank(struct domain_ranks *dr, int peer) {
+  struct migrant_buffer *out = &dr->outbox[peer];
+  u_long n_in;
+
+  for (int pass = 0; pass < 2; pass++) {
+    if ((pass == 0) == (dr->rank < peer)) {
+      send_to_rank(dr, peer, &out->n_items, sizeof(u_long));
+      send_to_rank(dr, peer, out->items,
+                   out->n_items * sizeof(struct domain_migrant));
+      out->n_items = 0;
+    } else {
+      recv_from_rank(dr, peer, &n_in, sizeof(u_long));
+      reserve_migrants(&dr->inbox, dr->inbox.n_items + n_in);
+      recv_from_rank(dr, peer, dr->inbox.items + dr->inbox.n_items,
+                     n_in * sizeof(struct domain_migrant));
+      dr->inbox.n_items += n_in;
+    }
+  }
+}
+
+/*************************************************************************
+domain_sum:
+  In: world: simulation state
+      values: values to sum
+      n_values: number of values
+  Out: No return value.  Every value is replaced by its sum over all ranks.
+       Sums are formed in the same order on every run.
+*************************************************************************/
+void domain_sum(struct volume *world, double *values, int n_values) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL || n_values == 0)
+    return;
+
+  if (dr->rank != 0) {
+    send_to_rank(dr, 0, values, n_values * sizeof(double));
+    recv_from_rank(dr, 0, values, n_values * sizeof(double));
+    return;
+  }
+
+  double *peer_values =
+      CHECKED_MALLOC_ARRAY(double, n_values, "values summed over ranks");
+  for (int peer = 1; peer < dr->n_ranks; peer++) {
+    recv_from_rank(dr, peer, peer_values, n_values * sizeof(double));
+    for (int i = 0; i < n_values; i++)
+      values[i] += peer_values[i];
+  }
+  free(peer_values);
+  for (int peer = 1; peer < dr->n_ranks; peer++)
+    send_to_rank(dr, peer, values, n_values * sizeof(double));
+}
+
+/*************************************************************************
+domain_owns_subvol:
+  In: world: simulation state
+      sv: a subvolume
+  Out: 1 if the molecules in the subvolume are simulated by this rank,
+       0 if they are simulated by another one.
+*************************************************************************/
+int domain_owns_subvol(struct volume *world, struct subvolume *sv) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return 1;
+
+  int x_part = (int)(sv - world->subvol) / dr->yz_parts;
+  return x_part >= dr->x_lo[dr->rank] && x_part < dr->x_lo[dr->rank + 1];
+}
+
+/*************************************************************************
+rank_of_subvol:
+  In: world: simulation state
+      subvol_index: index of a subvolume
+  Out: The rank simulating the molecules in the subvolume.
+*************************************************************************/
+static int rank_of_subvol(struct volume *world, int subvol_index) {
+  struct domain_ranks *dr = world->ranks;
+  int x_part = subvol_index / dr->yz_parts;
+  int rank = 0;
+  while (x_part >= dr->x_lo[rank + 1])
+    rank++;
+  return rank;
+}
+
+/*************************************************************************
+domain_begin_replicated:
+  In: world: simulation state
+  Out: No return value.  Every rank is about to do the same thing (release
+       molecules or clamp concentrations); until domain_end_replicated
+       random numbers come from the generator shared by all ranks.
+*************************************************************************/
+void domain_begin_replicated(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return;
+
+  dr->own_rng = world->rng;
+  world->rng = dr->release_rng;
+  dr->replicating = 1;
+}
+
+/*************************************************************************
+domain_note_inserted_molecule:
+  In: world: simulation state
+      vm: volume molecule which was just inserted into the world
+  Out: No return value.  If the molecule was released by every rank and
+       isn't ours, it is remembered so that it can be discarded.
+*************************************************************************/
+void domain_note_inserted_molecule(struct volume *world,
+                                   struct volume_molecule *vm) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL || !dr->replicating || domain_owns_subvol(world, vm->subvol))
+    return;
+
+  if (dr->n_replicas == dr->replicas_size) {
+    u_long size = dr->replicas_size ? 2 * dr->replicas_size : 256;
+    struct volume_molecule **replicas = CHECKED_MALLOC_ARRAY(
+        struct volume_molecule *, size, "molecules released by other ranks");
+    if (dr->n_replicas > 0)
+      memcpy(replicas, dr->replicas,
+             dr->n_replicas * sizeof(struct volume_molecule *));
+    free(dr->replicas);
+    dr->replicas = replicas;
+    dr->replicas_size = size;
+  }
+  dr->replicas[dr->n_replicas++] = vm;
+}
+
+/*************************************************************************
+domain_end_replicated:
+  In: world: simulation state
+  Out: No return value.  This rank's generator is back in place and the
+       molecules released outside of this rank's slab are removed again,
+       undoing their counts.
+*************************************************************************/
+void domain_end_replicated(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return;
+
+  world->rng = dr->own_rng;
+  dr->replicating = 0;
+
+  for (u_long i = 0; i < dr->n_replicas; i++) {
+    struct volume_molecule *vm = dr->replicas[i];
+    if (vm->properties == NULL)
+      continue;
+
+    vm->properties->population--;
+    mol_index_remove(vm->properties, (struct abstract_molecule *)vm);
+    vm->subvol->mol_count--;
+    if ((vm->properties->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) != 0)
+      count_region_from_scratch(world, (struct abstract_molecule *)vm, NULL,
+                                -1, &(vm->pos), NULL, vm->t, vm->periodic_box);
+    if (vm->flags & IN_SCHEDULE)
+      vm->subvol->local_storage->timer->defunct_count++;
+    collect_molecule(vm);
+  }
+  dr->n_replicas = 0;
+}
+
+/*************************************************************************
+domain_export_molecule:
+  In: vm: volume molecule just taken off the scheduler, which has ended up
+          in a subvolume owned by another rank (e.g. a reaction product)
+  Out: No return value.  The molecule is queued for the owning rank.
+*************************************************************************/
+void domain_export_molecule(struct volume_molecule *vm) {
+  struct storage *local = vm->subvol->local_storage;
+  struct mol_handoff *h =
+      (struct mol_handoff *)CHECKED_MEM_GET(local->handoff, "molecule hand-off");
+  memset(h, 0, sizeof(struct mol_handoff));
+  h->vm = vm;
+  h->dest = vm->subvol; /* Not crossing a boundary; see pack_handoffs */
+  h->next = local->handoff_out;
+  local->handoff_out = h;
+  vm->flags |= IN_SCHEDULE;
+}
+
+/*************************************************************************
+pack_handoffs:
+  In: world: simulation state
+      local: a storage
+  Out: Number of molecules packed.  The molecules handed off by the
+       storage are moved into the outboxes of the ranks they are going to.
+       A hand-off to the molecule's own subvolume is a plain move; any
+       other one also carries the rest of the diffusion step.
+*************************************************************************/
+static u_long pack_handoffs(struct volume *world, struct storage *local) {
+  struct domain_ranks *dr = world->ranks;
+  u_long n_packed = 0;
+  struct mol_handoff *next;
+
+  for (struct mol_handoff *h = local->handoff_out; h != NULL; h = next) {
+    next = h->next;
+
+    struct volume_molecule *vm = h->vm;
+    vm->flags &= ~IN_SCHEDULE;
+    if (vm->properties == NULL) {
+      if ((vm->flags & IN_MASK) == 0)
+        mem_put(vm->birthplace, vm);
+      mem_put(local->handoff, h);
+      continue;
+    }
+
+    int subvol_index = (int)(h->dest - world->subvol);
+    struct migrant_buffer *out = &dr->outbox[rank_of_subvol(world, subvol_index)];
+    reserve_migrants(out, out->n_items + 1);
+    struct domain_migrant *mg = &out->items[out->n_items++];
+    memset(mg, 0, sizeof(struct domain_migrant));
+    mg->id = vm->id;
+    mg->t = vm->t;
+    mg->t2 = vm->t2;
+    mg->birthday = vm->birthday;
+    mg->pos = vm->pos;
+    mg->species = vm->properties->species_id;
+    mg->subvol = subvol_index;
+    mg->flags = vm->flags;
+    mg->index = vm->index;
+    if (h->dest != vm->subvol) {
+      mg->resume = 1;
+      mg->inertness = h->inertness;
+      mg->redo_expand_collision_list_flag = h->redo_expand_collision_list_flag;
+      mg->displacement = h->displacement;
+      mg->displacement2 = h->displacement2;
+      mg->t_steps = h->t_steps;
+      mg->rate_factor = h->rate_factor;
+      mg->r_rate_factor = h->r_rate_factor;
+      mg->t_start = h->t_start;
+    }
+    n_packed++;
+
+    /* The molecule now lives on the other rank.  Region counts are summed
+     * over all ranks, so only the population moves with it. */
+    vm->properties->population--;
+    mol_index_remove(vm->properties, (struct abstract_molecule *)vm);
+    vm->subvol->mol_count--;
+    collect_molecule(vm);
+    mem_put(local->handoff, h);
+  }
+  local->handoff_out = NULL;
+  return n_packed;
+}
+
+/*************************************************************************
+unpack_migrants:
+  In: world: simulation state
+  Out: No return value.  The molecules received from other ranks are added
+       to their subvolumes.  Those which crossed a boundary are queued to
+       finish their step; the others are scheduled.
+*************************************************************************/
+static void unpack_migrants(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+
+  for (u_long i = 0; i < dr->inbox.n_items; i++) {
+    struct domain_migrant *mg = &dr->inbox.items[i];
+    struct subvolume *sv = &world->subvol[mg->subvol];
+    struct storage *local = sv->local_storage;
+
+    struct volume_molecule *vm = (struct volume_molecule *)CHECKED_MEM_GET(
+        local->mol, "volume molecule");
+    memset(vm, 0, sizeof(struct volume_molecule));
+    vm->t = mg->t;
+    vm->t2 = mg->t2;
+    vm->flags = (short)mg->flags;
+    vm->properties = world->species_list[mg->species];
+    vm->birthplace = local->mol;
+    vm->birthday = mg->birthday;
+    vm->id = mg->id;
+    struct periodic_image no_image = { .x = 0, .y = 0, .z = 0 };
+    vm->periodic_box = new_periodic_image(world, &no_image);
+    vm->pos = mg->pos;
+    vm->subvol = sv;
+    vm->index = mg->index;
+
+    ht_add_molecule_to_list(&sv->mol_by_species, vm);
+    sv->mol_count++;
+    vm->properties->population++;
+    mol_index_add((struct abstract_molecule *)vm);
+
+    if (mg->resume) {
+      struct mol_handoff *h = (struct mol_handoff *)CHECKED_MEM_GET(
+          local->handoff, "molecule hand-off");
+      h->vm = vm;
+      h->dest = sv;
+      h->displacement = mg->displacement;
+      h->displacement2 = mg->displacement2;
+      h->t_steps = mg->t_steps;
+      h->rate_factor = mg->rate_factor;
+      h->r_rate_factor = mg->r_rate_factor;
+      h->t_start = mg->t_start;
+      h->inertness = mg->inertness;
+      h->redo_expand_collision_list_flag = mg->redo_expand_collision_list_flag;
+      h->next = local->handoff_in;
+      local->handoff_in = h;
+    } else {
+      vm->flags |= IN_SCHEDULE;
+      if (schedule_add(local->timer, vm))
+        mcell_allocfailed("Failed to add a '%s' volume molecule to scheduler "
+                          "after moving it between ranks.",
+                          vm->properties->sym->name);
+    }
+  }
+  dr->inbox.n_items = 0;
+}
+
+/*************************************************************************
+domain_exchange_molecules:
+  In: world: simulation state
+  Out: 1 if any molecule moved between ranks, in which case the storages
+       need to run again, 0 otherwise.  Must be called by all ranks at the
+       same time, once none of this rank's storages has anything left to do.
+*************************************************************************/
+int domain_exchange_molecules(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return 0;
+
+  double n_moved = 0;
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next)
+    n_moved += pack_handoffs(world, l->store);
+
+  for (int peer = 0; peer < dr->n_ranks; peer++) {
+    if (peer != dr->rank)
+      exchange_with_rank(dr, peer);
+  }
+  unpack_migrants(world);
+
+  domain_sum(world, &n_moved, 1);
+  return n_moved > 0;
+}
+
+/*************************************************************************
+domain_rng_uses:
+  In: world: simulation state
+  Out: The number of random numbers drawn by the generator shared by all
+       ranks and, after finish_domain_ranks, by the other ranks.
+*************************************************************************/
+long long domain_rng_uses(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return 0;
+  return rng_uses(dr->release_rng) + dr->other_rng_uses;
+}
+
+/*************************************************************************
+init_domain_ranks:
+  In: world: simulation state
+  Out: 0 on success, 1 on failure.  If more than one rank was requested
+       and the model allows it, the other ranks are forked off and every
+       rank is given its slab of the world.  Otherwise the whole world
+       stays on this process.
+*************************************************************************/
+int init_domain_ranks(struct volume *world) {
+  if (world->num_ranks <= 1)
+    return 0;
+
+  char const *reason = domain_ineligible(world);
+  if (reason != NULL) {
+    mcell_warn("Running on a single rank instead of %d: %s.",
+               world->num_ranks, reason);
+    return 0;
+  }
+
+  int n_ranks = world->num_ranks;
+  struct domain_ranks *dr =
+      CHECKED_MALLOC_STRUCT(struct domain_ranks, "distributed run state");
+  memset(dr, 0, sizeof(struct domain_ranks));
+  dr->n_ranks = n_ranks;
+  dr->yz_parts = (world->ny_parts - 1) * (world->nz_parts - 1);
+  dr->x_lo = CHECKED_MALLOC_ARRAY(int, n_ranks + 1, "rank slabs");
+  for (int r = 0; r <= n_ranks; r++)
+    dr->x_lo[r] = (int)((long long)r * (world->nx_parts - 1) / n_ranks);
+  dr->outbox = CHECKED_MALLOC_ARRAY(struct migrant_buffer, n_ranks,
+                                    "molecules migrating between ranks");
+  memset(dr->outbox, 0, n_ranks * sizeof(struct migrant_buffer));
+  dr->peer_fd = CHECKED_MALLOC_ARRAY(int, n_ranks, "rank connections");
+  dr->children = CHECKED_MALLOC_ARRAY(pid_t, n_ranks, "rank processes");
+
+  /* One socket pair per pair of ranks; fd[a][b] is a's end of it. */
+  int *fd = CHECKED_MALLOC_ARRAY(int, n_ranks * n_ranks, "rank connections");
+  for (int a = 0; a < n_ranks; a++) {
+    fd[a * n_ranks + a] = -1;
+    for (int b = a + 1; b < n_ranks; b++) {
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        mcell_perror_nodie(errno, "Failed to connect rank %d to rank %d", a,
+                           b);
+        return 1;
+      }
+      fd[a * n_ranks + b] = pair[0];
+      fd[b * n_ranks + a] = pair[1];
+    }
+  }
+
+  /* A rank which loses its peers should fail with an error, not a signal */
+  signal(SIGPIPE, SIG_IGN);
+
+  /* The ranks start out with the same generator, which they keep for
+   * releases; then each of them gets its own. */
+  dr->release_rng =
+      CHECKED_MALLOC_STRUCT(struct rng_state, "random number generator state");
+  memcpy(dr->release_rng, world->rng, sizeof(struct rng_state));
+
+  fflush(NULL);
+  dr->rank = 0;
+  for (int r = 1; r < n_ranks; r++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      mcell_perror_nodie(errno, "Failed to start rank %d", r);
+      return 1;
+    }
+    if (pid == 0) {
+      dr->rank = r;
+      break;
+    }
+    dr->children[r] = pid;
+  }
+
+  for (int a = 0; a < n_ranks; a++) {
+    for (int b = 0; b < n_ranks; b++) {
+      if (a == b)
+        continue;
+      if (a == dr->rank)
+        dr->peer_fd[b] = fd[a * n_ranks + b];
+      else
+        close(fd[a * n_ranks + b]);
+    }
+  }
+  dr->peer_fd[dr->rank] = -1;
+  free(fd);
+
+  world->procnum = dr->rank;
+  world->ranks = dr;
+  if (dr->rank != 0) {
+    rng_stream_init(world->rng, world->seed_seq, RNG_STREAM_RANK(dr->rank));
+    world->current_mol_id += (u_long)dr->rank << 48;
+
+    /* Rank 0 speaks for all of them */
+    world->notify->progress_report = NOTIFY_NONE;
+    world->notify->iteration_report = NOTIFY_NONE;
+    world->notify->throughput_report = NOTIFY_NONE;
+    world->notify->release_events = NOTIFY_NONE;
+    world->notify->file_writes = NOTIFY_NONE;
+    world->notify->final_summary = NOTIFY_NONE;
+    world->notify->reaction_output_report = NOTIFY_NONE;
+  }
+
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next) {
+    if (l->store->handoff != NULL)
+      continue;
+    if ((l->store->handoff = create_mem_named(sizeof(struct mol_handoff), 128,
+                                              "molecule hand-off")) == NULL)
+      mcell_allocfailed("Failed to create memory pool for molecule hand-offs.");
+  }
+
+  if (dr->rank == 0 && world->notify->progress_report != NOTIFY_NONE)
+    mcell_log("Running on %d ranks, %d x partitions each.  Subvolumes are "
+              "not mirrored across ranks, and checkpoint requests are "
+              "ignored.",
+              n_ranks, (world->nx_parts - 1) / n_ranks);
+  return 0;
+}
+
+/*************************************************************************
+finish_domain_ranks:
+  In: world: simulation state
+  Out: No return value.  The statistics of all ranks are summed on rank 0,
+       which then waits for the other ranks to exit.  The other ranks do
+       not return from this function.
+*************************************************************************/
+void finish_domain_ranks(struct volume *world) {
+  struct domain_ranks *dr = world->ranks;
+  if (dr == NULL)
+    return;
+
+  int n_rxns = 0;
+  for (int i = 0; i < world->rx_hashsize; i++)
+    for (struct rxn *rx = world->reaction_hash[i]; rx != NULL; rx = rx->next)
+      n_rxns++;
+
+  int n_values = 16 + 2 * n_rxns + 2 * world->n_species;
+  double *values =
+      CHECKED_MALLOC_ARRAY(double, n_values, "statistics summed over ranks");
+  int n = 0;
+  values[n++] = (double)world->diffusion_number;
+  values[n++] = world->diffusion_cumtime;
+  values[n++] = (double)world->ray_voxel_tests;
+  values[n++] = (double)world->ray_polygon_tests;
+  values[n++] = (double)world->ray_polygon_colls;
+  values[n++] = (double)world->ray_polygon_culls;
+  values[n++] = (double)world->vol_vol_colls;
+  values[n++] = (double)world->vol_surf_colls;
+  values[n++] = (double)world->surf_surf_colls;
+  values[n++] = (double)world->vol_wall_colls;
+  values[n++] = (double)world->vol_vol_vol_colls;
+  values[n++] = (double)world->vol_vol_surf_colls;
+  values[n++] = (double)world->vol_surf_surf_colls;
+  values[n++] = (double)world->surf_surf_surf_colls;
+  values[n++] = (double)world->reaction_prob_limit_flag;
+  values[n++] = (dr->rank == 0) ? 0.0 : (double)rng_uses(world->rng);
+  for (int i = 0; i < world->rx_hashsize; i++) {
+    for (struct rxn *rx = world->reaction_hash[i]; rx != NULL; rx = rx->next) {
+      values[n++] = (double)rx->n_occurred;
+      values[n++] = rx->n_skipped;
+    }
+  }
+  for (int i = 0; i < world->n_species; i++) {
+    values[n++] = (double)world->species_list[i]->n_deceased;
+    values[n++] = world->species_list[i]->cum_lifetime_seconds;
+  }
+
+  domain_sum(world, values, n_values);
+
+  if (dr->rank != 0) {
+    fflush(NULL);
+    _exit(0);
+  }
+
+  n = 0;
+  world->diffusion_number = (long long)values[n++];
+  world->diffusion_cumtime = values[n++];
+  world->ray_voxel_tests = (long long)values[n++];
+  world->ray_polygon_tests = (long long)values[n++];
+  world->ray_polygon_colls = (long long)values[n++];
+  world->ray_polygon_culls = (long long)values[n++];
+  world->vol_vol_colls = (long long)values[n++];
+  world->vol_surf_colls = (long long)values[n++];
+  world->surf_surf_colls = (long long)values[n++];
+  world->vol_wall_colls = (long long)values[n++];
+  world->vol_vol_vol_colls = (long long)values[n++];
+  world->vol_vol_surf_colls = (long long)values[n++];
+  world->vol_surf_surf_colls = (long long)values[n++];
+  world->surf_surf_surf_colls = (long long)values[n++];
+  world->reaction_prob_limit_flag = (values[n++] > 0);
+  dr->other_rng_uses = (long long)values[n++];
+  for (int i = 0; i < world->rx_hashsize; i++) {
+    for (struct rxn *rx = world->reaction_hash[i]; rx != NULL; rx = rx->next) {
+      rx->n_occurred = (long long)values[n++];
+      rx->n_skipped = values[n++];
+    }
+  }
+  for (int i = 0; i < world->n_species; i++) {
+    world->species_list[i]->n_deceased = (long long)values[n++];
+    world->species_list[i]->cum_lifetime_seconds = values[n++];
+  }
+  free(values);
+
+  for (int peer = 1; peer < dr->n_ranks; peer++) {
+    int status;
+    close(dr->peer_fd[peer]);
+    if (waitpid(dr->children[peer], &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      mcell_warn("Rank %d did not exit cleanly.", peer);
+  }
+}
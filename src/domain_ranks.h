@@ -0,0 +1,46 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+/* All of the functions below except init_domain_ranks do nothing (or report
+ * that this rank owns everything) unless the world is split across several
+ * ranks. */
+
+int init_domain_ranks(struct volume *world);
+void finish_domain_ranks(struct volume *world);
+
+int domain_owns_subvol(struct volume *world, struct subvolume *sv);
+
+void domain_begin_replicated(struct volume *world);
+void domain_end_replicated(struct volume *world);
+void domain_note_inserted_molecule(struct volume *world,
+                                   struct volume_molecule *vm);
+
+void domain_export_molecule(struct volume_molecule *vm);
+int domain_exchange_molecules(struct volume *world);
+
+void domain_sum(struct volume *world, double *values, int n_values);
+long long domain_rng_uses(struct volume *world);
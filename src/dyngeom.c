@@ -41,6 +41,9 @@
 #include "mdlparse_aux.h"
 #include "react.h"
 #include "nfsim_func.h"
+#include "wall_bvh.h"
+#include "packed_walls.h"
+#include "mol_index.h"
 
 #define NO_MESH "\0"
 
@@ -50,7 +53,10 @@
  In:  state: MCell state
       storage_head: we will pull all the molecules out of the scheduler from
         this
- Out: An array of all the molecules to be saved
+ Out: An array of all the molecules to be saved.  They are saved in
+      scheduler order, which is the order they are placed back in; the
+      per-species index of live molecules is not used here, since walking it
+      would change that order.
 ***************************************************************************/
 struct molecule_info **save_all_molecules(struct volume *state,
                                           struct storage_list *storage_head) {
@@ -209,6 +215,7 @@ int save_surface_molecule(struct molecule_info *mol_info,
     remove_molecules_name_list(&reg_name_list_head);
   }
   remove_surfmol_from_list(&sm_ptr->grid->sm_list[sm_ptr->grid_index], sm_ptr);
+  update_tile_occupancy(sm_ptr->grid, sm_ptr->grid_index);
   return 0;
 }
 
@@ -268,7 +275,6 @@ int place_all_molecules(
 
     struct molecule_info *mol_info = state->all_molecules[n_mol];
     struct abstract_molecule *am_ptr = mol_info->molecule;
-    initialize_diffusion_function(am_ptr);
     // Insert volume molecule into world.
     if ((am_ptr->properties->flags & NOT_FREE) == 0) {
       vm_ptr->t = am_ptr->t;
@@ -281,7 +287,6 @@ int place_all_molecules(
       vm_ptr->pos.y = mol_info->pos.y;
       vm_ptr->pos.z = mol_info->pos.z;
       vm_ptr->periodic_box = am_ptr->periodic_box;
-      initialize_diffusion_function((struct abstract_molecule*)vm_ptr);
 
       vm_guess = insert_volume_molecule_encl_mesh(
           state, vm_ptr, vm_guess, mol_info->mesh_names, meshes_to_ignore);
@@ -299,7 +304,7 @@ int place_all_molecules(
           state, am_ptr->properties, &mol_info->pos, mol_info->orient,
           state->vacancy_search_dist2, am_ptr->t, mesh_name,
           mol_info->reg_names, regions_to_ignore, am_ptr->periodic_box);
-      free(am_ptr->periodic_box);
+      free_periodic_image(state, am_ptr->periodic_box);
       if (sm == NULL) {
         mcell_warn("Unable to find surface upon which to place molecule %s.",
                    am_ptr->properties->sym->name);
@@ -661,6 +666,7 @@ struct volume_molecule *insert_volume_molecule_encl_mesh(
   ht_add_molecule_to_list(&(new_vm->subvol->mol_by_species), new_vm);
   new_vm->subvol->mol_count++;
   new_vm->properties->population++;
+  mol_index_add((struct abstract_molecule *)new_vm);
 
   if ((new_vm->properties->flags & COUNT_SOME_MASK) != 0) {
     new_vm->flags |= COUNT_ME;
@@ -1233,6 +1239,10 @@ int destroy_everything(struct volume *state) {
     sv->local_storage->wall_count = 0;
     sv->local_storage->vert_count = 0;
     sv->wall_head = NULL;
+    destroy_wall_bvh(sv->wall_bvh);
+    sv->wall_bvh = NULL;
+    destroy_packed_walls(sv->packed_walls);
+    sv->packed_walls = NULL;
   }
 
   for (mem = state->storage_head; mem != NULL; mem = mem->next) {
@@ -1353,6 +1363,9 @@ int destroy_poly_object(struct object *obj_ptr, int free_poly_flag) {
       if (w->grid) {
         /*free(w->grid->mol);*/
         delete_void_list((struct void_list *)w->grid->sm_list);
+        free(w->grid->occupancy);
+        free(w->grid->tile_species);
+        delete_tile_nbr_table(w->grid);
       } 
       delete_void_list((struct void_list *)w->surf_class_head);
     }
@@ -1417,8 +1430,9 @@ reset_current_counts:
   In: mol_sym_table:
       count_hashmask:
       count_hash:
-  Out: Zero on success. Species populations are set to zero. Counts on/in
-       regions are also set to zero.
+  Out: Zero on success. Species populations (and their indices of live
+       molecules) are set to zero. Counts on/in regions are also set to
+       zero.
 ***************************************************************************/
 int reset_current_counts(struct sym_table_head *mol_sym_table,
                          int count_hashmask,
@@ -1430,6 +1444,7 @@ int reset_current_counts(struct sym_table_head *mol_sym_table,
          sym_ptr != NULL; sym_ptr = sym_ptr->next) {
       struct species *mol = (struct species *)sym_ptr->value;
       mol->population = 0;
+      mol->n_live_mols = 0;
     }
   }
 
@@ -345,11 +345,52 @@ int create_grid(struct volume *world, struct wall *w, struct subvolume *guess) {
     sg->sm_list[i] = NULL;
   }
 
+  sg->occupancy = (u_int *)calloc((sg->n_tiles + 31) / 32, sizeof(u_int));
+  sg->tile_species = (u_int *)calloc(sg->n_tiles, sizeof(u_int));
+  if (sg->occupancy == NULL || sg->tile_species == NULL)
+    mcell_allocfailed("Failed to allocate surface grid occupancy.");
+  sg->nbr_table = NULL;
+
   w->grid = sg;
 
   return 0;
 }
 
+/*************************************************************************
+update_tile_occupancy:
+  In: g: a surface grid
+      idx: index of a tile on that grid whose molecule list has changed
+  Out: No return value.  The occupancy bit and species of the tile are set
+       from the head of its molecule list.
+*************************************************************************/
+void update_tile_occupancy(struct surface_grid *g, u_int idx) {
+  struct surface_molecule_list *sm_list = g->sm_list[idx];
+  u_int bit = 1u << (idx & 31);
+  if (sm_list != NULL && sm_list->sm != NULL) {
+    g->occupancy[idx >> 5] |= bit;
+    struct species *spec = sm_list->sm->properties;
+    g->tile_species[idx] = (spec != NULL) ? spec->species_id + 1 : 0;
+  } else {
+    g->occupancy[idx >> 5] &= ~bit;
+    g->tile_species[idx] = 0;
+  }
+}
+
+/*************************************************************************
+update_grid_occupancy:
+  In: g: a surface grid whose molecule lists were filled in directly
+  Out: No return value.  The occupancy of every tile is brought up to date
+       and the number of occupied tiles is recounted.
+*************************************************************************/
+void update_grid_occupancy(struct surface_grid *g) {
+  g->n_occupied = 0;
+  for (u_int idx = 0; idx < g->n_tiles; idx++) {
+    update_tile_occupancy(g, idx);
+    if (tile_occupied(g, idx))
+      g->n_occupied++;
+  }
+}
+
 /*************************************************************************
 grid_neighbors:
   In: a surface grid
@@ -546,7 +587,7 @@ int nearest_free(struct surface_grid *g, struct vector2 *v, double max_d2,
           h = (g->n - k) - 1;
           h = h * h + 2 * j + i;
 
-          if (!g->sm_list[h] || !g->sm_list[h]->sm) {
+          if (!tile_occupied(g, h)) {
             idx = h;
             d2 = fff;
           } else if (idx == -1) {
@@ -1068,23 +1109,19 @@ int tile_orientation(struct vector2 *v, struct surface_grid *g) {
 }
 
 /*****************************************************************************
-grid_all_neighbors_for_inner_tile:
+inner_tile_neighbor_indices:
   In: a surface grid
       an index on that grid
       a point on that tile
-      a linked list of  neighbor tiles (return value)
-      a length of the linked list above (return value)
-  Out: The list and list length of nearest neighbors
-       are returned.  Neighbors should share either common edge or
-       common vertice.
+      an array to be filled in with the indices of the neighbor tiles
+  Out: No return value.  The INNER_TILE_NEIGHBORS neighbor tiles, all of
+       them on the same grid, are filled in.
   Note: The code below is valid only for the inner tile - the one that has 12
         neighbor tiles all belonging to the same grid as the start tile.
 *****************************************************************************/
-void grid_all_neighbors_for_inner_tile(
-    struct volume *world, struct surface_grid *grid, int idx,
-    struct vector2 *pos, struct tile_neighbor **tile_neighbor_head,
-    int *list_length) {
-  struct tile_neighbor *tile_nbr_head = NULL;
+static void inner_tile_neighbor_indices(struct volume *world,
+                                        struct surface_grid *grid, int idx,
+                                        struct vector2 *pos, int *nbr) {
   int count = 0;
 
   int vert_nbr_ind = -1;
@@ -1125,14 +1162,10 @@ void grid_all_neighbors_for_inner_tile(
   }
 
   /* The tile has 2 neighbors to the left and 2 neighbors to the right */
-  push_tile_neighbor_to_list(&tile_nbr_head, grid, idx - 1);
-  count++;
-  push_tile_neighbor_to_list(&tile_nbr_head, grid, idx - 2);
-  count++;
-  push_tile_neighbor_to_list(&tile_nbr_head, grid, idx + 1);
-  count++;
-  push_tile_neighbor_to_list(&tile_nbr_head, grid, idx + 2);
-  count++;
+  nbr[count++] = idx - 1;
+  nbr[count++] = idx - 2;
+  nbr[count++] = idx + 1;
+  nbr[count++] = idx + 2;
 
   /* find the orientation of the tile */
   int tile_orient = tile_orientation(pos, grid);
@@ -1140,16 +1173,11 @@ void grid_all_neighbors_for_inner_tile(
   int temp_ind;
   if (tile_orient == 0) {
     /* upright tile has 5 neighbors in the row above it */
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind - 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind - 2);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind + 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind + 2);
-    count++;
+    nbr[count++] = vert_nbr_ind;
+    nbr[count++] = vert_nbr_ind - 1;
+    nbr[count++] = vert_nbr_ind - 2;
+    nbr[count++] = vert_nbr_ind + 1;
+    nbr[count++] = vert_nbr_ind + 2;
 
     /* upright tile has 3 neighbors in the row below it */
     temp_ind = move_strip_down(grid, idx);
@@ -1159,12 +1187,9 @@ void grid_all_neighbors_for_inner_tile(
                            "tile.",
                            idx);
     }
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind - 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind + 1);
-    count++;
+    nbr[count++] = temp_ind;
+    nbr[count++] = temp_ind - 1;
+    nbr[count++] = temp_ind + 1;
   } else {
     /* inverted tile has 3 neighbors in the row above it  */
     temp_ind = move_strip_up(grid, idx);
@@ -1174,34 +1199,44 @@ void grid_all_neighbors_for_inner_tile(
                            "tile.",
                            idx);
     }
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind - 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, temp_ind + 1);
-    count++;
+    nbr[count++] = temp_ind;
+    nbr[count++] = temp_ind - 1;
+    nbr[count++] = temp_ind + 1;
 
     /*   inverted tile has 5 neighbors in the row below it  */
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind - 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind - 2);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind + 1);
-    count++;
-    push_tile_neighbor_to_list(&tile_nbr_head, grid, vert_nbr_ind + 2);
-    count++;
-  }
-
-  if (count != 12) {
-    mcell_internal_error("The function 'grid_all_neighbors_for_inner_tile() is "
-                         "called for the tile %d that is not an inner tile.",
-                         idx);
-  } else {
-    *list_length = count;
+    nbr[count++] = vert_nbr_ind;
+    nbr[count++] = vert_nbr_ind - 1;
+    nbr[count++] = vert_nbr_ind - 2;
+    nbr[count++] = vert_nbr_ind + 1;
+    nbr[count++] = vert_nbr_ind + 2;
   }
+}
 
+/*****************************************************************************
+grid_all_neighbors_for_inner_tile:
+  In: a surface grid
+      an index on that grid
+      a point on that tile
+      a linked list of  neighbor tiles (return value)
+      a length of the linked list above (return value)
+  Out: The list and list length of nearest neighbors
+       are returned.  Neighbors should share either common edge or
+       common vertice.
+  Note: The code below is valid only for the inner tile - the one that has 12
+        neighbor tiles all belonging to the same grid as the start tile.
+*****************************************************************************/
+void grid_all_neighbors_for_inner_tile(
+    struct volume *world, struct surface_grid *grid, int idx,
+    struct vector2 *pos, struct tile_neighbor **tile_neighbor_head,
+    int *list_length) {
+  struct tile_neighbor *tile_nbr_head = NULL;
+  int nbr[INNER_TILE_NEIGHBORS];
+
+  inner_tile_neighbor_indices(world, grid, idx, pos, nbr);
+  for (int kk = 0; kk < INNER_TILE_NEIGHBORS; kk++)
+    push_tile_neighbor_to_list(&tile_nbr_head, grid, nbr[kk]);
+
+  *list_length = INNER_TILE_NEIGHBORS;
   *tile_neighbor_head = tile_nbr_head;
 }
 
@@ -3064,4 +3099,198 @@ void find_neighbor_tiles(struct volume *world, struct surface_molecule *sm,
   *list_length = tmp_list_length;
 }
 
+/* Neighbors of the border tiles of a surface grid, as find_neighbor_tiles
+ * finds them when searching for reactants of a molecule that doesn't care
+ * about region borders.  For the tiles not on the border the neighbors are
+ * just a few index computations away, so they aren't stored.
+ *
+ * Which neighbor tiles there are depends on which of the neighboring walls
+ * have grids; the table is rebuilt once one of those without a grid gets
+ * one.  It goes away with the grid when the geometry changes. */
+struct tile_nbr_table {
+  /* The neighbors of tile i are tiles[start[i]] up to tiles[start[i+1]-1] */
+  u_int *start;
+  struct tile_nbr_ref *tiles;
+
+  /* Neighboring walls that had no grid when the table was built */
+  struct wall_list *gridless;
+};
+
+/*************************************************************************
+delete_tile_nbr_table:
+  In: a surface grid
+  Out: No return value.  The grid's table of neighbor tiles is freed.
+*************************************************************************/
+void delete_tile_nbr_table(struct surface_grid *grid) {
+  struct tile_nbr_table *table = grid->nbr_table;
+  if (table == NULL)
+    return;
+
+  free(table->start);
+  free(table->tiles);
+  delete_wall_list(table->gridless);
+  free(table);
+  grid->nbr_table = NULL;
+}
+
+/*************************************************************************
+note_gridless_wall:
+  In: the table being built
+      a wall whose grid the neighbors of some tile depend on
+  Out: No return value.  The wall is remembered if it has no grid.
+*************************************************************************/
+static void note_gridless_wall(struct tile_nbr_table *table, struct wall *w) {
+  if (w == NULL || w->grid != NULL)
+    return;
+  for (struct wall_list *wl = table->gridless; wl != NULL; wl = wl->next)
+    if (wl->this_wall == w)
+      return;
+  push_wall_to_list(&table->gridless, w);
+}
+
+/*************************************************************************
+build_tile_nbr_table:
+  In: world: simulation state
+      grid: a surface grid
+  Out: No return value.  The grid's table of neighbor tiles is (re)built.
+*************************************************************************/
+static void build_tile_nbr_table(struct volume *world,
+                                 struct surface_grid *grid) {
+  delete_tile_nbr_table(grid);
+
+  struct tile_nbr_table *table =
+      CHECKED_MALLOC_STRUCT(struct tile_nbr_table, "tile neighbor table");
+  table->start = CHECKED_MALLOC_ARRAY(u_int, grid->n_tiles + 1,
+                                      "tile neighbor table");
+  table->gridless = NULL;
+
+  for (int kk = 0; kk < 3; kk++)
+    note_gridless_wall(table, grid->surface->nb_walls[kk]);
+
+  /* Collect the neighbors of the border tiles in the order in which
+   * find_neighbor_tiles lists them */
+  struct tile_neighbor **lists = CHECKED_MALLOC_ARRAY(
+      struct tile_neighbor *, grid->n_tiles, "tile neighbor table");
+  u_int n_entries = 0;
+  for (u_int idx = 0; idx < grid->n_tiles; idx++) {
+    table->start[idx] = n_entries;
+    lists[idx] = NULL;
+    if (is_inner_tile(grid, idx))
+      continue;
+
+    int list_length = 0;
+    find_neighbor_tiles(world, NULL, grid, idx, 0, 1, &lists[idx],
+                        &list_length);
+    n_entries += list_length;
+
+    if (is_corner_tile(grid, idx)) {
+      long long shared_vert[3] = { -1, -1, -1 };
+      find_shared_vertices_corner_tile_parent_wall(world, grid, idx,
+                                                   shared_vert);
+      struct wall_list *wall_nbr_head =
+          find_nbr_walls_shared_one_vertex(world, grid->surface, shared_vert);
+      for (struct wall_list *wl = wall_nbr_head; wl != NULL; wl = wl->next)
+        note_gridless_wall(table, wl->this_wall);
+      delete_wall_list(wall_nbr_head);
+    }
+  }
+  table->start[grid->n_tiles] = n_entries;
+
+  table->tiles = CHECKED_MALLOC_ARRAY(
+      struct tile_nbr_ref, n_entries > 0 ? n_entries : 1,
+      "tile neighbor table");
+  for (u_int idx = 0; idx < grid->n_tiles; idx++) {
+    struct tile_nbr_ref *ref = table->tiles + table->start[idx];
+    for (struct tile_neighbor *tn = lists[idx]; tn != NULL; tn = tn->next) {
+      ref->grid = tn->grid;
+      ref->idx = tn->idx;
+      ref++;
+    }
+    delete_tile_neighbor_list(lists[idx]);
+  }
+  free(lists);
+
+  grid->nbr_table = table;
+}
+
+/*************************************************************************
+get_neighbor_tiles:
+  In: world: simulation state
+      sm: a surface molecule searching for reaction partners
+      set: to be filled in with the neighbor tiles
+  Out: No return value.  The set holds the tiles that find_neighbor_tiles
+       would list (in the same order) without allocating anything, unless
+       the molecule sits on the border of its grid and can see region
+       borders.  Release the set with release_neighbor_tiles.
+*************************************************************************/
+void get_neighbor_tiles(struct volume *world, struct surface_molecule *sm,
+                        struct tile_nbr_set *set) {
+  struct surface_grid *grid = sm->grid;
+  int idx = sm->grid_index;
+  set->allocated = NULL;
+
+  if (is_inner_tile(grid, idx)) {
+    /* find_neighbor_tiles lists them in the opposite order */
+    struct vector2 pos;
+    int nbr[INNER_TILE_NEIGHBORS];
+    grid2uv(grid, idx, &pos);
+    inner_tile_neighbor_indices(world, grid, idx, &pos, nbr);
+    for (int kk = 0; kk < INNER_TILE_NEIGHBORS; kk++) {
+      set->inner[kk].grid = grid;
+      set->inner[kk].idx = nbr[INNER_TILE_NEIGHBORS - 1 - kk];
+    }
+    set->tiles = set->inner;
+    set->n = INNER_TILE_NEIGHBORS;
+    return;
+  }
+
+  if (sm->properties->flags & CAN_REGION_BORDER) {
+    struct tile_neighbor *head = NULL;
+    int list_length = 0;
+    find_neighbor_tiles(world, sm, grid, idx, 0, 1, &head, &list_length);
+    set->n = list_length;
+    set->tiles = set->inner;
+    if (list_length > INNER_TILE_NEIGHBORS) {
+      set->allocated = CHECKED_MALLOC_ARRAY(struct tile_nbr_ref, list_length,
+                                            "neighbor tiles");
+      set->tiles = set->allocated;
+    }
+    struct tile_nbr_ref *ref = set->tiles;
+    for (struct tile_neighbor *tn = head; tn != NULL; tn = tn->next) {
+      ref->grid = tn->grid;
+      ref->idx = tn->idx;
+      ref++;
+    }
+    delete_tile_neighbor_list(head);
+    return;
+  }
+
+  int stale = (grid->nbr_table == NULL);
+  if (!stale) {
+    for (struct wall_list *wl = grid->nbr_table->gridless; wl != NULL;
+         wl = wl->next) {
+      if (wl->this_wall->grid != NULL) {
+        stale = 1;
+        break;
+      }
+    }
+  }
+  if (stale)
+    build_tile_nbr_table(world, grid);
+
+  struct tile_nbr_table *table = grid->nbr_table;
+  set->tiles = table->tiles + table->start[idx];
+  set->n = table->start[idx + 1] - table->start[idx];
+}
+
+/*************************************************************************
+release_neighbor_tiles:
+  In: a set of neighbor tiles filled in by get_neighbor_tiles
+  Out: No return value.  Memory held by the set is freed.
+*************************************************************************/
+void release_neighbor_tiles(struct tile_nbr_set *set) {
+  free(set->allocated);
+  set->allocated = NULL;
+}
+
 
@@ -28,6 +28,9 @@
 
 #define TILE_CHECKED 0x01
 
+/* Number of neighbors of a tile that isn't on the border of its grid */
+#define INNER_TILE_NEIGHBORS 12
+
 /* contains information about the neigbors of the tile */
 struct tile_neighbor {
   struct surface_grid *grid; /* surface grid the tile is on */
@@ -55,6 +58,15 @@ void init_grid_geometry(struct surface_grid *sm);
 
 int create_grid(struct volume *world, struct wall *w, struct subvolume *guess);
 
+void update_tile_occupancy(struct surface_grid *g, u_int idx);
+
+void update_grid_occupancy(struct surface_grid *g);
+
+/* Whether a tile of the grid holds a surface molecule */
+static inline int tile_occupied(struct surface_grid *g, u_int idx) {
+  return (g->occupancy[idx >> 5] >> (idx & 31)) & 1;
+}
+
 void grid_neighbors(struct volume *world, struct surface_grid *grid, int idx,
                     int create_grid_flag, struct surface_grid **nb_grid,
                     int *nb_idx);
@@ -76,6 +88,27 @@ struct wall *search_nbhd_for_free(struct volume *world, struct wall *origin,
 
 void delete_tile_neighbor_list(struct tile_neighbor *head);
 
+/* A neighbor tile, as an entry of an array */
+struct tile_nbr_ref {
+  struct surface_grid *grid; /* surface grid the tile is on */
+  u_int idx;                 /* index on that grid */
+};
+
+/* The neighbor tiles of a surface molecule (see get_neighbor_tiles) */
+struct tile_nbr_set {
+  int n;                          /* number of neighbor tiles */
+  struct tile_nbr_ref *tiles;     /* the neighbor tiles */
+  struct tile_nbr_ref *allocated; /* tiles, if they had to be allocated */
+  struct tile_nbr_ref inner[INNER_TILE_NEIGHBORS];
+};
+
+void get_neighbor_tiles(struct volume *world, struct surface_molecule *sm,
+                        struct tile_nbr_set *set);
+
+void release_neighbor_tiles(struct tile_nbr_set *set);
+
+void delete_tile_nbr_table(struct surface_grid *grid);
+
 void delete_region_list(struct region_list *head);
 
 void push_tile_neighbor_to_list(struct tile_neighbor **head,
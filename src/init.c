@@ -56,6 +56,8 @@
 #include "dyngeom.h"
 #include "dyngeom_parse_extras.h"
 #include "triangle_overlap.h"
+#include "wall_bvh.h"
+#include "packed_walls.h"
 
 #define MESH_DISTINCTIVE EPS_C
 
@@ -253,6 +255,7 @@ int init_variables(struct volume *world) {
   world->ray_voxel_tests = 0;
   world->ray_polygon_tests = 0;
   world->ray_polygon_colls = 0;
+  world->ray_polygon_culls = 0;
   world->dyngeom_molec_displacements = 0;
   world->vol_vol_colls = 0;
   world->vol_surf_colls = 0;
@@ -410,6 +413,14 @@ int init_data_structures(struct volume *world) {
     return 1;
   }
 
+  world->periodic_image_mem = create_mem_named(
+      sizeof(struct periodic_image), 4096, "periodic image");
+  if (world->periodic_image_mem == NULL) {
+    mcell_allocfailed_nodie(
+        "Failed to create memory pool for molecule periodic images.");
+    return 1;
+  }
+
   world->dynamic_geometry_events_mem = create_mem_named(
       sizeof(struct dg_time_filename), 100, "dynamic geometry time filename");
   if (world->dynamic_geometry_events_mem == NULL)
@@ -693,6 +704,8 @@ int init_vertices_walls(struct volume *world) {
                       "among partitions.");
     return 1;
   }
+  if (init_wall_bvhs(world) || init_packed_walls(world))
+    return 1;
 
   if (world->notify->progress_report != NOTIFY_NONE)
     mcell_log("Creating edges...");
@@ -3019,13 +3032,8 @@ int init_surf_mols_by_number(struct volume *world, struct object *objp,
           for (int n_wall = 0; n_wall < rp->membership->nbits; n_wall++) {
             if (get_bit(rp->membership, n_wall)) {
               struct surface_grid *sg = objp->wall_p[n_wall]->grid;
-              if (sg != NULL) {
-                sg->n_occupied = 0;
-                for (unsigned int n_tile = 0; n_tile < sg->n_tiles; ++n_tile) {
-                  if (sg->sm_list[n_tile]->sm != NULL)
-                    sg->n_occupied++;
-                }
-              }
+              if (sg != NULL)
+                update_grid_occupancy(sg);
             }
           }
         }
@@ -3173,14 +3181,8 @@ int init_surf_mols_by_number(struct volume *world, struct object *objp,
             for (int n_wall = 0; n_wall < rp->membership->nbits; n_wall++) {
               if (get_bit(rp->membership, n_wall)) {
                 struct surface_grid *sg = objp->wall_p[n_wall]->grid;
-                if (sg != NULL) {
-                  sg->n_occupied = 0;
-                  for (unsigned int n_tile = 0; n_tile < sg->n_tiles;
-                       ++n_tile) {
-                    if (sg->sm_list[n_tile]->sm != NULL)
-                      sg->n_occupied++;
-                  }
-                }
+                if (sg != NULL)
+                  update_grid_occupancy(sg);
               }
             }
           }
@@ -36,6 +36,9 @@ static FILE *mcell_log_file = NULL;
 /* Our warning/error file */
 static FILE *mcell_error_file = NULL;
 
+/* Whether mcell_die leaves without running the exit handlers */
+static int mcell_die_without_cleanup = 0;
+
 /* Get the log file. */
 FILE *mcell_get_log_file(void) {
   if (mcell_log_file == NULL) {
@@ -285,4 +288,13 @@ void mcell_allocfailedv(char const *fmt, va_list args) {
 }
 
 /* Terminate program execution due to an error. */
-void mcell_die(void) { exit(EXIT_FAILURE); }
+void mcell_die(void) {
+  if (mcell_die_without_cleanup) {
+    fflush(mcell_get_error_file());
+    _Exit(EXIT_FAILURE);
+  }
+  exit(EXIT_FAILURE);
+}
+
+/* Make mcell_die end the process right away. */
+void mcell_die_immediately(void) { mcell_die_without_cleanup = 1; }
@@ -151,3 +151,8 @@ void mcell_allocfailedv(char const *fmt, va_list args) PRINTF_FORMAT_V(1)
 
 /* Terminate program execution due to an error. */
 void mcell_die(void) __attribute__((noreturn));
+
+/* Make mcell_die end the process right away, without running the exit
+ * handlers or flushing stdio buffers other than the error file.  For forked
+ * copies of the process, which share those with the simulation. */
+void mcell_die_immediately(void);
@@ -48,10 +48,15 @@
 #include "mcell_misc.h"
 #include "mcell_reactions.h"
 #include "dyngeom.h"
+#include "storage_threads.h"
+#include "domain_ranks.h"
+#include "packed_mols.h"
+#include "react_table.h"
 #include "chkpt.h"
 
 //for nfsim initialization 
 #include "nfsim_func.h"
+#include "nfsim_cache.h"
 
 /* simple wrapper for executing the supplied function call. In case
  * of an error returns with MCELL_FAIL and prints out error_message */
@@ -118,6 +123,22 @@ MCELL_STATE *mcell_create() {
       ULONG_MAX; /* Indicates that this value has not been set by user */
   state->seed_seq = 1;
   state->with_checks_flag = 1;
+  state->num_threads = 1;
+  state->num_ranks = 1;
+  state->use_packed_molecules = 0;
+  state->use_wall_bvh = 0;
+  state->use_packed_walls = 0;
+  state->use_huge_pages = 0;
+  state->use_binary_reaction_output = 0;
+  state->use_binary_volume_output = 0;
+  state->use_background_checkpoints = 0;
+  state->adaptive_partition_iterations = 0;
+  state->partition_load = NULL;
+  state->auto_partitions = 0;
+  state->nfsim_cache_file = NULL;
+  state->nfsim_cache_bytes = (size_t)NFSIM_CACHE_DEFAULT_MB << 20;
+  state->nfsim_rules_fingerprint = 0;
+  state->snapshot = NULL;
   state->nfsim_flag = 0; //JJT: NFsim flag
 
   time_t begin_time_of_day;
@@ -143,6 +164,8 @@ MCELL_STATE *mcell_create() {
  ************************************************************************/
 MCELL_STATUS
 mcell_init_state(MCELL_STATE *state) {
+  mem_use_huge_pages(state->use_huge_pages);
+
   CHECKED_CALL(
       init_notifications(state),
       "Unknown error while initializing user-notification data structures.");
@@ -176,6 +199,9 @@ mcell_init_simulation(MCELL_STATE *state) {
 
   CHECKED_CALL(init_species(state), "Error initializing species.");
 
+  CHECKED_CALL(init_bimolecular_table(state),
+               "Error initializing the species-pair reaction table.");
+
   if (has_micro_rev_and_trimol_rxns(state->species_list, state->n_species,
     state->volume_reversibility, state->surface_reversibility)) {
     mcell_error("Tri-molecular reactions can not be combined with microscopic "
@@ -220,6 +246,8 @@ mcell_init_simulation(MCELL_STATE *state) {
   //hashmap where nfsim struct graph_data is stored
   if(state->nfsim_flag){
     initialize_graph_hashmap();
+    CHECKED_CALL(nfsim_cache_init(state),
+                 "Error while reading the NFSim reaction cache.");
   }
 
   return MCELL_SUCCESS;
@@ -383,6 +411,12 @@ mcell_init_output(MCELL_STATE *state) {
   CHECKED_CALL(init_reaction_data(state),
                "Error while initializing reaction data.");
   CHECKED_CALL(init_timers(state), "Error initializing the simulation timers.");
+  CHECKED_CALL(init_packed_molecules(state),
+               "Error initializing the packed molecule lists.");
+  CHECKED_CALL(init_domain_ranks(state),
+               "Error starting the ranks of the distributed run.");
+  CHECKED_CALL(init_storage_threads(state),
+               "Error initializing the storage worker threads.");
 
   // signal successful end of simulation
   state->initialization_state = NULL;
@@ -20,6 +20,7 @@
  * USA.
  *
 ******************************************************************************/
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
@@ -45,36 +46,18 @@
 #include "argparse.h"
 #include "dyngeom.h"
 #include "mcell_run.h"
+#include "storage_threads.h"
+#include "domain_ranks.h"
+#include "repartition.h"
+#include "nfsim_cache.h"
 #include <nfsim_c.h>
 #include "mcell_reactions.h"
 #include "mcell_react_out.h"
+#include "mcell_snapshot.h"
 
 // static helper functions
 static long long mcell_determine_output_frequency(MCELL_STATE *state);
 
-/***********************************************************************
- process_volume_output:
-
-    Produce this round's volume output, if any.
-
-    In:  struct volume *wrld - the world
-         double not_yet - earliest time which should not yet be output
-    Out: none.  volume output files are updated as appropriate.
- ***********************************************************************/
-static void process_volume_output(struct volume *wrld, double not_yet) {
-  struct volume_output_item *vo;
-  for (vo = (struct volume_output_item *)schedule_next(
-           wrld->volume_output_scheduler);
-       vo != NULL || not_yet >= wrld->volume_output_scheduler->now;
-       vo = (struct volume_output_item *)schedule_next(
-           wrld->volume_output_scheduler)) {
-    if (vo == NULL)
-      continue;
-    if (update_volume_output(wrld, vo))
-      mcell_error("Failed to update volume output.");
-  }
-}
-
 /***********************************************************************
  process_reaction_output:
 
@@ -86,18 +69,39 @@ static void process_volume_output(struct volume *wrld, double not_yet) {
  ***********************************************************************/
 static void process_reaction_output(struct volume *wrld, double not_yet) {
   struct output_block *obp;
+  struct output_block **due = NULL;
+  int n_due = 0;
+  int max_due = 0;
   
   for (obp = schedule_next(wrld->count_scheduler);
        obp != NULL || not_yet >= wrld->count_scheduler->now;
        obp = schedule_next(wrld->count_scheduler)) {
     if (obp == NULL)
       continue;
+    if (n_due == max_due) {
+      max_due = (max_due == 0) ? 8 : 2 * max_due;
+      due = (struct output_block **)realloc(
+          due, max_due * sizeof(struct output_block *));
+      if (due == NULL)
+        mcell_allocfailed("Failed to grow list of reaction output blocks.");
+    }
+    due[n_due++] = obp;
+
+    /* The blocks of one time slot are updated together, so that over
+     * several ranks their counters are summed in a single exchange.  The
+     * slot is done when the scheduler would have to advance. */
+    if (wrld->count_scheduler->current != NULL)
+      continue;
     //nfsim observables update
     if(wrld->nfsim_flag)
-      logNFSimObservables_c(wrld->current_iterations * wrld->time_unit, wrld->seed_seq);
-    if (update_reaction_output(wrld, obp))
+      for (int b = 0; b < n_due; b++)
+        logNFSimObservables_c(wrld->current_iterations * wrld->time_unit,
+                              wrld->seed_seq);
+    if (update_reaction_outputs(wrld, due, n_due))
       mcell_error("Failed to update reaction output.");
+    n_due = 0;
   }
+  free(due);
   if (wrld->count_scheduler->error)
     mcell_internal_error("Scheduler reported an out-of-memory error while "
                          "retrieving next scheduled reaction output, but this "
@@ -210,10 +214,30 @@ static int make_checkpoint(struct volume *wrld) {
     return 0;
   }
 
-  /* Make the checkpoint */
-  create_chkpt(wrld, wrld->chkpt_outfile);
+  /* Make the checkpoint.  Only checkpoints after which the simulation goes
+   * on are worth writing in the background. */
+  struct timeval stall_start;
+  gettimeofday(&stall_start, NULL);
+  int cont = (wrld->checkpoint_requested == CHKPT_ITERATIONS_CONT ||
+              wrld->checkpoint_requested == CHKPT_SIGNAL_CONT ||
+              (wrld->checkpoint_requested == CHKPT_ALARM_CONT &&
+               wrld->continue_after_checkpoint));
+  if (cont && wrld->use_background_checkpoints)
+    create_chkpt_in_background(wrld, wrld->chkpt_outfile);
+  else {
+    wait_for_chkpt_writer(wrld, 1);
+    create_chkpt(wrld, wrld->chkpt_outfile);
+  }
   wrld->last_checkpoint_iteration = wrld->current_iterations;
 
+  if (cont && wrld->notify->checkpoint_report != NOTIFY_NONE) {
+    struct timeval stall_end;
+    gettimeofday(&stall_end, NULL);
+    mcell_log("MCell: checkpoint stalled the simulation for %.3f s.",
+              (stall_end.tv_sec - stall_start.tv_sec) +
+                  1e-6 * (stall_end.tv_usec - stall_start.tv_usec));
+  }
+
   /* Break out of the loop, if appropriate */
   if (wrld->checkpoint_requested == CHKPT_ALARM_EXIT ||
       wrld->checkpoint_requested == CHKPT_SIGNAL_EXIT ||
@@ -305,6 +329,40 @@ static int print_molecule_collision_report(
   return 0;
 }
 
+/* Adds the usage of one storage's pool to the totals, unless the previous
+ * storage used the same pool (storages share all of their pools or none). */
+static void add_pool_usage(struct mem_helper *mh, struct mem_helper *prev,
+                           long long *live, long long *peak) {
+  if (mh == NULL || mh == prev)
+    return;
+  long long l, p;
+  mem_usage(mh, &l, &p);
+  *live += l;
+  *peak += p;
+}
+
+static void print_memory_pool_usage(struct volume *world) {
+  long long mol_live = 0, mol_peak = 0;
+  long long smol_live = 0, smol_peak = 0;
+  long long coll_live = 0, coll_peak = 0;
+  struct storage *prev = NULL;
+  for (struct storage_list *stl = world->storage_head; stl != NULL;
+       stl = stl->next) {
+    struct storage *local = stl->store;
+    add_pool_usage(local->mol, prev ? prev->mol : NULL, &mol_live, &mol_peak);
+    add_pool_usage(local->smol, prev ? prev->smol : NULL, &smol_live,
+                   &smol_peak);
+    add_pool_usage(local->coll, prev ? prev->coll : NULL, &coll_live,
+                   &coll_peak);
+    prev = local;
+  }
+  mcell_log("Volume molecules in memory pools: %lld (peak %lld)", mol_live,
+            mol_peak);
+  mcell_log("Surface molecules in memory pools: %lld (peak %lld)", smol_live,
+            smol_peak);
+  mcell_log("Peak number of collision records in use: %lld", coll_peak);
+}
+
 /***********************************************************************
  run_sim:
 
@@ -345,6 +403,8 @@ mcell_run_simulation(MCELL_STATE *world) {
     }
   }
 
+  finish_domain_ranks(world);
+
   if (mcell_flush_data(world)) {
     mcell_error_nodie("Failed to flush reaction and visualization data.");
     status = 1;
@@ -359,12 +419,16 @@ mcell_run_simulation(MCELL_STATE *world) {
     mcell_error_nodie("Failed to print final statistics.");
     status = 1;
   }
+  destroy_storage_threads(world);
+  mcell_free_snapshot(world);
   if(world->nfsim_flag){
     char buffer[1000];
     memset(buffer, 0, 1000*sizeof(char));
     sprintf(buffer, "mdlr_%d.gdat", world->seed_seq);
     //outputNFSimObservablesF_c(buffer);
     outputNFSimObservables_c(world->seed_seq);
+    if (nfsim_cache_save(world))
+      status = 1;
     deleteNFSimSystem_c();
   }
   return status;
@@ -421,7 +485,9 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
     process_geometry_changes(world, not_yet);
 
     /* Release molecules */
+    domain_begin_replicated(world);
     process_molecule_releases(world, not_yet);
+    domain_end_replicated(world);
 
     /* Produce output */
     process_reaction_output(world, not_yet);
@@ -466,6 +532,9 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
       mcell_log_raw("\n");
     }
 
+    /* Report a checkpoint written in the background once it is done */
+    wait_for_chkpt_writer(world, 0);
+
     /* Check for a checkpoint on this iteration */
     if (world->chkpt_iterations && world->current_iterations != world->start_iterations &&
         ((world->current_iterations - world->start_iterations) % world->chkpt_iterations == 0)) {
@@ -487,8 +556,17 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
           "periodic boundary conditions do not currently work with "
           "checkpointing.");
       }
+      /* A rank only holds its slab of the world (see domain_ranks.c), so
+       * checkpoint signals are ignored rather than writing part of it */
+      if (world->ranks != NULL) {
+        mcell_warn("Ignoring the checkpoint request at iteration %lld: "
+                   "checkpoints cannot be written while the world is split "
+                   "across ranks.",
+                   world->current_iterations);
+        world->checkpoint_requested = CHKPT_NOT_REQUESTED;
+      }
       /* Make a checkpoint, exiting the loop if necessary */
-      if (make_checkpoint(world))
+      else if (make_checkpoint(world))
         return 1;
     }
 
@@ -500,7 +578,9 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
   // reset this flag to zero
   *restarted_from_checkpoint = 0;
 
+  domain_begin_replicated(world);
   run_concentration_clamp(world, world->current_iterations);
+  domain_end_replicated(world);
 
   double next_release_time;
   if (!schedule_anticipate(world->releaser, &next_release_time))
@@ -518,16 +598,26 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
 
   while (world->storage_head != NULL &&
          world->storage_head->store->current_time <= not_yet) {
-    int done = 0;
-    while (!done) {
-      done = 1;
-      for (struct storage_list *local = world->storage_head; local != NULL;
-           local = local->next) {
-        if (local->store->timer->current != NULL) {
-          run_timestep(world, local->store, next_barrier,
-                       (double)world->iterations + 1.0);
-          done = 0;
+    if (world->threads != NULL) {
+      run_storages_threaded(world, next_barrier,
+                            (double)world->iterations + 1.0);
+    } else {
+      int done = 0;
+      while (!done) {
+        done = 1;
+        for (struct storage_list *local = world->storage_head; local != NULL;
+             local = local->next) {
+          if (local->store->timer->current != NULL ||
+              local->store->handoff_in != NULL) {
+            resume_handed_off_molecules(world, local->store);
+            run_timestep(world, local->store, next_barrier,
+                         (double)world->iterations + 1.0);
+            done = 0;
+          }
         }
+        /* Molecules crossing over from other ranks need another sweep */
+        if (done)
+          done = !domain_exchange_molecules(world);
       }
     }
 
@@ -543,6 +633,15 @@ mcell_run_iteration(MCELL_STATE *world, long long frequency,
 
   world->current_iterations++;
 
+  if (world->nfsim_flag)
+    nfsim_cache_end_iteration();
+
+  if (adapt_partitions(world))
+    mcell_allocfailed("Failed to move the partitions.");
+
+  if (world->snapshot != NULL && mcell_refresh_snapshot(world))
+    mcell_allocfailed("Failed to take a snapshot of the simulation state.");
+
   return 0;
 }
 
@@ -590,6 +689,7 @@ mcell_flush_data(MCELL_STATE *world) {
       world->current_iterations > world->last_checkpoint_iteration) {
     status = make_checkpoint(world);
   }
+  wait_for_chkpt_writer(world, 1);
 
   emergency_output_hook_enabled = 0;
   int num_errors = flush_reaction_output(world);
@@ -719,15 +819,29 @@ mcell_print_final_statistics(MCELL_STATE *world) {
     if (world->diffusion_number > 0)
       mcell_log("Average diffusion jump was %.2f timesteps\n",
                 world->diffusion_cumtime / (double)world->diffusion_number);
-    mcell_log("Total number of random number use: %lld", rng_uses(world->rng));
+    mcell_log("Total number of random number use: %lld",
+              rng_uses(world->rng) + storage_threads_rng_uses(world) +
+                  domain_rng_uses(world));
     mcell_log("Total number of ray-subvolume intersection tests: %lld",
               world->ray_voxel_tests);
     mcell_log("Total number of ray-polygon intersection tests: %lld",
               world->ray_polygon_tests);
     mcell_log("Total number of ray-polygon intersections: %lld",
               world->ray_polygon_colls);
+    if (world->use_wall_bvh) {
+      long long considered = world->ray_polygon_tests + world->ray_polygon_culls;
+      mcell_log("Total number of ray-polygon tests culled by wall "
+                "hierarchies: %lld (%.1f%%)",
+                world->ray_polygon_culls,
+                (considered > 0)
+                    ? 100.0 * (double)world->ray_polygon_culls / considered
+                    : 0.0);
+    }
     mcell_log("Total number of dynamic geometry molecule displacements: %lld",
               world->dyngeom_molec_displacements);
+    if (world->nfsim_flag)
+      nfsim_cache_report();
+    print_memory_pool_usage(world);
     print_molecule_collision_report(
         world->notify->molecule_collision_report,
         world->vol_vol_colls,
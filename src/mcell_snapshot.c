@@ -0,0 +1,401 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Snapshots of the molecule state and the counters for pyMCell.
+ *
+ * Once snapshots are enabled, the positions, ids and orientations of the
+ * molecules of every species and the current values of all molecule and
+ * reaction counters are copied into flat arrays after each iteration.  The
+ * arrays are exposed to Python through the buffer protocol (see
+ * mcell_snapshot.i), so a controller running the simulation one iteration at
+ * a time can look at the whole state without writing viz output and without
+ * creating a Python object per value.
+ *
+ * The arrays of a species only move when the species outgrows them, and the
+ * counter values only move when counters are added.  An array that is
+ * replaced is not freed but retired until the snapshot is freed at the end
+ * of the simulation (MCellSim.end_sim in Python), so until then a view held
+ * by Python never points at freed memory.  Its contents are those of
+ * the iteration it was last filled in, while a view of a current array
+ * changes with every iteration. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "sym_table.h"
+#include "grid_util.h"
+#include "mcell_snapshot.h"
+
+/*************************************************************************
+retire_buffers:
+  In: snap: snapshot
+      n: number of arrays, at most 3
+      data: arrays of the snapshot that are being replaced, entries may be
+            NULL
+  Out: 0 on success, 1 if out of memory, in which case none of the arrays
+       is retired.  The arrays are kept until the snapshot is freed.
+*************************************************************************/
+static int retire_buffers(struct mcell_snapshot *snap, int n, void **data) {
+  struct retired_buffer *rb[3] = { NULL, NULL, NULL };
+  for (int i = 0; i < n; i++) {
+    if (data[i] == NULL)
+      continue;
+    rb[i] = CHECKED_MALLOC_STRUCT_NODIE(struct retired_buffer,
+                                        "snapshot buffer");
+    if (rb[i] == NULL) {
+      for (int j = 0; j < i; j++)
+        free(rb[j]);
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (rb[i] == NULL)
+      continue;
+    rb[i]->data = data[i];
+    rb[i]->next = snap->retired;
+    snap->retired = rb[i];
+  }
+  return 0;
+}
+
+/*************************************************************************
+grow_species_snapshot:
+  In: snap: snapshot
+      ss: species snapshot
+      n_mols: number of molecules it has to hold
+  Out: 0 on success, 1 if out of memory.  The arrays are replaced by larger
+       ones if they are too small; their contents are not kept.
+*************************************************************************/
+static int grow_species_snapshot(struct mcell_snapshot *snap,
+                                 struct species_snapshot *ss, u_int n_mols) {
+  if (n_mols <= ss->n_alloc)
+    return 0;
+
+  u_int n_alloc = ss->n_alloc ? ss->n_alloc : 64;
+  while (n_alloc < n_mols)
+    n_alloc *= 2;
+
+  double *pos = CHECKED_MALLOC_ARRAY_NODIE(double, 3 * (size_t)n_alloc,
+                                           "molecule positions snapshot");
+  u_long *id =
+      CHECKED_MALLOC_ARRAY_NODIE(u_long, n_alloc, "molecule ids snapshot");
+  short *orient = CHECKED_MALLOC_ARRAY_NODIE(short, n_alloc,
+                                             "molecule orientations snapshot");
+  void *old[3] = { ss->pos, ss->id, ss->orient };
+  if (pos == NULL || id == NULL || orient == NULL ||
+      retire_buffers(snap, 3, old)) {
+    free(pos);
+    free(id);
+    free(orient);
+    return 1;
+  }
+  ss->pos = pos;
+  ss->id = id;
+  ss->orient = orient;
+  ss->n_alloc = n_alloc;
+  return 0;
+}
+
+/*************************************************************************
+snapshot_species:
+  In: state: MCell simulation state
+      spec: species to take the snapshot of
+      ss: where to store it
+  Out: 0 on success, 1 if out of memory
+*************************************************************************/
+static int snapshot_species(MCELL_STATE *state, struct species *spec,
+                            struct species_snapshot *ss) {
+  if (grow_species_snapshot(state->snapshot, ss, spec->n_live_mols))
+    return 1;
+
+  u_int n = 0;
+  for (u_int m = 0; m < spec->n_live_mols; m++) {
+    struct abstract_molecule *am = spec->live_mols[m];
+    struct vector3 where;
+    short orient = 0;
+    if ((am->properties->flags & NOT_FREE) == 0) {
+      where = ((struct volume_molecule *)am)->pos;
+    } else if ((am->properties->flags & ON_GRID) != 0) {
+      struct surface_molecule *sm = (struct surface_molecule *)am;
+      uv2xyz(&sm->s_pos, sm->grid->surface, &where);
+      orient = sm->orient;
+    } else
+      continue;
+
+    ss->pos[3 * n] = where.x * state->length_unit;
+    ss->pos[3 * n + 1] = where.y * state->length_unit;
+    ss->pos[3 * n + 2] = where.z * state->length_unit;
+    ss->id[n] = am->id;
+    ss->orient[n] = orient;
+    n++;
+  }
+  ss->n_mols = n;
+  return 0;
+}
+
+/*************************************************************************
+counter_target_label:
+  In: c: molecule or reaction counter
+  Out: the name of the species or reaction counted, followed by the
+       orientation of the molecules counted (' , or ;), if any, and the
+       periodic box counted in as [x,y,z], if any.  NULL if out of memory.
+       Counters of the same target and region which differ in these get
+       different labels.
+*************************************************************************/
+static char *counter_target_label(struct counter *c) {
+  char const *name;
+  char const *orient = "";
+  if (c->counter_type & MOL_COUNTER) {
+    name = ((struct species *)c->target)->sym->name;
+    if (c->orientation != ORIENT_NOT_SET)
+      orient = (c->orientation > 0) ? "'" : (c->orientation < 0) ? "," : ";";
+  } else
+    name = ((struct rxn_pathname *)c->target)->sym->name;
+
+  if (c->periodic_box == NULL)
+    return CHECKED_SPRINTF_NODIE("%s%s", name, orient);
+  return CHECKED_SPRINTF_NODIE("%s%s[%d,%d,%d]", name, orient,
+                               c->periodic_box->x, c->periodic_box->y,
+                               c->periodic_box->z);
+}
+
+/*************************************************************************
+snapshot_counters:
+  In: state: MCell simulation state
+      snap: snapshot
+  Out: 0 on success, 1 if out of memory.  The molecule and reaction
+       counters in the count hash are listed in hash order together with
+       their current values.  Trigger counters have no value and are left
+       out.
+*************************************************************************/
+static int snapshot_counters(MCELL_STATE *state, struct mcell_snapshot *snap) {
+  int n = 0;
+  for (int i = 0; i <= state->count_hashmask; i++) {
+    for (struct counter *c = state->count_hash[i]; c != NULL; c = c->next) {
+      if (c->counter_type & TRIG_COUNTER)
+        continue;
+
+      if (n == snap->n_counters_alloc) {
+        int n_alloc = snap->n_counters_alloc ? 2 * snap->n_counters_alloc : 64;
+        struct counter **counters = CHECKED_MALLOC_ARRAY_NODIE(
+            struct counter *, n_alloc, "counter snapshot");
+        char **targets =
+            CHECKED_MALLOC_ARRAY_NODIE(char *, n_alloc, "counter snapshot");
+        double *values =
+            CHECKED_MALLOC_ARRAY_NODIE(double, n_alloc, "counter snapshot");
+        void *old = snap->count_values;
+        if (counters == NULL || targets == NULL || values == NULL ||
+            retire_buffers(snap, 1, &old)) {
+          free(counters);
+          free(targets);
+          free(values);
+          return 1;
+        }
+        memset(counters, 0, n_alloc * sizeof(struct counter *));
+        memset(targets, 0, n_alloc * sizeof(char *));
+        if (n > 0) {
+          memcpy(counters, snap->counters, n * sizeof(struct counter *));
+          memcpy(targets, snap->counter_targets, n * sizeof(char *));
+        }
+        free(snap->counters);
+        free(snap->counter_targets);
+        snap->counters = counters;
+        snap->counter_targets = targets;
+        snap->count_values = values;
+        snap->n_counters_alloc = n_alloc;
+      }
+
+      if (snap->counters[n] != c || snap->counter_targets[n] == NULL) {
+        char *target = counter_target_label(c);
+        if (target == NULL)
+          return 1;
+        free(snap->counter_targets[n]);
+        snap->counter_targets[n] = target;
+      }
+      snap->counters[n] = c;
+      if (c->counter_type & MOL_COUNTER)
+        snap->count_values[n] = c->data.move.n_at + c->data.move.n_enclosed;
+      else
+        snap->count_values[n] = c->data.rx.n_rxn_at + c->data.rx.n_rxn_enclosed;
+      n++;
+    }
+  }
+  snap->n_counters = n;
+  return 0;
+}
+
+/*************************************************************************
+mcell_enable_snapshots:
+  In: state: MCell simulation state
+  Out: MCELL_SUCCESS, or MCELL_FAIL if out of memory.  From now on the
+       snapshot is refreshed after every iteration.
+*************************************************************************/
+MCELL_STATUS mcell_enable_snapshots(MCELL_STATE *state) {
+  if (state->snapshot != NULL)
+    return MCELL_SUCCESS;
+
+  struct mcell_snapshot *snap =
+      CHECKED_MALLOC_STRUCT_NODIE(struct mcell_snapshot, "state snapshot");
+  if (snap == NULL)
+    return MCELL_FAIL;
+  memset(snap, 0, sizeof(struct mcell_snapshot));
+  snap->iteration = -1;
+  state->snapshot = snap;
+  return MCELL_SUCCESS;
+}
+
+/*************************************************************************
+mcell_refresh_snapshot:
+  In: state: MCell simulation state
+  Out: MCELL_SUCCESS, or MCELL_FAIL if snapshots are not enabled or memory
+       runs out.  The snapshot is filled in from the current state.
+*************************************************************************/
+MCELL_STATUS mcell_refresh_snapshot(MCELL_STATE *state) {
+  struct mcell_snapshot *snap = state->snapshot;
+  if (snap == NULL)
+    return MCELL_FAIL;
+
+  if (snap->n_species < state->n_species) {
+    struct species_snapshot *species = CHECKED_MALLOC_ARRAY_NODIE(
+        struct species_snapshot, state->n_species, "species snapshots");
+    if (species == NULL)
+      return MCELL_FAIL;
+    memset(species, 0, state->n_species * sizeof(struct species_snapshot));
+    if (snap->n_species > 0)
+      memcpy(species, snap->species,
+             snap->n_species * sizeof(struct species_snapshot));
+    free(snap->species);
+    snap->species = species;
+    snap->n_species = state->n_species;
+  }
+
+  for (int i = 0; i < state->n_species; i++) {
+    struct species *spec = state->species_list[i];
+    if (snapshot_species(state, spec, &snap->species[spec->species_id]))
+      return MCELL_FAIL;
+  }
+
+  if (snapshot_counters(state, snap))
+    return MCELL_FAIL;
+
+  snap->iteration = state->current_iterations;
+  return MCELL_SUCCESS;
+}
+
+/*************************************************************************
+mcell_free_snapshot:
+  In: state: MCell simulation state
+  Out: None.  Snapshots are disabled and their memory is released, so views
+       of the arrays must not be used afterwards.
+*************************************************************************/
+void mcell_free_snapshot(MCELL_STATE *state) {
+  struct mcell_snapshot *snap = state->snapshot;
+  if (snap == NULL)
+    return;
+
+  for (int i = 0; i < snap->n_species; i++) {
+    free(snap->species[i].pos);
+    free(snap->species[i].id);
+    free(snap->species[i].orient);
+  }
+  free(snap->species);
+  for (int i = 0; i < snap->n_counters_alloc; i++)
+    free(snap->counter_targets[i]);
+  free(snap->counter_targets);
+  free(snap->counters);
+  free(snap->count_values);
+  while (snap->retired != NULL) {
+    struct retired_buffer *rb = snap->retired;
+    snap->retired = rb->next;
+    free(rb->data);
+    free(rb);
+  }
+  free(snap);
+  state->snapshot = NULL;
+}
+
+/*************************************************************************
+mcell_get_species_snapshot:
+  In: state: MCell simulation state
+      species_name: name of the species
+  Out: the snapshot of the species, or NULL if there is no such species or
+       no snapshot has been taken yet
+*************************************************************************/
+struct species_snapshot *mcell_get_species_snapshot(MCELL_STATE *state,
+                                                    const char *species_name) {
+  struct mcell_snapshot *snap = state->snapshot;
+  if (snap == NULL || snap->iteration < 0)
+    return NULL;
+
+  struct sym_entry *sym = retrieve_sym(species_name, state->mol_sym_table);
+  if (sym == NULL)
+    return NULL;
+
+  struct species *spec = (struct species *)sym->value;
+  if (spec->species_id >= (u_int)snap->n_species)
+    return NULL;
+  return &snap->species[spec->species_id];
+}
+
+/*************************************************************************
+mcell_get_snapshot_counter_count:
+  In: state: MCell simulation state
+  Out: number of counters in the snapshot
+*************************************************************************/
+int mcell_get_snapshot_counter_count(MCELL_STATE *state) {
+  if (state->snapshot == NULL)
+    return 0;
+  return state->snapshot->n_counters;
+}
+
+/*************************************************************************
+mcell_get_snapshot_counter_target:
+  In: state: MCell simulation state
+      index: index of the counter in the snapshot
+  Out: name of the species or reaction counted, with the orientation and
+       periodic box counted if the counter has them (see
+       counter_target_label), or NULL if there is no such counter
+*************************************************************************/
+const char *mcell_get_snapshot_counter_target(MCELL_STATE *state, int index) {
+  if (index < 0 || index >= mcell_get_snapshot_counter_count(state))
+    return NULL;
+
+  return state->snapshot->counter_targets[index];
+}
+
+/*************************************************************************
+mcell_get_snapshot_counter_region:
+  In: state: MCell simulation state
+      index: index of the counter in the snapshot
+  Out: name of the region counted on, or NULL if there is no such counter
+*************************************************************************/
+const char *mcell_get_snapshot_counter_region(MCELL_STATE *state, int index) {
+  if (index < 0 || index >= mcell_get_snapshot_counter_count(state))
+    return NULL;
+
+  return state->snapshot->counters[index]->reg_type->sym->name;
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_init.h"
+
+/* Molecule state of one species as of the last refresh */
+struct species_snapshot {
+  u_int n_mols;    /* Number of molecules of the species */
+  u_int n_alloc;   /* Number of molecules the arrays have room for */
+  double *pos;     /* x, y, z of each molecule, in microns */
+  u_long *id;      /* Unique id of each molecule */
+  short *orient;   /* Orientation of each molecule, 0 for volume molecules */
+};
+
+/* An array that has been replaced by a larger one.  It is kept until the
+   snapshot is freed, since Python may still hold a view of it. */
+struct retired_buffer {
+  struct retired_buffer *next;
+  void *data;
+};
+
+/* Arrays that are filled after every iteration so that they can be shared
+   with Python without copying (see mcell_snapshot.c) */
+struct mcell_snapshot {
+  long long iteration;               /* Iteration of the last refresh, or -1 */
+  int n_species;                     /* Number of species snapshots */
+  struct species_snapshot *species;  /* Indexed by species_id */
+  int n_counters;                    /* Number of counters */
+  int n_counters_alloc;              /* Room in counters and count_values */
+  struct counter **counters;         /* Molecule and reaction counters */
+  char **counter_targets;            /* Label of what each counter counts */
+  double *count_values;              /* Current value of each counter */
+  struct retired_buffer *retired;    /* Replaced arrays, freed with snap */
+};
+
+MCELL_STATUS mcell_enable_snapshots(MCELL_STATE *state);
+
+MCELL_STATUS mcell_refresh_snapshot(MCELL_STATE *state);
+
+void mcell_free_snapshot(MCELL_STATE *state);
+
+struct species_snapshot *mcell_get_species_snapshot(MCELL_STATE *state,
+                                                    const char *species_name);
+
+int mcell_get_snapshot_counter_count(MCELL_STATE *state);
+
+const char *mcell_get_snapshot_counter_target(MCELL_STATE *state, int index);
+
+const char *mcell_get_snapshot_counter_region(MCELL_STATE *state, int index);
@@ -0,0 +1,82 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+MCELL_STATUS mcell_enable_snapshots(MCELL_STATE *state);
+
+MCELL_STATUS mcell_refresh_snapshot(MCELL_STATE *state);
+
+void mcell_free_snapshot(MCELL_STATE *state);
+
+int mcell_get_snapshot_counter_count(MCELL_STATE *state);
+
+const char *mcell_get_snapshot_counter_target(MCELL_STATE *state, int index);
+
+const char *mcell_get_snapshot_counter_region(MCELL_STATE *state, int index);
+
+// The snapshot arrays are handed to Python as read-only memoryviews of the
+// C arrays, so nothing is copied. Arrays that are replaced are kept until
+// mcell_free_snapshot, so a view stays readable until then, but the values
+// it shows are overwritten by the following iterations.
+%{
+static PyObject *snapshot_view(void *data, Py_ssize_t size) {
+  static char empty[1];
+  if (data == NULL || size == 0)
+    return PyMemoryView_FromMemory(empty, 0, PyBUF_READ);
+  return PyMemoryView_FromMemory((char *)data, size, PyBUF_READ);
+}
+%}
+
+%inline %{
+
+/* x, y, z of each molecule of a species, as doubles */
+PyObject *mcell_snapshot_positions(MCELL_STATE *state, const char *name) {
+  struct species_snapshot *ss = mcell_get_species_snapshot(state, name);
+  if (ss == NULL)
+    return snapshot_view(NULL, 0);
+  return snapshot_view(ss->pos, 3 * (Py_ssize_t)ss->n_mols * sizeof(double));
+}
+
+/* id of each molecule of a species, as unsigned longs */
+PyObject *mcell_snapshot_ids(MCELL_STATE *state, const char *name) {
+  struct species_snapshot *ss = mcell_get_species_snapshot(state, name);
+  if (ss == NULL)
+    return snapshot_view(NULL, 0);
+  return snapshot_view(ss->id, (Py_ssize_t)ss->n_mols * sizeof(u_long));
+}
+
+/* orientation of each molecule of a species, as shorts */
+PyObject *mcell_snapshot_orientations(MCELL_STATE *state, const char *name) {
+  struct species_snapshot *ss = mcell_get_species_snapshot(state, name);
+  if (ss == NULL)
+    return snapshot_view(NULL, 0);
+  return snapshot_view(ss->orient, (Py_ssize_t)ss->n_mols * sizeof(short));
+}
+
+/* value of each counter, as doubles */
+PyObject *mcell_snapshot_counts(MCELL_STATE *state) {
+  if (state->snapshot == NULL)
+    return snapshot_view(NULL, 0);
+  return snapshot_view(state->snapshot->count_values,
+                       state->snapshot->n_counters * sizeof(double));
+}
+%}
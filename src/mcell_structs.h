@@ -595,6 +595,15 @@ struct per_species_list {
 
   //JJT: nfsim related fields
   struct graph_data* graph_data;
+
+  /* Contiguous copy of the list, kept only in storages with
+   * packed_molecules set (see packed_mols.c).  Slot i holds molecule
+   * packed_mol[i], its position and its index. */
+  int n_packed;
+  int max_packed;
+  struct volume_molecule **packed_mol;
+  struct vector3 *packed_pos;
+  int *packed_index;
 };
 
 /* Properties of one type of molecule or surface */
@@ -609,6 +618,18 @@ struct species {
 
   u_int population; /* How many of this species exist? */
 
+  /* Every molecule of this species that exists, in no particular order (see
+   * mol_index.c).  Each molecule knows its slot in index_slot. */
+  struct abstract_molecule **live_mols;
+  u_int n_live_mols;
+  u_int live_mols_alloc;
+
+  /* Reactions with each other species, by species_id, from the species-pair
+   * table (see react_table.c).  Partners with ids of bimol_row_len and above
+   * aren't covered by the table. */
+  struct rxn ***bimol_rxns;
+  u_int bimol_row_len;
+
   double D;               /* Diffusion constant */
   double space_step;      /* Characteristic step length */
   double time_step;       /* Minimum (maximum?) sensible timestep */
@@ -763,14 +784,13 @@ struct abstract_molecule {
   struct periodic_image* periodic_box;  /* track the periodic box a molecule is in */
 
   /* structs used by the nfsim integration */
-  struct graph_data* graph_data; /* nfsim graph structure data */
-  u_int (*get_flags)(void *); /* returns the reactivity flags associated with this particle */
-  double (*get_diffusion)(void *);        /* returns the diffusion value */
-  double (*get_time_step)(void *);        /* function pointer to a method that returns the time step */
-  double (*get_space_step)(void *);       /* function pointer to a method that returns the space step */
+  struct graph_data* graph_data; /* nfsim graph structure data; read it
+                                    through mol_diffusion and friends
+                                    (nfsim_func.h) */
   /* end structs used by the nfsim integration */
   char *mesh_name;                // Name of mesh that molecule is either in
                                   // (volume molecule) or on (surface molecule)
+  u_int index_slot; /* Slot in the species' index of live molecules */
 };
 
 /* Volume molecules: freely diffusing or fixed in solution */
@@ -786,12 +806,9 @@ struct volume_molecule {
   struct periodic_image* periodic_box;  /* track the periodic box a molecule is in */
 
   struct graph_data* graph_data;
-  u_int (*get_flags)(void *); /* returns the reactivity flags associated with this particle */
-  double (*get_diffusion)(void *);        /* returns the diffusion value */
-  double (*get_time_step)(void *);        /* returns the diffusion value */
-  double (*get_space_step)(void *);        /* returns the diffusion value */
 
   char *mesh_name;                // Name of mesh that the molecule is in
+  u_int index_slot;
   struct vector3 pos;       /* Position in space */
   struct subvolume *subvol; /* Partition we are in */
 
@@ -800,6 +817,8 @@ struct volume_molecule {
 
   struct volume_molecule **prev_v; /* Previous molecule in this subvolume */
   struct volume_molecule *next_v;  /* Next molecule in this subvolume */
+  int packed_slot; /* Slot in the packed copy of the per-species list */
+  struct per_species_list *packed_list; /* List that slot belongs to */
 };
 
 /* Fixed molecule on a grid on a surface */
@@ -815,12 +834,9 @@ struct surface_molecule {
   struct periodic_image* periodic_box;  /* track the periodic box a molecule is in */
 
   struct graph_data* graph_data;
-  u_int (*get_flags)(void *); /* returns the reactivity flags associated with this particle */
-  double (*get_diffusion)(void *);        /* returns the diffusion value */
-  double (*get_time_step)(void *);        /* returns the diffusion value */
-  double (*get_space_step)(void *);        /* returns the diffusion value */
 
   char *mesh_name;                // Name of mesh that the molecule is on 
+  u_int index_slot;
   unsigned int grid_index;   /* Which gridpoint do we occupy? */
   short orient;              /* Which way do we point? */
   struct surface_grid *grid; /* Our grid (which tells us our surface) */
@@ -943,6 +959,17 @@ struct surface_grid {
   /* Array of pointers to surface_molecule_list for each tile */
   struct surface_molecule_list **sm_list; 
 
+  /* Compact mirror of sm_list for scans over neighboring tiles, kept up to
+   * date by update_tile_occupancy: one bit per tile, set if the tile holds a
+   * surface molecule, and the species_id+1 of that molecule (0 if empty or
+   * not known) */
+  u_int *occupancy;
+  u_int *tile_species;
+
+  /* Neighbors of the tiles on the border of the grid, built when first
+   * needed (see get_neighbor_tiles), or NULL */
+  struct tile_nbr_table *nbr_table;
+
   struct subvolume *subvol; /* Best match for which subvolume we're in */
   struct wall *surface;     /* The wall that we are in */
 };
@@ -961,6 +988,18 @@ struct waypoint {
   struct region_list *regions; /* We are inside these regions */
   struct region_list *
   antiregions; /* We are outside of (but hit) these regions */
+
+  /* The lists above in reverse, and sorted by address, as counts read them
+   * (see count_region_from_scratch).  Built if cached is set.  A count at a
+   * point no counted wall separates from the waypoint reads them instead of
+   * copies; uniform is set if that holds for the whole subvolume, which
+   * then needs no raytracing either. */
+  int cached;
+  int uniform;
+  struct region_list *rev_regions;
+  struct region_list *rev_antiregions;
+  struct region_list *sorted_regions;
+  struct region_list *sorted_antiregions;
 };
 
 /* Contains local memory and scheduler for molecules, walls, wall_lists, etc. */
@@ -986,6 +1025,18 @@ struct storage {
   struct schedule_helper *timer; /* Local scheduler */
   double current_time;           /* Local time */
   double max_timestep;           /* Local maximum timestep */
+
+  /* The following are only used when storages run on worker threads or
+   * the world is split across ranks */
+  struct volume *world_view;       /* Private copy of the world (own RNG and
+                                      statistics counters) */
+  struct mem_helper *handoff;      /* Hand-off records */
+  struct mol_handoff *handoff_out; /* Molecules leaving this storage */
+  struct mol_handoff *handoff_in;  /* Molecules entering this storage */
+  int color; /* Storages of the same color are never adjacent */
+  struct rng_state *rng; /* Private random number stream, or NULL */
+
+  int packed_molecules; /* Keep packed copies of the per-species lists */
 };
 
 /* Linked list of storage areas. */
@@ -997,6 +1048,8 @@ struct storage_list {
 /* Walls and molecules in a spatial subvolume */
 struct subvolume {
   struct wall_list *wall_head; /* Head of linked list of intersecting walls */
+  struct wall_bvh *wall_bvh;   /* Hierarchy over those walls, or NULL */
+  struct packed_walls *packed_walls; /* Their planes, packed, or NULL */
 
   struct pointer_hash mol_by_species; /* table of species->molecule list */
   struct per_species_list *species_head;
@@ -1064,6 +1117,19 @@ struct counter {
                               reference data.move for move counter
                               reference data.rx for rxn counter
                               reference data.trig for trigger */
+  int shard_index; /* Slot of this counter in count shards */
+};
+
+/* Changes to the (non-trigger) counters made by one storage running on a
+ * worker thread.  They are added to the counters by the main thread after
+ * each round of storages (see storage_threads.c and count_util.c). */
+struct count_shard {
+  int n_counters;
+  struct counter **counters; /* All counters, by shard_index (shared) */
+  union counter_data *delta; /* Change of each counter */
+  byte *touched;             /* Whether delta[i] may be nonzero */
+  int *touched_list;         /* Indices of touched counters */
+  int n_touched;
 };
 
 enum magic_types {
@@ -1186,6 +1252,31 @@ struct volume {
   struct mem_helper *storage_allocator; /* Memory for storage list */
   struct storage_list *storage_head;    /* Linked list of all local
                                            memory/schedulers */
+  int num_threads; /* Number of threads used to run the storages */
+  struct storage_threads *threads; /* Worker threads, NULL if serial */
+  struct count_shard *count_shard; /* Where a storage's view accumulates its
+                                      counts, NULL in the world itself */
+  int num_ranks; /* Number of ranks the world is split across */
+  struct domain_ranks *ranks; /* Distributed run state, NULL if one rank */
+  int use_packed_molecules; /* Scan packed per-species molecule lists */
+  int use_wall_bvh; /* Cull ray-wall tests with per-subvolume hierarchies */
+  int use_packed_walls; /* Test displacements against packed wall planes */
+  int use_huge_pages; /* Back large memory pool blocks with huge pages */
+  int use_binary_reaction_output; /* Write reaction data files in binary */
+  int use_binary_volume_output; /* Write nonzero voxels of volume output in
+                                   binary */
+  int use_background_checkpoints; /* Write checkpoints from a forked copy */
+  int adaptive_partition_iterations; /* Iterations over which to sample the
+                                        load before moving the partitions, 0
+                                        if they stay put (see repartition.c) */
+  struct partition_load *partition_load; /* Load sampled so far, or NULL */
+  int auto_partitions; /* Partitions were placed by set_auto_partitions */
+  char *nfsim_cache_file; /* Where NFSim query results are kept between runs */
+  size_t nfsim_cache_bytes; /* Memory bound of the NFSim reaction cache */
+  unsigned long nfsim_rules_fingerprint; /* Checksum of the NFSim rules */
+  struct mcell_snapshot *snapshot; /* State copied out after every iteration
+                                      for pyMCell, or NULL (see
+                                      mcell_snapshot.c) */
 
   u_long current_mol_id; /* next unique molecule id to use*/
 
@@ -1225,6 +1316,7 @@ struct volume {
   trig_request_mem; /* Memory to store listeners for trigger events */
   struct mem_helper *magic_mem; /* Memory used to store magic lists for
                                    reaction-triggered releases and such */
+  struct mem_helper *periodic_image_mem; /* Periodic images of molecules */
   double elapsed_time; /* Used for concentration measurement */
 
   /* Visualization state */
@@ -1293,6 +1385,8 @@ struct volume {
                                   we performed */
   long long ray_polygon_colls; /* How many ray-polygon intersections have
                                   occured */
+  long long ray_polygon_culls; /* How many ray-polygon tests the wall
+                                  hierarchies have saved */
   long long dyngeom_molec_displacements; /* Total number of dynamic geometry
                                             molecule displacements */
   /* below "vol" means volume molecule, "surf" means surface molecule */
@@ -1376,6 +1470,8 @@ struct volume {
   continue_after_checkpoint; /* 0: exit after chkpt, 1: continue after chkpt */
   long long
   last_checkpoint_iteration;  /* Last iteration when chkpt was created */
+  pid_t chkpt_writer_pid; /* Process writing a checkpoint, 0 if none */
+  struct timeval chkpt_writer_start; /* When that process was started */
   time_t begin_timestamp;     /* Time since epoch at beginning of 'main' */
   char *initialization_state; /* NULL after initialization completes */
   struct reaction_flags rxn_flags;
@@ -1399,6 +1495,22 @@ struct volume {
   struct pointer_hash *species_mesh_transp; 
 };
 
+/* A volume molecule that crossed into a storage run by another worker
+ * thread, parked on the boundary together with the rest of its step. */
+struct mol_handoff {
+  struct mol_handoff *next;
+  struct volume_molecule *vm; /* The molecule, still in its old subvolume */
+  struct subvolume *dest;     /* Subvolume the molecule is entering */
+  struct vector3 displacement;  /* Remaining displacement */
+  struct vector3 displacement2; /* Displacement after unbinding (inert) */
+  double t_steps;       /* Remaining time of the step */
+  double rate_factor;   /* Rate scaling factors of the step */
+  double r_rate_factor;
+  double t_start;       /* Time at which the step started */
+  int inertness;
+  int redo_expand_collision_list_flag;
+};
+
 /* Data structure to store information about collisions. */
 struct collision {
   struct collision *next;
@@ -1659,6 +1771,9 @@ struct volume_output_item {
   int num_times;
   double *times;     /* in numeric order  */
   double *next_time; /* points into times */
+
+  struct voxel_counts *counts; /* Voxels holding molecules at the current
+                                  output time (see volume_output.c) */
 };
 
 /* Data for a single REACTION_DATA_OUTPUT block */
@@ -36,6 +36,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 #include "strfunc.h"
 #include "logging.h"
@@ -314,6 +317,67 @@ void mem_dump_stats(FILE *out) {
 
 #endif
 
+/* Blocks of at least this many bytes are aligned to, and advised to be
+   backed by, huge pages once mem_use_huge_pages has been called. */
+#define MEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Largest block a growing pool asks for at once when using huge pages */
+#define MEM_MAX_BLOCK_SIZE (16 * MEM_HUGE_PAGE_SIZE)
+
+static int mem_huge_pages = 0;
+
+/*************************************************************************
+mem_use_huge_pages:
+   In: 1 to back large blocks with huge pages, 0 not to
+   Out: No return value.  Only affects blocks allocated afterwards.  With
+        huge pages, each block a pool adds when it runs full is twice as
+        large as the previous one, so that busy pools soon reach blocks
+        spanning several huge pages.
+   Note: The pages are transparent huge pages (madvise), which need no
+         pages reserved by the administrator; where they are unavailable
+         the blocks are plain memory.
+*************************************************************************/
+
+void mem_use_huge_pages(int enable) { mem_huge_pages = enable; }
+
+/*************************************************************************
+alloc_block:
+   In: Size of the block in bytes
+   Out: Pointer to the block, to be released with free, or NULL if out of
+        memory.
+*************************************************************************/
+
+static unsigned char *alloc_block(size_t size) {
+  if (!mem_huge_pages || size < MEM_HUGE_PAGE_SIZE)
+    return (unsigned char *)Malloc(size);
+
+  void *block;
+  if (posix_memalign(&block, MEM_HUGE_PAGE_SIZE, size) != 0)
+    return NULL;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  /* Only whole huge pages can be advised; madvise failing is harmless */
+  size_t whole = size & ~((size_t)MEM_HUGE_PAGE_SIZE - 1);
+  madvise(block, whole, MADV_HUGEPAGE);
+#endif
+  return (unsigned char *)block;
+}
+
+/*************************************************************************
+next_block_length:
+   In: A mem_helper whose block is full
+   Out: Number of records for the block it adds next.
+*************************************************************************/
+
+static int next_block_length(struct mem_helper *mh) {
+  if (!mem_huge_pages)
+    return mh->buf_len;
+
+  size_t max_len = MEM_MAX_BLOCK_SIZE / mh->record_size;
+  if ((size_t)mh->buf_len >= max_len / 2)
+    return ((size_t)mh->buf_len > max_len) ? mh->buf_len : (int)max_len;
+  return 2 * mh->buf_len;
+}
+
 /*************************************************************************
 create_mem_named:
    In: Size of a single element (including the leading "next" pointer)
@@ -335,6 +399,8 @@ struct mem_helper *create_mem_named(size_t size, int length, char const *name) {
   mh->buf_index = 0;
   mh->defunct = NULL;
   mh->next_helper = NULL;
+  mh->live = 0;
+  mh->peak = 0;
 
 #ifndef MEM_UTIL_NO_POOLING
 #ifdef MEM_UTIL_TRACK_FREED
@@ -342,7 +408,7 @@ struct mem_helper *create_mem_named(size_t size, int length, char const *name) {
       (unsigned char *)Malloc(mh->buf_len * (mh->record_size + sizeof(int)));
   memset(mh->heap_array, 0, mh->buf_len * (mh->record_size + sizeof(int)));
 #else
-  mh->heap_array = (unsigned char *)Malloc(mh->buf_len * mh->record_size);
+  mh->heap_array = alloc_block(mh->buf_len * mh->record_size);
 #endif
 
   if (mh->heap_array == NULL) {
@@ -392,6 +458,8 @@ mem_get:
 *************************************************************************/
 
 void *mem_get(struct mem_helper *mh) {
+  if (++mh->live > mh->peak)
+    mh->peak = mh->live;
 #ifdef MEM_UTIL_NO_POOLING
   return malloc(mh->record_size);
 #else
@@ -468,18 +536,21 @@ void *mem_get(struct mem_helper *mh) {
   } else {
     struct mem_helper *mhnext;
     unsigned char *temp;
+    int length = next_block_length(mh);
 #ifdef MEM_UTIL_KEEP_STATS
     struct mem_stats *s = mh->stats;
-    mhnext = create_mem_named(mh->record_size, mh->buf_len, s->name);
+    mhnext = create_mem_named(mh->record_size, length, s->name);
     ++s->non_head_arenas;
     if (s->non_head_arenas > s->max_non_head_arenas)
       s->max_non_head_arenas = s->non_head_arenas;
     ++s->total_non_head_arenas;
 #else
-    mhnext = create_mem(mh->record_size, mh->buf_len);
+    mhnext = create_mem(mh->record_size, length);
 #endif
-    if (mhnext == NULL)
+    if (mhnext == NULL) {
+      --mh->live;
       return NULL;
+    }
 
     /* Swap contents of this mem_helper with new one */
     /* Keeps mh at top of list but with freshly allocated space */
@@ -488,9 +559,12 @@ void *mem_get(struct mem_helper *mh) {
     mhnext->heap_array = mh->heap_array;
     mh->heap_array = temp;
     mhnext->buf_index = mh->buf_index;
+    mhnext->buf_len = mh->buf_len;
+    mh->buf_len = length;
     mh->next_helper = mhnext;
 
     mh->buf_index = 0;
+    --mh->live; /* counted again by the call below */
     return mem_get(mh);
   }
 #endif
@@ -506,6 +580,7 @@ mem_put:
 *************************************************************************/
 
 void mem_put(struct mem_helper *mh, void *defunct) {
+  --mh->live;
 #ifdef MEM_UTIL_NO_POOLING
   free(defunct);
   return;
@@ -555,6 +630,7 @@ void mem_put_list(struct mem_helper *mh, void *defunct) {
   for (alp = data; alp != NULL; alp = alpNext) {
     alpNext = alp->next;
     free(alp);
+    --mh->live;
   }
 #else
 #ifdef MEM_UTIL_ZERO_FREED
@@ -574,10 +650,11 @@ void mem_put_list(struct mem_helper *mh, void *defunct) {
     ptr[-1] = 0;
   }
 #endif
-#ifdef MEM_UTIL_KEEP_STATS
   int count = 1;
   for (alp = data; alp->next != NULL; alp = alp->next)
     ++count;
+  mh->live -= count;
+#ifdef MEM_UTIL_KEEP_STATS
   struct mem_stats *s = mh->stats;
   s->cur_free += count;
   s->cur_alloc -= count;
@@ -587,9 +664,6 @@ void mem_put_list(struct mem_helper *mh, void *defunct) {
   if ((mem_cur_overall_wastage += mh->record_size * count) >
       mem_max_overall_wastage)
     mem_max_overall_wastage = mem_cur_overall_wastage;
-#else
-  for (alp = data; alp->next != NULL; alp = alp->next) {
-  }
 #endif
 
   alp->next = mh->defunct;
@@ -629,3 +703,55 @@ void delete_mem(struct mem_helper *mh) {
 #endif
   free(mh);
 }
+
+/*************************************************************************
+mem_usage:
+   In: A mem_helper
+       Where to put the number of records in use
+       Where to put the largest number of records in use at any one time
+   Out: No return value.
+   Note: Records are counted as in use from mem_get until they are put back
+         into the same mem_helper (or it is reclaimed), so the figures are
+         only meaningful for helpers whose records are not put elsewhere.
+*************************************************************************/
+
+void mem_usage(struct mem_helper *mh, long long *live, long long *peak) {
+  *live = mh->live;
+  *peak = mh->peak;
+}
+
+#if MEM_UTIL_BULK_RECLAIM
+/*************************************************************************
+mem_reclaim_all:
+   In: A mem_helper none of whose records are in use any more
+   Out: No return value.  Every record is available again, as if it had
+        been put back.  If the helper had grown beyond its first block, the
+        blocks are replaced by one block as large as all of them, so that
+        the next time as many records fit without growing.
+   Note: This is much cheaper than putting back lists of records, but any
+         record still referenced afterwards will be handed out again.
+*************************************************************************/
+
+void mem_reclaim_all(struct mem_helper *mh) {
+  mh->buf_index = 0;
+  mh->defunct = NULL;
+  mh->live = 0;
+  if (mh->next_helper == NULL)
+    return;
+
+  int length = mh->buf_len;
+  for (struct mem_helper *mhp = mh->next_helper; mhp != NULL;
+       mhp = mhp->next_helper)
+    length += mhp->buf_len;
+
+  /* Keep the current block if a single large one can't be had */
+  unsigned char *merged = alloc_block(length * mh->record_size);
+  delete_mem(mh->next_helper);
+  mh->next_helper = NULL;
+  if (merged != NULL) {
+    free(mh->heap_array);
+    mh->heap_array = merged;
+    mh->buf_len = length;
+  }
+}
+#endif
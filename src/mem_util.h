@@ -91,6 +91,8 @@ struct mem_helper {
   struct abstract_list *defunct; /* Linked list of elements that may be reused
                                     for next memory request */
   struct mem_helper *next_helper; /* Next (fully-used) mem_helper */
+  long long live;                 /* Records handed out and not put back */
+  long long peak;                 /* Largest value "live" has reached */
 #ifdef MEM_UTIL_KEEP_STATS
   struct mem_stats *stats;
 #endif
@@ -110,5 +112,17 @@ void *mem_get(struct mem_helper *mh);
 void mem_put(struct mem_helper *mh, void *defunct);
 void mem_put_list(struct mem_helper *mh, void *defunct);
 void delete_mem(struct mem_helper *mh);
+void mem_usage(struct mem_helper *mh, long long *live, long long *peak);
+void mem_use_huge_pages(int enable);
+
+/* Bulk reclaim takes back whole blocks, so it is only available when the
+   records live in the helper's blocks and nothing tracks them one by one */
+#if defined(MEM_UTIL_NO_POOLING) || defined(MEM_UTIL_TRACK_FREED) ||          \
+    defined(MEM_UTIL_KEEP_STATS)
+#define MEM_UTIL_BULK_RECLAIM 0
+#else
+#define MEM_UTIL_BULK_RECLAIM 1
+void mem_reclaim_all(struct mem_helper *mh);
+#endif
 
 #define stack_nonempty(sh) ((sh)->index > 0 || (sh)->next != NULL)
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Index of the molecules of each species that exist.
+ *
+ * Output and geometry code that needs all molecules of a species (viz
+ * output, saving molecules for dynamic geometry) used to walk every
+ * scheduler of every storage and pick them out.  Instead each species keeps
+ * an array of its live molecules.  A molecule is added where the
+ * population of its species goes up and removed where it goes down; the
+ * slot emptied by a removal is filled from the last slot, so a molecule's
+ * slot (index_slot) stays valid for as long as it exists.
+ *
+ * The populations are shared by all storages, and are only changed on the
+ * main thread or while holding SHARED_STATE_LOCK (see storage_threads.c);
+ * the same goes for the index. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "mol_index.h"
+
+/*************************************************************************
+mol_index_add:
+  In: am: a molecule whose species' population has just been incremented
+  Out: No return value.  The molecule is added to the index of its species.
+*************************************************************************/
+void mol_index_add(struct abstract_molecule *am) {
+  struct species *spec = am->properties;
+  if (spec->n_live_mols == spec->live_mols_alloc) {
+    spec->live_mols_alloc =
+        (spec->live_mols_alloc < 16) ? 16 : 2 * spec->live_mols_alloc;
+    spec->live_mols = (struct abstract_molecule **)realloc(
+        spec->live_mols,
+        spec->live_mols_alloc * sizeof(struct abstract_molecule *));
+    if (spec->live_mols == NULL)
+      mcell_allocfailed("Failed to grow index of live molecules.");
+  }
+
+  am->index_slot = spec->n_live_mols++;
+  spec->live_mols[am->index_slot] = am;
+}
+
+/*************************************************************************
+mol_index_remove:
+  In: spec: species the molecule was counted as
+      am: a molecule whose species' population has just been decremented
+  Out: No return value.  The molecule's slot is taken over by the molecule
+       in the last slot.
+*************************************************************************/
+void mol_index_remove(struct species *spec, struct abstract_molecule *am) {
+  u_int slot = am->index_slot;
+  if (slot >= spec->n_live_mols || spec->live_mols[slot] != am)
+    mcell_internal_error("Molecule of species '%s' is missing from the index "
+                         "of live molecules.",
+                         spec->sym->name);
+
+  u_int last = --spec->n_live_mols;
+  if (slot != last) {
+    spec->live_mols[slot] = spec->live_mols[last];
+    spec->live_mols[slot]->index_slot = slot;
+  }
+}
+
+/*************************************************************************
+mol_index_moved:
+  In: am: a copy of a molecule in the index, which takes the place of the
+          original (e.g. after migrating into another storage)
+  Out: No return value.  The copy's slot now refers to the copy.
+*************************************************************************/
+void mol_index_moved(struct abstract_molecule *am) {
+  am->properties->live_mols[am->index_slot] = am;
+}
@@ -0,0 +1,650 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Cache of NFSim reaction queries.
+ *
+ * Rule-based species have no reactions until NFSim is asked which rules
+ * apply to their graph patterns, and asking is slow.  The answers are kept
+ * here, keyed on the reactant patterns themselves (in order, since the
+ * reaction built from an answer lists its reactants in that order), so that
+ * different pairs never share an entry even if their hashes collide.
+ *
+ * The cache holds at most world->nfsim_cache_bytes of entries (roughly
+ * counted) and drops the least recently used ones beyond that.  The
+ * reactions of dropped entries may still be in use by whoever asked for
+ * them during this iteration, so they are freed once it is over.
+ *
+ * With -nfsim_cache, the answers are read from a file when the simulation
+ * starts and written back when it ends, so a run of the same rules starts
+ * with what the previous one found out.  The file starts with a checksum of
+ * the rules file, and is ignored if the rules have changed. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "map_c.h"
+#include "mcell_structs.h"
+#include "mem_util.h"
+#include "nfsim_cache.h"
+#include "react.h"
+
+#define NFSIM_CACHE_MAGIC "MCELL_NFSIM_CACHE"
+#define NFSIM_CACHE_VERSION 1
+
+/* Initial number of hash buckets (a power of two) */
+#define NFSIM_CACHE_BUCKETS 1024
+
+struct nfsim_cache {
+  struct nfsim_cache_entry **buckets;
+  unsigned long n_buckets;
+  unsigned long n_entries;
+  struct nfsim_cache_entry *lru_head; /* Most recently used */
+  struct nfsim_cache_entry *lru_tail; /* Least recently used */
+  size_t bytes;
+  size_t max_bytes; /* 0 if there is no limit */
+  struct rxn **retired; /* Reactions of dropped entries */
+  int n_retired;
+  int max_retired;
+  long long hits;
+  long long misses;
+  long long evictions;
+  long long preloaded;
+  int *n_found; /* Pathways found so far, world->n_NFSimPReactions */
+};
+
+static struct nfsim_cache cache;
+
+/*************************************************************************
+pair_hash:
+  In: hash_a, hash_b: hashes of the reactant patterns
+      bimolecular: 0 if there is only the first reactant
+  Out: Hash of the ordered pair.
+*************************************************************************/
+static unsigned long pair_hash(unsigned long hash_a, unsigned long hash_b,
+                               int bimolecular) {
+  unsigned long h = hash_a * 1000003UL;
+  if (bimolecular)
+    h ^= hash_b + 0x9e3779b9UL + (h << 6) + (h >> 2);
+  return h;
+}
+
+/*************************************************************************
+rxn_bytes:
+  In: rx: a reaction built from NFSim results
+  Out: Roughly how much memory it holds.
+*************************************************************************/
+static size_t rxn_bytes(struct rxn *rx) {
+  if (rx == NULL)
+    return 0;
+  size_t per_path = sizeof(double) + sizeof(struct external_reaction_datastruct) +
+                    2 * sizeof(int) + sizeof(struct graph_data **) +
+                    sizeof(struct species **) + sizeof(short *);
+  size_t per_reactant =
+      sizeof(struct species *) + sizeof(short) + sizeof(struct graph_data *);
+  return sizeof(struct rxn) + rx->n_pathways * per_path +
+         rx->n_reactants * per_reactant;
+}
+
+/*************************************************************************
+free_nfsim_rxn:
+  In: rx: a reaction built by initializeNFSimReaction
+  Out: No return value.  The reaction is freed.  The graph data it points
+       to belong to the graph map and are kept.
+*************************************************************************/
+static void free_nfsim_rxn(struct rxn *rx) {
+  for (int i = 0; i < rx->n_pathways; i++) {
+    free(rx->external_reaction_data[i].reaction_name);
+    free(rx->product_graph_data[i]);
+    if (rx->nfsim_players[i] != NULL) {
+      free(rx->nfsim_players[i]);
+      free(rx->nfsim_geometries[i]);
+    }
+  }
+  free(rx->external_reaction_data);
+  free(rx->product_graph_data);
+  free(rx->nfsim_players);
+  free(rx->nfsim_geometries);
+  free(rx->reactant_graph_data);
+  free(rx->cum_probs);
+  free(rx->product_idx);
+  free(rx->product_idx_aux);
+  free(rx->players);
+  free(rx->geometries);
+  free(rx);
+}
+
+/*************************************************************************
+lru_unlink:
+  In: e: an entry in the cache
+  Out: No return value.  The entry is taken out of the LRU list.
+*************************************************************************/
+static void lru_unlink(struct nfsim_cache_entry *e) {
+  if (e->lru_prev != NULL)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    cache.lru_head = e->lru_next;
+  if (e->lru_next != NULL)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    cache.lru_tail = e->lru_prev;
+  e->lru_prev = e->lru_next = NULL;
+}
+
+/*************************************************************************
+lru_push_front:
+  In: e: an entry not in the LRU list
+  Out: No return value.  The entry becomes the most recently used one.
+*************************************************************************/
+static void lru_push_front(struct nfsim_cache_entry *e) {
+  e->lru_prev = NULL;
+  e->lru_next = cache.lru_head;
+  if (cache.lru_head != NULL)
+    cache.lru_head->lru_prev = e;
+  else
+    cache.lru_tail = e;
+  cache.lru_head = e;
+}
+
+/*************************************************************************
+retire_rxn:
+  In: rx: reaction of a dropped entry
+  Out: No return value.  The reaction is freed at the end of the iteration.
+*************************************************************************/
+static void retire_rxn(struct rxn *rx) {
+  if (cache.n_retired == cache.max_retired) {
+    int n = (cache.max_retired == 0) ? 64 : 2 * cache.max_retired;
+    struct rxn **retired = (struct rxn **)realloc(cache.retired,
+                                                  n * sizeof(struct rxn *));
+    if (retired == NULL)
+      mcell_allocfailed("Failed to grow the list of dropped NFSim reactions.");
+    cache.retired = retired;
+    cache.max_retired = n;
+  }
+  cache.retired[cache.n_retired++] = rx;
+}
+
+/*************************************************************************
+evict_entry:
+  In: e: an entry in the cache
+  Out: No return value.  The entry is taken out of the cache and freed.
+*************************************************************************/
+static void evict_entry(struct nfsim_cache_entry *e) {
+  struct nfsim_cache_entry **pe = &cache.buckets[e->hash & (cache.n_buckets - 1)];
+  while (*pe != e)
+    pe = &(*pe)->next_hash;
+  *pe = e->next_hash;
+  lru_unlink(e);
+
+  cache.n_entries--;
+  cache.bytes -= e->bytes;
+  cache.evictions++;
+
+  if (e->rx != NULL)
+    retire_rxn(e->rx);
+  for (int i = 0; i < e->n_paths; i++)
+    free(e->paths[i].name);
+  free(e->paths);
+  free(e->pattern_a);
+  free(e->pattern_b);
+  free(e);
+}
+
+/*************************************************************************
+drop_all:
+  In: No arguments.
+  Out: No return value.  Every entry is taken out of the cache and freed.
+*************************************************************************/
+static void drop_all(void) {
+  while (cache.lru_tail != NULL)
+    evict_entry(cache.lru_tail);
+  cache.evictions = 0;
+}
+
+/*************************************************************************
+enforce_limit:
+  In: keep: an entry that must stay
+  Out: No return value.  Least recently used entries are dropped until the
+       cache is within its limit.
+*************************************************************************/
+static void enforce_limit(struct nfsim_cache_entry *keep) {
+  if (cache.max_bytes == 0)
+    return;
+  while (cache.bytes > cache.max_bytes && cache.lru_tail != NULL &&
+         cache.lru_tail != keep)
+    evict_entry(cache.lru_tail);
+}
+
+/*************************************************************************
+grow_buckets:
+  In: No arguments.
+  Out: No return value.  The hash table is doubled.
+*************************************************************************/
+static void grow_buckets(void) {
+  unsigned long n = 2 * cache.n_buckets;
+  struct nfsim_cache_entry **buckets = CHECKED_MALLOC_ARRAY(
+      struct nfsim_cache_entry *, n, "NFSim reaction cache");
+  memset(buckets, 0, n * sizeof(struct nfsim_cache_entry *));
+  for (unsigned long i = 0; i < cache.n_buckets; i++) {
+    struct nfsim_cache_entry *e = cache.buckets[i];
+    while (e != NULL) {
+      struct nfsim_cache_entry *next = e->next_hash;
+      e->next_hash = buckets[e->hash & (n - 1)];
+      buckets[e->hash & (n - 1)] = e;
+      e = next;
+    }
+  }
+  free(cache.buckets);
+  cache.buckets = buckets;
+  cache.n_buckets = n;
+}
+
+/*************************************************************************
+lookup:
+  In: hash: hash of the pair
+      a, b: reactant patterns, b NULL for unimolecular reactions
+  Out: The entry for the pair, or NULL if there is none.
+*************************************************************************/
+static struct nfsim_cache_entry *lookup(unsigned long hash, char const *a,
+                                        char const *b) {
+  if (cache.buckets == NULL)
+    return NULL;
+  for (struct nfsim_cache_entry *e =
+           cache.buckets[hash & (cache.n_buckets - 1)];
+       e != NULL; e = e->next_hash) {
+    if (e->hash != hash || strcmp(e->pattern_a, a) != 0)
+      continue;
+    if (b == NULL ? e->pattern_b == NULL
+                  : (e->pattern_b != NULL && strcmp(e->pattern_b, b) == 0))
+      return e;
+  }
+  return NULL;
+}
+
+/*************************************************************************
+insert:
+  In: hash: hash of the pair
+      a, b: reactant patterns, b NULL for unimolecular reactions
+      n_paths: number of pathways
+      paths: the pathways, which the entry takes over
+  Out: The new entry, as the most recently used one.
+*************************************************************************/
+static struct nfsim_cache_entry *insert(unsigned long hash, char const *a,
+                                        char const *b, int n_paths,
+                                        struct nfsim_path *paths) {
+  if (cache.buckets == NULL) {
+    cache.n_buckets = NFSIM_CACHE_BUCKETS;
+    cache.buckets = CHECKED_MALLOC_ARRAY(struct nfsim_cache_entry *,
+                                         cache.n_buckets,
+                                         "NFSim reaction cache");
+    memset(cache.buckets, 0,
+           cache.n_buckets * sizeof(struct nfsim_cache_entry *));
+  } else if (cache.n_entries >= 2 * cache.n_buckets) {
+    grow_buckets();
+  }
+
+  struct nfsim_cache_entry *e =
+      CHECKED_MALLOC_STRUCT(struct nfsim_cache_entry, "NFSim reaction cache");
+  e->hash = hash;
+  e->pattern_a = CHECKED_STRDUP(a, "reactant pattern");
+  e->pattern_b = (b != NULL) ? CHECKED_STRDUP(b, "reactant pattern") : NULL;
+  e->n_paths = n_paths;
+  e->paths = paths;
+  e->rx = NULL;
+
+  e->bytes = sizeof(struct nfsim_cache_entry) + strlen(a) + 1 +
+             ((b != NULL) ? strlen(b) + 1 : 0) +
+             n_paths * sizeof(struct nfsim_path);
+  for (int i = 0; i < n_paths; i++)
+    e->bytes += strlen(paths[i].name) + 1;
+
+  e->next_hash = cache.buckets[hash & (cache.n_buckets - 1)];
+  cache.buckets[hash & (cache.n_buckets - 1)] = e;
+  lru_push_front(e);
+  cache.n_entries++;
+  cache.bytes += e->bytes;
+
+  enforce_limit(e);
+  return e;
+}
+
+/*************************************************************************
+nfsim_cache_find:
+  In: a, b: graph data of the reactants, b NULL for unimolecular reactions
+  Out: The cached answer for the reactants, or NULL if NFSim has to be
+       asked.
+*************************************************************************/
+struct nfsim_cache_entry *nfsim_cache_find(struct graph_data *a,
+                                           struct graph_data *b) {
+  unsigned long hash = pair_hash(a->graph_pattern_hash,
+                                 (b != NULL) ? b->graph_pattern_hash : 0,
+                                 b != NULL);
+  struct nfsim_cache_entry *e =
+      lookup(hash, a->graph_pattern, (b != NULL) ? b->graph_pattern : NULL);
+  if (e == NULL) {
+    cache.misses++;
+    return NULL;
+  }
+
+  cache.hits++;
+  if (e != cache.lru_head) {
+    lru_unlink(e);
+    lru_push_front(e);
+  }
+  return e;
+}
+
+/*************************************************************************
+nfsim_cache_add:
+  In: a, b: graph data of the reactants, b NULL for unimolecular reactions
+      results: what NFSim answered for them
+  Out: The new cache entry, whose pathways are counted as found.  Other
+       entries may be dropped to make room.
+*************************************************************************/
+struct nfsim_cache_entry *nfsim_cache_add(struct graph_data *a,
+                                          struct graph_data *b,
+                                          void *results) {
+  int n_paths = 0;
+  struct nfsim_path *paths = NULL;
+
+  if (mapvectormap_size(results) > 0) {
+    /* Only the first complex is asked about */
+    char **keys = mapvectormap_getKeys(results);
+    void *head_complex = mapvectormap_get(results, keys[0]);
+    n_paths = mapvector_size(head_complex);
+    if (n_paths > 0)
+      paths =
+          CHECKED_MALLOC_ARRAY(struct nfsim_path, n_paths, "NFSim pathways");
+    for (int path = 0; path < n_paths; path++) {
+      void *info = mapvector_get(head_complex, path);
+      paths[path].rate = atof(map_get(info, "rate"));
+      paths[path].name = CHECKED_STRDUP(map_get(info, "name"), "pathway name");
+      paths[path].resample = (strcmp(map_get(info, "resample"), "true") == 0);
+    }
+
+    for (int i = 0; i < mapvectormap_size(results); i++)
+      free(keys[i]);
+    free(keys);
+  }
+
+  *cache.n_found += n_paths;
+  unsigned long hash = pair_hash(a->graph_pattern_hash,
+                                 (b != NULL) ? b->graph_pattern_hash : 0,
+                                 b != NULL);
+  return insert(hash, a->graph_pattern, (b != NULL) ? b->graph_pattern : NULL,
+                n_paths, paths);
+}
+
+/*************************************************************************
+nfsim_cache_set_rxn:
+  In: e: an entry returned by nfsim_cache_find or nfsim_cache_add
+      rx: the reaction built from its pathways
+  Out: No return value.  The entry keeps the reaction.
+*************************************************************************/
+void nfsim_cache_set_rxn(struct nfsim_cache_entry *e, struct rxn *rx) {
+  size_t bytes = rxn_bytes(rx);
+  e->rx = rx;
+  e->bytes += bytes;
+  cache.bytes += bytes;
+  enforce_limit(e);
+}
+
+/*************************************************************************
+nfsim_cache_end_iteration:
+  In: No arguments.
+  Out: No return value.  Reactions of entries dropped during the iteration
+       are freed.
+*************************************************************************/
+void nfsim_cache_end_iteration(void) {
+  for (int i = 0; i < cache.n_retired; i++)
+    free_nfsim_rxn(cache.retired[i]);
+  cache.n_retired = 0;
+}
+
+/*************************************************************************
+nfsim_rules_fingerprint:
+  In: rules_file: NFSim rules file
+  Out: Checksum of its contents, or 0 if it can't be read.
+*************************************************************************/
+unsigned long nfsim_rules_fingerprint(char const *rules_file) {
+  FILE *f = fopen(rules_file, "rb");
+  if (f == NULL)
+    return 0;
+
+  unsigned long sum = 0;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long len = ftell(f);
+    rewind(f);
+    unsigned char *buf = (len > 0) ? (unsigned char *)malloc(len) : NULL;
+    if (buf != NULL && fread(buf, 1, len, f) == (size_t)len)
+      sum = crc32(buf, (unsigned int)len);
+    free(buf);
+  }
+  fclose(f);
+  return sum;
+}
+
+/*************************************************************************
+write_string:
+  In: f: file
+      s: string, or NULL
+  Out: No return value.  The string is written with its length in front.
+*************************************************************************/
+static void write_string(FILE *f, char const *s) {
+  if (s == NULL)
+    fprintf(f, "-1:");
+  else
+    fprintf(f, "%lu:%s", (unsigned long)strlen(s), s);
+}
+
+/*************************************************************************
+read_string:
+  In: f: file
+      s: set to the string read, or NULL
+  Out: 0 on success, 1 if the file is malformed.
+*************************************************************************/
+static int read_string(FILE *f, char **s) {
+  long len;
+  if (fscanf(f, " %ld:", &len) != 1 || len < -1)
+    return 1;
+  if (len == -1) {
+    *s = NULL;
+    return 0;
+  }
+  *s = CHECKED_MALLOC_ARRAY(char, len + 1, "NFSim cache string");
+  if (fread(*s, 1, len, f) != (size_t)len) {
+    free(*s);
+    return 1;
+  }
+  (*s)[len] = '\0';
+  return 0;
+}
+
+/*************************************************************************
+load_cache_file:
+  In: world: simulation state
+      f: cache file
+  Out: 0 on success or if the file is of other rules, 1 if it is malformed.
+       Entries read before the error are left in the cache.
+*************************************************************************/
+static int load_cache_file(struct volume *world, FILE *f) {
+  char magic[32];
+  int version;
+  unsigned long rules;
+  long n_entries;
+  if (fscanf(f, "%31s %d %lu %ld", magic, &version, &rules, &n_entries) != 4 ||
+      strcmp(magic, NFSIM_CACHE_MAGIC) != 0 || version != NFSIM_CACHE_VERSION)
+    return 1;
+  if (rules != world->nfsim_rules_fingerprint) {
+    mcell_warn("NFSim reaction cache was written for other rules; ignoring it.");
+    return 0;
+  }
+
+  int n_found = 0; /* Pathways read, counted once the whole file is read */
+  for (long i = 0; i < n_entries; i++) {
+    char *a, *b;
+    int n_paths;
+    if (read_string(f, &a))
+      return 1;
+    if (a == NULL || read_string(f, &b)) {
+      free(a);
+      return 1;
+    }
+    if (fscanf(f, " %d", &n_paths) != 1 || n_paths < 0) {
+      free(a);
+      free(b);
+      return 1;
+    }
+
+    struct nfsim_path *paths =
+        (n_paths > 0)
+            ? CHECKED_MALLOC_ARRAY(struct nfsim_path, n_paths, "NFSim pathways")
+            : NULL;
+    for (int path = 0; path < n_paths; path++) {
+      if (fscanf(f, " %lf %d", &paths[path].rate, &paths[path].resample) !=
+              2 ||
+          read_string(f, &paths[path].name) || paths[path].name == NULL) {
+        for (int j = 0; j < path; j++)
+          free(paths[j].name);
+        free(paths);
+        free(a);
+        free(b);
+        return 1;
+      }
+    }
+
+    unsigned long hash = pair_hash(lhash(a), (b != NULL) ? lhash(b) : 0,
+                                   b != NULL);
+    if (lookup(hash, a, b) == NULL) {
+      insert(hash, a, b, n_paths, paths);
+      cache.preloaded++;
+      n_found += n_paths;
+    } else {
+      for (int path = 0; path < n_paths; path++)
+        free(paths[path].name);
+      free(paths);
+    }
+    free(a);
+    free(b);
+  }
+  *cache.n_found += n_found;
+  return 0;
+}
+
+/*************************************************************************
+nfsim_cache_init:
+  In: world: simulation state
+  Out: 0.  The cache is set up, and filled from the cache file if there is
+       one.  A cache file that can't be used is ignored with a warning.
+*************************************************************************/
+int nfsim_cache_init(struct volume *world) {
+  cache.max_bytes = world->nfsim_cache_bytes;
+  cache.n_found = &world->n_NFSimPReactions;
+  if (world->nfsim_cache_file == NULL)
+    return 0;
+  if (world->nfsim_rules_fingerprint == 0) {
+    /* Answers can't be matched to the rules they came from */
+    mcell_warn("NFSim rules file couldn't be read back; not using the "
+               "reaction cache file '%s'.",
+               world->nfsim_cache_file);
+    return 0;
+  }
+
+  FILE *f = fopen(world->nfsim_cache_file, "r");
+  if (f == NULL)
+    return 0; /* Nothing saved yet */
+
+  int err = load_cache_file(world, f);
+  fclose(f);
+  if (err) {
+    mcell_warn("NFSim reaction cache file '%s' is malformed; ignoring it.",
+               world->nfsim_cache_file);
+    drop_all();
+    cache.preloaded = 0;
+    return 0;
+  }
+  if (world->notify->progress_report != NOTIFY_NONE)
+    mcell_log("Read %lld NFSim query results from '%s'.", cache.preloaded,
+              world->nfsim_cache_file);
+  return 0;
+}
+
+/*************************************************************************
+nfsim_cache_save:
+  In: world: simulation state
+  Out: 0 on success, 1 if the cache file couldn't be written.  The cached
+       answers are written, least recently used first, so that reading them
+       back leaves them in the same order.
+*************************************************************************/
+int nfsim_cache_save(struct volume *world) {
+  if (world->nfsim_cache_file == NULL || world->nfsim_rules_fingerprint == 0)
+    return 0; /* Warned about in nfsim_cache_init */
+
+  FILE *f = fopen(world->nfsim_cache_file, "w");
+  if (f == NULL) {
+    mcell_perror_nodie(errno, "Failed to write NFSim reaction cache file '%s'",
+                       world->nfsim_cache_file);
+    return 1;
+  }
+
+  fprintf(f, "%s %d %lu %lu\n", NFSIM_CACHE_MAGIC, NFSIM_CACHE_VERSION,
+          world->nfsim_rules_fingerprint, cache.n_entries);
+  for (struct nfsim_cache_entry *e = cache.lru_tail; e != NULL;
+       e = e->lru_prev) {
+    write_string(f, e->pattern_a);
+    fputc(' ', f);
+    write_string(f, e->pattern_b);
+    fprintf(f, " %d\n", e->n_paths);
+    for (int path = 0; path < e->n_paths; path++) {
+      fprintf(f, "%.17g %d ", e->paths[path].rate, e->paths[path].resample);
+      write_string(f, e->paths[path].name);
+      fputc('\n', f);
+    }
+  }
+
+  if (fclose(f) != 0) {
+    mcell_perror_nodie(errno, "Failed to write NFSim reaction cache file '%s'",
+                       world->nfsim_cache_file);
+    return 1;
+  }
+  return 0;
+}
+
+/*************************************************************************
+nfsim_cache_report:
+  In: No arguments.
+  Out: No return value.  The cache statistics are logged.
+*************************************************************************/
+void nfsim_cache_report(void) {
+  long long n_queries = cache.hits + cache.misses;
+  mcell_log("NFSim reaction cache: %lld hits, %lld misses (%.1f%% hits), "
+            "%lld dropped, %lu entries (%.1f MB), %lld read from file",
+            cache.hits, cache.misses,
+            (n_queries > 0) ? 100.0 * (double)cache.hits / n_queries : 0.0,
+            cache.evictions, cache.n_entries,
+            (double)cache.bytes / (1024.0 * 1024.0), cache.preloaded);
+}
@@ -0,0 +1,63 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+/* Default memory bound of the cache, in megabytes */
+#define NFSIM_CACHE_DEFAULT_MB 256
+
+/* One reaction pathway NFSim reported for a set of reactants */
+struct nfsim_path {
+  double rate;
+  int resample;
+  char *name;
+};
+
+/* Answer to one NFSim query, for one ordered pair of reactant patterns
+ * (or a single pattern, for unimolecular reactions) */
+struct nfsim_cache_entry {
+  struct nfsim_cache_entry *next_hash;  /* Next entry in the hash bucket */
+  struct nfsim_cache_entry *lru_prev;   /* More recently used entry */
+  struct nfsim_cache_entry *lru_next;   /* Less recently used entry */
+  unsigned long hash;
+  char *pattern_a;
+  char *pattern_b; /* NULL for unimolecular queries */
+  int n_paths;
+  struct nfsim_path *paths;
+  struct rxn *rx; /* Built from the paths when first needed, or NULL */
+  size_t bytes;   /* Approximate memory held by the entry */
+};
+
+int nfsim_cache_init(struct volume *world);
+struct nfsim_cache_entry *nfsim_cache_find(struct graph_data *a,
+                                           struct graph_data *b);
+struct nfsim_cache_entry *nfsim_cache_add(struct graph_data *a,
+                                          struct graph_data *b,
+                                          void *results);
+void nfsim_cache_set_rxn(struct nfsim_cache_entry *e, struct rxn *rx);
+void nfsim_cache_end_iteration(void);
+int nfsim_cache_save(struct volume *world);
+void nfsim_cache_report(void);
+unsigned long nfsim_rules_fingerprint(char const *rules_file);
@@ -19,27 +19,6 @@ double rxn_get_standard_time_step(struct rxn *, int);
 double rxn_get_nfsim_time_step(struct rxn *, int);
 double rxn_get_standard_space_step(struct rxn *, int);
 
-void initialize_diffusion_function(struct abstract_molecule *this) {
-  // if nfsim provides spatial parameters...
-  if (this->properties->flags & EXTERNAL_SPECIES &&
-      this->graph_data->graph_diffusion != -1.0) {
-    this->get_diffusion = &get_nfsim_diffusion;
-    this->get_space_step = &get_nfsim_space_step;
-    this->get_time_step = &get_nfsim_time_step;
-  } else {
-    this->get_diffusion = &get_standard_diffusion;
-    this->get_space_step = &get_standard_space_step;
-    this->get_time_step = &get_standard_time_step;
-  }
-
-  if (this->properties->flags & EXTERNAL_SPECIES &&
-      this->graph_data->flags >= 0) {
-    this->get_flags = &get_nfsim_flags;
-  } else {
-    this->get_flags = &get_standard_flags;
-  }
-}
-
 void initialize_rxn_diffusion_functions(struct rxn *this) {
   if (this->players[0]->flags & EXTERNAL_SPECIES) {
     this->get_reactant_diffusion = rxn_get_nfsim_diffusion;
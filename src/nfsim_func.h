@@ -5,7 +5,6 @@
 
 // typedef double (*get_reactant_diffusion)(int a, int b);
 
-void initialize_diffusion_function(struct abstract_molecule *this);
 void initialize_rxn_diffusion_functions(struct rxn *this);
 
 double get_standard_diffusion(void *self);
@@ -35,4 +34,36 @@ int store_graph_data(unsigned long graph_pattern_hash,
 u_int get_nfsim_flags(void *this);
 u_int get_standard_flags(void *this);
 
+/* Properties of a molecule.  Those of rule-based (EXTERNAL_SPECIES)
+ * molecules come from their graph data where NFSim provides them; the
+ * others read their species directly, so that models without NFSim don't
+ * pay for a call on every step. */
+static inline u_int mol_flags(void *self) {
+  struct abstract_molecule *am = (struct abstract_molecule *)self;
+  if (am->properties->flags & EXTERNAL_SPECIES)
+    return get_nfsim_flags(am);
+  return am->properties->flags;
+}
+
+static inline double mol_diffusion(void *self) {
+  struct abstract_molecule *am = (struct abstract_molecule *)self;
+  if (am->properties->flags & EXTERNAL_SPECIES)
+    return get_nfsim_diffusion(am);
+  return am->properties->D;
+}
+
+static inline double mol_time_step(void *self) {
+  struct abstract_molecule *am = (struct abstract_molecule *)self;
+  if (am->properties->flags & EXTERNAL_SPECIES)
+    return get_nfsim_time_step(am);
+  return am->properties->time_step;
+}
+
+static inline double mol_space_step(void *self) {
+  struct abstract_molecule *am = (struct abstract_molecule *)self;
+  if (am->properties->flags & EXTERNAL_SPECIES)
+    return get_nfsim_space_step(am);
+  return am->properties->space_step;
+}
+
 #endif
@@ -0,0 +1,191 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Packed copies of the per-species molecule lists of the subvolumes.
+ *
+ * The volume molecules of one species in one subvolume are chained through
+ * next_v.  Scanning such a list for reaction partners touches each
+ * molecule, which is large and scattered over the storage's memory pool.
+ * With -packed_molecules every list also keeps a contiguous copy of the
+ * data these scans read: the molecule pointer, its position and its index.
+ * Slots are appended when a molecule joins a list and filled from the last
+ * slot when it leaves, so a molecule's slot (packed_slot) stays valid for as
+ * long as it is in the list.  The molecule also points back at the list
+ * (packed_list), so that updates don't have to look it up by species.
+ *
+ * The linked lists are still kept, and are what everything else walks.  The
+ * copy of a molecule is refreshed when it joins a list, when it is parked
+ * for a hand-off, and when it finishes its diffusion step; the molecule
+ * that is diffusing is the only one whose copy may be out of date.  Models
+ * in which molecules are moved in other ways (dynamic geometry, periodic
+ * boundaries) or in which partners depend on more than their species
+ * (NFSim) don't use the packed lists. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "packed_mols.h"
+
+/*************************************************************************
+packed_ineligible:
+  In: world: simulation state
+  Out: NULL if packed lists can be used for this model, or else a
+       description of why they can't.
+*************************************************************************/
+static char const *packed_ineligible(struct volume *world) {
+  if (world->nfsim_flag)
+    return "NFSim models are not supported";
+  if (world->dynamic_geometry_head != NULL)
+    return "dynamic geometry is not supported";
+  if (world->periodic_box_obj != NULL)
+    return "periodic boundary conditions are not supported";
+  return NULL;
+}
+
+/*************************************************************************
+find_packed_list:
+  In: vm: a molecule in a subvolume's per-species list
+  Out: the list holding the molecule
+*************************************************************************/
+static struct per_species_list *find_packed_list(struct volume_molecule *vm) {
+  struct per_species_list *psl = vm->packed_list;
+  if (psl == NULL || vm->packed_slot < 0 || vm->packed_slot >= psl->n_packed ||
+      psl->packed_mol[vm->packed_slot] != vm)
+    mcell_internal_error("Molecule of species '%s' is missing from the packed "
+                         "molecule list of its subvolume.",
+                         vm->properties->sym->name);
+  return psl;
+}
+
+/*************************************************************************
+init_packed_molecules:
+  In: world: simulation state
+  Out: 0 on success.  If packed lists were asked for and the model allows
+       them, every storage keeps them from now on, and the lists of the
+       molecules placed so far are packed.
+*************************************************************************/
+int init_packed_molecules(struct volume *world) {
+  if (!world->use_packed_molecules)
+    return 0;
+
+  char const *reason = packed_ineligible(world);
+  if (reason != NULL) {
+    mcell_warn("Not using packed molecule lists: %s.", reason);
+    world->use_packed_molecules = 0;
+    return 0;
+  }
+
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next)
+    l->store->packed_molecules = 1;
+
+  for (int i = 0; i < world->n_subvols; i++) {
+    for (struct per_species_list *psl = world->subvol[i].species_head;
+         psl != NULL; psl = psl->next) {
+      if (psl->properties == NULL)
+        continue;
+      for (struct volume_molecule *vm = psl->head; vm != NULL; vm = vm->next_v)
+        packed_list_add(psl, vm);
+    }
+  }
+
+  return 0;
+}
+
+/*************************************************************************
+packed_list_add:
+  In: psl: the per-species list the molecule has just been linked into
+      vm: the molecule
+  Out: No return value.  The molecule is copied into a new slot at the end
+       of the packed list.
+*************************************************************************/
+void packed_list_add(struct per_species_list *psl, struct volume_molecule *vm) {
+  if (psl->n_packed == psl->max_packed) {
+    psl->max_packed = (psl->max_packed < 8) ? 8 : 2 * psl->max_packed;
+    psl->packed_mol = (struct volume_molecule **)realloc(
+        psl->packed_mol, psl->max_packed * sizeof(struct volume_molecule *));
+    psl->packed_pos = (struct vector3 *)realloc(
+        psl->packed_pos, psl->max_packed * sizeof(struct vector3));
+    psl->packed_index = (int *)realloc(psl->packed_index,
+                                       psl->max_packed * sizeof(int));
+    if (psl->packed_mol == NULL || psl->packed_pos == NULL ||
+        psl->packed_index == NULL)
+      mcell_allocfailed("Failed to grow packed molecule list.");
+  }
+
+  int slot = psl->n_packed++;
+  psl->packed_mol[slot] = vm;
+  psl->packed_pos[slot] = vm->pos;
+  psl->packed_index[slot] = vm->index;
+  vm->packed_slot = slot;
+  vm->packed_list = psl;
+}
+
+/*************************************************************************
+packed_list_remove:
+  In: vm: a molecule about to be unlinked from its per-species list
+  Out: No return value.  The molecule's slot is taken over by the molecule
+       in the last slot.
+*************************************************************************/
+void packed_list_remove(struct volume_molecule *vm) {
+  struct per_species_list *psl = find_packed_list(vm);
+  int slot = vm->packed_slot;
+  int last = --psl->n_packed;
+  if (slot != last) {
+    psl->packed_mol[slot] = psl->packed_mol[last];
+    psl->packed_pos[slot] = psl->packed_pos[last];
+    psl->packed_index[slot] = psl->packed_index[last];
+    psl->packed_mol[slot]->packed_slot = slot;
+  }
+  vm->packed_slot = -1;
+  vm->packed_list = NULL;
+}
+
+/*************************************************************************
+packed_list_update:
+  In: vm: a molecule in a per-species list which may have moved
+  Out: No return value.  The position and index in the molecule's slot are
+       refreshed.
+*************************************************************************/
+void packed_list_update(struct volume_molecule *vm) {
+  struct per_species_list *psl = find_packed_list(vm);
+  psl->packed_pos[vm->packed_slot] = vm->pos;
+  psl->packed_index[vm->packed_slot] = vm->index;
+}
+
+/*************************************************************************
+packed_list_free:
+  In: psl: a per-species list which is about to be discarded
+  Out: No return value.  The memory of the packed copy is released.
+*************************************************************************/
+void packed_list_free(struct per_species_list *psl) {
+  free(psl->packed_mol);
+  free(psl->packed_pos);
+  free(psl->packed_index);
+  psl->packed_mol = NULL;
+  psl->packed_pos = NULL;
+  psl->packed_index = NULL;
+  psl->n_packed = psl->max_packed = 0;
+}
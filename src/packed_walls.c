@@ -0,0 +1,203 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Packed wall planes for ray tracing.
+ *
+ * Almost every wall collide_wall is asked about is missed because the
+ * displacement doesn't cross its plane, which collide_wall finds out after
+ * following the wall pointer and reading the normal and the distance from
+ * the middle of a large struct.  With -packed_walls, subvolumes with enough
+ * walls (and no wall hierarchy, which already leaves only a few of them)
+ * keep the planes of their walls in separate arrays, and test a
+ * displacement against all of them in one loop, which the compiler
+ * vectorizes.
+ *
+ * Only walls whose plane is clearly not crossed are dropped; the test
+ * leaves a margin far wider than rounding, so a wall collide_wall would
+ * report as hit, or ask to redo the displacement for, is never dropped.
+ * The rest go to collide_wall in wall_head order, so front and back hits,
+ * hit locations and redos come out exactly as before. */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "packed_walls.h"
+
+/* Subvolumes with fewer walls than this just use the list */
+#define PACKED_WALLS_MIN 8
+
+/*************************************************************************
+build_packed_walls:
+  In: sv: a subvolume
+      n_walls: number of walls in its wall list
+  Out: The packed planes of the walls of the subvolume.
+*************************************************************************/
+static struct packed_walls *build_packed_walls(struct subvolume *sv,
+                                               int n_walls) {
+  struct packed_walls *pw =
+      CHECKED_MALLOC_STRUCT(struct packed_walls, "packed wall planes");
+  pw->n_walls = n_walls;
+  pw->nx = CHECKED_MALLOC_ARRAY(double, n_walls, "packed wall planes");
+  pw->ny = CHECKED_MALLOC_ARRAY(double, n_walls, "packed wall planes");
+  pw->nz = CHECKED_MALLOC_ARRAY(double, n_walls, "packed wall planes");
+  pw->d = CHECKED_MALLOC_ARRAY(double, n_walls, "packed wall planes");
+  pw->links = CHECKED_MALLOC_ARRAY(struct wall_list, n_walls,
+                                   "packed wall planes");
+  pw->crossed =
+      CHECKED_MALLOC_ARRAY(unsigned char, n_walls, "packed wall planes");
+
+  int i = 0;
+  for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next, i++) {
+    struct wall *w = wl->this_wall;
+    pw->nx[i] = w->normal.x;
+    pw->ny[i] = w->normal.y;
+    pw->nz[i] = w->normal.z;
+    pw->d[i] = w->d;
+    pw->links[i].this_wall = w;
+    pw->links[i].next = NULL;
+  }
+  return pw;
+}
+
+/*************************************************************************
+destroy_packed_walls:
+  In: pw: packed planes, or NULL
+  Out: No return value.  The planes are freed.
+*************************************************************************/
+void destroy_packed_walls(struct packed_walls *pw) {
+  if (pw == NULL)
+    return;
+  free(pw->nx);
+  free(pw->ny);
+  free(pw->nz);
+  free(pw->d);
+  free(pw->links);
+  free(pw->crossed);
+  free(pw);
+}
+
+/*************************************************************************
+init_packed_walls:
+  In: world: simulation state
+  Out: 0 on success.  If packed planes were asked for, every subvolume with
+       enough walls and no wall hierarchy gets them.
+*************************************************************************/
+int init_packed_walls(struct volume *world) {
+  for (int i = 0; i < world->n_subvols; i++)
+    world->subvol[i].packed_walls = NULL;
+  if (!world->use_packed_walls)
+    return 0;
+
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    if (sv->wall_bvh != NULL)
+      continue;
+    int n_walls = 0;
+    for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next)
+      n_walls++;
+    if (n_walls >= PACKED_WALLS_MIN)
+      sv->packed_walls = build_packed_walls(sv, n_walls);
+  }
+  return 0;
+}
+
+/*************************************************************************
+find_crossed_planes:
+  In: pw: packed planes
+      px, py, pz: where the molecule starts
+      mx, my, mz: its displacement
+      margin: how far from a plane a point has to be to be clearly off it
+  Out: No return value.  pw->crossed is cleared for every wall whose plane
+       the displacement clearly doesn't reach, and set for the others.
+  Note: On x86-64 with GCC an AVX2 version is built as well, and picked
+        when the program starts if the processor supports it.
+*************************************************************************/
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) &&         \
+    !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void find_crossed_planes(struct packed_walls *pw, double px, double py,
+                                double pz, double mx, double my, double mz,
+                                double margin) {
+  int n = pw->n_walls;
+  double const *nx = pw->nx;
+  double const *ny = pw->ny;
+  double const *nz = pw->nz;
+  double const *d = pw->d;
+  unsigned char *crossed = pw->crossed;
+  double far_end = EPS_C + margin;
+
+  for (int i = 0; i < n; i++) {
+    double dd = nx[i] * px + ny[i] * py + nz[i] * pz - d[i];
+    double dv = nx[i] * mx + ny[i] * my + nz[i] * mz;
+    double de = dd + dv;
+    /* Start and end both clearly above or both clearly below the plane */
+    int above = (dd > margin) & (de > far_end);
+    int below = (dd < -margin) & (de < -far_end);
+    crossed[i] = !(above | below);
+  }
+}
+
+/*************************************************************************
+packed_walls_query:
+  In: pw: packed planes of the walls of a subvolume
+      pos: where the molecule starts
+      v: its displacement
+      notify: notification settings
+      ray_polygon_tests: counter of ray-polygon tests
+  Out: A list of the walls whose planes the displacement may cross, in the
+       order of the subvolume's wall list, or NULL if there are none.  The
+       list belongs to pw and is overwritten by the next query.  The walls
+       left out are counted as tested.
+*************************************************************************/
+struct wall_list *packed_walls_query(struct packed_walls *pw,
+                                     struct vector3 *pos, struct vector3 *v,
+                                     struct notifications *notify,
+                                     long long *ray_polygon_tests) {
+  /* collide_wall finds a plane missed if both ends are more than EPS_C
+   * (or half their distance) on one side of it; rounding is bounded by a
+   * tiny multiple of the size of the coordinates. */
+  double margin = EPS_C * (1.0 + fabs(pos->x) + fabs(pos->y) + fabs(pos->z) +
+                           fabs(v->x) + fabs(v->y) + fabs(v->z));
+  find_crossed_planes(pw, pos->x, pos->y, pos->z, v->x, v->y, v->z, margin);
+
+  struct wall_list *head = NULL;
+  struct wall_list **tail = &head;
+  int n_crossed = 0;
+  for (int i = 0; i < pw->n_walls; i++) {
+    if (pw->crossed[i]) {
+      *tail = &pw->links[i];
+      tail = &pw->links[i].next;
+      n_crossed++;
+    }
+  }
+  *tail = NULL;
+
+  if (notify->final_summary == NOTIFY_FULL)
+    *ray_polygon_tests += pw->n_walls - n_crossed;
+  return head;
+}
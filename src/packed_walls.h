@@ -0,0 +1,45 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+/* Planes of the walls of a subvolume, in wall_head order */
+struct packed_walls {
+  int n_walls;
+  double *nx; /* Normals */
+  double *ny;
+  double *nz;
+  double *d; /* Distances to the origin */
+  struct wall_list *links; /* One per wall */
+  unsigned char *crossed;  /* Scratch for queries */
+};
+
+int init_packed_walls(struct volume *world);
+void destroy_packed_walls(struct packed_walls *pw);
+
+struct wall_list *packed_walls_query(struct packed_walls *pw,
+                                     struct vector3 *pos, struct vector3 *v,
+                                     struct notifications *notify,
+                                     long long *ray_polygon_tests);
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#include "config.h"
+#include "philox.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+#define philox_round(c, k0, k1)                                                \
+  {                                                                            \
+    ub8 p0 = (ub8)PHILOX_M0 * c[0];                                            \
+    ub8 p1 = (ub8)PHILOX_M1 * c[2];                                            \
+    c[0] = (ub4)(p1 >> 32) ^ c[1] ^ (k0);                                      \
+    c[1] = (ub4)p1;                                                            \
+    c[2] = (ub4)(p0 >> 32) ^ c[3] ^ (k1);                                      \
+    c[3] = (ub4)p0;                                                            \
+  }
+
+/*************************************************************************
+philox_generate:
+  In:  struct philox_state *rng - generator state
+  Out: No return value.  The next PHILOX_BLOCKS blocks of the stream are
+       stored in the result buffer, and the counter is advanced past them.
+ *************************************************************************/
+void philox_generate(struct philox_state *rng) {
+  for (int b = 0; b < PHILOX_BLOCKS; b++) {
+    ub8 n = rng->counter + (ub8)b;
+    ub4 c[4] = { (ub4)n, (ub4)(n >> 32), rng->stream, 0 };
+    ub4 k0 = rng->key[0];
+    ub4 k1 = rng->key[1];
+    for (int r = 0; r < 9; r++) {
+      philox_round(c, k0, k1);
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    philox_round(c, k0, k1);
+
+    ub4 *out = rng->randrsl + 4 * b;
+    out[0] = c[0];
+    out[1] = c[1];
+    out[2] = c[2];
+    out[3] = c[3];
+  }
+  rng->counter += PHILOX_BLOCKS;
+}
+
+/*************************************************************************
+philox_init:
+  In:  struct philox_state *rng - generator state
+       ub4 seed - seed
+       ub8 stream - stream id
+  Out: No return value.  The generator is set to the start of the stream.
+ *************************************************************************/
+void philox_init(struct philox_state *rng, ub4 seed, ub8 stream) {
+  rng->key[0] = seed;
+  rng->key[1] = (ub4)stream;
+  rng->stream = (ub4)(stream >> 32);
+  rng->counter = 0;
+  rng->randcnt = 0; /* the first draw fills the buffer */
+}
+
+/*************************************************************************
+philox_restore:
+  In:  struct philox_state *rng - generator state whose key, counter and
+         randcnt have been set (e.g. read back from a checkpoint)
+  Out: No return value.  The result buffer is refilled so that the
+       generator carries on exactly where it was when they were saved.
+ *************************************************************************/
+void philox_restore(struct philox_state *rng) {
+  if (rng->randcnt == 0)
+    return;
+  rng->counter -= PHILOX_BLOCKS;
+  philox_generate(rng);
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Philox4x32-10 counter-based random number generator.
+ *
+ * Salmon, Moraes, Dror, Shaw - Parallel random numbers: as easy as 1, 2, 3 -
+ *   SC11 (2011)
+ *
+ * The output for a given key and counter is a fixed function of the two, so
+ * a generator is fully described by its key (the seed and a stream id) and
+ * the number of blocks it has produced.  Any number of independent streams
+ * can be derived from one seed without any shared state, and a stream can
+ * be recreated anywhere from those few words.
+ *
+ * Results are buffered and handed out from the end of the buffer towards
+ * the start, the same way as with ISAAC64. */
+
+#pragma once
+
+#include <inttypes.h>
+
+#define PHILOX_BLOCKS 16
+#define PHILOX_RANDMAX (4 * PHILOX_BLOCKS)
+
+typedef unsigned long long ub8;
+typedef uint32_t ub4;
+
+#ifndef DBL32
+#define DBL32 (2.3283064365386962890625e-10)
+#endif
+
+struct philox_state {
+  unsigned int randcnt;
+  ub4 key[2];   /* Seed, low word of the stream id */
+  ub4 stream;   /* High word of the stream id */
+  ub8 counter;  /* Number of 128-bit blocks produced so far */
+  ub4 randrsl[PHILOX_RANDMAX];
+};
+
+void philox_init(struct philox_state *rng, ub4 seed, ub8 stream);
+
+void philox_generate(struct philox_state *rng);
+
+void philox_restore(struct philox_state *rng);
+
+#define philox_uint32(rng)                                                     \
+  (rng->randcnt > 0 ? rng->randrsl[rng->randcnt -= 1]                          \
+                    : (philox_generate(rng), rng->randcnt = PHILOX_RANDMAX - 1,\
+                       rng->randrsl[rng->randcnt]))
+
+#define philox_dbl32(rng) (DBL32 * (double)philox_uint32(rng))
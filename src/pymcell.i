@@ -97,6 +97,7 @@
 #include "mcell_run.h"
 #include "mcell_structs.h"
 #include "mcell_dyngeom.h"
+#include "mcell_snapshot.h"
 #include "vector.h"
 
 
@@ -137,6 +138,7 @@ from data_model_import import *
 %include "mcell_run.i"
 %include "mcell_structs.i"
 %include "mcell_dyngeom.i"
+%include "mcell_snapshot.i"
 %include "vector.i"
 
 // Generate docstrings
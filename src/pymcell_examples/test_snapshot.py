@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+import pymcell as m
+import box as b
+
+
+def main():
+    world = m.MCellSim(seed=1)
+    world.set_time_step(time_step=1e-5)
+    world.set_iterations(iterations=100)
+    world.silence_notifications()
+    world.set_output_freq(10)
+
+    vm1 = m.Species("vm1", 1e-6)
+    world.add_species(vm1)
+
+    box_obj = m.MeshObj(
+        "Box", b.vert_list, b.face_list, translation=(0, 0, 0))
+    world.add_geometry(box_obj)
+
+    vm1_box_rel = m.ObjectRelease(vm1, number=1000, mesh_obj=box_obj)
+    world.release(vm1_box_rel)
+    world.add_count(vm1, box_obj)
+
+    # Read the molecules and counts straight from the simulation after every
+    # iteration instead of going through viz and reaction data files
+    world.enable_snapshots()
+    for i in range(100):
+        world.run_iteration()
+        pos = world.get_molecule_positions(vm1)
+        ids = world.get_molecule_ids(vm1)
+        counts = world.get_counts()
+        if i % 10 == 0:
+            print("iteration %d: %d molecules, first %s at %s, counts %s" % (
+                i, len(ids), ids[0] if len(ids) else None,
+                tuple(pos[0]) if len(pos) else None, list(counts)))
+    print(world.get_count_labels())
+    world.end_sim()
+
+
+if __name__ == "__main__":
+    main()
@@ -13,6 +13,11 @@ import logging
 from enum import Enum
 # import uuid
 import random
+import struct
+try:
+    import numpy as np
+except ImportError:
+    np = None
 
 
 class Orient(Enum):
@@ -270,6 +275,21 @@ class SurfaceClass:
         return self.name
 
 
+def _snapshot_array(view, fmt: str, width: int = 1, copy: bool = False):
+    """ Wrap a snapshot buffer. This is a NumPy array if NumPy is available
+    and a typed memoryview otherwise. It shares its memory with the
+    simulation unless copy is True. """
+    if copy:
+        view = memoryview(view.tobytes())
+    if np is not None:
+        arr = np.frombuffer(view, dtype=fmt)
+        return arr.reshape(-1, width) if width > 1 else arr
+    if width > 1 and view.nbytes > 0:
+        rows = view.nbytes // (struct.calcsize(fmt) * width)
+        return view.cast(fmt, [rows, width])
+    return view.cast(fmt)
+
+
 class MCellSim:
     """ The main class required to run a pyMCell simulation. """
     def __init__(self, seed: int) -> None:
@@ -284,6 +304,7 @@ class MCellSim:
         self._regions = {}  # type: Dict[str, Any]
         self._releases = {}  # type: Dict[str, Any]
         self._counts = {}  # type: Dict[str, Any]
+        self._count_labels = []  # type: List[Tuple[str, str]]
         self._iterations = 0
         self._current_iteration = 0
         self._finished = False
@@ -660,6 +681,57 @@ class MCellSim:
         return m.mcell_get_count(
             species.name, "Scene.%s,ALL" % mesh_obj.name, self._world)
 
+    def enable_snapshots(self) -> None:
+        """ Copy the molecule state and all counts into arrays after every
+        iteration, so that they can be read with get_molecule_positions,
+        get_molecule_ids, get_molecule_orientations and get_counts. """
+        m.mcell_enable_snapshots(self._world)
+
+    def get_molecule_positions(self, species: Species, copy: bool = False):
+        """ Get the positions (in microns) of the molecules of a species after
+        the last iteration as an n x 3 array. The array shares its memory with
+        the simulation: its values change with the next iterations, and it
+        must not be used after end_sim. Pass copy=True for values of your
+        own. """
+        return _snapshot_array(
+            m.mcell_snapshot_positions(self._world, species.name), 'd', 3,
+            copy)
+
+    def get_molecule_ids(self, species: Species, copy: bool = False):
+        """ Get the ids of the molecules of a species after the last iteration,
+        in the same order as get_molecule_positions. Shared with the
+        simulation like get_molecule_positions unless copy is True. """
+        return _snapshot_array(
+            m.mcell_snapshot_ids(self._world, species.name), 'L', copy=copy)
+
+    def get_molecule_orientations(self, species: Species, copy: bool = False):
+        """ Get the orientations of the molecules of a species after the last
+        iteration (0 for volume molecules), in the same order as
+        get_molecule_positions. Shared with the simulation like
+        get_molecule_positions unless copy is True. """
+        return _snapshot_array(
+            m.mcell_snapshot_orientations(self._world, species.name), 'h',
+            copy=copy)
+
+    def get_count_labels(self) -> List[Tuple[str, str]]:
+        """ Get the (species or reaction, region) counted by each entry of
+        get_counts. A species is followed by the orientation counted (' , or
+        ;) and a periodic box by [x,y,z], if the count has them. """
+        n_counters = m.mcell_get_snapshot_counter_count(self._world)
+        if len(self._count_labels) != n_counters:
+            self._count_labels = [
+                (m.mcell_get_snapshot_counter_target(self._world, i),
+                 m.mcell_get_snapshot_counter_region(self._world, i))
+                for i in range(n_counters)]
+        return self._count_labels
+
+    def get_counts(self, copy: bool = False):
+        """ Get the values of all molecule and reaction counters after the
+        last iteration, in the order of get_count_labels. Shared with the
+        simulation like get_molecule_positions unless copy is True. """
+        return _snapshot_array(
+            m.mcell_snapshot_counts(self._world), 'd', copy=copy)
+
     def modify_rate_constant(
             self, rxn: Reaction, new_rate_constant: float) -> None:
         """ Modify the rate constant of the specified reaction. """
@@ -706,12 +778,15 @@ class MCellSim:
         self._finished = True
 
     def end_sim(self) -> None:
-        """ Call this if we end the simulation early """
+        """ Call this when done with the simulation, or to end it early.
+        Snapshot arrays that were not copied must not be used afterwards. """
         if self._started and not self._finished:
             m.mcell_flush_data(self._world)
             m.mcell_print_final_warnings(self._world)
             m.mcell_print_final_statistics(self._world)
             self._finished = True
+        m.mcell_free_snapshot(self._world)
+        self._count_labels = []
 
 
 def create_partitions(world, axis, start, stop, step):
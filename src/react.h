@@ -252,8 +252,10 @@ bool product_tile_can_be_reached(struct wall *target,
 
 //This function creates a queryOptions object for designing an NFSim experiment query
 queryOptions initializeNFSimQueryForUnimolecularReactions(struct abstract_molecule *);
-int initializeNFSimReaction(struct volume* state, struct rxn*, int, void*,
-                            struct abstract_molecule*, struct abstract_molecule *);
+struct nfsim_path;
+int initializeNFSimReaction(struct volume* state, struct rxn*, int, int,
+                            struct nfsim_path *, struct abstract_molecule*,
+                            struct abstract_molecule *);
 
 int trigger_bimolecular_nfsim(struct volume* state, struct abstract_molecule *,
                         struct abstract_molecule *,short,
@@ -40,6 +40,7 @@
 #include "mcell_reactions.h"
 
 #include "diffuse.h"
+#include "mol_index.h"
 
 static int outcome_products_random(struct volume *world, struct wall *w,
                                    struct vector3 *hitpt, double t,
@@ -178,15 +179,10 @@ place_volume_product(struct volume *world, struct species *product_species, stru
   new_volume_mol->t = t;
   new_volume_mol->t2 = 0.0;
 
-  new_volume_mol->periodic_box = CHECKED_MALLOC_STRUCT(struct periodic_image,
-    "periodic image descriptor");
-  new_volume_mol->periodic_box->x = periodic_box->x;
-  new_volume_mol->periodic_box->y = periodic_box->y;
-  new_volume_mol->periodic_box->z = periodic_box->z;
+  new_volume_mol->periodic_box = new_periodic_image(world, periodic_box);
 
   new_volume_mol->properties = product_species;
   new_volume_mol->graph_data = graph;
-  initialize_diffusion_function((struct abstract_molecule*) new_volume_mol);
 
   new_volume_mol->prev_v = NULL;
   new_volume_mol->next_v = NULL;
@@ -198,7 +194,7 @@ place_volume_product(struct volume *world, struct species *product_species, stru
   //XXX: is this the best way?
 
 
-  if (new_volume_mol->get_space_step(new_volume_mol) > 0.0)
+  if (mol_space_step(new_volume_mol) > 0.0)
     new_volume_mol->flags |= ACT_DIFFUSE;
   if ((product_species->flags & COUNT_SOME_MASK) != 0)
     new_volume_mol->flags |= COUNT_ME;
@@ -211,7 +207,7 @@ place_volume_product(struct volume *world, struct species *product_species, stru
 
   /* If this product resulted from a surface rxn, store the previous wall
    * position. */
-  if (sm_reactant && distinguishable(new_volume_mol->get_diffusion(new_volume_mol), 0, EPS_C)) {
+  if (sm_reactant && distinguishable(mol_diffusion(new_volume_mol), 0, EPS_C)) {
     new_volume_mol->previous_wall = sm_reactant->grid->surface;
 
     /* This will be overwritten with orientation in the CLAMPED/surf.
@@ -273,15 +269,10 @@ place_sm_product(struct volume *world, struct species *product_species, struct g
   new_surf_mol->properties = product_species;
   //nfsim graph init
   new_surf_mol->graph_data = graph;
-  initialize_diffusion_function((struct abstract_molecule*) new_surf_mol);
-  new_surf_mol->periodic_box = CHECKED_MALLOC_STRUCT(struct periodic_image,
-    "periodic image descriptor");
-  new_surf_mol->periodic_box->x = periodic_box->x;
-  new_surf_mol->periodic_box->y = periodic_box->y;
-  new_surf_mol->periodic_box->z = periodic_box->z;
+  new_surf_mol->periodic_box = new_periodic_image(world, periodic_box);
 
   new_surf_mol->flags = TYPE_SURF | ACT_NEWBIE | IN_SCHEDULE;
-  if (new_surf_mol->get_space_step(new_surf_mol) > 0)
+  if (mol_space_step(new_surf_mol) > 0)
     new_surf_mol->flags |= ACT_DIFFUSE;
   if (product_species->flags & COUNT_ENCLOSED)
     new_surf_mol->flags |= COUNT_ME;
@@ -305,6 +296,7 @@ place_sm_product(struct volume *world, struct species *product_species, struct g
   }
   grid->sm_list[grid_index] = add_surfmol_with_unique_pb_to_list(
     grid->sm_list[grid_index], new_surf_mol);
+  update_tile_occupancy(grid, grid_index);
 
   /* Add to the schedule. */
   if (schedule_add(sv->local_storage->timer, new_surf_mol))
@@ -457,10 +449,10 @@ static int outcome_products_random(struct volume *world, struct wall *w,
     rxn_uv_idx = uv2grid(&rxn_uv_pos, w->grid);
 
     /* find out number of static surface reactants */
-    if ((sm_1 != NULL) && (!distinguishable(sm_1->get_diffusion(sm_1), 0, EPS_C))){
+    if ((sm_1 != NULL) && (!distinguishable(mol_diffusion(sm_1), 0, EPS_C))){
       num_surface_static_reactants++;
     }
-    if ((sm_2 != NULL) && (!distinguishable(sm_2->get_diffusion(sm_2), 0, EPS_C))){
+    if ((sm_2 != NULL) && (!distinguishable(mol_diffusion(sm_2), 0, EPS_C))){
       num_surface_static_reactants++;
     }
   }
@@ -499,8 +491,7 @@ static int outcome_products_random(struct volume *world, struct wall *w,
       /* Create list of vacant tiles */
       for (struct tile_neighbor *tile_nbr = tile_nbr_head; tile_nbr != NULL;
            tile_nbr = tile_nbr->next) {
-        struct surface_molecule_list *sm_list = tile_nbr->grid->sm_list[tile_nbr->idx]; 
-        if (sm_list == NULL || sm_list->sm == NULL) {
+        if (!tile_occupied(tile_nbr->grid, tile_nbr->idx)) {
           num_vacant_tiles++;
           push_tile_neighbor_to_list(&tile_vacant_nbr_head, tile_nbr->grid, tile_nbr->idx);
         }
@@ -712,9 +703,9 @@ static int outcome_products_random(struct volume *world, struct wall *w,
     } else if (num_surface_products > 1) {
       /* more than one surface products */
       if (num_surface_static_reactants > 0) {
-        bool replace_reacA = (!distinguishable(reacA->get_diffusion(reacA), 0, EPS_C)) && replace_p1;
+        bool replace_reacA = (!distinguishable(mol_diffusion(reacA), 0, EPS_C)) && replace_p1;
         bool replace_reacB =
-            (reacB == NULL) ? false : (!distinguishable(reacB->get_diffusion(reacB), 0, EPS_C)) && replace_p2;
+            (reacB == NULL) ? false : (!distinguishable(mol_diffusion(reacB), 0, EPS_C)) && replace_p2;
 
         if (replace_reacA || replace_reacB) {
           int max_static_count = (num_surface_static_products < num_surface_static_reactants)
@@ -1001,6 +992,7 @@ static int outcome_products_random(struct volume *world, struct wall *w,
 
     /* Update molecule counts */
     ++product_species->population;
+    mol_index_add(this_product);
     if (product_species->flags & (COUNT_CONTENTS | COUNT_ENCLOSED))
       count_region_from_scratch(world, this_product, NULL, 1, NULL, NULL, t, this_product->periodic_box);
 
@@ -1134,6 +1126,7 @@ int outcome_unimolecular(struct volume *world, struct rxn *rx, int path,
       }
     } else {
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SCHEDULE) {
         sm->grid->subvol->local_storage->timer->defunct_count++;
@@ -1144,7 +1137,7 @@ int outcome_unimolecular(struct volume *world, struct rxn *rx, int path,
       }
     }
 
-    free(reac->periodic_box);
+    free_periodic_image(world, reac->periodic_box);
     who_was_i->n_deceased++;
     double t_time = convert_iterations_to_seconds(
         world->start_iterations, world->time_unit,
@@ -1152,6 +1145,7 @@ int outcome_unimolecular(struct volume *world, struct rxn *rx, int path,
     who_was_i->cum_lifetime_seconds += t_time - reac->birthday;
 
     who_was_i->population--;
+    mol_index_remove(who_was_i, reac);
     if (vm != NULL)
       collect_molecule(vm);
     else {
@@ -1247,6 +1241,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
       sm = (struct surface_molecule *)reacB;
 
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SURFACE)
         sm->flags -= IN_SURFACE;
@@ -1266,7 +1261,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
       count_region_from_scratch(world, reacB, NULL, -1, NULL, NULL, t, reacB->periodic_box);
     }
 
-    free(reacB->periodic_box);
+    free_periodic_image(world, reacB->periodic_box);
     reacB->periodic_box = NULL;
     reacB->properties->n_deceased++;
     double t_time = convert_iterations_to_seconds(
@@ -1274,6 +1269,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
         world->simulation_start_seconds, t);
     reacB->properties->cum_lifetime_seconds += t_time - reacB->birthday;
     reacB->properties->population--;
+    mol_index_remove(reacB->properties, reacB);
 
     if (vm != NULL)
       collect_molecule(vm);
@@ -1287,6 +1283,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
       sm = (struct surface_molecule *)reacA;
 
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SCHEDULE) {
         sm->grid->subvol->local_storage->timer->defunct_count++;
@@ -1334,7 +1331,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
       }
     }
 
-    free(reacA->periodic_box);
+    free_periodic_image(world, reacA->periodic_box);
     reacA->periodic_box = NULL;
     reacA->properties->n_deceased++;
     double t_time = convert_iterations_to_seconds(
@@ -1342,6 +1339,7 @@ int outcome_bimolecular(struct volume *world, struct rxn *rx, int path,
         world->simulation_start_seconds, t);
     reacA->properties->cum_lifetime_seconds += t_time - reacA->birthday;
     reacA->properties->population--;
+    mol_index_remove(reacA->properties, reacA);
 
     if (vm != NULL)
       collect_molecule(vm);
@@ -1433,13 +1431,14 @@ int outcome_intersect(struct volume *world, struct rxn *rx, int path,
                                     t, reac->periodic_box);
         }
       }
-      free(reac->periodic_box);
+      free_periodic_image(world, reac->periodic_box);
       reac->properties->n_deceased++;
       double t_time = convert_iterations_to_seconds(
           world->start_iterations, world->time_unit,
           world->simulation_start_seconds, t);
       reac->properties->cum_lifetime_seconds += t_time - reac->birthday;
       reac->properties->population--;
+      mol_index_remove(reac->properties, reac);
       if (vm->flags & IN_SCHEDULE) {
         vm->subvol->local_storage->timer->defunct_count++;
       }
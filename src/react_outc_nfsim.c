@@ -736,18 +736,11 @@ void properties_nfsim(struct volume *world, struct abstract_molecule *reac) {
     reac->graph_data->graph_diffusion = -1;
     reac->graph_data->space_step = -1;
     reac->graph_data->time_step = -1;
-    reac->get_diffusion = get_standard_diffusion;
-    reac->get_space_step = get_standard_space_step;
-    reac->get_time_step = get_standard_time_step;
   }
   mapvector_delete(results);
 
   // now lets get information about the reactionality of this reactant
-  if (calculate_nfsim_reactivity(reac->graph_data)) {
-    reac->get_flags = get_nfsim_flags;
-  } else {
-    reac->get_flags = get_standard_flags;
-  }
+  calculate_nfsim_reactivity(reac->graph_data);
 
   free(options.optionValues[0]);
   free(options.optionValues);
@@ -37,6 +37,7 @@
 #include "react.h"
 #include "vol_util.h"
 #include "wall_util.h"
+#include "mol_index.h"
 
 static int outcome_products_trimol_reaction_random(
     struct volume *world, struct wall *w, struct vector3 *hitpt, double t,
@@ -687,8 +688,7 @@ static int outcome_products_trimol_reaction_random(
       /* Create list of vacant tiles */
       for (tile_nbr = tile_nbr_head; tile_nbr != NULL;
            tile_nbr = tile_nbr->next) {
-        struct surface_molecule_list *sm_list = tile_nbr->grid->sm_list[tile_nbr->idx];
-        if (sm_list == NULL || sm_list->sm == NULL) {
+        if (!tile_occupied(tile_nbr->grid, tile_nbr->idx)) {
           num_vacant_tiles++;
           push_tile_neighbor_to_list(&tile_vacant_nbr_head, tile_nbr->grid,
                                      tile_nbr->idx);
@@ -1706,6 +1706,7 @@ static int outcome_products_trimol_reaction_random(
 
     /* Update molecule counts */
     ++product_species->population;
+    mol_index_add(this_product);
     if (product_species->flags & (COUNT_CONTENTS | COUNT_ENCLOSED))
       count_region_from_scratch(world, this_product, NULL, 1, NULL, NULL, t, NULL);
   }
@@ -1850,6 +1851,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
     if ((reacC->properties->flags & ON_GRID) != 0) {
       sm = (struct surface_molecule *)reacC;
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SURFACE)
         sm->flags -= IN_SURFACE;
@@ -1875,6 +1877,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
         world->simulation_start_seconds, t);
     reacC->properties->cum_lifetime_seconds += t_time - reacC->birthday;
     reacC->properties->population--;
+    mol_index_remove(reacC->properties, reacC);
     if (vm != NULL)
       collect_molecule(vm);
     else {
@@ -1889,6 +1892,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
     if ((reacB->properties->flags & ON_GRID) != 0) {
       sm = (struct surface_molecule *)reacB;
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SURFACE)
         sm->flags -= IN_SURFACE;
@@ -1914,6 +1918,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
         world->simulation_start_seconds, t);
     reacB->properties->cum_lifetime_seconds += t_time - reacB->birthday;
     reacB->properties->population--;
+    mol_index_remove(reacB->properties, reacB);
     if (vm != NULL)
       collect_molecule(vm);
     else {
@@ -1928,6 +1933,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
     if ((reacA->properties->flags & ON_GRID) != 0) {
       sm = (struct surface_molecule *)reacA;
       remove_surfmol_from_list(&sm->grid->sm_list[sm->grid_index], sm);
+      update_tile_occupancy(sm->grid, sm->grid_index);
       sm->grid->n_occupied--;
       if (sm->flags & IN_SURFACE)
         sm->flags -= IN_SURFACE;
@@ -1982,6 +1988,7 @@ int outcome_trimolecular(struct volume *world, struct rxn *rx, int path,
         world->simulation_start_seconds, t);
     reacA->properties->cum_lifetime_seconds += t_time - reacA->birthday;
     reacA->properties->population--;
+    mol_index_remove(reacA->properties, reacA);
     if (vm != NULL)
       collect_molecule(vm);
     else
@@ -37,8 +37,10 @@
 #include "sched_util.h"
 #include "mcell_structs.h"
 #include "react_output.h"
+#include "react_output_bin.h"
 #include "mdlparse_util.h"
 #include "strfunc.h"
+#include "domain_ranks.h"
 
 // XXX: This global state should be removed. Currently
 // we need it for cleanup via signals.
@@ -67,6 +69,9 @@ int truncate_output_file(char *name, double start_value) {
   if (fs.st_size == 0)
     return 0; /* File already is empty */
 
+  if (is_binary_reaction_output(name))
+    return truncate_binary_output_file(name, start_value);
+
   /* Set the buffer size */
   off_t bsize;
   if (fs.st_size < (1 << 20)) {
@@ -403,7 +408,8 @@ flush_reaction_output:
    In: nothing
    Out: 0 on success, 1 on error (memory allocation or file I/O).
         Writes all remaining trigger events in buffers to disk.
-        (Do this before ending the simulation.)
+        (Do this before ending the simulation.)  Binary output is on disk
+        once this returns.
 *************************************************************************/
 int flush_reaction_output(struct volume *world) {
   struct schedule_helper *sh;
@@ -428,18 +434,148 @@ int flush_reaction_output(struct volume *world) {
     }
   }
 
+  if (world->use_binary_reaction_output)
+    n_errors += finish_binary_reaction_output();
+
   return n_errors;
 }
 
+/* A counter read by the expression of a reaction output column */
+struct oexpr_leaf {
+  void *value;
+  int is_int;
+  double saved;
+};
+
 /**************************************************************************
-update_reaction_output:
-  In: the output_block we want to update
-  Out: 0 on success, 1 on failure.
-       The counters in this block are updated, and the block is
-       rescheduled for the next output time.  The counters are saved
-       to an internal buffer, and written out when full.
+collect_oexpr_leaves:
+  In: root: expression tree of a reaction output column
+      leaves: array to fill in, or NULL to only count the leaves
+      n_leaves: number of leaves collected so far
+  Out: The number of leaves collected so far, including those of this tree.
+       Constant subtrees are skipped since they are never reevaluated.
 **************************************************************************/
-int update_reaction_output(struct volume *world, struct output_block *block) {
+static int collect_oexpr_leaves(struct output_expression *root,
+                                struct oexpr_leaf *leaves, int n_leaves) {
+  if (root->expr_flags & OEXPR_TYPE_CONST)
+    return n_leaves;
+
+  if (root->left != NULL) {
+    int type = root->expr_flags & OEXPR_LEFT_MASK;
+    if (type == OEXPR_LEFT_INT || type == OEXPR_LEFT_DBL) {
+      if (leaves != NULL) {
+        leaves[n_leaves].value = root->left;
+        leaves[n_leaves].is_int = (type == OEXPR_LEFT_INT);
+      }
+      n_leaves++;
+    } else if (type == OEXPR_LEFT_OEXPR)
+      n_leaves = collect_oexpr_leaves((struct output_expression *)root->left,
+                                      leaves, n_leaves);
+  }
+  if (root->right != NULL) {
+    int type = root->expr_flags & OEXPR_RIGHT_MASK;
+    if (type == OEXPR_RIGHT_INT || type == OEXPR_RIGHT_DBL) {
+      if (leaves != NULL) {
+        leaves[n_leaves].value = root->right;
+        leaves[n_leaves].is_int = (type == OEXPR_RIGHT_INT);
+      }
+      n_leaves++;
+    } else if (type == OEXPR_RIGHT_OEXPR)
+      n_leaves = collect_oexpr_leaves((struct output_expression *)root->right,
+                                      leaves, n_leaves);
+  }
+  return n_leaves;
+}
+
+/**************************************************************************
+sum_counters_over_ranks:
+  In: world: simulation state
+      blocks: the output_blocks about to be updated
+      n_blocks: number of blocks
+      n_leaves: set to the number of counters read by the blocks
+  Out: The counters read by the blocks together with their values on this
+       rank, or NULL if there are none.  Each counter holds its sum over all
+       ranks until restore_rank_counters is called.  All of them are summed
+       in a single exchange between the ranks.
+**************************************************************************/
+static struct oexpr_leaf *sum_counters_over_ranks(struct volume *world,
+                                                  struct output_block **blocks,
+                                                  int n_blocks,
+                                                  int *n_leaves) {
+  int n = 0;
+  for (int b = 0; b < n_blocks; b++) {
+    int i = blocks[b]->buf_index;
+    for (struct output_set *set = blocks[b]->data_set_head; set != NULL;
+         set = set->next)
+      for (struct output_column *column = set->column_head; column != NULL;
+           column = column->next)
+        if (column->buffer[i].data_type != COUNT_TRIG_STRUCT)
+          n = collect_oexpr_leaves(column->expr, NULL, n);
+  }
+
+  *n_leaves = n;
+  if (n == 0)
+    return NULL;
+
+  struct oexpr_leaf *leaves =
+      CHECKED_MALLOC_ARRAY(struct oexpr_leaf, n, "counters summed over ranks");
+  n = 0;
+  for (int b = 0; b < n_blocks; b++) {
+    int i = blocks[b]->buf_index;
+    for (struct output_set *set = blocks[b]->data_set_head; set != NULL;
+         set = set->next)
+      for (struct output_column *column = set->column_head; column != NULL;
+           column = column->next)
+        if (column->buffer[i].data_type != COUNT_TRIG_STRUCT)
+          n = collect_oexpr_leaves(column->expr, leaves, n);
+  }
+
+  /* A counter read by several columns is summed once per column; every
+   * copy is saved before any sum is stored. */
+  double *sums = CHECKED_MALLOC_ARRAY(double, n, "counters summed over ranks");
+  for (int j = 0; j < n; j++) {
+    if (leaves[j].is_int)
+      leaves[j].saved = (double)*((int *)leaves[j].value);
+    else
+      leaves[j].saved = *((double *)leaves[j].value);
+    sums[j] = leaves[j].saved;
+  }
+  domain_sum(world, sums, n);
+  for (int j = 0; j < n; j++) {
+    if (leaves[j].is_int)
+      *((int *)leaves[j].value) = (int)sums[j];
+    else
+      *((double *)leaves[j].value) = sums[j];
+  }
+  free(sums);
+  return leaves;
+}
+
+/**************************************************************************
+restore_rank_counters:
+  In: leaves: counters returned by sum_counters_over_ranks
+      n_leaves: number of counters
+  Out: No return value.  The counters are back to their values on this rank.
+**************************************************************************/
+static void restore_rank_counters(struct oexpr_leaf *leaves, int n_leaves) {
+  for (int j = 0; j < n_leaves; j++) {
+    if (leaves[j].is_int)
+      *((int *)leaves[j].value) = (int)leaves[j].saved;
+    else
+      *((double *)leaves[j].value) = leaves[j].saved;
+  }
+  free(leaves);
+}
+
+/**************************************************************************
+update_block_output:
+  In: world: simulation state
+      block: the output_block we want to update
+  Out: 0 on success, 1 on failure.  As update_reaction_output, with the
+       counters already summed over the ranks.
+**************************************************************************/
+static int update_block_output(struct volume *world,
+                               struct output_block *block) {
   int report_as_non_trigger = 1;
   int i = block->buf_index;
   if (block->data_set_head != NULL &&
@@ -606,6 +742,47 @@ int update_reaction_output(struct volume *world, struct output_block *block) {
   return 0;
 }
 
+/**************************************************************************
+update_reaction_outputs:
+  In: world: simulation state
+      blocks: the output_blocks due now
+      n_blocks: number of blocks
+  Out: 0 on success, 1 on failure.
+       Every block is updated as by update_reaction_output.  When the world
+       is split across ranks, the counters of all the blocks are summed over
+       the ranks together, so that an output time costs one exchange however
+       many blocks are due.
+**************************************************************************/
+int update_reaction_outputs(struct volume *world, struct output_block **blocks,
+                            int n_blocks) {
+  /* Each rank only counts its own part of the world */
+  int n_rank_counters = 0;
+  struct oexpr_leaf *rank_counters = NULL;
+  if (world->ranks != NULL)
+    rank_counters =
+        sum_counters_over_ranks(world, blocks, n_blocks, &n_rank_counters);
+
+  int err = 0;
+  for (int b = 0; b < n_blocks && !err; b++)
+    err = update_block_output(world, blocks[b]);
+
+  if (rank_counters != NULL)
+    restore_rank_counters(rank_counters, n_rank_counters);
+  return err;
+}
+
+/**************************************************************************
+update_reaction_output:
+  In: the output_block we want to update
+  Out: 0 on success, 1 on failure.
+       The counters in this block are updated, and the block is
+       rescheduled for the next output time.  The counters are saved
+       to an internal buffer, and written out when full.
+**************************************************************************/
+int update_reaction_output(struct volume *world, struct output_block *block) {
+  return update_reaction_outputs(world, &block, 1);
+}
+
 /**************************************************************************
  check_reaction_output_file:
     Check that the reaction output file is writable within the policy set by
@@ -772,6 +949,10 @@ int write_reaction_output(struct volume *world, struct output_set *set) {
   u_int n_output;
   u_int i;
 
+  /* Rank 0 writes the output of a distributed run */
+  if (world->procnum != 0)
+    return 0;
+
   switch (set->file_flags) {
   case FILE_OVERWRITE:
   case FILE_CREATE:
@@ -796,6 +977,10 @@ int write_reaction_output(struct volume *world, struct output_set *set) {
         set->file_flags, set->outfile_name);
   }
 
+  if (world->use_binary_reaction_output &&
+      set->column_head->buffer[0].data_type != COUNT_TRIG_STRUCT)
+    return write_binary_reaction_output(world, set, mode);
+
   fp = open_file(set->outfile_name, mode);
   if (fp == NULL)
     return 1;
@@ -42,6 +42,8 @@ int flush_reaction_output(struct volume *world);
 int check_reaction_output_file(struct output_set *os);
 
 int update_reaction_output(struct volume *world, struct output_block *block);
+int update_reaction_outputs(struct volume *world, struct output_block **blocks,
+                            int n_blocks);
 
 int write_reaction_output(struct volume *world, struct output_set *set);
 
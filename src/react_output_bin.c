@@ -0,0 +1,606 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Binary reaction data output.
+ *
+ * With -binary_reaction_output the buffered values of each reaction data
+ * file are written as rows of doubles (see react_output_bin.h for the
+ * layout) instead of being formatted with fprintf.  Trigger output keeps
+ * the text format.
+ *
+ * The values are copied out of the output block on the main thread, so the
+ * block's buffers can be refilled right away, and the copies are written by
+ * a background thread.  Jobs are written in the order they were queued, so
+ * chunks of one file can't overtake each other.  The main thread only
+ * waits for the writer when more than RXN_BIN_MAX_PENDING bytes are queued,
+ * and when the output is finished.  Write errors are reported on the main
+ * thread by the next call, or by finish_binary_reaction_output. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "mem_util.h"
+#include "react_output_bin.h"
+
+/* Queued bytes above which the main thread waits for the writer */
+#define RXN_BIN_MAX_PENDING (64 << 20)
+
+/* Offsets of the fixed part of the header */
+#define RXN_BIN_FIXED_HEADER 28
+#define RXN_BIN_OFS_VERSION 8
+#define RXN_BIN_OFS_HEADER_BYTES 12
+#define RXN_BIN_OFS_N_COLUMNS 16
+
+/* Values of one reaction data file waiting to be written */
+struct rxn_bin_job {
+  struct rxn_bin_job *next;
+  char *file_name;
+  int append;      /* Append to the file rather than truncate it */
+  char *header;    /* Header if this is the first chunk, or NULL */
+  size_t header_len;
+  u_int n_columns;
+  double *rows;
+  size_t n_values; /* Number of doubles in rows */
+};
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_room = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static int writer_running = 0;
+static int writer_stop = 0;
+static int writer_busy = 0; /* The writer thread is writing a job */
+static struct rxn_bin_job *queue_head = NULL;
+static struct rxn_bin_job *queue_tail = NULL;
+static size_t queue_bytes = 0;
+
+/* First failed write that hasn't been reported yet */
+static int writer_errors = 0;
+static int writer_err = 0;
+static char *writer_err_name = NULL;
+static u_int writer_err_columns = 0;
+
+/*************************************************************************
+job_bytes:
+  In: job: queued job
+  Out: number of bytes the job holds
+*************************************************************************/
+static size_t job_bytes(struct rxn_bin_job *job) {
+  return job->header_len + job->n_values * sizeof(double);
+}
+
+/*************************************************************************
+free_job:
+  In: job: job that was written or failed
+  Out: No return value.  The job is freed.
+*************************************************************************/
+static void free_job(struct rxn_bin_job *job) {
+  free(job->file_name);
+  free(job->header);
+  free(job->rows);
+  free(job);
+}
+
+/*************************************************************************
+write_job:
+  In: job: job to write
+  Out: 0 on success, errno if the file couldn't be written, or -1 if it
+       already holds something other than binary reaction data with the
+       same number of columns.
+*************************************************************************/
+static int write_job(struct rxn_bin_job *job) {
+  FILE *f = fopen(job->file_name, job->append ? "a+b" : "wb");
+  if (f == NULL)
+    return errno;
+
+  int err = 0;
+  if (fseek(f, 0, SEEK_END) != 0) {
+    err = errno;
+    goto done;
+  }
+  long size = ftell(f);
+  if (size < 0) {
+    err = errno;
+    goto done;
+  }
+
+  if (job->header != NULL) {
+    if (size == 0) {
+      if (fwrite(job->header, 1, job->header_len, f) != job->header_len) {
+        err = errno ? errno : EIO;
+        goto done;
+      }
+    } else {
+      /* Appending to an existing file: it must be in the same format */
+      char fixed[RXN_BIN_FIXED_HEADER];
+      uint32_t n_columns;
+      if (fseek(f, 0, SEEK_SET) != 0 ||
+          fread(fixed, 1, sizeof(fixed), f) != sizeof(fixed)) {
+        err = -1;
+        goto done;
+      }
+      uint32_t version;
+      memcpy(&version, fixed + RXN_BIN_OFS_VERSION, sizeof(version));
+      memcpy(&n_columns, fixed + RXN_BIN_OFS_N_COLUMNS, sizeof(n_columns));
+      if (memcmp(fixed, RXN_BIN_MAGIC, 8) != 0 ||
+          version != RXN_BIN_VERSION || n_columns != job->n_columns) {
+        err = -1;
+        goto done;
+      }
+    }
+  }
+
+  if (fwrite(job->rows, sizeof(double), job->n_values, f) != job->n_values)
+    err = errno ? errno : EIO;
+
+done:
+  if (fclose(f) != 0 && err == 0)
+    err = errno;
+  return err;
+}
+
+/*************************************************************************
+record_error:
+  In: job: job that failed
+      err: what write_job returned
+  Out: No return value.  The failure is kept for the main thread to report.
+       Must be called with writer_lock held.
+*************************************************************************/
+static void record_error(struct rxn_bin_job *job, int err) {
+  writer_errors++;
+  if (writer_err_name == NULL) {
+    writer_err = err;
+    writer_err_columns = job->n_columns;
+    writer_err_name = job->file_name;
+    job->file_name = NULL;
+  }
+}
+
+/*************************************************************************
+report_errors:
+  In: No arguments.
+  Out: Number of failed writes since the last call.  The first one is
+       reported.
+*************************************************************************/
+static int report_errors(void) {
+  pthread_mutex_lock(&writer_lock);
+  int n_errors = writer_errors;
+  int err = writer_err;
+  char *name = writer_err_name;
+  u_int n_columns = writer_err_columns;
+  writer_errors = 0;
+  writer_err_name = NULL;
+  pthread_mutex_unlock(&writer_lock);
+
+  if (name != NULL) {
+    if (err == -1)
+      mcell_error_nodie("Reaction data output file '%s' exists, but doesn't "
+                        "hold binary reaction data with %u columns.",
+                        name, n_columns);
+    else
+      mcell_perror_nodie(err, "Failed to write binary reaction data output "
+                              "file '%s'.",
+                         name);
+    free(name);
+  }
+  return n_errors;
+}
+
+/*************************************************************************
+rxn_bin_writer:
+  In: unused
+  Out: NULL.  Writes queued jobs until told to stop and nothing is left.
+*************************************************************************/
+static void *rxn_bin_writer(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&writer_lock);
+  for (;;) {
+    while (queue_head == NULL && !writer_stop)
+      pthread_cond_wait(&writer_wake, &writer_lock);
+    struct rxn_bin_job *job = queue_head;
+    if (job == NULL)
+      break;
+    queue_head = job->next;
+    if (queue_head == NULL)
+      queue_tail = NULL;
+    writer_busy = 1;
+    pthread_mutex_unlock(&writer_lock);
+
+    int err = write_job(job);
+
+    pthread_mutex_lock(&writer_lock);
+    writer_busy = 0;
+    queue_bytes -= job_bytes(job);
+    if (err != 0)
+      record_error(job, err);
+    pthread_cond_broadcast(&writer_room);
+    free_job(job);
+  }
+  pthread_mutex_unlock(&writer_lock);
+  return NULL;
+}
+
+/*************************************************************************
+queue_job:
+  In: job: job to write
+  Out: No return value.  The job is handed to the writer thread, which is
+       started if needed.  If it can't be started, the job is written
+       right away.
+*************************************************************************/
+static void queue_job(struct rxn_bin_job *job) {
+  pthread_mutex_lock(&writer_lock);
+  if (!writer_running) {
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, rxn_bin_writer, NULL) == 0)
+      writer_running = 1;
+  }
+  if (!writer_running) {
+    pthread_mutex_unlock(&writer_lock);
+    int err = write_job(job);
+    pthread_mutex_lock(&writer_lock);
+    if (err != 0)
+      record_error(job, err);
+    pthread_mutex_unlock(&writer_lock);
+    free_job(job);
+    return;
+  }
+
+  while (queue_head != NULL && queue_bytes > RXN_BIN_MAX_PENDING)
+    pthread_cond_wait(&writer_room, &writer_lock);
+  job->next = NULL;
+  if (queue_tail != NULL)
+    queue_tail->next = job;
+  else
+    queue_head = job;
+  queue_tail = job;
+  queue_bytes += job_bytes(job);
+  pthread_cond_signal(&writer_wake);
+  pthread_mutex_unlock(&writer_lock);
+}
+
+/*************************************************************************
+append_bytes:
+  In: buf: header being built
+      pos: where to put the bytes
+      data: bytes to append
+      len: number of bytes
+  Out: position after the bytes
+*************************************************************************/
+static size_t append_bytes(char *buf, size_t pos, void const *data,
+                           size_t len) {
+  memcpy(buf + pos, data, len);
+  return pos + len;
+}
+
+/*************************************************************************
+column_type:
+  In: column: reaction data column
+      n_output: number of buffered values
+  Out: RXN_BIN_INT or RXN_BIN_DBL.  Counts on meshes that don't exist yet
+       have no type in their expression; they take the type of the first
+       value that is set, and are integers if none is, as
+       dyngeom.c:reset_count_type assumes.
+*************************************************************************/
+static uint8_t column_type(struct output_column *column, u_int n_output) {
+  switch (column->expr->expr_flags & OEXPR_TYPE_MASK) {
+  case OEXPR_TYPE_INT:
+    return RXN_BIN_INT;
+  case OEXPR_TYPE_DBL:
+    return RXN_BIN_DBL;
+  default:
+    break;
+  }
+  for (u_int i = 0; i < n_output; i++) {
+    if (column->buffer[i].data_type == COUNT_DBL)
+      return RXN_BIN_DBL;
+    if (column->buffer[i].data_type == COUNT_INT)
+      return RXN_BIN_INT;
+  }
+  return RXN_BIN_INT;
+}
+
+/*************************************************************************
+build_header:
+  In: set: reaction data file
+      n_columns: number of columns in set
+      n_output: number of buffered values
+      text_header: whether the text file would start with a header line
+      header_len: where to store the header length
+  Out: the header of a new binary file for set, or NULL if out of memory
+*************************************************************************/
+static char *build_header(struct output_set *set, u_int n_columns,
+                          u_int n_output, int text_header,
+                          size_t *header_len) {
+  char const *comment = text_header ? set->header_comment : "";
+  size_t len = RXN_BIN_FIXED_HEADER + strlen(comment);
+  struct output_column *column;
+  for (column = set->column_head; column != NULL; column = column->next) {
+    char const *title =
+        (column->expr->title != NULL) ? column->expr->title : "untitled";
+    len += 1 + sizeof(uint32_t) + strlen(title);
+  }
+
+  char *header =
+      CHECKED_MALLOC_ARRAY_NODIE(char, len, "binary reaction data header");
+  if (header == NULL)
+    return NULL;
+
+  uint32_t version = RXN_BIN_VERSION;
+  uint32_t header_bytes = (uint32_t)len;
+  uint32_t columns = n_columns;
+  uint32_t flags = text_header ? RXN_BIN_TEXT_HEADER : 0;
+  if (set->block->timer_type == OUTPUT_BY_ITERATION_LIST)
+    flags |= RXN_BIN_ITERATIONS;
+  uint32_t comment_len = (uint32_t)strlen(comment);
+
+  size_t pos = append_bytes(header, 0, RXN_BIN_MAGIC, 8);
+  pos = append_bytes(header, pos, &version, sizeof(version));
+  pos = append_bytes(header, pos, &header_bytes, sizeof(header_bytes));
+  pos = append_bytes(header, pos, &columns, sizeof(columns));
+  pos = append_bytes(header, pos, &flags, sizeof(flags));
+  pos = append_bytes(header, pos, &comment_len, sizeof(comment_len));
+  pos = append_bytes(header, pos, comment, comment_len);
+  for (column = set->column_head; column != NULL; column = column->next) {
+    char const *title =
+        (column->expr->title != NULL) ? column->expr->title : "untitled";
+    uint8_t type = column_type(column, n_output);
+    uint32_t title_len = (uint32_t)strlen(title);
+    pos = append_bytes(header, pos, &type, sizeof(type));
+    pos = append_bytes(header, pos, &title_len, sizeof(title_len));
+    pos = append_bytes(header, pos, title, title_len);
+  }
+
+  *header_len = pos;
+  return header;
+}
+
+/**************************************************************************
+write_binary_reaction_output:
+  In: world: simulation state
+      set: the (non-trigger) output set whose buffer is full or final
+      mode: "w" to start the file over, "a" to append to it
+  Out: 0 on success, 1 on failure.
+       The buffered values are copied and queued for the writer thread.
+       A failure may also be one of an earlier write.  Like
+       write_reaction_output, indices are not reset.
+**************************************************************************/
+int write_binary_reaction_output(struct volume *world, struct output_set *set,
+                                 char const *mode) {
+  int n_errors = report_errors();
+
+  u_int n_output = set->block->buffersize;
+  if (set->block->buf_index < set->block->buffersize)
+    n_output = set->block->buf_index;
+
+  if (world->notify->file_writes == NOTIFY_FULL)
+    mcell_log("Writing %d lines to output file %s.", n_output,
+              set->outfile_name);
+
+  u_int n_columns = 0;
+  struct output_column *column;
+  for (column = set->column_head; column != NULL; column = column->next)
+    n_columns++;
+
+  struct rxn_bin_job *job =
+      CHECKED_MALLOC_STRUCT_NODIE(struct rxn_bin_job, "binary reaction data");
+  if (job == NULL)
+    return 1;
+  memset(job, 0, sizeof(struct rxn_bin_job));
+  job->append = (mode[0] == 'a');
+  job->n_columns = n_columns;
+  job->n_values = (size_t)n_output * (1 + n_columns);
+  job->file_name = CHECKED_STRDUP_NODIE(set->outfile_name, "file name");
+  job->rows = CHECKED_MALLOC_ARRAY_NODIE(double, job->n_values + 1,
+                                         "binary reaction data");
+  if (job->file_name == NULL || job->rows == NULL) {
+    free_job(job);
+    return 1;
+  }
+
+  /* Same condition as for the header of a text file */
+  if (set->chunk_count == 0) {
+    int text_header =
+        set->header_comment != NULL && set->file_flags != FILE_APPEND &&
+        (world->chkpt_seq_num == 1 || set->file_flags == FILE_APPEND_HEADER ||
+         set->file_flags == FILE_CREATE || set->file_flags == FILE_OVERWRITE);
+    job->header = build_header(set, n_columns, n_output, text_header,
+                               &job->header_len);
+    if (job->header == NULL) {
+      free_job(job);
+      return 1;
+    }
+  }
+
+  double *row = job->rows;
+  for (u_int i = 0; i < n_output; i++) {
+    *row++ = set->block->time_array[i];
+    for (column = set->column_head; column != NULL; column = column->next) {
+      switch (column->buffer[i].data_type) {
+      case COUNT_INT:
+        *row++ = (double)column->buffer[i].val.ival;
+        break;
+
+      case COUNT_DBL:
+        *row++ = column->buffer[i].val.dval;
+        break;
+
+      case COUNT_UNSET:
+        *row++ = NAN;
+        break;
+
+      case COUNT_TRIG_STRUCT:
+      default:
+        if (column->expr->title != NULL)
+          mcell_warn("Unexpected data type in column titled '%s' -- "
+                     "writing 0.",
+                     column->expr->title);
+        else
+          mcell_warn("Unexpected data type in untitled column -- writing 0.");
+        *row++ = 0.0;
+        break;
+      }
+    }
+  }
+
+  queue_job(job);
+  set->chunk_count++;
+  return n_errors ? 1 : 0;
+}
+
+/**************************************************************************
+finish_binary_reaction_output:
+  In: No arguments.
+  Out: Number of writes that failed and weren't reported yet.  Waits until
+       everything queued is on disk and stops the writer thread.
+**************************************************************************/
+int finish_binary_reaction_output(void) {
+  pthread_mutex_lock(&writer_lock);
+  int running = writer_running;
+  if (running) {
+    writer_stop = 1;
+    pthread_cond_signal(&writer_wake);
+  }
+  pthread_mutex_unlock(&writer_lock);
+
+  if (running) {
+    pthread_join(writer_thread, NULL);
+    pthread_mutex_lock(&writer_lock);
+    writer_running = 0;
+    writer_stop = 0;
+    pthread_mutex_unlock(&writer_lock);
+  }
+  return report_errors();
+}
+
+/**************************************************************************
+binary_reaction_output_before_fork:
+  In: No arguments.
+  Out: No return value.  Waits until the writer thread is between jobs and
+       keeps it there, so that a copy of the process forked now (see
+       create_chkpt_in_background) inherits neither a held lock nor a file
+       buffer that is being filled.  Must be followed by
+       binary_reaction_output_after_fork in the parent and in the copy.
+**************************************************************************/
+void binary_reaction_output_before_fork(void) {
+  pthread_mutex_lock(&writer_lock);
+  while (writer_busy)
+    pthread_cond_wait(&writer_room, &writer_lock);
+}
+
+/**************************************************************************
+binary_reaction_output_after_fork:
+  In: No arguments.
+  Out: No return value.  Lets the writer thread go on.
+**************************************************************************/
+void binary_reaction_output_after_fork(void) {
+  pthread_mutex_unlock(&writer_lock);
+}
+
+/**************************************************************************
+is_binary_reaction_output:
+  In: name: file name
+  Out: 1 if the file holds binary reaction data, 0 if not
+**************************************************************************/
+int is_binary_reaction_output(char const *name) {
+  char magic[8];
+  FILE *f = fopen(name, "rb");
+  if (f == NULL)
+    return 0;
+  int is_binary = (fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                   memcmp(magic, RXN_BIN_MAGIC, sizeof(magic)) == 0);
+  fclose(f);
+  return is_binary;
+}
+
+/**************************************************************************
+truncate_binary_output_file:
+  In: name: binary reaction data file
+      start_value: value that we will start outputting to the file
+  Out: 0 if file preparation is successful, 1 if not.  The file is
+       truncated before the first row whose time is greater than or equal
+       to the value to be printed out, as truncate_output_file does for
+       text files.
+**************************************************************************/
+int truncate_binary_output_file(char const *name, double start_value) {
+  FILE *f = fopen(name, "r+b");
+  if (f == NULL) {
+    mcell_perror_nodie(errno, "Failed to open reaction data output file '%s' "
+                              "for truncation.",
+                       name);
+    return 1;
+  }
+
+  char fixed[RXN_BIN_FIXED_HEADER];
+  uint32_t header_bytes, n_columns;
+  struct stat fs;
+  if (fread(fixed, 1, sizeof(fixed), f) != sizeof(fixed) ||
+      fstat(fileno(f), &fs) != 0) {
+    mcell_error_nodie("Failed to read the header of reaction data output "
+                      "file '%s'.",
+                      name);
+    fclose(f);
+    return 1;
+  }
+  memcpy(&header_bytes, fixed + RXN_BIN_OFS_HEADER_BYTES, sizeof(uint32_t));
+  memcpy(&n_columns, fixed + RXN_BIN_OFS_N_COLUMNS, sizeof(uint32_t));
+
+  size_t row_bytes = (1 + (size_t)n_columns) * sizeof(double);
+  off_t n_rows = 0;
+  if (fs.st_size > (off_t)header_bytes)
+    n_rows = (fs.st_size - header_bytes) / (off_t)row_bytes;
+
+  /* Keep the rows before start_value, and drop a partial row at the end */
+  off_t keep = 0;
+  if (fseek(f, header_bytes, SEEK_SET) == 0) {
+    for (; keep < n_rows; keep++) {
+      double t;
+      if (fread(&t, sizeof(double), 1, f) != 1)
+        break;
+      if (t + EPS_C >= start_value)
+        break;
+      if (fseek(f, (long)(row_bytes - sizeof(double)), SEEK_CUR) != 0)
+        break;
+    }
+  }
+
+  int status = 0;
+  if (ftruncate(fileno(f), header_bytes + keep * (off_t)row_bytes)) {
+    mcell_perror_nodie(errno,
+                       "Failed to truncate reaction data output file '%s'",
+                       name);
+    status = 1;
+  }
+  fclose(f);
+  return status;
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/* Binary reaction data files, written with -binary_reaction_output.
+ *
+ * Layout (native byte order):
+ *   char     magic[8]       "MCELLRXB"
+ *   uint32_t version        RXN_BIN_VERSION
+ *   uint32_t header_bytes   offset of the first row
+ *   uint32_t n_columns      columns besides the time
+ *   uint32_t flags          RXN_BIN_* below
+ *   uint32_t comment_len    followed by the header comment (not terminated)
+ *   per column:
+ *     uint8_t  type         RXN_BIN_INT or RXN_BIN_DBL
+ *     uint32_t title_len    followed by the title (not terminated)
+ *   rows of 1 + n_columns doubles: the time, then one value per column,
+ *     NaN where the count is unset (its mesh doesn't exist at that time)
+ *
+ * The converter rxn_bin2txt prints a file in the text format MCell writes
+ * otherwise. */
+
+#define RXN_BIN_MAGIC "MCELLRXB"
+#define RXN_BIN_VERSION 2
+
+/* flags */
+#define RXN_BIN_ITERATIONS 0x1  /* times are iteration numbers, not seconds */
+#define RXN_BIN_TEXT_HEADER 0x2 /* the text file would start with a header */
+
+/* column types */
+#define RXN_BIN_INT 0
+#define RXN_BIN_DBL 1
+
+struct volume;
+struct output_set;
+
+int write_binary_reaction_output(struct volume *world, struct output_set *set,
+                                 char const *mode);
+
+int finish_binary_reaction_output(void);
+
+void binary_reaction_output_before_fork(void);
+void binary_reaction_output_after_fork(void);
+
+int is_binary_reaction_output(char const *name);
+
+int truncate_binary_output_file(char const *name, double start_value);
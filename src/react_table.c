@@ -0,0 +1,204 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Species-pair table of bimolecular reactions.
+ *
+ * To find the reactions between two molecules, trigger_bimolecular hashes
+ * the species' hash values into the reaction hash and walks the chain,
+ * comparing the players of each reaction.  This happens for every pair of
+ * molecules considered for a collision.  The table answers the same
+ * question with two array lookups: every species that is one of the first
+ * two players of a reaction gets a row with one entry per species, pointing
+ * to the list of reactions between the two.  The lists keep the order of
+ * the hash chains, so the reactions found (and thus the random numbers
+ * drawn when choosing between them) are the same as without the table.
+ *
+ * The table is built once the species are numbered.  It isn't built for
+ * NFSim models, whose species and reactions are created as the simulation
+ * goes, nor when it would get too large; the reaction hash is searched
+ * then, as it is for species created after the table was built. */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "react_table.h"
+
+/* Largest number of row entries (species with reactions times all
+ * species) the table may have, 8 MB of pointers on 64-bit machines */
+#define MAX_BIMOL_TABLE_ENTRIES (1 << 20)
+
+/* The list of a pair of species that don't react */
+struct rxn *no_bimol_rxns[1] = { NULL };
+
+/*************************************************************************
+bimol_pair_rxn:
+  In: world: simulation state
+      hash_bin: bin of the reaction hash the reaction is in
+      rx: a reaction
+  Out: 1 if trigger_bimolecular finds rx for its first two players when
+       searching the reaction hash, 0 otherwise.
+*************************************************************************/
+static int bimol_pair_rxn(struct volume *world, int hash_bin,
+                          struct rxn *rx) {
+  if (rx->n_reactants < 2)
+    return 0;
+
+  u_int hash = (rx->players[0]->hashval + rx->players[1]->hashval) &
+               (world->rx_hashsize - 1);
+  return (int)hash == hash_bin &&
+         rx->players[0]->species_id < (u_int)world->n_species &&
+         rx->players[1]->species_id < (u_int)world->n_species;
+}
+
+/*************************************************************************
+init_bimolecular_table:
+  In: world: simulation state, with species numbered
+  Out: 0 on success, 1 if we ran out of memory.  The species which react
+       with others get a row of the table; all species are marked as covered
+       by it.
+*************************************************************************/
+int init_bimolecular_table(struct volume *world) {
+  int n_species = world->n_species;
+  if (world->nfsim_flag || n_species == 0)
+    return 0;
+
+  /* Number the species that need a row */
+  int *row_of = CHECKED_MALLOC_ARRAY_NODIE(int, n_species, "table rows");
+  if (row_of == NULL)
+    return 1;
+  for (int i = 0; i < n_species; i++)
+    row_of[i] = -1;
+
+  int n_rows = 0;
+  for (int bin = 0; bin < world->rx_hashsize; bin++) {
+    for (struct rxn *rx = world->reaction_hash[bin]; rx != NULL;
+         rx = rx->next) {
+      if (!bimol_pair_rxn(world, bin, rx))
+        continue;
+      for (int k = 0; k < 2; k++) {
+        u_int id = rx->players[k]->species_id;
+        if (row_of[id] < 0)
+          row_of[id] = n_rows++;
+      }
+    }
+  }
+
+  if ((long long)n_rows * n_species > MAX_BIMOL_TABLE_ENTRIES) {
+    if (world->notify->progress_report != NOTIFY_NONE)
+      mcell_log("Species-pair table of reactions would have %lld entries; "
+                "searching the reaction hash instead.",
+                (long long)n_rows * n_species);
+    free(row_of);
+    return 0;
+  }
+
+  /* Count the reactions of each pair */
+  size_t n_entries = (size_t)n_rows * n_species;
+  u_int *counts = (u_int *)calloc(n_entries > 0 ? n_entries : 1,
+                                  sizeof(u_int));
+  if (counts == NULL) {
+    free(row_of);
+    mcell_allocfailed_nodie("Failed to allocate species-pair table.");
+    return 1;
+  }
+
+  for (int bin = 0; bin < world->rx_hashsize; bin++) {
+    for (struct rxn *rx = world->reaction_hash[bin]; rx != NULL;
+         rx = rx->next) {
+      if (!bimol_pair_rxn(world, bin, rx))
+        continue;
+      u_int a = rx->players[0]->species_id;
+      u_int b = rx->players[1]->species_id;
+      counts[(size_t)row_of[a] * n_species + b]++;
+      if (a != b)
+        counts[(size_t)row_of[b] * n_species + a]++;
+    }
+  }
+
+  /* Lay out the lists, each followed by a NULL */
+  size_t n_list_slots = 0;
+  for (size_t e = 0; e < n_entries; e++)
+    if (counts[e] > 0)
+      n_list_slots += counts[e] + 1;
+
+  struct rxn ***rows = (struct rxn ***)malloc(
+      (n_entries > 0 ? n_entries : 1) * sizeof(struct rxn **));
+  struct rxn **lists = (struct rxn **)calloc(
+      n_list_slots > 0 ? n_list_slots : 1, sizeof(struct rxn *));
+  if (rows == NULL || lists == NULL) {
+    free(rows);
+    free(lists);
+    free(counts);
+    free(row_of);
+    mcell_allocfailed_nodie("Failed to allocate species-pair table.");
+    return 1;
+  }
+
+  size_t next_slot = 0;
+  for (size_t e = 0; e < n_entries; e++) {
+    if (counts[e] == 0) {
+      rows[e] = no_bimol_rxns;
+    } else {
+      rows[e] = lists + next_slot;
+      next_slot += counts[e] + 1;
+    }
+    counts[e] = 0; /* now the number of reactions filled in */
+  }
+
+  /* Fill them in, in the order of the hash chains */
+  for (int bin = 0; bin < world->rx_hashsize; bin++) {
+    for (struct rxn *rx = world->reaction_hash[bin]; rx != NULL;
+         rx = rx->next) {
+      if (!bimol_pair_rxn(world, bin, rx))
+        continue;
+      u_int a = rx->players[0]->species_id;
+      u_int b = rx->players[1]->species_id;
+      size_t e = (size_t)row_of[a] * n_species + b;
+      rows[e][counts[e]++] = rx;
+      if (a != b) {
+        e = (size_t)row_of[b] * n_species + a;
+        rows[e][counts[e]++] = rx;
+      }
+    }
+  }
+
+  for (int i = 0; i < n_species; i++) {
+    struct species *spec = world->species_list[i];
+    int row = row_of[spec->species_id];
+    spec->bimol_rxns = (row < 0) ? NULL : rows + (size_t)row * n_species;
+    spec->bimol_row_len = n_species;
+  }
+
+  if (world->notify->progress_report != NOTIFY_NONE)
+    mcell_log("Built species-pair table of reactions: %d x %d entries, "
+              "%lu kB.", n_rows, n_species,
+              (u_long)((n_entries + n_list_slots) * sizeof(struct rxn *) /
+                       1024));
+
+  free(counts);
+  free(row_of);
+  return 0;
+}
@@ -0,0 +1,48 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+extern struct rxn *no_bimol_rxns[1];
+
+int init_bimolecular_table(struct volume *world);
+
+/* Reactions with at least two reactants naming species a and b as the
+ * first two, in the order in which they are found in the reaction hash,
+ * as a NULL-terminated list; or NULL if the table doesn't cover the pair,
+ * in which case the reaction hash has to be searched. */
+static inline struct rxn **bimolecular_rxns_by_id(struct species *a,
+                                                  u_int b_id) {
+  if (b_id >= a->bimol_row_len)
+    return NULL;
+  if (a->bimol_rxns == NULL)
+    return no_bimol_rxns;
+  return a->bimol_rxns[b_id];
+}
+
+static inline struct rxn **bimolecular_rxns(struct species *a,
+                                            struct species *b) {
+  return bimolecular_rxns_by_id(a, b->species_id);
+}
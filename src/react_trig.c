@@ -37,6 +37,7 @@
 #include "mcell_structs.h"
 #include "react.h"
 #include "react_nfsim.h"
+#include "react_table.h"
 #include "vol_util.h"
 
 /*************************************************************************
@@ -108,6 +109,10 @@ int trigger_bimolecular_preliminary(struct rxn **reaction_hash, int rx_hashsize,
                                     u_int hashA, u_int hashB,
                                     struct species *reacA,
                                     struct species *reacB) {
+  struct rxn **table_rxns = bimolecular_rxns(reacA, reacB);
+  if (table_rxns != NULL)
+    return table_rxns[0] != NULL;
+
   u_int hash = (hashA + hashB) & (rx_hashsize - 1);
   for (struct rxn *inter = reaction_hash[hash]; inter != NULL; inter = inter->next) {
     /* Enough reactants? (3=>wall also) */
@@ -262,7 +267,14 @@ int trigger_bimolecular(struct rxn **reaction_hash, int rx_hashsize,
 
   int num_matching_rxns = 0; /* number of matching reactions */
   u_int hash = (hashA + hashB) & (rx_hashsize - 1); /* index in the reaction hash table */
-  for (struct rxn *inter = reaction_hash[hash]; inter != NULL; inter = inter->next) {
+
+  /* Candidates come from the species-pair table if it covers the pair, and
+   * from the hash chain otherwise; either way in hash chain order. */
+  struct rxn **table_rxns =
+      bimolecular_rxns(reacA->properties, reacB->properties);
+  struct rxn *inter = (table_rxns != NULL) ? table_rxns[0] : reaction_hash[hash];
+  for (; inter != NULL;
+       inter = (table_rxns != NULL) ? *++table_rxns : inter->next) {
     int right_walls_surf_classes = 0;  /* flag to check whether SURFACE_CLASSES
                                           of the walls for one or both reactants
                                           match the SURFACE_CLASS of the reaction
@@ -414,7 +426,7 @@ int trigger_bimolecular(struct rxn **reaction_hash, int rx_hashsize,
         }
       } /* if (right_walls_surf_classes) ... */
     } /* end if (test_wall && orientA != NULL) */
-  }   /* end for (inter = reaction_hash[hash]; ...) */
+  }   /* end for (inter = ...) */
 
   if (num_matching_rxns > MAX_MATCHING_RXNS) {
     mcell_warn("Number of matching reactions exceeds the maximum allowed "
@@ -4,6 +4,7 @@
 #include "map_c.h"
 #include "logging.h"
 #include "mcell_structs.h"
+#include "nfsim_cache.h"
 #include "nfsim_func.h"
 #include "react.h"
 #include "react_nfsim.h"
@@ -13,15 +14,6 @@
 #include <string.h>
 //#include "lru.h"
 
-map_t reaction_map = NULL;
-map_t reaction_preliminary_map = NULL;
-
-
-void clear_maps() {
-  hashmap_clear(reaction_map);
-  hashmap_clear(reaction_preliminary_map);
-}
-
 // struct rxn *rx;
 
 unsigned long lhash(const char *keystring) {
@@ -122,59 +114,24 @@ initializeNFSimQueryForUnimolecularReactions(struct abstract_molecule *am) {
    traverse when checking for mol-mol collisions.
 *************************************************************************/
 
-long rxnfound = 0;
-long rxnmissed = 0;
-
-
 int trigger_bimolecular_preliminary_nfsim(struct abstract_molecule *reacA,
                                           struct abstract_molecule *reacB) {
 
-  if (reaction_preliminary_map == NULL)
-    reaction_preliminary_map = hashmap_new();
-
-  bool *isValidReaction = NULL;
-  unsigned long reactionHash = reacA->graph_data->graph_pattern_hash +
-                               reacB->graph_data->graph_pattern_hash;
-  int error = hashmap_get_nohash(reaction_preliminary_map, reactionHash,
-                                 reactionHash, (void **)(&isValidReaction));
-  // error = find_in_cache(reaction_key, rx);
-
-  // XXX: it might be worth it to return the rx object since we already queried
-  // it
-  if (error == MAP_OK) {
-    if (isValidReaction != NULL)
-      return 1;
-
-    rxnfound++;
-
-    return 0;
-  }
-
-  rxnmissed++;
-
-  queryOptions options = initializeNFSimQueryForBimolecularReactions(
-      reacA->graph_data, reacB->graph_data, "1");
-
-  void *results = mapvectormap_create();
-  initAndQueryByNumReactant_c(options, results);
-  // if we have reactions great! although we can't decide what to do with them
-  // yet. bummer.
-
-  if (mapvectormap_size(results) > 0) {
-    isValidReaction = CHECKED_MALLOC_ARRAY(bool, 1, "this is a valid reaction");
-    *isValidReaction = true;
-    mapvectormap_delete(results);
-
-    error = hashmap_put_nohash(reaction_preliminary_map, reactionHash,
-                               reactionHash, isValidReaction);
-    return 1;
-  } else {
-    // if we know there's no reactions there's no need to check again later
+  struct nfsim_cache_entry *e =
+      nfsim_cache_find(reacA->graph_data, reacB->graph_data);
+  if (e == NULL) {
+    /* The same query as in trigger_bimolecular_nfsim, which then finds the
+     * answer here */
+    queryOptions options = initializeNFSimQueryForBimolecularReactions(
+        reacA->graph_data, reacB->graph_data, "1");
+
+    void *results = mapvectormap_create();
+    initAndQueryByNumReactant_c(options, results);
+    e = nfsim_cache_add(reacA->graph_data, reacB->graph_data, results);
     mapvectormap_delete(results);
-    error = hashmap_put_nohash(reaction_preliminary_map, reactionHash,
-                               reactionHash, NULL);
-    return 0;
   }
+
+  return e->n_paths > 0;
 }
 
 /***********
@@ -185,75 +142,36 @@ int trigger_bimolecular_nfsim(struct volume *state,
                               struct abstract_molecule *reacB, short orientA,
                               short orientB, struct rxn **matching_rxns) {
 
-  int error;
   int num_matching_rxns = 0;
 
-  if (reaction_map == NULL)
-    reaction_map = hashmap_new();
-
-  // memset(&reaction_key[0], 0, sizeof(reaction_key));
-  struct rxn *rx = NULL;
-
-  unsigned long reactionHash = reacA->graph_data->graph_pattern_hash +
-                               reacB->graph_data->graph_pattern_hash;
-  // sprintf(reaction_key,"%lu",reacA->graph_pattern_hash +
-  // reacB->graph_pattern_hash);
-  // mcell_log("reaction_key %s %s %s",reacA->graph_pattern,
-  // reacB->graph_pattern, reaction_key);
-  // A + B ->C is the same as B +A -> C
-  // if (strcmp(reacA->graph_pattern, reacB->graph_pattern) < 0)
-  //    sprintf(reaction_key,"%s-%s",reacA->graph_pattern,reacB->graph_pattern);
-  // else
-  //    sprintf(reaction_key,"%s-%s",reacB->graph_pattern,reacA->graph_pattern);
-
-  error = hashmap_get_nohash(reaction_map, reactionHash, reactionHash,
-                             (void **)(&rx));
-  // error = find_in_cache(reaction_key, rx);
-
-  if (error == MAP_OK) {
-    // if(error != -1){
-
-    if (rx != NULL) {
-      int result = process_bimolecular(reacA, reacB, rx, orientA, orientB,
-                                       matching_rxns, num_matching_rxns);
-
-      if (result == 1)
-        num_matching_rxns++;
-    }
-    return num_matching_rxns;
+  struct nfsim_cache_entry *e =
+      nfsim_cache_find(reacA->graph_data, reacB->graph_data);
+  if (e == NULL) {
+    queryOptions options = initializeNFSimQueryForBimolecularReactions(
+        reacA->graph_data, reacB->graph_data, "1");
+    // reset, init, query the nfsim system
+    void *results = mapvectormap_create();
+    initAndQueryByNumReactant_c(options, results);
+    e = nfsim_cache_add(reacA->graph_data, reacB->graph_data, results);
+    mapvectormap_delete(results);
   }
 
-  // mcell_log("+++++ %s %s %s",reacA->graph_pattern, reacB->graph_pattern,
-  // reaction_key);
-  queryOptions options = initializeNFSimQueryForBimolecularReactions(
-      reacA->graph_data, reacB->graph_data, "1");
-  // reset, init, query the nfsim system
-  void *results = mapvectormap_create();
-  initAndQueryByNumReactant_c(options, results);
-
-  // XXX: it would probably would be more natural to make a method that queries
-  // all the reactions
-  // associated with a given species
-  if (mapvectormap_size(results) > 0) {
-    rx = new_reaction();
-    initializeNFSimReaction(state, rx, 2, results, reacA, reacB);
-
-    /*int result = process_bimolecular(reacA, reacB, rx, orientA, orientB,*/
-    /*                matching_rxns, num_matching_rxns, 0);*/
-    int result = process_bimolecular(reacA, reacB, rx, orientA, orientB,
-                                     matching_rxns, num_matching_rxns);
-
-    if (result == 1)
-      num_matching_rxns++;
+  if (e->n_paths == 0)
+    return 0;
+
+  // the answer may have come from the preliminary check or the cache file,
+  // without the reaction built yet
+  if (e->rx == NULL) {
+    struct rxn *rx = new_reaction();
+    initializeNFSimReaction(state, rx, 2, e->n_paths, e->paths, reacA, reacB);
+    nfsim_cache_set_rxn(e, rx);
   }
-  // store value in hashmap
 
-  error = hashmap_put_nohash(reaction_map, reactionHash, reactionHash, rx);
-  // add_to_cache(reaction_key, rx);
+  int result = process_bimolecular(reacA, reacB, e->rx, orientA, orientB,
+                                   matching_rxns, num_matching_rxns);
+  if (result == 1)
+    num_matching_rxns++;
 
-  // CLEANUP
-  // delete_reactantQueryResults(query2);
-  mapvectormap_delete(results);
   return num_matching_rxns;
 }
 
@@ -298,18 +216,12 @@ int adjust_rates_nfsim(struct volume *state, struct rxn *rx, bool is_surface) {
 }
 
 int initializeNFSimReaction(struct volume *state, struct rxn *r,
-                            int n_reactants, void *results,
+                            int n_reactants, int n_paths,
+                            struct nfsim_path *paths,
                             struct abstract_molecule *reacA,
                             struct abstract_molecule *reacB) {
 
-  char **resultKeys = mapvectormap_getKeys(results);
-  void *headComplex = mapvectormap_get(results, resultKeys[0]);
-
-  // we know that it only contains one result
-  int keysize = mapvectormap_size(results);
-
-  int headNumAssociatedReactions = mapvector_size(headComplex);
-  state->n_NFSimPReactions += headNumAssociatedReactions;
+  int headNumAssociatedReactions = n_paths;
 
   r->cum_probs = CHECKED_MALLOC_ARRAY(double, headNumAssociatedReactions,
                                       "cumulative probabilities");
@@ -338,6 +250,8 @@ int initializeNFSimReaction(struct volume *state, struct rxn *r,
   r->product_graph_data =
       CHECKED_MALLOC_ARRAY(struct graph_data **, headNumAssociatedReactions,
                            "graph patterns of the possible products");
+  memset(r->product_graph_data, 0,
+         sizeof(struct graph_data **) * headNumAssociatedReactions);
 
   r->nfsim_players =
       CHECKED_MALLOC_ARRAY(struct species **, headNumAssociatedReactions,
@@ -355,15 +269,10 @@ int initializeNFSimReaction(struct volume *state, struct rxn *r,
   // XXX:do we really have to go over all of them or do we need to filter out
   // repeats?
   // for (int i=0; i<query2.numOfResults; i++){
-  void *pathInformation;
   for (int path = 0; path < headNumAssociatedReactions; path++) {
-    pathInformation = mapvector_get(headComplex, path);
-    r->cum_probs[path] = atof(map_get(pathInformation, "rate"));
-    r->external_reaction_data[path].reaction_name =
-        strdup(map_get(pathInformation, "name"));
-    r->external_reaction_data[path].resample = 0;
-    if (strcmp(map_get(pathInformation, "resample"), "true") == 0)
-      r->external_reaction_data[path].resample = 1;
+    r->cum_probs[path] = paths[path].rate;
+    r->external_reaction_data[path].reaction_name = strdup(paths[path].name);
+    r->external_reaction_data[path].resample = paths[path].resample;
     r->product_idx[path] = 0;
     r->product_idx_aux[path] = -1;
   }
@@ -419,61 +328,30 @@ int initializeNFSimReaction(struct volume *state, struct rxn *r,
   else
     r->min_noreaction_p = r->max_fixed_p = 1.0;
 
-  // cleanup
-  for (int i = 0; i < keysize; i++)
-    free(resultKeys[i]);
-
-  free(resultKeys);
-
   return 0;
 }
 
 struct rxn *pick_unimolecular_reaction_nfsim(struct volume *state,
                                              struct abstract_molecule *am) {
 
-  int error;
-  struct rxn *rx = NULL;
-  if (reaction_map == NULL)
-    reaction_map = hashmap_new();
-
-  // memset(&reaction_key[0], 0, sizeof(reaction_key));
-  // sprintf(reaction_key,"%s",am->graph_pattern);
-  // sprintf(reaction_key,"%lu",am->graph_pattern_hash);
-
-  // check in the hashmap in case this is a reaction we have encountered before
-  error =
-      hashmap_get_nohash(reaction_map, am->graph_data->graph_pattern_hash,
-                         am->graph_data->graph_pattern_hash, (void **)(&rx));
-  // error = find_in_cache(reaction_key, rx);
-
-  if (error == MAP_OK) {
-    return rx;
-  }
-
-  // if(error != -1)
-  //    return rx;
-
-  // otherwise build the object
-  queryOptions options = initializeNFSimQueryForUnimolecularReactions(am);
-  // reset, init, query the nfsim system
-  void *results = mapvectormap_create();
-  initAndQueryByNumReactant_c(options, results);
-
-  // XXX: it would probably would be more natural to  make a method that queries
-  // all the reactions
-  // associated with a given species
-  if (mapvectormap_size(results) > 0) {
-    rx = new_reaction();
-    initializeNFSimReaction(state, rx, 1, results, am, NULL);
+  struct nfsim_cache_entry *e = nfsim_cache_find(am->graph_data, NULL);
+  if (e == NULL) {
+    // not asked before, so ask nfsim
+    queryOptions options = initializeNFSimQueryForUnimolecularReactions(am);
+    // reset, init, query the nfsim system
+    void *results = mapvectormap_create();
+    initAndQueryByNumReactant_c(options, results);
+    e = nfsim_cache_add(am->graph_data, NULL, results);
+    mapvectormap_delete(results);
   }
 
-  // store newly created reaction in the hashmap
-  error = hashmap_put_nohash(reaction_map, am->graph_data->graph_pattern_hash,
-                             am->graph_data->graph_pattern_hash, rx);
-  // add_to_cache(reaction_key, rx);
+  if (e->n_paths == 0)
+    return NULL;
 
-  // CLEANUP
-  mapvectormap_delete(results);
-  return rx;
-  // delete_reactantQueryResults(query2);
+  if (e->rx == NULL) {
+    struct rxn *rx = new_reaction();
+    initializeNFSimReaction(state, rx, 1, e->n_paths, e->paths, am, NULL);
+    nfsim_cache_set_rxn(e, rx);
+  }
+  return e->rx;
 }
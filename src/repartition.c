@@ -0,0 +1,483 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Adaptive partitions.
+ *
+ * The automatic partitions are evenly spaced over the bounding box of the
+ * geometry, so where the molecules crowd into a small part of it, a few
+ * subvolumes hold nearly all of them, and every molecule there checks long
+ * lists of partners, while most subvolumes stay empty.
+ *
+ * With -adaptive_partitions n, the load of each subvolume is sampled after
+ * each of the first n iterations: its molecules, times the number of walls
+ * and molecules each of them may collide with there.  The partitions inside
+ * the bounding box are then moved, one axis at a time, so that the slabs
+ * between them carry about the same share of the load summed over the other
+ * two axes.  A tenth of the load is spread evenly so that empty regions
+ * still get some partitions, and partitions stay at least as far apart as
+ * set_partitions requires.
+ *
+ * The number of partitions along each axis stays the same, and so do the
+ * storages the subvolumes belong to; only the subvolume bounds change.  The
+ * wall lists, wall hierarchies and waypoints are rebuilt, and volume
+ * molecules are moved to the subvolumes they are now in.  Surface
+ * molecules stay with their grids. */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "count_util.h"
+#include "logging.h"
+#include "mcell_structs.h"
+#include "mem_util.h"
+#include "packed_walls.h"
+#include "repartition.h"
+#include "sched_util.h"
+#include "util.h"
+#include "vol_util.h"
+#include "wall_bvh.h"
+#include "wall_util.h"
+
+/* Share of the load spread evenly over each axis */
+#define EVEN_LOAD_SHARE 0.1
+
+/* First and last fine partitions with even spacing (see set_partitions) */
+#define FINE_LINEAR_FIRST 4096
+#define FINE_LINEAR_LAST (4096 + 16384)
+
+struct partition_load {
+  int n_samples;
+  double *load; /* Per subvolume, summed over the samples */
+};
+
+/* Molecules per subvolume, for the report */
+struct partition_stats {
+  int max_mols;
+  int n_empty;
+  int max_walls;
+};
+
+/*************************************************************************
+wall_list_length:
+  In: sv: a subvolume
+  Out: The number of walls in its wall list.
+*************************************************************************/
+static int wall_list_length(struct subvolume *sv) {
+  int n = 0;
+  for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next)
+    n++;
+  return n;
+}
+
+/*************************************************************************
+sample_partition_load:
+  In: world: simulation state
+      pl: load sampled so far
+  Out: No return value.  The current load of each subvolume is added.
+*************************************************************************/
+static void sample_partition_load(struct volume *world,
+                                  struct partition_load *pl) {
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    double n_mols = (double)sv->mol_count;
+    pl->load[i] += n_mols * (n_mols + (double)wall_list_length(sv));
+  }
+  pl->n_samples++;
+}
+
+/*************************************************************************
+find_partition_stats:
+  In: world: simulation state
+      stats: to be filled in
+  Out: No return value.
+*************************************************************************/
+static void find_partition_stats(struct volume *world,
+                                 struct partition_stats *stats) {
+  memset(stats, 0, sizeof(struct partition_stats));
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    if (sv->mol_count > stats->max_mols)
+      stats->max_mols = sv->mol_count;
+    if (sv->mol_count == 0)
+      stats->n_empty++;
+    int n_walls = wall_list_length(sv);
+    if (n_walls > stats->max_walls)
+      stats->max_walls = n_walls;
+  }
+}
+
+/*************************************************************************
+plan_axis:
+  In: world: simulation state
+      partitions: partitions along one axis
+      n_parts: how many there are
+      fineparts: fine partitions along the axis
+      slab_load: load between each pair of neighboring partitions
+      min_spacing: how close partitions may get
+  Out: 0 on success, 1 on memory allocation failure.  The partitions within
+       the evenly spaced fine partitions are moved to balance the load, if
+       there are any that can be moved and there is room to do so.
+*************************************************************************/
+static int plan_axis(struct volume *world, double *partitions, int n_parts,
+                     double *fineparts, double *slab_load,
+                     double min_spacing) {
+  int *idx = CHECKED_MALLOC_ARRAY(int, n_parts, "partition indices");
+  for (int p = 0; p < n_parts; p++)
+    idx[p] = bisect_near(fineparts, world->n_fineparts, partitions[p]);
+
+  /* Partitions a and b are the outermost ones that stay put */
+  int a = 0, b = n_parts - 1;
+  while (a < n_parts && idx[a] < FINE_LINEAR_FIRST)
+    a++;
+  while (b >= 0 && idx[b] > FINE_LINEAR_LAST)
+    b--;
+  if (b - a < 2) {
+    free(idx);
+    return 0;
+  }
+
+  int n_cells = idx[b] - idx[a];
+  double df = fineparts[FINE_LINEAR_FIRST + 1] - fineparts[FINE_LINEAR_FIRST];
+  int min_steps = (int)ceil(min_spacing / df);
+  if (min_steps < 1)
+    min_steps = 1;
+  if ((b - a) * min_steps > n_cells) {
+    free(idx);
+    return 0;
+  }
+
+  /* Spread the load of each slab over its fine cells */
+  double *cumul = CHECKED_MALLOC_ARRAY(double, n_cells, "partition load");
+  double total = 0.0;
+  for (int p = a; p < b; p++) {
+    if (idx[p + 1] == idx[p])
+      continue;
+    double per_cell = slab_load[p] / (double)(idx[p + 1] - idx[p]);
+    for (int c = idx[p]; c < idx[p + 1]; c++)
+      cumul[c - idx[a]] = per_cell;
+    total += slab_load[p];
+  }
+  if (total <= 0.0) {
+    free(cumul);
+    free(idx);
+    return 0;
+  }
+
+  double even = EVEN_LOAD_SHARE * total / ((1.0 - EVEN_LOAD_SHARE) * n_cells);
+  double sum = 0.0;
+  for (int c = 0; c < n_cells; c++) {
+    sum += cumul[c] + even;
+    cumul[c] = sum;
+  }
+
+  /* Put each partition where its share of the load is reached */
+  int *new_idx = CHECKED_MALLOC_ARRAY(int, n_parts, "partition indices");
+  new_idx[a] = idx[a];
+  new_idx[b] = idx[b];
+  int c = 0;
+  for (int p = a + 1; p < b; p++) {
+    double target = sum * (double)(p - a) / (double)(b - a);
+    while (c < n_cells - 1 && cumul[c] < target)
+      c++;
+    new_idx[p] = idx[a] + c + 1;
+  }
+
+  /* Keep them apart */
+  for (int p = a + 1; p < b; p++) {
+    if (new_idx[p] < new_idx[p - 1] + min_steps)
+      new_idx[p] = new_idx[p - 1] + min_steps;
+  }
+  for (int p = b - 1; p > a; p--) {
+    if (new_idx[p] > new_idx[p + 1] - min_steps)
+      new_idx[p] = new_idx[p + 1] - min_steps;
+  }
+
+  for (int p = a + 1; p < b; p++)
+    partitions[p] = fineparts[new_idx[p]];
+
+  free(new_idx);
+  free(cumul);
+  free(idx);
+  return 0;
+}
+
+/*************************************************************************
+plan_partitions:
+  In: world: simulation state
+      pl: sampled load
+  Out: 0 on success, 1 on memory allocation failure.  The partitions are
+       moved to balance the load.
+*************************************************************************/
+static int plan_partitions(struct volume *world, struct partition_load *pl) {
+  int nx = world->nx_parts - 1, ny = world->ny_parts - 1,
+      nz = world->nz_parts - 1;
+  double *x_load = CHECKED_MALLOC_ARRAY(double, nx, "partition load");
+  double *y_load = CHECKED_MALLOC_ARRAY(double, ny, "partition load");
+  double *z_load = CHECKED_MALLOC_ARRAY(double, nz, "partition load");
+  memset(x_load, 0, nx * sizeof(double));
+  memset(y_load, 0, ny * sizeof(double));
+  memset(z_load, 0, nz * sizeof(double));
+
+  for (int i = 0; i < nx; i++) {
+    for (int j = 0; j < ny; j++) {
+      for (int k = 0; k < nz; k++) {
+        double load = pl->load[k + nz * (j + ny * i)];
+        x_load[i] += load;
+        y_load[j] += load;
+        z_load[k] += load;
+      }
+    }
+  }
+
+  /* Same bound as set_partitions */
+  double min_spacing = 0.1 * world->r_length_unit;
+  if (2 * world->rx_radius_3d > min_spacing)
+    min_spacing = 2 * world->rx_radius_3d;
+
+  int err = plan_axis(world, world->x_partitions, world->nx_parts,
+                      world->x_fineparts, x_load, min_spacing) ||
+            plan_axis(world, world->y_partitions, world->ny_parts,
+                      world->y_fineparts, y_load, min_spacing) ||
+            plan_axis(world, world->z_partitions, world->nz_parts,
+                      world->z_fineparts, z_load, min_spacing);
+
+  free(z_load);
+  free(y_load);
+  free(x_load);
+  return err;
+}
+
+/*************************************************************************
+set_subvolume_bounds:
+  In: world: simulation state
+  Out: No return value.  The fine partition bounds of every subvolume are
+       set from the partitions, as in init_partitions.
+*************************************************************************/
+static void set_subvolume_bounds(struct volume *world) {
+  for (int i = 0; i < world->nx_parts - 1; i++) {
+    for (int j = 0; j < world->ny_parts - 1; j++) {
+      for (int k = 0; k < world->nz_parts - 1; k++) {
+        int h = k + (world->nz_parts - 1) * (j + (world->ny_parts - 1) * i);
+        struct subvolume *sv = &(world->subvol[h]);
+        sv->llf.x = bisect_near(world->x_fineparts, world->n_fineparts,
+                                world->x_partitions[i]);
+        sv->llf.y = bisect_near(world->y_fineparts, world->n_fineparts,
+                                world->y_partitions[j]);
+        sv->llf.z = bisect_near(world->z_fineparts, world->n_fineparts,
+                                world->z_partitions[k]);
+        sv->urb.x = bisect_near(world->x_fineparts, world->n_fineparts,
+                                world->x_partitions[i + 1]);
+        sv->urb.y = bisect_near(world->y_fineparts, world->n_fineparts,
+                                world->y_partitions[j + 1]);
+        sv->urb.z = bisect_near(world->z_fineparts, world->n_fineparts,
+                                world->z_partitions[k + 1]);
+      }
+    }
+  }
+}
+
+/*************************************************************************
+rebuild_wall_lists:
+  In: world: simulation state
+  Out: 0 on success, 1 on memory allocation failure.  The wall lists of the
+       subvolumes and what is built from them are made anew.
+*************************************************************************/
+static int rebuild_wall_lists(struct volume *world) {
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    destroy_wall_bvh(sv->wall_bvh);
+    destroy_packed_walls(sv->packed_walls);
+  }
+
+  if (redistribute_walls(world))
+    return 1;
+  if (init_wall_bvhs(world))
+    return 1;
+  return init_packed_walls(world);
+}
+
+/*************************************************************************
+move_volume_molecules:
+  In: world: simulation state
+  Out: 0 on success, 1 on memory allocation failure.  Every volume molecule
+       is moved to the subvolume it is now in; those that change storage
+       are scheduled in their new one.
+*************************************************************************/
+static int move_volume_molecules(struct volume *world) {
+  for (int n = 0; n < world->n_species; n++) {
+    struct species *spec = world->species_list[n];
+    if (spec->flags & (IS_SURFACE | ON_GRID))
+      continue;
+
+    for (u_int m = 0; m < spec->n_live_mols; m++) {
+      struct abstract_molecule *am = spec->live_mols[m];
+      if ((am->flags & TYPE_VOL) == 0)
+        continue;
+
+      struct volume_molecule *vm = (struct volume_molecule *)am;
+      struct subvolume *new_sv = find_subvolume(world, &vm->pos, vm->subvol);
+      if (new_sv == vm->subvol)
+        continue;
+
+      struct storage *old_stor = vm->subvol->local_storage;
+      struct volume_molecule *new_vm = migrate_volume_molecule(vm, new_sv);
+      if (new_vm == NULL)
+        return 1;
+
+      /* A copy is left in the old scheduler to be dropped there */
+      if (new_vm != vm && (new_vm->flags & IN_SCHEDULE)) {
+        old_stor->timer->defunct_count++;
+        if (schedule_add(new_sv->local_storage->timer, new_vm))
+          mcell_allocfailed("Failed to add a volume molecule to scheduler.");
+      }
+    }
+  }
+  return 0;
+}
+
+/*************************************************************************
+release_waypoint_regions:
+  In: world: simulation state
+  Out: No return value.  The region lists of the waypoints are given back
+       to the memory they came from.
+*************************************************************************/
+static void release_waypoint_regions(struct volume *world) {
+  for (int i = 0; i < world->n_waypoints && i < world->n_subvols; i++) {
+    struct waypoint *wp = &world->waypoints[i];
+    struct mem_helper *mh = world->subvol[i].local_storage->regl;
+    struct region_list *lists[] = { wp->regions,         wp->antiregions,
+                                    wp->rev_regions,     wp->rev_antiregions,
+                                    wp->sorted_regions,  wp->sorted_antiregions };
+    for (unsigned int l = 0; l < sizeof(lists) / sizeof(lists[0]); l++) {
+      if (lists[l] != NULL)
+        mem_put_list(mh, lists[l]);
+    }
+  }
+}
+
+/*************************************************************************
+repartition:
+  In: world: simulation state
+      pl: sampled load
+  Out: 0 on success, 1 on memory allocation failure.  The partitions are
+       moved and everything that depends on them is updated.
+*************************************************************************/
+static int repartition(struct volume *world, struct partition_load *pl) {
+  struct partition_stats before, after;
+  find_partition_stats(world, &before);
+
+  if (plan_partitions(world, pl))
+    return 1;
+
+  set_subvolume_bounds(world);
+  if (rebuild_wall_lists(world))
+    return 1;
+  if (move_volume_molecules(world))
+    return 1;
+  if (world->place_waypoints_flag) {
+    release_waypoint_regions(world);
+    if (place_waypoints(world))
+      return 1;
+  }
+
+  find_partition_stats(world, &after);
+  if (world->notify->progress_report != NOTIFY_NONE) {
+    double mean = 0.0;
+    for (int i = 0; i < world->n_subvols; i++)
+      mean += world->subvol[i].mol_count;
+    mean /= world->n_subvols;
+    mcell_log("Moved partitions after %d iterations (%.1f molecules per "
+              "subvolume on average).",
+              pl->n_samples, mean);
+    mcell_log("  Before: at most %d molecules and %d walls in a subvolume, "
+              "%d of %d subvolumes empty.",
+              before.max_mols, before.max_walls, before.n_empty,
+              world->n_subvols);
+    mcell_log("  After:  at most %d molecules and %d walls in a subvolume, "
+              "%d of %d subvolumes empty.",
+              after.max_mols, after.max_walls, after.n_empty,
+              world->n_subvols);
+  }
+  return 0;
+}
+
+/*************************************************************************
+adaptive_partitions_supported:
+  In: world: simulation state
+  Out: 1 if the partitions may be moved, 0 if not (with a warning).
+*************************************************************************/
+static int adaptive_partitions_supported(struct volume *world) {
+  char const *reason = NULL;
+  if (!world->auto_partitions)
+    reason = "the partitions were given by the user";
+  else if (world->periodic_box_obj != NULL)
+    reason = "the world is periodic";
+  else if (world->dynamic_geometry_head != NULL)
+    reason = "the geometry changes during the run";
+  else if (world->ranks != NULL)
+    reason = "the world is split across ranks";
+  if (reason == NULL)
+    return 1;
+
+  mcell_warn("Partitions will not be moved, since %s.", reason);
+  return 0;
+}
+
+/*************************************************************************
+adapt_partitions:
+  In: world: simulation state, after an iteration
+  Out: 0 on success, 1 on memory allocation failure.  If adaptive
+       partitions were asked for, the load is sampled, and once enough
+       iterations have gone by, the partitions are moved.
+*************************************************************************/
+int adapt_partitions(struct volume *world) {
+  if (world->adaptive_partition_iterations == 0)
+    return 0;
+
+  struct partition_load *pl = world->partition_load;
+  if (pl == NULL) {
+    if (!adaptive_partitions_supported(world)) {
+      world->adaptive_partition_iterations = 0;
+      return 0;
+    }
+    pl = CHECKED_MALLOC_STRUCT(struct partition_load, "partition load");
+    pl->n_samples = 0;
+    pl->load = CHECKED_MALLOC_ARRAY(double, world->n_subvols, "partition load");
+    memset(pl->load, 0, world->n_subvols * sizeof(double));
+    world->partition_load = pl;
+  }
+
+  sample_partition_load(world, pl);
+  if (pl->n_samples < world->adaptive_partition_iterations)
+    return 0;
+
+  int err = repartition(world, pl);
+  world->adaptive_partition_iterations = 0;
+  world->partition_load = NULL;
+  free(pl->load);
+  free(pl);
+  return err;
+}
@@ -217,3 +217,30 @@ double rng_gauss(struct rng_state *rng) {
 
   return sign * x;
 }
+
+/*************************************************************************
+rng_stream_init:
+  In:  struct rng_state *rng - uniform RNG state
+       unsigned int seed - seed of the run
+       unsigned long long stream - stream id (see RNG_STREAM_*)
+  Out: No return value.  The generator is set to the start of the given
+       stream of the seed.  Stream 0 is the same as rng_init(rng, seed).
+  Note: With Philox the stream id is part of the key, so the streams are
+        independent by construction.  The other generators are seeded with
+        the seed scrambled by the stream id instead.
+ *************************************************************************/
+void rng_stream_init(struct rng_state *rng, unsigned int seed,
+                     unsigned long long stream) {
+#if defined(USE_PHILOX_RNG)
+  philox_init(rng, seed, stream);
+#else
+  /* 64-bit finalizer of MurmurHash3; maps 0 to 0 */
+  unsigned long long h = stream;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  rng_init(rng, seed ^ (unsigned int)(h ^ (h >> 32)));
+#endif
+}
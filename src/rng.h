@@ -33,6 +33,18 @@
 #define rng_dbl(x) mrng_dbl32((x))
 #define rng_uint(x) mrng_uint32((x))
 
+#elif defined(USE_PHILOX_RNG)
+/*******************Philox4x32*******************/
+#include "philox.h"
+
+#define rng_state philox_state
+
+#define rng_uses(x) ((long long)(4 * (x)->counter) - (long long)(x)->randcnt)
+#define rng_init(x, y) philox_init((x), (y), 0)
+#define rng_dbl(x) philox_dbl32((x))
+#define rng_uint(x) philox_uint32((x))
+/***********************************************/
+
 #else
 /*******************ISAAC64*********************/
 #include "isaac64.h"
@@ -50,4 +62,17 @@
 
 #define rng_open_dbl(x) (rng_dbl(x) + ONE_OVER_2_TO_THE_33RD)
 
+/* Ids of the streams derived from the seed by rng_stream_init.  Stream 0 is
+ * the one rng_init starts.  Each memory partition run on a worker thread, and
+ * each rank, draws from a stream of its own, so that no generator state is
+ * shared between them.  This alone does not make runs reproducible across
+ * thread counts; see storage_threads.c.  The generator itself is chosen when
+ * MCell is built (USE_PHILOX_RNG, USE_MINIMAL_RNG), not at run time. */
+#define RNG_STREAM_WORLD 0ULL
+#define RNG_STREAM_STORAGE(i) (1ULL + (unsigned long long)(i))
+#define RNG_STREAM_RANK(r) ((1ULL << 32) + (unsigned long long)(r))
+
+void rng_stream_init(struct rng_state *rng, unsigned int seed,
+                     unsigned long long stream);
+
 double rng_gauss(struct rng_state *rng);
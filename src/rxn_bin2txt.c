@@ -0,0 +1,151 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Converter from binary reaction data files to text.
+ *
+ * Prints a file written with -binary_reaction_output exactly as MCell
+ * would have written it without that option: the header line, if the file
+ * has one, and then one line per output time.
+ *
+ * Usage: rxn_bin2txt binary_file [text_file] */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "react_output_bin.h"
+
+static int read_u32(FILE *f, uint32_t *v) {
+  return fread(v, sizeof(uint32_t), 1, f) == 1 ? 0 : 1;
+}
+
+/* Reads a string of len bytes and terminates it */
+static char *read_string(FILE *f, uint32_t len) {
+  char *s = (char *)malloc(len + 1);
+  if (s == NULL)
+    return NULL;
+  if (fread(s, 1, len, f) != len) {
+    free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s binary_file [text_file]\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  char magic[8];
+  uint32_t version, header_bytes, n_columns, flags, comment_len;
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, RXN_BIN_MAGIC, sizeof(magic)) != 0 ||
+      read_u32(in, &version) || read_u32(in, &header_bytes) ||
+      read_u32(in, &n_columns) || read_u32(in, &flags) ||
+      read_u32(in, &comment_len)) {
+    fprintf(stderr, "%s is not a binary reaction data file.\n", argv[1]);
+    return 1;
+  }
+  if (version != RXN_BIN_VERSION) {
+    fprintf(stderr, "%s has format version %u; only version %d is known.\n",
+            argv[1], version, RXN_BIN_VERSION);
+    return 1;
+  }
+
+  char *comment = read_string(in, comment_len);
+  uint8_t *types = (uint8_t *)malloc(n_columns + 1);
+  char **titles = (char **)calloc(n_columns + 1, sizeof(char *));
+  double *row = (double *)malloc((n_columns + 1) * sizeof(double));
+  if (comment == NULL || types == NULL || titles == NULL || row == NULL) {
+    fprintf(stderr, "Failed to read the header of %s.\n", argv[1]);
+    return 1;
+  }
+  for (uint32_t c = 0; c < n_columns; c++) {
+    uint32_t title_len;
+    if (fread(&types[c], 1, 1, in) != 1 || read_u32(in, &title_len) ||
+        (titles[c] = read_string(in, title_len)) == NULL) {
+      fprintf(stderr, "Failed to read the header of %s.\n", argv[1]);
+      return 1;
+    }
+  }
+  if (fseek(in, header_bytes, SEEK_SET) != 0) {
+    fprintf(stderr, "Failed to read the header of %s.\n", argv[1]);
+    return 1;
+  }
+
+  FILE *out = stdout;
+  if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  if (flags & RXN_BIN_TEXT_HEADER) {
+    fprintf(out, "%s%s", comment,
+            (flags & RXN_BIN_ITERATIONS) ? "Iteration_#" : "Seconds");
+    for (uint32_t c = 0; c < n_columns; c++)
+      fprintf(out, " %s", titles[c]);
+    fprintf(out, "\n");
+  }
+
+  while (fread(row, sizeof(double), n_columns + 1, in) == n_columns + 1) {
+    fprintf(out, "%.15g", row[0]);
+    for (uint32_t c = 0; c < n_columns; c++) {
+      if (isnan(row[c + 1]))
+        fprintf(out, " X"); /* unset count */
+      else if (types[c] == RXN_BIN_INT)
+        fprintf(out, " %d", (int)row[c + 1]);
+      else
+        fprintf(out, " %.9g", row[c + 1]);
+    }
+    fprintf(out, "\n");
+  }
+
+  int status = 0;
+  if (ferror(in)) {
+    fprintf(stderr, "Failed to read %s.\n", argv[1]);
+    status = 1;
+  }
+  if (fclose(out) != 0) {
+    perror(argc == 3 ? argv[2] : "stdout");
+    status = 1;
+  }
+  fclose(in);
+
+  for (uint32_t c = 0; c < n_columns; c++)
+    free(titles[c]);
+  free(titles);
+  free(types);
+  free(row);
+  free(comment);
+  return status;
+}
@@ -0,0 +1,595 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Runs the memory partitions (storages) of the world on a pool of worker
+ * threads.
+ *
+ * Every storage is owned by exactly one worker while it runs, and sees the
+ * world through a private copy of 'struct volume' (world_view) which carries
+ * its own random number generator and statistics counters.  Storages are
+ * colored by the parity of their position in the storage grid, so that two
+ * storages of the same color are never adjacent; only one color runs at a
+ * time.  This lets a worker read the subvolumes next to its own (expanded
+ * collision lists, exact disk) without them changing underneath it.
+ *
+ * A molecule which diffuses out of its storage is not moved by the worker.
+ * It is parked on the boundary in the storage's outgoing hand-off queue, then
+ * migrated by the main thread once the color has finished, and finally takes
+ * the rest of its step when the storage it entered runs.
+ *
+ * Updates to state shared by all storages (populations, reaction and count
+ * statistics, trigger output, molecule ids) are made while holding
+ * SHARED_STATE_LOCK.  The exception are wall hits and crossings of
+ * molecules without triggers: every view collects them in a count shard of
+ * its own, and the main thread adds the shards to the counters after each
+ * color, i.e. before any output can look at them.
+ *
+ * Models using features whose data structures cross storage boundaries in
+ * other ways (surface molecules, trimolecular reactions, NFSim, dynamic
+ * geometry, periodic boundaries) fall back to running serially.
+ *
+ * Two storages of the same color may both collide with a molecule of the
+ * storage between them.  Whichever worker takes SHARED_STATE_LOCK first may
+ * destroy it, so the other must check the partner again under the lock (see
+ * collide_and_react_with_vol_mol).  For the same reason, a worker leaves the
+ * per-species lists of a neighboring storage alone when scanning it, and
+ * only collects the empty lists of its own.
+ *
+ * Runs on worker threads are not reproducible: molecule ids, the order in
+ * which products landing in a neighboring storage join its schedule, and
+ * which of two workers gets a shared partner all follow the order in which
+ * workers take SHARED_STATE_LOCK.  A single thread never creates the pool
+ * and takes none of these paths. */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "diffuse.h"
+#include "vol_util.h"
+#include "count_util.h"
+#include "storage_threads.h"
+
+#define NUM_STORAGE_COLORS 8
+
+struct storage_threads {
+  struct volume *world;     /* The real world state */
+  struct storage **stores;  /* All storages, in creation order */
+  int n_stores;
+
+  pthread_mutex_t state_lock; /* See SHARED_STATE_LOCK */
+
+  /* Job queue shared with the workers */
+  pthread_mutex_t job_lock;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  unsigned long generation; /* Bumped whenever a new batch is posted */
+  int shutdown;
+  struct storage **jobs;
+  int n_jobs;
+  int next_job;
+  int jobs_pending;
+  double release_time;
+  double checkpt_time;
+
+  int n_workers; /* Threads besides the main thread */
+  int n_idle;    /* Workers waiting for the next batch */
+  pthread_t *workers;
+};
+
+/*************************************************************************
+threads_ineligible:
+  In: world: simulation state
+  Out: NULL if the storages of this model may be run concurrently, otherwise
+       a short description of the reason why they may not.
+*************************************************************************/
+static char const *threads_ineligible(struct volume *world) {
+  if (world->ranks != NULL)
+    return "the world is split across several ranks";
+  if (world->nfsim_flag)
+    return "NFSim models are not supported";
+  if (world->dynamic_geometry_head != NULL)
+    return "dynamic geometry is not supported";
+  if (world->periodic_box_obj != NULL)
+    return "periodic boundary conditions are not supported";
+
+  for (int i = 0; i < world->n_species; i++) {
+    struct species *sp = world->species_list[i];
+    if (sp == world->all_mols || sp == world->all_volume_mols ||
+        sp == world->all_surface_mols || (sp->flags & IS_SURFACE) != 0)
+      continue;
+    if (sp->flags & ON_GRID)
+      return "surface molecules are not supported";
+    if (sp->flags & (CAN_VOLVOLVOL | CAN_VOLVOLSURF))
+      return "trimolecular reactions are not supported";
+  }
+
+  /* Same-colored storages may only be one storage apart, so a subvolume
+   * next to one of them must not be next to the other as well. */
+  int n_parts[3] = { world->nx_parts - 1, world->ny_parts - 1,
+                     world->nz_parts - 1 };
+  int mem_part[3] = { world->mem_part_x, world->mem_part_y,
+                      world->mem_part_z };
+  for (int axis = 0; axis < 3; axis++) {
+    int n_storages = (n_parts[axis] + mem_part[axis] - 1) / mem_part[axis];
+    if (n_storages < 2)
+      continue;
+    int last = n_parts[axis] - (n_storages - 1) * mem_part[axis];
+    if (mem_part[axis] < 2 || last < 2)
+      return "memory partitions must be at least two subvolumes wide";
+  }
+  return NULL;
+}
+
+/*************************************************************************
+clear_view_counters:
+  In: view: a storage's private view of the simulation state
+  Out: No return value.  The statistics counters of the view are zeroed.
+*************************************************************************/
+static void clear_view_counters(struct volume *view) {
+  view->diffusion_number = 0;
+  view->diffusion_cumtime = 0.0;
+  view->ray_voxel_tests = 0;
+  view->ray_polygon_tests = 0;
+  view->ray_polygon_colls = 0;
+  view->ray_polygon_culls = 0;
+  view->vol_vol_colls = 0;
+  view->vol_surf_colls = 0;
+  view->surf_surf_colls = 0;
+  view->vol_wall_colls = 0;
+  view->vol_vol_vol_colls = 0;
+  view->vol_vol_surf_colls = 0;
+  view->vol_surf_surf_colls = 0;
+  view->surf_surf_surf_colls = 0;
+}
+
+/*************************************************************************
+merge_view_counters:
+  In: world: simulation state
+      view: a storage's private view of the simulation state
+  Out: No return value.  The statistics and counts gathered in the view are
+       added to the world and cleared in the view.
+*************************************************************************/
+static void merge_view_counters(struct volume *world, struct volume *view) {
+  world->diffusion_number += view->diffusion_number;
+  world->diffusion_cumtime += view->diffusion_cumtime;
+  world->ray_voxel_tests += view->ray_voxel_tests;
+  world->ray_polygon_tests += view->ray_polygon_tests;
+  world->ray_polygon_colls += view->ray_polygon_colls;
+  world->ray_polygon_culls += view->ray_polygon_culls;
+  world->vol_vol_colls += view->vol_vol_colls;
+  world->vol_surf_colls += view->vol_surf_colls;
+  world->surf_surf_colls += view->surf_surf_colls;
+  world->vol_wall_colls += view->vol_wall_colls;
+  world->vol_vol_vol_colls += view->vol_vol_vol_colls;
+  world->vol_vol_surf_colls += view->vol_vol_surf_colls;
+  world->vol_surf_surf_colls += view->vol_surf_surf_colls;
+  world->surf_surf_surf_colls += view->surf_surf_surf_colls;
+  if (view->count_shard != NULL)
+    merge_count_shard(view->count_shard);
+  clear_view_counters(view);
+}
+
+/*************************************************************************
+refresh_view:
+  In: world: simulation state
+      view: a storage's private view of the simulation state
+  Out: No return value.  The view is brought up to date with the world,
+       keeping its own random number generator and count shard.
+*************************************************************************/
+static void refresh_view(struct volume *world, struct volume *view) {
+  struct rng_state *rng = view->rng;
+  struct count_shard *count_shard = view->count_shard;
+  memcpy(view, world, sizeof(struct volume));
+  view->rng = rng;
+  view->count_shard = count_shard;
+  clear_view_counters(view);
+}
+
+/*************************************************************************
+run_storage_jobs:
+  In: st: thread pool
+  Out: No return value.  Runs storages from the current batch until there
+       are none left.  Must be called with job_lock held.
+*************************************************************************/
+static void run_storage_jobs(struct storage_threads *st) {
+  while (st->next_job < st->n_jobs) {
+    struct storage *local = st->jobs[st->next_job++];
+    double release_time = st->release_time;
+    double checkpt_time = st->checkpt_time;
+    pthread_mutex_unlock(&st->job_lock);
+
+    resume_handed_off_molecules(local->world_view, local);
+    run_timestep(local->world_view, local, release_time, checkpt_time);
+
+    pthread_mutex_lock(&st->job_lock);
+    if (--st->jobs_pending == 0)
+      pthread_cond_signal(&st->job_done);
+  }
+}
+
+/*************************************************************************
+storage_worker:
+  In: arg: thread pool
+  Out: NULL.  Body of a worker thread: waits for batches of storages to be
+       posted and helps running them until asked to shut down.
+*************************************************************************/
+static void *storage_worker(void *arg) {
+  struct storage_threads *st = (struct storage_threads *)arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&st->job_lock);
+  while (1) {
+    st->n_idle++;
+    pthread_cond_signal(&st->job_done);
+    while (!st->shutdown && st->generation == seen)
+      pthread_cond_wait(&st->job_ready, &st->job_lock);
+    st->n_idle--;
+    if (st->shutdown)
+      break;
+    seen = st->generation;
+    run_storage_jobs(st);
+  }
+  pthread_mutex_unlock(&st->job_lock);
+  return NULL;
+}
+
+/*************************************************************************
+transfer_handoffs:
+  In: local: storage which has just run
+  Out: No return value.  Molecules parked on the boundary of this storage
+       are migrated into the storage they were entering and queued there.
+       Molecules which reacted away while parked are freed.
+*************************************************************************/
+static void transfer_handoffs(struct storage *local) {
+  struct mol_handoff *next;
+  for (struct mol_handoff *h = local->handoff_out; h != NULL; h = next) {
+    next = h->next;
+
+    struct volume_molecule *vm = h->vm;
+    vm->flags &= ~IN_SCHEDULE;
+    if (vm->properties == NULL) {
+      if ((vm->flags & IN_MASK) == 0)
+        mem_put(vm->birthplace, vm);
+      mem_put(local->handoff, h);
+      continue;
+    }
+
+    struct storage *dest = h->dest->local_storage;
+    struct mol_handoff *moved = (struct mol_handoff *)CHECKED_MEM_GET(
+        dest->handoff, "molecule hand-off");
+    *moved = *h;
+    moved->vm = migrate_volume_molecule(vm, h->dest);
+    moved->next = dest->handoff_in;
+    dest->handoff_in = moved;
+    mem_put(local->handoff, h);
+  }
+  local->handoff_out = NULL;
+}
+
+/*************************************************************************
+run_color:
+  In: st: thread pool
+      jobs: storages to run
+      n_jobs: number of storages to run
+  Out: No return value.  The storages are run concurrently; the call
+       returns once all of them are done.
+*************************************************************************/
+static void run_color(struct storage_threads *st, struct storage **jobs,
+                      int n_jobs) {
+  pthread_mutex_lock(&st->job_lock);
+  st->jobs = jobs;
+  st->n_jobs = n_jobs;
+  st->next_job = 0;
+  st->jobs_pending = n_jobs;
+  if (n_jobs > 1) {
+    st->generation++;
+    pthread_cond_broadcast(&st->job_ready);
+  }
+  run_storage_jobs(st);
+  while (st->jobs_pending > 0)
+    pthread_cond_wait(&st->job_done, &st->job_lock);
+  pthread_mutex_unlock(&st->job_lock);
+}
+
+/*************************************************************************
+run_storages_threaded:
+  In: world: simulation state
+      release_time: time of the next release event
+      checkpt_time: time of the next checkpoint
+  Out: No return value.  This is the threaded counterpart of calling
+       run_timestep on every storage until none of them has anything left
+       to do in the current time slot.
+*************************************************************************/
+void run_storages_threaded(struct volume *world, double release_time,
+                           double checkpt_time) {
+  struct storage_threads *st = world->threads;
+  struct storage *jobs[st->n_stores];
+
+  for (int i = 0; i < st->n_stores; i++)
+    refresh_view(world, st->stores[i]->world_view);
+  st->release_time = release_time;
+  st->checkpt_time = checkpt_time;
+
+  int done = 0;
+  while (!done) {
+    for (int color = 0; color < NUM_STORAGE_COLORS; color++) {
+      int n_jobs = 0;
+      for (int i = 0; i < st->n_stores; i++) {
+        struct storage *local = st->stores[i];
+        if (local->color == color &&
+            (local->timer->current != NULL || local->handoff_in != NULL))
+          jobs[n_jobs++] = local;
+      }
+      if (n_jobs == 0)
+        continue;
+
+      run_color(st, jobs, n_jobs);
+
+      for (int i = 0; i < n_jobs; i++) {
+        merge_view_counters(world, jobs[i]->world_view);
+        transfer_handoffs(jobs[i]);
+      }
+    }
+
+    done = 1;
+    for (int i = 0; i < st->n_stores; i++) {
+      if (st->stores[i]->timer->current != NULL ||
+          st->stores[i]->handoff_in != NULL) {
+        done = 0;
+        break;
+      }
+    }
+  }
+}
+
+/*************************************************************************
+storage_threads_lock:
+  In: world: simulation state as seen by the calling worker
+  Out: No return value.  Takes the shared state lock and brings the
+       global fields which are modified under it up to date in the view.
+*************************************************************************/
+void storage_threads_lock(struct volume *world) {
+  struct storage_threads *st = world->threads;
+  pthread_mutex_lock(&st->state_lock);
+  if (world != st->world) {
+    world->current_mol_id = st->world->current_mol_id;
+    world->dissociation_index = st->world->dissociation_index;
+  }
+}
+
+/*************************************************************************
+storage_threads_unlock:
+  In: world: simulation state as seen by the calling worker
+  Out: No return value.  Publishes the global fields modified under the
+       shared state lock and releases it.
+*************************************************************************/
+void storage_threads_unlock(struct volume *world) {
+  struct storage_threads *st = world->threads;
+  if (world != st->world) {
+    st->world->current_mol_id = world->current_mol_id;
+    st->world->dissociation_index = world->dissociation_index;
+    st->world->reaction_prob_limit_flag |= world->reaction_prob_limit_flag;
+  }
+  pthread_mutex_unlock(&st->state_lock);
+}
+
+/*************************************************************************
+storage_threads_before_fork:
+  In: world: simulation state
+  Out: No return value.  Waits until every worker is idle, and holds the
+       locks of the pool, so that a copy of the process forked now (see
+       create_chkpt_in_background) inherits them in a known state.  Must be
+       called by the main thread between iterations, and be followed by
+       storage_threads_after_fork in the parent and in the copy.
+*************************************************************************/
+void storage_threads_before_fork(struct volume *world) {
+  struct storage_threads *st = world->threads;
+  if (st == NULL)
+    return;
+
+  pthread_mutex_lock(&st->job_lock);
+  while (st->n_idle < st->n_workers)
+    pthread_cond_wait(&st->job_done, &st->job_lock);
+  pthread_mutex_lock(&st->state_lock);
+}
+
+/*************************************************************************
+storage_threads_after_fork:
+  In: world: simulation state
+  Out: No return value.  Releases the locks taken by
+       storage_threads_before_fork.
+*************************************************************************/
+void storage_threads_after_fork(struct volume *world) {
+  struct storage_threads *st = world->threads;
+  if (st == NULL)
+    return;
+
+  pthread_mutex_unlock(&st->state_lock);
+  pthread_mutex_unlock(&st->job_lock);
+}
+
+/*************************************************************************
+storage_threads_rng_uses:
+  In: world: simulation state
+  Out: The number of random numbers drawn by the storages' private
+       generators.
+*************************************************************************/
+long long storage_threads_rng_uses(struct volume *world) {
+  long long uses = 0;
+  if (world->threads == NULL)
+    return 0;
+  for (int i = 0; i < world->threads->n_stores; i++)
+    uses += rng_uses(world->threads->stores[i]->rng);
+  return uses;
+}
+
+/*************************************************************************
+init_storage_threads:
+  In: world: simulation state
+  Out: 0 on success, 1 on failure.  If more than one thread was requested
+       and the model allows it, the worker threads are started and every
+       storage gets its private view of the world, random number generator,
+       count shard, collision memory and hand-off queues.  Otherwise the
+       storages keep running serially.
+*************************************************************************/
+int init_storage_threads(struct volume *world) {
+  if (world->num_threads <= 1)
+    return 0;
+
+  int n_stores = 0;
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next)
+    n_stores++;
+
+  char const *reason = threads_ineligible(world);
+  if (reason == NULL && n_stores < 2)
+    reason = "there is only one memory partition";
+  if (reason != NULL) {
+    mcell_warn("Running memory partitions serially instead of on %d threads: "
+               "%s.",
+               world->num_threads, reason);
+    return 0;
+  }
+
+  struct storage_threads *st =
+      CHECKED_MALLOC_STRUCT(struct storage_threads, "storage threads");
+  memset(st, 0, sizeof(struct storage_threads));
+  st->world = world;
+  st->n_stores = n_stores;
+  st->stores = CHECKED_MALLOC_ARRAY(struct storage *, n_stores,
+                                    "storages run by threads");
+
+  /* The storage list is built backwards; undo that so that the storage
+   * index (and hence the random number stream) follows the storage grid. */
+  int idx = n_stores;
+  for (struct storage_list *l = world->storage_head; l != NULL; l = l->next)
+    st->stores[--idx] = l->store;
+
+  for (int i = 0; i < world->nx_parts - 1; i++)
+    for (int j = 0; j < world->ny_parts - 1; j++)
+      for (int k = 0; k < world->nz_parts - 1; k++) {
+        int h = k + (world->nz_parts - 1) * (j + (world->ny_parts - 1) * i);
+        world->subvol[h].local_storage->color =
+            ((i / world->mem_part_x) & 1) |
+            (((j / world->mem_part_y) & 1) << 1) |
+            (((k / world->mem_part_z) & 1) << 2);
+      }
+
+  world->threads = st;
+  struct count_shard *shards = NULL;
+  if (world->count_hash != NULL)
+    shards = create_count_shards(world, n_stores);
+  for (int i = 0; i < n_stores; i++) {
+    struct storage *local = st->stores[i];
+
+    /* Collision and exact disk lists are shared between storages when
+     * running serially; give every storage its own. */
+    if ((local->coll = create_mem_named(sizeof(struct collision), 128,
+                                        "collision")) == NULL)
+      mcell_allocfailed("Failed to create memory pool for collisions.");
+    if ((local->sp_coll = create_mem_named(sizeof(struct sp_collision), 128,
+                                           "sp collision")) == NULL)
+      mcell_allocfailed(
+          "Failed to create memory pool for trimolecular-pathway collisions.");
+    if ((local->tri_coll = create_mem_named(sizeof(struct tri_collision), 128,
+                                            "tri collision")) == NULL)
+      mcell_allocfailed(
+          "Failed to create memory pool for trimolecular collisions.");
+    if ((local->exdv = create_mem_named(sizeof(struct exd_vertex), 64,
+                                        "exact disk vertex")) == NULL)
+      mcell_allocfailed(
+          "Failed to create memory pool for exact disk calculation vertices.");
+    if ((local->handoff = create_mem_named(sizeof(struct mol_handoff), 128,
+                                           "molecule hand-off")) == NULL)
+      mcell_allocfailed("Failed to create memory pool for molecule hand-offs.");
+
+    /* The stream may already have been restored from a checkpoint */
+    if (local->rng == NULL) {
+      local->rng = CHECKED_MALLOC_STRUCT(struct rng_state,
+                                         "random number generator state");
+      rng_stream_init(local->rng, world->seed_seq, RNG_STREAM_STORAGE(i));
+    }
+
+    local->world_view =
+        CHECKED_MALLOC_STRUCT(struct volume, "storage view of the world");
+    local->world_view->rng = local->rng;
+    local->world_view->count_shard = (shards != NULL) ? &shards[i] : NULL;
+    refresh_view(world, local->world_view);
+  }
+
+  pthread_mutex_init(&st->state_lock, NULL);
+  pthread_mutex_init(&st->job_lock, NULL);
+  pthread_cond_init(&st->job_ready, NULL);
+  pthread_cond_init(&st->job_done, NULL);
+
+  st->n_workers = world->num_threads - 1;
+  st->workers = CHECKED_MALLOC_ARRAY(pthread_t, st->n_workers,
+                                     "storage worker threads");
+  for (int i = 0; i < st->n_workers; i++) {
+    if (pthread_create(&st->workers[i], NULL, storage_worker, st) != 0) {
+      mcell_error_nodie("Failed to start storage worker thread %d.", i + 1);
+      st->n_workers = i;
+      destroy_storage_threads(world);
+      return 1;
+    }
+  }
+
+  if (world->notify->progress_report != NOTIFY_NONE)
+    mcell_log("Running %d memory partitions on %d threads; results will "
+              "differ from run to run.",
+              n_stores, world->num_threads);
+  return 0;
+}
+
+/*************************************************************************
+destroy_storage_threads:
+  In: world: simulation state
+  Out: No return value.  The worker threads are stopped.  The storages'
+       private memory pools and views stay in place so that the storages
+       remain usable.
+*************************************************************************/
+void destroy_storage_threads(struct volume *world) {
+  struct storage_threads *st = world->threads;
+  if (st == NULL)
+    return;
+
+  pthread_mutex_lock(&st->job_lock);
+  st->shutdown = 1;
+  pthread_cond_broadcast(&st->job_ready);
+  pthread_mutex_unlock(&st->job_lock);
+  for (int i = 0; i < st->n_workers; i++)
+    pthread_join(st->workers[i], NULL);
+
+  pthread_cond_destroy(&st->job_done);
+  pthread_cond_destroy(&st->job_ready);
+  pthread_mutex_destroy(&st->job_lock);
+  pthread_mutex_destroy(&st->state_lock);
+  free(st->workers);
+  free(st->stores);
+  free(st);
+  world->threads = NULL;
+}
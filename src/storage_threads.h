@@ -0,0 +1,55 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+/* Guard simulation state which is shared between storages (species
+ * populations, reaction statistics, counters, trigger output and molecule
+ * ids).  Both are no-ops unless the storages are running on worker threads. */
+#define SHARED_STATE_LOCK(world)                                               \
+  do {                                                                         \
+    if ((world)->threads != NULL)                                              \
+      storage_threads_lock(world);                                             \
+  } while (0)
+
+#define SHARED_STATE_UNLOCK(world)                                             \
+  do {                                                                         \
+    if ((world)->threads != NULL)                                              \
+      storage_threads_unlock(world);                                           \
+  } while (0)
+
+int init_storage_threads(struct volume *world);
+void destroy_storage_threads(struct volume *world);
+
+void run_storages_threaded(struct volume *world, double release_time,
+                           double checkpt_time);
+
+void storage_threads_lock(struct volume *world);
+void storage_threads_unlock(struct volume *world);
+
+void storage_threads_before_fork(struct volume *world);
+void storage_threads_after_fork(struct volume *world);
+
+long long storage_threads_rng_uses(struct volume *world);
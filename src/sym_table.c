@@ -205,6 +205,11 @@ struct species *new_species(void) {
   specp->chkpt_species_id = 0;
   specp->sm_dat_head = NULL;
   specp->population = 0;
+  specp->live_mols = NULL;
+  specp->n_live_mols = 0;
+  specp->live_mols_alloc = 0;
+  specp->bimol_rxns = NULL;
+  specp->bimol_row_len = 0;
   specp->D = 0.0;
   specp->space_step = 0.0;
   specp->time_step = 0.0;
@@ -0,0 +1,216 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Round-trip test of the packed molecule chunks of checkpoint files.
+ *
+ * Packs columns laid out like a molecule chunk of chkpt.c (times and
+ * positions as doubles, species ids, orientations and flags) with
+ * pack_columns, unpacks them with unpack_columns and checks that they come
+ * back unchanged, both for data which compress and for data which don't.
+ * Truncated chunks, chunks which claim the wrong number of molecules and
+ * chunks with corrupted bytes must be rejected, or at least never be
+ * unpacked past the end of the output buffer. */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress_util.h"
+
+/* Columns of a molecule chunk, as in chkpt.c */
+static const size_t column_sizes[] = {
+  sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+  sizeof(double), sizeof(double), sizeof(uint32_t), sizeof(int16_t), 1
+};
+#define N_COLUMNS (sizeof(column_sizes) / sizeof(column_sizes[0]))
+#define BYTES_PER_MOL                                                          \
+  (6 * sizeof(double) + sizeof(uint32_t) + sizeof(int16_t) + 1)
+
+/* Room in the columns, and molecules in the chunk */
+#define CAPACITY 4096
+#define N_MOLS 3000
+
+/* Guard bytes after the output buffers */
+#define GUARD 64
+
+static int failures = 0;
+
+static void check(int ok, char const *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+static unsigned long long rng_state = 0x9E3779B97F4A7C15ULL;
+
+static unsigned long long next_random(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+/* Columns with room for CAPACITY molecules, the first N_MOLS of them set.
+ * Unless 'noise', the values look like a real chunk and compress well. */
+static unsigned char *make_columns(int noise) {
+  unsigned char *cols = (unsigned char *)calloc(CAPACITY, BYTES_PER_MOL);
+  double *t = (double *)cols;
+  double *t2 = t + CAPACITY, *birthday = t2 + CAPACITY;
+  double *x = birthday + CAPACITY, *y = x + CAPACITY, *z = y + CAPACITY;
+  uint32_t *species = (uint32_t *)(z + CAPACITY);
+  int16_t *orient = (int16_t *)(species + CAPACITY);
+  unsigned char *flags = (unsigned char *)(orient + CAPACITY);
+  for (int i = 0; i < N_MOLS; i++) {
+    if (noise) {
+      unsigned char *p = cols;
+      for (size_t c = 0; c < N_COLUMNS; c++) {
+        for (size_t b = 0; b < column_sizes[c]; b++)
+          p[i * column_sizes[c] + b] = (unsigned char)next_random();
+        p += CAPACITY * column_sizes[c];
+      }
+      continue;
+    }
+    t[i] = 100.0 + (i % 7);
+    t2[i] = 1e300;
+    birthday[i] = (double)(i / 100);
+    x[i] = (double)(next_random() % 1000) / 1000.0;
+    y[i] = (double)(next_random() % 1000) / 1000.0;
+    z[i] = 0.5;
+    species[i] = (uint32_t)(i % 3);
+    orient[i] = 0;
+    flags[i] = (unsigned char)(i & 1);
+  }
+  return cols;
+}
+
+/* Whether the unpacked columns (room for N_MOLS each) match the original
+ * ones (room for CAPACITY each) */
+static int same_columns(unsigned char const *orig, unsigned char const *cols) {
+  for (size_t c = 0; c < N_COLUMNS; c++) {
+    if (memcmp(orig, cols, N_MOLS * column_sizes[c]) != 0)
+      return 0;
+    orig += CAPACITY * column_sizes[c];
+    cols += N_MOLS * column_sizes[c];
+  }
+  return 1;
+}
+
+static int guard_intact(unsigned char const *buf, size_t size) {
+  for (size_t i = 0; i < GUARD; i++)
+    if (buf[size + i] != 0xA5)
+      return 0;
+  return 1;
+}
+
+/* Unpacks 'stored' for n_mols molecules into guarded buffers.  Returns what
+ * unpack_columns returned, or -1 if it wrote past the buffers. */
+static int unpack(unsigned char const *stored, size_t stored_size,
+                  int compressed, size_t n_mols, unsigned char **out) {
+  size_t raw_size = n_mols * BYTES_PER_MOL;
+  unsigned char *scratch = (unsigned char *)malloc(raw_size + GUARD);
+  unsigned char *cols = (unsigned char *)malloc(raw_size + GUARD);
+  memset(scratch, 0xA5, raw_size + GUARD);
+  memset(cols, 0xA5, raw_size + GUARD);
+  int status = unpack_columns(stored, stored_size, compressed, n_mols,
+                              column_sizes, N_COLUMNS, scratch, cols);
+  if (!guard_intact(scratch, raw_size) || !guard_intact(cols, raw_size))
+    status = -1;
+  free(scratch);
+  if (out != NULL && status == 0)
+    *out = cols;
+  else
+    free(cols);
+  return status;
+}
+
+int main(void) {
+  size_t raw_size = N_MOLS * BYTES_PER_MOL;
+  unsigned char *shuffled = (unsigned char *)malloc(raw_size);
+  unsigned char *packed = (unsigned char *)malloc(raw_size);
+
+  /* A chunk which compresses */
+  unsigned char *orig = make_columns(0);
+  size_t packed_size = pack_columns(orig, CAPACITY, N_MOLS, column_sizes,
+                                    N_COLUMNS, shuffled, packed);
+  check(packed_size > 0 && packed_size < raw_size,
+        "a typical chunk is compressed");
+
+  unsigned char *cols = NULL;
+  check(unpack(packed, packed_size, 1, N_MOLS, &cols) == 0 && cols != NULL &&
+            same_columns(orig, cols),
+        "a compressed chunk unpacks to the original columns");
+  free(cols);
+  cols = NULL;
+
+  /* Truncated, or claiming another number of molecules */
+  size_t cuts[] = { 0, 1, 2, packed_size / 2, packed_size - 2,
+                    packed_size - 1 };
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++)
+    check(unpack(packed, cuts[i], 1, N_MOLS, NULL) == 1,
+          "a truncated compressed chunk is rejected");
+  check(unpack(packed, packed_size, 1, N_MOLS + 1, NULL) == 1,
+        "a compressed chunk with too few molecules is rejected");
+  check(unpack(packed, packed_size, 1, N_MOLS - 1, NULL) == 1,
+        "a compressed chunk with too many molecules is rejected");
+
+  /* Corrupted bytes: mostly detected, never unpacked out of bounds */
+  unsigned char *corrupt = (unsigned char *)malloc(packed_size);
+  int n_rejected = 0, n_overrun = 0;
+  for (size_t i = 0; i < packed_size; i++) {
+    memcpy(corrupt, packed, packed_size);
+    corrupt[i] ^= 0xFF;
+    int status = unpack(corrupt, packed_size, 1, N_MOLS, NULL);
+    if (status == 1)
+      n_rejected++;
+    else if (status < 0)
+      n_overrun++;
+  }
+  check(n_overrun == 0, "a corrupted chunk is never unpacked out of bounds");
+  check(n_rejected > 0, "corrupted chunks are rejected");
+  free(corrupt);
+  free(orig);
+
+  /* A chunk which doesn't compress is stored shuffled */
+  orig = make_columns(1);
+  packed_size = pack_columns(orig, CAPACITY, N_MOLS, column_sizes, N_COLUMNS,
+                             shuffled, packed);
+  check(packed_size == 0, "random data are not compressed");
+  check(unpack(shuffled, raw_size, 0, N_MOLS, &cols) == 0 && cols != NULL &&
+            same_columns(orig, cols),
+        "a shuffled chunk unpacks to the original columns");
+  free(cols);
+  check(unpack(shuffled, raw_size - 1, 0, N_MOLS, NULL) == 1,
+        "a truncated shuffled chunk is rejected");
+  free(orig);
+
+  free(shuffled);
+  free(packed);
+  if (failures != 0)
+    return 1;
+  printf("Checkpoint chunks survived the round trip.\n");
+  return 0;
+}
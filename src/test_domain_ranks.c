@@ -0,0 +1,249 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Loopback test of splitting a world across two ranks.
+ *
+ * Forks a world of two subvolumes, one per rank, over the real socket
+ * transport of domain_ranks.c.  Rank 0 hands a molecule which is crossing
+ * into rank 1's slab over in the middle of its step, and rank 1 hands back a
+ * molecule which ended up in rank 0's slab; each must arrive with its state
+ * and the rest of its step, and leave the sending rank.  Values summed over
+ * the ranks, both in one batch and in the final statistics, must add up.
+ *
+ * The parts of the simulator which place molecules in subvolumes and count
+ * them are replaced by the stubs below; the rest is the real code.
+ *
+ * Usage: test_domain_ranks */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcell_structs.h"
+#include "count_util.h"
+#include "mem_util.h"
+#include "rng.h"
+#include "sched_util.h"
+#include "vol_util.h"
+#include "mol_index.h"
+#include "domain_ranks.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "Rank %d: ", world.procnum);                             \
+      fprintf(stderr, __VA_ARGS__);                                            \
+      fprintf(stderr, "\n");                                                   \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+/* Molecules the exchange put into a subvolume on this rank */
+static struct volume_molecule *arrived[4];
+static int n_arrived = 0;
+
+void ht_add_molecule_to_list(struct pointer_hash *h,
+                             struct volume_molecule *vm) {
+  if (n_arrived < 4)
+    arrived[n_arrived] = vm;
+  n_arrived++;
+}
+
+void collect_molecule(struct volume_molecule *vm) {
+  vm->properties = NULL;
+  if ((vm->flags & IN_MASK) == 0)
+    mem_put(vm->birthplace, vm);
+}
+
+void count_region_from_scratch(struct volume *world,
+                               struct abstract_molecule *am,
+                               struct rxn_pathname *rxpn, int n,
+                               struct vector3 *loc, struct wall *my_wall,
+                               double t, struct periodic_image *periodic_box) {}
+
+struct periodic_image *new_periodic_image(struct volume *state,
+                                          struct periodic_image const *img) {
+  struct periodic_image *copy =
+      (struct periodic_image *)malloc(sizeof(struct periodic_image));
+  *copy = *img;
+  return copy;
+}
+
+static struct volume world;
+
+static struct volume_molecule *new_molecule(struct storage *local,
+                                            struct species *spec,
+                                            struct subvolume *sv, u_long id) {
+  struct volume_molecule *vm = (struct volume_molecule *)mem_get(local->mol);
+  memset(vm, 0, sizeof(struct volume_molecule));
+  vm->properties = spec;
+  vm->birthplace = local->mol;
+  vm->subvol = sv;
+  vm->id = id;
+  vm->t = 5.0;
+  vm->t2 = 0.5;
+  vm->birthday = 1.0;
+  vm->flags = TYPE_VOL | ACT_DIFFUSE | IN_VOLUME;
+  vm->pos.x = 0.25 + (double)(sv - world.subvol);
+  vm->pos.y = vm->pos.z = 0.5;
+  spec->population++;
+  mol_index_add((struct abstract_molecule *)vm);
+  return vm;
+}
+
+int main(void) {
+  static struct notifications notify;
+  static struct sym_entry sym;
+  static struct species spec;
+  static struct subvolume subvol[2];
+  static struct storage store;
+  static struct storage_list stores;
+  struct species *species_list[1] = { &spec };
+
+  sym.name = "A";
+  spec.sym = &sym;
+  spec.species_id = 0;
+  spec.flags = 0;
+
+  world.notify = &notify;
+  world.num_ranks = 2;
+  world.seed_seq = 1;
+  world.nx_parts = 3;
+  world.ny_parts = 2;
+  world.nz_parts = 2;
+  world.n_subvols = 2;
+  world.subvol = subvol;
+  world.n_species = 1;
+  world.species_list = species_list;
+  world.rng = (struct rng_state *)malloc(sizeof(struct rng_state));
+  rng_init(world.rng, world.seed_seq);
+
+  store.mol = create_mem(sizeof(struct volume_molecule), 16);
+  store.timer = create_scheduler(1.0, 100.0, 100, 0.0);
+  stores.store = &store;
+  world.storage_head = &stores;
+  for (int i = 0; i < 2; i++)
+    subvol[i].local_storage = &store;
+
+  if (init_domain_ranks(&world) || world.ranks == NULL) {
+    fprintf(stderr, "The world was not split across two ranks.\n");
+    return 1;
+  }
+  int rank = world.procnum;
+  CHECK(domain_owns_subvol(&world, &subvol[rank]) &&
+            !domain_owns_subvol(&world, &subvol[1 - rank]),
+        "owns the wrong subvolume");
+
+  struct volume_molecule *leaving = NULL;
+  if (rank == 0) {
+    /* Crossing into rank 1's subvolume, halfway through its step */
+    leaving = new_molecule(&store, &spec, &subvol[0], 100);
+    struct mol_handoff *h = (struct mol_handoff *)mem_get(store.handoff);
+    memset(h, 0, sizeof(struct mol_handoff));
+    h->vm = leaving;
+    h->dest = &subvol[1];
+    h->displacement.x = 0.75;
+    h->displacement2.y = -0.125;
+    h->t_steps = 0.5;
+    h->rate_factor = 2.0;
+    h->r_rate_factor = 0.5;
+    h->t_start = 4.5;
+    h->inertness = 1;
+    h->next = store.handoff_out;
+    store.handoff_out = h;
+    leaving->flags |= IN_SCHEDULE;
+  } else {
+    /* A product which landed in rank 0's subvolume */
+    leaving = new_molecule(&store, &spec, &subvol[0], 200);
+    domain_export_molecule(leaving);
+  }
+
+  CHECK(domain_exchange_molecules(&world) == 1,
+        "no molecule reported as moved");
+  CHECK(leaving->properties == NULL, "sent molecule was not collected");
+  CHECK(n_arrived == 1, "%d molecules arrived instead of 1", n_arrived);
+  CHECK(spec.population == 1, "population is %d instead of 1",
+        spec.population);
+  CHECK(spec.n_live_mols == 1, "%u molecules indexed instead of 1",
+        spec.n_live_mols);
+
+  if (n_arrived == 1) {
+    struct volume_molecule *vm = arrived[0];
+    CHECK(vm->properties == &spec, "arrived as the wrong species");
+    CHECK(vm->t == 5.0 && vm->t2 == 0.5 && vm->birthday == 1.0,
+          "arrived with the wrong times");
+    if (rank == 1) {
+      struct mol_handoff *h = store.handoff_in;
+      CHECK(vm->id == 100 && vm->subvol == &subvol[1] && vm->pos.x == 0.25,
+            "crossing molecule arrived with the wrong identity or place");
+      CHECK(h != NULL && h->vm == vm && h->dest == &subvol[1],
+            "crossing molecule was not queued to finish its step");
+      if (h != NULL)
+        CHECK(h->displacement.x == 0.75 && h->displacement2.y == -0.125 &&
+                  h->t_steps == 0.5 && h->rate_factor == 2.0 &&
+                  h->r_rate_factor == 0.5 && h->t_start == 4.5 &&
+                  h->inertness == 1,
+              "crossing molecule lost the rest of its step");
+      CHECK((vm->flags & IN_SCHEDULE) == 0, "crossing molecule was scheduled");
+    } else {
+      CHECK(vm->id == 200 && vm->subvol == &subvol[0],
+            "exported molecule arrived with the wrong identity or place");
+      CHECK(store.handoff_in == NULL, "exported molecule was given a step");
+      CHECK((vm->flags & IN_SCHEDULE) != 0 && store.timer->count == 1,
+            "exported molecule was not scheduled");
+    }
+  }
+
+  CHECK(domain_exchange_molecules(&world) == 0,
+        "molecules moved with nothing to hand over");
+
+  /* Summed in one batch, as the reaction output of a time slot is */
+  double values[3] = { rank + 1.0, 10.0 * (rank + 1), spec.population };
+  domain_sum(&world, values, 3);
+  CHECK(values[0] == 3.0 && values[1] == 30.0 && values[2] == 2.0,
+        "sums are %g, %g, %g instead of 3, 30, 2", values[0], values[1],
+        values[2]);
+
+  /* Rank 1 doesn't return from finish_domain_ranks, so rank 0 reports */
+  int checked_before = failures;
+  double n_failed = failures;
+  domain_sum(&world, &n_failed, 1);
+  world.diffusion_number = rank + 1;
+  world.vol_vol_colls = 10 * (rank + 1);
+  finish_domain_ranks(&world);
+
+  CHECK(world.diffusion_number == 3 && world.vol_vol_colls == 30,
+        "final statistics are %lld and %lld instead of 3 and 30",
+        world.diffusion_number, world.vol_vol_colls);
+  n_failed += failures - checked_before;
+  if (n_failed > 0) {
+    fprintf(stderr, "%g check(s) failed on the ranks.\n", n_failed);
+    return 1;
+  }
+  printf("Molecules were handed over and counts summed across two ranks.\n");
+  return 0;
+}
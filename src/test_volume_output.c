@@ -0,0 +1,148 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Regression test for the scheduling of volume output.
+ *
+ * Runs the volume output of a world without molecules through the real
+ * scheduler, the way mcell_run_iteration does, and checks that the output
+ * of each item is written on exactly the iterations it asks for, and not
+ * before: every iteration, every other iteration, and a list of iterations.
+ *
+ * Usage: test_volume_output [scratch directory] */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mcell_structs.h"
+#include "sched_util.h"
+#include "volume_output.h"
+
+#define TEST_ITERATIONS 12
+
+static struct volume_output_item *new_item(char const *dir, char const *name,
+                                           struct species *spec) {
+  struct volume_output_item *vo =
+      (struct volume_output_item *)calloc(1, sizeof(struct volume_output_item));
+  vo->filename_prefix = (char *)malloc(strlen(dir) + strlen(name) + 2);
+  sprintf(vo->filename_prefix, "%s/%s", dir, name);
+  vo->num_molecules = 1;
+  vo->molecules = (struct species **)malloc(sizeof(struct species *));
+  vo->molecules[0] = spec;
+  vo->voxel_size.x = vo->voxel_size.y = vo->voxel_size.z = 1.0;
+  vo->nvoxels_x = vo->nvoxels_y = vo->nvoxels_z = 1;
+  return vo;
+}
+
+static int output_exists(char const *dir, char const *name, long long it) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s.%lld.dat", dir, name, it);
+  return access(path, F_OK) == 0;
+}
+
+int main(int argc, char **argv) {
+  char dir_template[] = "/tmp/test_volume_output.XXXXXX";
+  char const *dir = (argc > 1) ? argv[1] : mkdtemp(dir_template);
+  if (dir == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  static struct volume world;
+  static struct notifications notify;
+  static struct species spec;
+  struct species *species_list[1] = { &spec };
+  notify.volume_output_report = NOTIFY_NONE;
+  world.notify = &notify;
+  world.time_unit = 1e-6;
+  world.length_unit = 1.0;
+  world.n_species = 1;
+  world.species_list = species_list;
+  world.volume_output_scheduler = create_scheduler(1.0, 100.0, 100, 0.0);
+
+  /* Every iteration, every other iteration, and iterations 0, 3 and 7 */
+  struct volume_output_item *every = new_item(dir, "every", &spec);
+  every->timer_type = OUTPUT_BY_STEP;
+  every->step_time = world.time_unit;
+  struct volume_output_item *second = new_item(dir, "second", &spec);
+  second->timer_type = OUTPUT_BY_STEP;
+  second->step_time = 2 * world.time_unit;
+  struct volume_output_item *list = new_item(dir, "list", &spec);
+  list->timer_type = OUTPUT_BY_ITERATION_LIST;
+  list->num_times = 3;
+  list->times = (double *)malloc(3 * sizeof(double));
+  list->times[0] = 0.0;
+  list->times[1] = 3.0;
+  list->times[2] = 7.0;
+  list->next_time = list->times + 1;
+
+  struct volume_output_item *items[] = { every, second, list };
+  for (int i = 0; i < 3; i++) {
+    if (schedule_add(world.volume_output_scheduler, items[i])) {
+      fprintf(stderr, "Failed to schedule volume output.\n");
+      return 1;
+    }
+  }
+
+  int failures = 0;
+  for (long long it = 0; it < TEST_ITERATIONS; it++) {
+    world.current_iterations = it;
+    process_volume_output(&world, it + 1.0);
+
+    int expected[3] = { 1, it % 2 == 0, it == 0 || it == 3 || it == 7 };
+    char const *names[3] = { "every", "second", "list" };
+    for (int i = 0; i < 3; i++) {
+      if (output_exists(dir, names[i], it) != expected[i]) {
+        fprintf(stderr, "Volume output '%s' %s on iteration %lld.\n",
+                names[i], expected[i] ? "missing" : "written", it);
+        failures++;
+      }
+      if (output_exists(dir, names[i], it + 1)) {
+        fprintf(stderr, "Volume output '%s' for iteration %lld written on "
+                        "iteration %lld.\n", names[i], it + 1, it);
+        failures++;
+      }
+    }
+  }
+
+  /* Clean up unless we were told where to write */
+  if (argc <= 1) {
+    char const *names[3] = { "every", "second", "list" };
+    for (long long it = 0; it <= TEST_ITERATIONS; it++) {
+      for (int i = 0; i < 3; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.%lld.dat", dir, names[i], it);
+        unlink(path);
+      }
+    }
+    rmdir(dir);
+  }
+
+  if (failures > 0)
+    return 1;
+  printf("Volume output was written on the expected iterations.\n");
+  return 0;
+}
@@ -117,21 +117,23 @@ static long long frame_iteration(struct volume *world, double iterval,
 
 /*************************************************************************
 sort_molecules_by_species:
-    Scans over all molecules, sorting them into arrays by species.
+    Looks up the molecules of each species in the index of live molecules.
 
         In:  struct abstract_molecule ****viz_molpp
              u_int  **viz_mol_countp
              int include_volume - should the lists include vol mols?
              int include_grid - should the lists include surface mols?
         Out: 0 on success, 1 on error; viz_molpp and viz_mol_countp arrays are
-             allocated and filled with sorted data.
+             allocated and filled with sorted data.  The arrays of molecules
+             belong to the index; only viz_molpp itself is to be freed, and
+             only as long as no molecules are created or destroyed may it be
+             used.
 **************************************************************************/
 static int sort_molecules_by_species(struct volume *world,
                                      struct viz_output_block *vizblk,
                                      struct abstract_molecule ****viz_molpp,
                                      u_int **viz_mol_countp, int include_volume,
                                      int include_grid) {
-  struct storage_list *slp;
   u_int *counts;
   int species_index;
 
@@ -143,74 +145,32 @@ static int sort_molecules_by_species(struct volume *world,
       NULL)
     return 1;
 
-  /* Walk through the species allocating arrays for all molecules of that
-   * species */
   for (species_index = 0; species_index < world->n_species; ++species_index) {
-    int mol_count;
-    u_int spec_id = world->species_list[species_index]->species_id;
+    struct species *spec = world->species_list[species_index];
+    u_int spec_id = spec->species_id;
 
     if (vizblk->species_viz_states[species_index] == EXCLUDE_OBJ)
       continue;
 
-    if (world->species_list[species_index]->flags & IS_SURFACE)
+    if (spec->flags & IS_SURFACE)
       continue;
 
-    if (!include_grid && (world->species_list[species_index]->flags & ON_GRID))
+    if (!include_grid && (spec->flags & ON_GRID))
       continue;
 
-    if (!include_volume &&
-        !(world->species_list[species_index]->flags & ON_GRID))
+    if (!include_volume && !(spec->flags & ON_GRID))
       continue;
 
-    mol_count = world->species_list[species_index]->population;
-    if (mol_count <= 0)
+    if (spec->n_live_mols != spec->population) {
+      mcell_warn("Molecule count disagreement!\n"
+                 "  Species %s  population = %d  count = %d",
+                 spec->sym->name, spec->population, spec->n_live_mols);
+    }
+    if (spec->n_live_mols == 0)
       continue;
 
-    if (((*viz_molpp)[spec_id] =
-             (struct abstract_molecule **)allocate_ptr_array(mol_count)) ==
-        NULL)
-      return 1;
-  }
-
-  /* Sort molecules by species id */
-  for (slp = world->storage_head; slp != NULL; slp = slp->next) {
-    struct storage *sp = slp->store;
-    struct schedule_helper *shp;
-    struct abstract_molecule *amp;
-    int sched_slot_index;
-    for (shp = sp->timer; shp != NULL; shp = shp->next_scale) {
-      for (sched_slot_index = -1; sched_slot_index < shp->buf_len;
-           ++sched_slot_index) {
-        for (amp = (struct abstract_molecule *)((sched_slot_index < 0)
-                                                    ? shp->current
-                                                    : shp->circ_buf_head
-                                                          [sched_slot_index]);
-             amp != NULL; amp = amp->next) {
-          u_int spec_id;
-          if (amp->properties == NULL)
-            continue;
-
-          spec_id = amp->properties->species_id;
-          if (vizblk->species_viz_states[spec_id] == EXCLUDE_OBJ)
-            continue;
-
-          if (!include_grid && (amp->flags & TYPE_MASK) != TYPE_VOL)
-            continue;
-
-          if (!include_volume && (amp->flags & TYPE_MASK) == TYPE_VOL)
-            continue;
-
-          if (counts[spec_id] < amp->properties->population)
-            (*viz_molpp)[spec_id][counts[spec_id]++] = amp;
-          else {
-            mcell_warn("Molecule count disagreement!\n"
-                       "  Species %s  population = %d  count = %d",
-                       amp->properties->sym->name, amp->properties->population,
-                       counts[spec_id]);
-          }
-        }
-      }
-    }
+    (*viz_molpp)[spec_id] = spec->live_mols;
+    counts[spec_id] = spec->n_live_mols;
   }
 
   return 0;
@@ -346,15 +306,12 @@ static int output_ascii_molecules(struct volume *world,
                                   struct frame_data_list *fdlp) {
   FILE *custom_file;
   char *cf_name;
-  struct storage_list *slp;
-  struct schedule_helper *shp;
-  struct abstract_element *aep;
   struct abstract_molecule *amp;
   struct volume_molecule *mp;
   struct surface_molecule *gmp;
   short orient = 0;
 
-  int ndigits, i;
+  int ndigits;
   long long lli;
 
   struct vector3 where, norm;
@@ -386,56 +343,49 @@ static int output_ascii_molecules(struct volume *world,
     free(cf_name);
     cf_name = NULL;
 
-    for (slp = world->storage_head; slp != NULL; slp = slp->next) {
-      for (shp = slp->store->timer; shp != NULL; shp = shp->next_scale) {
-        for (i = -1; i < shp->buf_len; i++) {
-          for (aep = (i < 0) ? shp->current : shp->circ_buf_head[i];
-               aep != NULL; aep = aep->next) {
-            amp = (struct abstract_molecule *)aep;
-            if (amp->properties == NULL)
-              continue;
-
-            int id = vizblk->species_viz_states[amp->properties->species_id];
-            if (id == EXCLUDE_OBJ)
-              continue;
-
-            if ((amp->properties->flags & NOT_FREE) == 0) {
-              mp = (struct volume_molecule *)amp;
-              where.x = mp->pos.x;
-              where.y = mp->pos.y;
-              where.z = mp->pos.z;
-              norm.x = 0;
-              norm.y = 0;
-              norm.z = 0;
-            } else if ((amp->properties->flags & ON_GRID) != 0) {
-              gmp = (struct surface_molecule *)amp;
-              uv2xyz(&(gmp->s_pos), gmp->grid->surface, &where);
-              orient = gmp->orient;
-              norm.x = orient * gmp->grid->surface->normal.x;
-              norm.y = orient * gmp->grid->surface->normal.y;
-              norm.z = orient * gmp->grid->surface->normal.z;
-            } else
-              continue;
-
-            where.x *= world->length_unit;
-            where.y *= world->length_unit;
-            where.z *= world->length_unit;
-            /*
-                        fprintf(custom_file,"%d %15.8e %15.8e %15.8e
-               %2d\n",id,where.x,where.y,where.z,orient);
-            */
-            if (id == INCLUDE_OBJ) {
-              /* write name of molecule */
-              fprintf(custom_file, "%s %lu %.9g %.9g %.9g %.9g %.9g %.9g\n",
-                      amp->properties->sym->name, amp->id, where.x, where.y,
-                      where.z, norm.x, norm.y, norm.z);
-            } else {
-              /* write state value of molecule */
-              fprintf(custom_file, "%d %lu %.9g %.9g %.9g %.9g %.9g %.9g\n", id,
-                      amp->id, where.x, where.y, where.z, norm.x, norm.y,
-                      norm.z);
-            }
-          }
+    for (int i = 0; i < world->n_species; i++) {
+      struct species *spec = world->species_list[i];
+      int id = vizblk->species_viz_states[spec->species_id];
+      if (id == EXCLUDE_OBJ)
+        continue;
+
+      for (u_int n = 0; n < spec->n_live_mols; n++) {
+        amp = spec->live_mols[n];
+        if ((amp->properties->flags & NOT_FREE) == 0) {
+          mp = (struct volume_molecule *)amp;
+          where.x = mp->pos.x;
+          where.y = mp->pos.y;
+          where.z = mp->pos.z;
+          norm.x = 0;
+          norm.y = 0;
+          norm.z = 0;
+        } else if ((amp->properties->flags & ON_GRID) != 0) {
+          gmp = (struct surface_molecule *)amp;
+          uv2xyz(&(gmp->s_pos), gmp->grid->surface, &where);
+          orient = gmp->orient;
+          norm.x = orient * gmp->grid->surface->normal.x;
+          norm.y = orient * gmp->grid->surface->normal.y;
+          norm.z = orient * gmp->grid->surface->normal.z;
+        } else
+          continue;
+
+        where.x *= world->length_unit;
+        where.y *= world->length_unit;
+        where.z *= world->length_unit;
+        /*
+                    fprintf(custom_file,"%d %15.8e %15.8e %15.8e
+           %2d\n",id,where.x,where.y,where.z,orient);
+        */
+        if (id == INCLUDE_OBJ) {
+          /* write name of molecule */
+          fprintf(custom_file, "%s %lu %.9g %.9g %.9g %.9g %.9g %.9g\n",
+                  amp->properties->sym->name, amp->id, where.x, where.y,
+                  where.z, norm.x, norm.y, norm.z);
+        } else {
+          /* write state value of molecule */
+          fprintf(custom_file, "%d %lu %.9g %.9g %.9g %.9g %.9g %.9g\n", id,
+                  amp->id, where.x, where.y, where.z, norm.x, norm.y,
+                  norm.z);
         }
       }
     }
@@ -2364,7 +2314,7 @@ static int output_cellblender_molecules(struct volume *world,
     fclose(custom_file);
     custom_file = NULL;
 
-    free_ptr_array((void **)viz_molp, world->n_species);
+    free(viz_molp);
     viz_molp = NULL;
     free(viz_mol_count);
     viz_mol_count = NULL;
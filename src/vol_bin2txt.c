@@ -0,0 +1,131 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Converter from binary volume output files to text.
+ *
+ * Prints a file written with -binary_volume_output exactly as MCell would
+ * have written it without that option: the header line and then the count
+ * of every voxel, one line per row of voxels and one block per slab.
+ *
+ * Usage: vol_bin2txt binary_file [text_file] */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "volume_output_bin.h"
+
+static int read_u32(FILE *f, uint32_t *v) {
+  return fread(v, sizeof(uint32_t), 1, f) == 1 ? 0 : 1;
+}
+
+/* Reads the next nonzero voxel, or sets *voxel past the last voxel */
+static int read_voxel(FILE *f, uint64_t *n_left, uint64_t *voxel,
+                      uint32_t *count) {
+  if (*n_left == 0) {
+    *voxel = UINT64_MAX;
+    return 0;
+  }
+  --*n_left;
+  if (fread(voxel, sizeof(uint64_t), 1, f) != 1 || read_u32(f, count))
+    return 1;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s binary_file [text_file]\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  char magic[8];
+  uint32_t version, dims[3];
+  double geometry[7];
+  uint64_t n_nonzero;
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, VOL_BIN_MAGIC, sizeof(magic)) != 0 ||
+      read_u32(in, &version)) {
+    fprintf(stderr, "%s is not a binary volume output file.\n", argv[1]);
+    return 1;
+  }
+  if (version != VOL_BIN_VERSION) {
+    fprintf(stderr, "%s has format version %u; only version %d is known.\n",
+            argv[1], version, VOL_BIN_VERSION);
+    return 1;
+  }
+  if (fread(dims, sizeof(uint32_t), 3, in) != 3 ||
+      fread(geometry, sizeof(double), 7, in) != 7 ||
+      fread(&n_nonzero, sizeof(uint64_t), 1, in) != 1) {
+    fprintf(stderr, "Failed to read the header of %s.\n", argv[1]);
+    return 1;
+  }
+
+  FILE *out = stdout;
+  if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  fprintf(out, "# nx=%d ny=%d nz=%d time=%g\n", (int)dims[0], (int)dims[1],
+          (int)dims[2], geometry[0]);
+
+  int status = 0;
+  uint64_t next_voxel;
+  uint32_t next_count;
+  if (read_voxel(in, &n_nonzero, &next_voxel, &next_count))
+    status = 1;
+  uint64_t voxel = 0;
+  for (uint32_t k = 0; k < dims[2] && !status; ++k) {
+    for (uint32_t u = 0; u < dims[1] && !status; ++u) {
+      for (uint32_t v = 0; v < dims[0]; ++v, ++voxel) {
+        uint32_t count = 0;
+        if (next_voxel == voxel) {
+          count = next_count;
+          if (read_voxel(in, &n_nonzero, &next_voxel, &next_count)) {
+            status = 1;
+            break;
+          }
+        }
+        fprintf(out, "%u ", count);
+      }
+      fprintf(out, "\n");
+    }
+    fprintf(out, "\n");
+  }
+
+  if (status)
+    fprintf(stderr, "Failed to read %s.\n", argv[1]);
+  if (fclose(out) != 0) {
+    perror(argc == 3 ? argv[2] : "stdout");
+    status = 1;
+  }
+  fclose(in);
+  return status;
+}
@@ -49,6 +49,9 @@
 #include "grid_util.h"
 #include "nfsim_func.h"
 #include "mcell_reactions.h"
+#include "domain_ranks.h"
+#include "packed_mols.h"
+#include "mol_index.h"
 #include "diffuse.h"
 
 static int test_max_release(double num_to_release, char *name);
@@ -71,6 +74,16 @@ static int release_inside_regions(struct volume *state,
 static int num_vol_mols_from_conc(struct release_site_obj *rso,
                                   double length_unit, bool *exactNumber);
 
+/* Number of molecules whose positions are generated before they are inserted
+   together by insert_volume_molecules */
+#define RELEASE_BATCH_SIZE 65536
+
+static struct per_species_list *ht_species_list(struct pointer_hash *h,
+                                                struct volume_molecule *vm);
+
+static void ht_link_molecule(struct per_species_list *list,
+                             struct volume_molecule *vm);
+
 /*************************************************************************
 inside_subvolume:
   In: pointer to vector3
@@ -554,8 +567,7 @@ struct wall* find_closest_wall(
     *grid_index = uv2grid(best_uv, best_w->grid);
   } else {
     *grid_index = uv2grid(best_uv, best_w->grid);
-    struct surface_molecule_list *sm_list = best_w->grid->sm_list[*grid_index];
-    if (sm_list && sm_list->sm) {
+    if (tile_occupied(best_w->grid, *grid_index)) {
       // XXX: this isn't good enough. we should only return this if the PB of
       // sm isn't represented in the PB list.
       if (state->periodic_box_obj && !state->periodic_traditional) {
@@ -645,17 +657,13 @@ place_surface_molecule(struct volume *state, struct species *s,
       state->simulation_start_seconds, t);
   sm->id = state->current_mol_id++;
   sm->properties = s;
-  initialize_diffusion_function((struct abstract_molecule*)sm);
 
   s->population++;
-  sm->periodic_box = CHECKED_MALLOC_STRUCT(struct periodic_image,
-    "periodic image descriptor");
-  sm->periodic_box->x = periodic_box->x;
-  sm->periodic_box->y = periodic_box->y;
-  sm->periodic_box->z = periodic_box->z;
+  mol_index_add((struct abstract_molecule *)sm);
+  sm->periodic_box = new_periodic_image(state, periodic_box);
 
   sm->flags = TYPE_SURF | ACT_NEWBIE | IN_SCHEDULE;
-  if (sm->get_space_step(sm) > 0)
+  if (mol_space_step(sm) > 0)
     sm->flags |= ACT_DIFFUSE;
   if (trigger_unimolecular(state->reaction_hash, state->rx_hashsize, s->hashval,
                            (struct abstract_molecule *)sm) != NULL ||
@@ -675,6 +683,7 @@ place_surface_molecule(struct volume *state, struct species *s,
     return NULL; 
   }
   sm->grid->sm_list[sm->grid_index] = sm_list;
+  update_tile_occupancy(sm->grid, sm->grid_index);
   
   sm->grid->n_occupied++;
   sm->flags |= IN_SURFACE;
@@ -779,14 +788,8 @@ struct volume_molecule *insert_volume_molecule(
   ht_add_molecule_to_list(&sv->mol_by_species, new_vm);
   sv->mol_count++;
   new_vm->properties->population++;
-  new_vm->periodic_box = CHECKED_MALLOC_STRUCT(struct periodic_image,
-    "periodic image descriptor");
-  new_vm->periodic_box->x = vm->periodic_box->x;
-  new_vm->periodic_box->y = vm->periodic_box->y;
-  new_vm->periodic_box->z = vm->periodic_box->z;
-
-  //initialize function pointer to diffusion function
-  initialize_diffusion_function((struct abstract_molecule*)new_vm);
+  mol_index_add((struct abstract_molecule *)new_vm);
+  new_vm->periodic_box = new_periodic_image(state, vm->periodic_box);
 
   if ((new_vm->properties->flags & COUNT_SOME_MASK) != 0)
     new_vm->flags |= COUNT_ME;
@@ -798,10 +801,122 @@ struct volume_molecule *insert_volume_molecule(
 
   if (schedule_add(sv->local_storage->timer, new_vm))
     mcell_allocfailed("Failed to add volume molecule to scheduler.");
+  domain_note_inserted_molecule(state, new_vm);
   return new_vm;
 }
 
+/*************************************************************************
+strictly_inside_subvolume:
+  In: state: MCell simulation state
+      point: a position
+      sv: a subvolume
+  Out: nonzero if the position is inside the subvolume and not on any of its
+       faces, i.e. inside no other subvolume.
+*************************************************************************/
+static int strictly_inside_subvolume(struct volume *state,
+                                     struct vector3 *point,
+                                     struct subvolume *sv) {
+  return ((point->x > state->x_fineparts[sv->llf.x]) &&
+          (point->x < state->x_fineparts[sv->urb.x]) &&
+          (point->y > state->y_fineparts[sv->llf.y]) &&
+          (point->y < state->y_fineparts[sv->urb.y]) &&
+          (point->z > state->z_fineparts[sv->llf.z]) &&
+          (point->z < state->z_fineparts[sv->urb.z]));
+}
+
+/*************************************************************************
+insert_volume_molecules
+  In: state: MCell simulation state
+      vm: template for the molecules to place in local storage
+      pos: positions of the molecules
+      n: number of molecules
+  Out: 0 on success, 1 if a position is outside of the periodic boundaries.
+       A copy of the template is placed at each of the positions and put in
+       the scheduler, exactly as if insert_volume_molecule had been called
+       for each position in turn.
+  Note: the periodic boundaries are checked once for the whole batch, the
+        ids are taken as one block, a subvolume's species list is only
+        looked up again when the subvolume changes, and a position strictly
+        inside the previous molecule's subvolume skips the search.  Each
+        molecule is still added to the scheduler on its own; schedule_add is
+        a constant-time append.
+*************************************************************************/
+int insert_volume_molecules(struct volume *state, struct volume_molecule *vm,
+                            struct vector3 *pos, int n) {
+  if (n <= 0)
+    return 0;
+
+  // Make sure none of the molecules are outside of the periodic boundaries
+  if (state->periodic_box_obj) {
+    struct polygon_object *p = (struct polygon_object*)(state->periodic_box_obj->contents);
+    struct subdivided_box *sb = p->sb;
+    struct vector3 llf = (struct vector3) {sb->x[0], sb->y[0], sb->z[0]};
+    struct vector3 urb = (struct vector3) {sb->x[1], sb->y[1], sb->z[1]};
+    for (int i = 0; i < n; i++) {
+      if (!point_in_box(&llf, &urb, &pos[i])) {
+        mcell_error("cannot release '%s' outside of periodic boundaries.",
+                    vm->properties->sym->name);
+        return 1;
+      }
+    }
+  }
+
+  u_long first_id = state->current_mol_id;
+  state->current_mol_id += n;
+
+  /* A position on a partition plane lies in two subvolumes, and a search
+     started from a guess may return either of them.  The previous
+     subvolume is only reused for a position strictly inside it, which no
+     other subvolume contains; everything else is searched from scratch,
+     as insert_volume_molecule does without a guess. */
+  struct subvolume *sv = NULL;
+  struct per_species_list *list = NULL;
+  for (int i = 0; i < n; i++) {
+    if (sv == NULL || !strictly_inside_subvolume(state, &pos[i], sv)) {
+      struct subvolume *new_sv = find_subvolume(state, &pos[i], NULL);
+      if (new_sv != sv)
+        list = NULL;
+      sv = new_sv;
+    }
+
+    struct volume_molecule *new_vm;
+    new_vm = CHECKED_MEM_GET(sv->local_storage->mol, "volume molecule");
+    memcpy(new_vm, vm, sizeof(struct volume_molecule));
+    new_vm->pos = pos[i];
+    new_vm->mesh_name = NULL;
+    new_vm->birthplace = sv->local_storage->mol;
+    new_vm->id = first_id + i;
+    new_vm->prev_v = NULL;
+    new_vm->next_v = NULL;
+    new_vm->next = NULL;
+    new_vm->subvol = sv;
+    if (list == NULL)
+      list = ht_species_list(&sv->mol_by_species, new_vm);
+    ht_link_molecule(list, new_vm);
+    sv->mol_count++;
+    new_vm->properties->population++;
+    mol_index_add((struct abstract_molecule *)new_vm);
+    new_vm->periodic_box = new_periodic_image(state, vm->periodic_box);
+
+    if ((new_vm->properties->flags & COUNT_SOME_MASK) != 0)
+      new_vm->flags |= COUNT_ME;
+    if (new_vm->properties->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) {
+      count_region_from_scratch(state, (struct abstract_molecule *)new_vm,
+                                NULL, 1, &(new_vm->pos), NULL, new_vm->t,
+                                new_vm->periodic_box);
+    }
+
+    if (schedule_add(sv->local_storage->timer, new_vm))
+      mcell_allocfailed("Failed to add volume molecule to scheduler.");
+    domain_note_inserted_molecule(state, new_vm);
+  }
+
+  return 0;
+}
+
 static int remove_from_list(struct volume_molecule *it) {
+  if (it->prev_v && it->subvol->local_storage->packed_molecules)
+    packed_list_remove(it);
   if (it->prev_v) {
 #ifdef DEBUG_LIST_CHECKS
     if (*it->prev_v != it) {
@@ -859,6 +974,7 @@ struct volume_molecule *migrate_volume_molecule(struct volume_molecule *vm,
   new_vm->subvol = new_sv;
 
   ht_add_molecule_to_list(&new_sv->mol_by_species, new_vm);
+  mol_index_moved((struct abstract_molecule *)new_vm);
 
   collect_molecule(vm);
 
@@ -975,6 +1091,12 @@ static int vacuum_inside_regions(struct volume *state,
   struct vector3 *origin;
   struct wall_list *wl;
 
+  /* Every rank would remove its own choice of molecules */
+  if (state->ranks != NULL)
+    mcell_error("Release site '%s' removes molecules, which is not supported "
+                "when the world is split across several ranks.",
+                rso->name);
+
   rrd = rso->region_data;
   mh = create_mem(sizeof(struct void_list), 1024);
   if (mh == NULL)
@@ -1074,6 +1196,7 @@ static int vacuum_inside_regions(struct volume *state,
     if (rng_dbl(state->rng) < ((double)(-n)) / ((double)vl_num)) {
       mp = (struct volume_molecule *)vl->data;
       mp->properties->population--;
+      mol_index_remove(mp->properties, (struct abstract_molecule *)mp);
       mp->subvol->mol_count--;
       if ((mp->properties->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) != 0)
         count_region_from_scratch(state, (struct abstract_molecule *)mp, NULL,
@@ -1333,12 +1456,11 @@ int release_molecules(struct volume *state, struct release_event_queue *req) {
 
   // All molecules are the same, so we can set flags
   if (rso->mol_list == NULL) {
-    initialize_diffusion_function(ap);
     if (trigger_unimolecular(state->reaction_hash, state->rx_hashsize,
                              rso->mol_type->hashval, ap) != NULL ||
         (rso->mol_type->flags & CAN_SURFWALL) != 0)
       ap->flags |= ACT_REACT;
-    if (ap->get_space_step(ap) > 0.0)
+    if (mol_space_step(ap) > 0.0)
       ap->flags |= ACT_DIFFUSE;
   }
 
@@ -1407,14 +1529,21 @@ int release_molecules(struct volume *state, struct release_event_queue *req) {
       vm.pos.y = location[0][1];
       vm.pos.z = location[0][2];
 
-      struct volume_molecule *vm_guess = NULL;
-      for (int i = 0; i < number; i++) {
-        vm_guess = insert_volume_molecule(state, &vm, vm_guess);
-        if (vm_guess == NULL)
-          return 1;
-        vm.periodic_box->x = rso->periodic_box->x;
-        vm.periodic_box->y = rso->periodic_box->y;
-        vm.periodic_box->z = rso->periodic_box->z;
+      int batch_size =
+          (number < RELEASE_BATCH_SIZE) ? number : RELEASE_BATCH_SIZE;
+      if (batch_size > 0) {
+        struct vector3 *batch = CHECKED_MALLOC_ARRAY(
+            struct vector3, batch_size, "molecule release positions");
+        for (int i = 0; i < batch_size; i++)
+          batch[i] = vm.pos;
+        for (int i = 0; i < number; i += batch_size) {
+          int n_batch = (number - i < batch_size) ? number - i : batch_size;
+          if (insert_volume_molecules(state, &vm, batch, n_batch)) {
+            free(batch);
+            return 1;
+          }
+        }
+        free(batch);
       }
       if (state->notify->release_events == NOTIFY_FULL) {
         mcell_log("Released %d %s from \"%s\" at iteration %lld.", number,
@@ -1472,6 +1601,13 @@ int release_ellipsoid_or_rectcuboid(struct volume *state,
                              rso->release_shape == SHAPE_ELLIPTIC ||
                              rso->release_shape == SHAPE_SPHERICAL_SHELL);
 
+  int batch_size = (number < RELEASE_BATCH_SIZE) ? number : RELEASE_BATCH_SIZE;
+  struct vector3 *batch = NULL;
+  if (batch_size > 0)
+    batch = CHECKED_MALLOC_ARRAY(struct vector3, batch_size,
+                                 "molecule release positions");
+  int n_batch = 0;
+
   for (int i = 0; i < number; i++) {
     do /* Pick values in unit square, toss if not in unit circle */
     {
@@ -1502,18 +1638,24 @@ int release_ellipsoid_or_rectcuboid(struct volume *state,
 
     mult_matrix(location, req->t_matrix, location, 1, 4, 4);
 
-    vm->pos.x = location[0][0];
-    vm->pos.y = location[0][1];
-    vm->pos.z = location[0][2];
-    struct volume_molecule *guess = NULL;
-    /* Insert copy of vm into state */
-    vm->periodic_box->x = rso->periodic_box->x;
-    vm->periodic_box->y = rso->periodic_box->y;
-    vm->periodic_box->z = rso->periodic_box->z;
-    guess = insert_volume_molecule(state, vm, guess); 
-    if (guess == NULL)
-      return 1;
+    batch[n_batch].x = location[0][0];
+    batch[n_batch].y = location[0][1];
+    batch[n_batch].z = location[0][2];
+
+    /* Insert copies of vm into state once the batch is full */
+    if (++n_batch == batch_size || i == number - 1) {
+      vm->periodic_box->x = rso->periodic_box->x;
+      vm->periodic_box->y = rso->periodic_box->y;
+      vm->periodic_box->z = rso->periodic_box->z;
+      if (insert_volume_molecules(state, vm, batch, n_batch)) {
+        free(batch);
+        return 1;
+      }
+      n_batch = 0;
+    }
   }
+  free(batch);
+
   if (state->notify->release_events == NOTIFY_FULL) {
     mcell_log("Released %d %s from \"%s\" at iteration %lld.", number,
               rso->mol_type->sym->name, rso->name, state->current_iterations);
@@ -1539,7 +1681,16 @@ int release_by_list(struct volume *state, struct release_event_queue *req,
   struct release_site_obj *rso = req->release_site;
   struct release_single_molecule *rsm = rso->mol_list;
 
-  for (; rsm != NULL; rsm = rsm->next) {
+  /* Runs of volume molecules of the same species are inserted together; a
+     run ends before a surface molecule so that ids keep the list order */
+  int n_listed = 0;
+  for (; rsm != NULL && n_listed < RELEASE_BATCH_SIZE; rsm = rsm->next)
+    n_listed++;
+  struct vector3 *batch = CHECKED_MALLOC_ARRAY(struct vector3, n_listed,
+                                               "molecule release positions");
+  int n_batch = 0;
+
+  for (rsm = rso->mol_list; rsm != NULL; rsm = rsm->next) {
     double location[1][4];
     location[0][0] = rsm->loc.x + rso->location->x;
     location[0][1] = rsm->loc.y + rso->location->y;
@@ -1548,30 +1699,36 @@ int release_by_list(struct volume *state, struct release_event_queue *req,
 
     mult_matrix(location, req->t_matrix, location, 1, 4, 4);
 
+    if (n_batch > 0 && (n_batch == n_listed ||
+                        (rsm->mol_type->flags & NOT_FREE) != 0 ||
+                        rsm->mol_type != vm->properties)) {
+      if (insert_volume_molecules(state, vm, batch, n_batch)) {
+        free(batch);
+        return 1;
+      }
+      i += n_batch;
+      n_batch = 0;
+    }
+
     vm->pos.x = location[0][0];
     vm->pos.y = location[0][1];
     vm->pos.z = location[0][2];
 
-    struct volume_molecule *vm_guess = NULL;
     if ((rsm->mol_type->flags & NOT_FREE) == 0) {
       struct abstract_molecule *ap = (struct abstract_molecule *)(vm);
       vm->properties = rsm->mol_type;
-      initialize_diffusion_function(ap);
-      // Have to set flags, since insert_volume_molecule doesn't
+      // Have to set flags, since insert_volume_molecules doesn't
       if (trigger_unimolecular(state->reaction_hash, state->rx_hashsize,
                                ap->properties->hashval, ap) != NULL ||
           (ap->properties->flags & CAN_SURFWALL) != 0) {
         ap->flags |= ACT_REACT;
       }
-      if (vm->get_space_step(vm) > 0.0)
+      if (mol_space_step(vm) > 0.0)
         ap->flags |= ACT_DIFFUSE;
-      vm_guess = insert_volume_molecule(state, vm, vm_guess);
-      if (vm_guess == NULL)
-        return 1;
-      vm_guess->periodic_box->x = rso->periodic_box->x;
-      vm_guess->periodic_box->y = rso->periodic_box->y;
-      vm_guess->periodic_box->z = rso->periodic_box->z;
-      i++;
+      vm->periodic_box->x = rso->periodic_box->x;
+      vm->periodic_box->y = rso->periodic_box->y;
+      vm->periodic_box->z = rso->periodic_box->z;
+      batch[n_batch++] = vm->pos;
     } else {
       double diam;
       if (rso->diameter == NULL)
@@ -1605,6 +1762,15 @@ int release_by_list(struct volume *state, struct release_event_queue *req,
       }
     }
   }
+  if (n_batch > 0) {
+    if (insert_volume_molecules(state, vm, batch, n_batch)) {
+      free(batch);
+      return 1;
+    }
+    i += n_batch;
+  }
+  free(batch);
+
   if (state->notify->release_events == NOTIFY_FULL) {
     mcell_log("Released %d molecules from list \"%s\" at iteration %lld.", i,
               rso->name, state->current_iterations);
@@ -1811,8 +1977,10 @@ int set_partitions(struct volume *state) {
       state->z_partitions == NULL) {
     set_auto_partitions(state, steps_min, steps_max, &part_min, &part_max,
                         f_max, smallest_spacing);
+    state->auto_partitions = 1;
   } else {
     set_user_partitions(state, dfx, dfy, dfz);
+    state->auto_partitions = 0;
   }
 
   /* And finally we tell the user what happened */
@@ -2124,6 +2292,9 @@ void path_bounding_box(struct vector3 *loc, struct vector3 *displacement,
       possibly returned to its birthplace.
 ***************************************************************************/
 void collect_molecule(struct volume_molecule *vm) {
+  if (vm->prev_v != NULL && vm->subvol->local_storage->packed_molecules)
+    packed_list_remove(vm);
+
   /* Unlink from the previous item */
   if (vm->prev_v != NULL) {
 #ifdef DEBUG_LIST_CHECKS
@@ -2156,24 +2327,18 @@ void collect_molecule(struct volume_molecule *vm) {
 }
 
 /***************************************************************************
- ht_add_molecule_to_list:
-    Add a molecule to the appropriate molecule list in a subvolume's pointer
-    hash.  It is assumed that the molecule's subvolume pointer is valid and
-    points to the right subvolume.
-
-    If the molecule takes part in any mol-mol interactions (including
-    trimolecular reactions involving two or more volume molecules), it is added
-    to a list containing only molecules of the same species.  If it does NOT
-    take part in any such interactions, it is added to a single molecule list
-    which keeps track of all molecules which do not interact with other volume
-    molecules.
+ ht_species_list:
+    Find the molecule list in a subvolume's pointer hash to which a molecule
+    belongs, creating the list if the subvolume doesn't have one yet.  It is
+    assumed that the molecule's subvolume pointer is valid and points to the
+    right subvolume.
 
- In: h: the pointer hash to which to add the molecule
+ In: h: the pointer hash of the molecule's subvolume
      vm: the molecule
- Out: Nothing.  Molecule is added to the subvolume's molecule lists.
+ Out: the per-species list into which the molecule is to be linked
 ***************************************************************************/
-void ht_add_molecule_to_list(struct pointer_hash *h,
-                             struct volume_molecule *vm) {
+static struct per_species_list *ht_species_list(struct pointer_hash *h,
+                                                struct volume_molecule *vm) {
   struct per_species_list *list = NULL;
 
   //if we are using external molecules store information per the graph tag instead of species struct
@@ -2190,6 +2355,10 @@ void ht_add_molecule_to_list(struct pointer_hash *h,
           vm->subvol->local_storage->pslv, "per-species molecule list");
       list->properties = vm->properties;
       list->graph_data = vm->graph_data;
+      list->n_packed = list->max_packed = 0;
+      list->packed_mol = NULL;
+      list->packed_pos = NULL;
+      list->packed_index = NULL;
       //list->graph_data->graph_pattern = strdup(vm->graph_data->graph_pattern);
       //list->graph_pattern_hash = vm->graph_pattern_hash;
       list->head = NULL;
@@ -2203,7 +2372,7 @@ void ht_add_molecule_to_list(struct pointer_hash *h,
     }
 
 
-  
+
   }
 
   else{
@@ -2217,6 +2386,10 @@ void ht_add_molecule_to_list(struct pointer_hash *h,
           vm->subvol->local_storage->pslv, "per-species molecule list");
       list->properties = vm->properties;
       list->head = NULL;
+      list->n_packed = list->max_packed = 0;
+      list->packed_mol = NULL;
+      list->packed_pos = NULL;
+      list->packed_index = NULL;
       if (pointer_hash_add(h, vm->properties, vm->properties->hashval, list))
         mcell_allocfailed("Failed to add species to subvolume species table.");
 
@@ -2225,12 +2398,49 @@ void ht_add_molecule_to_list(struct pointer_hash *h,
     }
   }
 
-  /* Link the molecule into the list */
+  return list;
+}
+
+/***************************************************************************
+ ht_link_molecule:
+    Link a molecule into the head of a per-species list of its subvolume.
+
+ In: list: the per-species list, as found by ht_species_list
+     vm: the molecule
+ Out: Nothing.  Molecule is added to the list.
+***************************************************************************/
+static void ht_link_molecule(struct per_species_list *list,
+                             struct volume_molecule *vm) {
   vm->next_v = list->head;
   if (list->head)
     list->head->prev_v = &vm->next_v;
   vm->prev_v = &list->head;
   list->head = vm;
+
+  if (vm->subvol->local_storage->packed_molecules)
+    packed_list_add(list, vm);
+}
+
+/***************************************************************************
+ ht_add_molecule_to_list:
+    Add a molecule to the appropriate molecule list in a subvolume's pointer
+    hash.  It is assumed that the molecule's subvolume pointer is valid and
+    points to the right subvolume.
+
+    If the molecule takes part in any mol-mol interactions (including
+    trimolecular reactions involving two or more volume molecules), it is added
+    to a list containing only molecules of the same species.  If it does NOT
+    take part in any such interactions, it is added to a single molecule list
+    which keeps track of all molecules which do not interact with other volume
+    molecules.
+
+ In: h: the pointer hash to which to add the molecule
+     vm: the molecule
+ Out: Nothing.  Molecule is added to the subvolume's molecule lists.
+***************************************************************************/
+void ht_add_molecule_to_list(struct pointer_hash *h,
+                             struct volume_molecule *vm) {
+  ht_link_molecule(ht_species_list(h, vm), vm);
 }
 
 /***************************************************************************
@@ -2507,6 +2717,33 @@ bool periodic_boxes_are_identical(const struct periodic_image *b1,
   return (b1->x == b2->x) && (b1->y == b2->y) && (b1->z == b2->z);
 }
 
+/*************************************************************************
+new_periodic_image:
+  In: state: MCell simulation state
+      img: periodic image to copy
+  Out: A copy of img for a new molecule, taken from the pool of periodic
+       images.  Like the rest of molecule creation, this must happen on the
+       main thread or under SHARED_STATE_LOCK.
+*************************************************************************/
+struct periodic_image *new_periodic_image(struct volume *state,
+                                          struct periodic_image const *img) {
+  struct periodic_image *copy = (struct periodic_image *)CHECKED_MEM_GET(
+      state->periodic_image_mem, "periodic image descriptor");
+  *copy = *img;
+  return copy;
+}
+
+/*************************************************************************
+free_periodic_image:
+  In: state: MCell simulation state
+      img: periodic image of a molecule which is going away, or NULL
+  Out: No return value.  The image is returned to the pool.
+*************************************************************************/
+void free_periodic_image(struct volume *state, struct periodic_image *img) {
+  if (img != NULL)
+    mem_put(state->periodic_image_mem, img);
+}
+
 /*************************************************************************
   convert_relative_to_abs_PBC_coords is used to convert the PBC coordinate
   system. This is probably not the best name for this function, since the
@@ -73,6 +73,9 @@ struct volume_molecule *insert_volume_molecule(struct volume *world,
                                                struct volume_molecule *vm,
                                                struct volume_molecule *guess);
 
+int insert_volume_molecules(struct volume *world, struct volume_molecule *vm,
+                            struct vector3 *pos, int n);
+
 struct volume_molecule *migrate_volume_molecule(struct volume_molecule *vm,
                                                 struct subvolume *new_sv);
 
@@ -125,6 +128,10 @@ void collect_molecule(struct volume_molecule *vm);
 bool periodic_boxes_are_identical(const struct periodic_image *b1,
   const struct periodic_image *b2);
 
+struct periodic_image *new_periodic_image(struct volume *state,
+                                          struct periodic_image const *img);
+void free_periodic_image(struct volume *state, struct periodic_image *img);
+
 int convert_relative_to_abs_PBC_coords(
     struct object *periodic_box_obj,
     struct periodic_image *periodic_box,
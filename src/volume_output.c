@@ -21,9 +21,28 @@
  *
 ******************************************************************************/
 
+/* Volume output.
+ *
+ * All items due at the same time are counted together: the molecules of
+ * the species any of them asks for are taken from the species' index of
+ * live molecules (see mol_index.c) and each volume molecule is binned into
+ * every item interested in its species, so the molecules are visited once
+ * per output time however many items there are.  Which items want which
+ * species is looked up in a table indexed by species id, built before the
+ * molecules are visited.
+ *
+ * The counts of an item are kept in a hash table of the voxels which hold
+ * molecules, so the work and memory depend on the number of molecules
+ * rather than on the number of voxels.  The table stays with the item and
+ * is reused at its next output time.  From the sorted nonzero voxels the
+ * file is written either in the text format, with a count for every voxel,
+ * or with -binary_volume_output as a list of the nonzero voxels only (see
+ * volume_output_bin.h for the layout). */
+
 #include "config.h"
 
 #include "volume_output.h"
+#include "volume_output_bin.h"
 #include "logging.h"
 #include "mcell_structs.h"
 #include "sched_util.h"
@@ -35,62 +54,234 @@
 #include <math.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 static int produce_item_header(FILE *out_file, struct volume_output_item *vo);
 
-static int produce_mol_counts(struct volume *wrld, FILE *out_file,
-                              struct volume_output_item *vo);
+static int count_volume_output_items(struct volume *wrld,
+                                     struct volume_output_item *items);
+
+static int write_volume_output_file(struct volume *wrld, char const *filename,
+                                    struct volume_output_item *vo);
 
-static int find_species_in_array(struct species **mols, int num_mols,
-                                 struct species *ptr);
+static int write_volume_output_item(struct volume *wrld, FILE *out_file,
+                                    struct volume_output_item *vo);
 
 static int reschedule_volume_output_item(struct volume *wrld,
                                          struct volume_output_item *vo);
 
+/* Voxels of an item which hold molecules, in an open addressing hash table
+   keyed on the voxel index */
+struct voxel_counts {
+  u_int size;        /* Number of slots, a power of two */
+  u_int n_used;      /* Number of slots in use */
+  uint64_t *voxel;   /* 1 + index of the voxel in each slot, 0 if unused */
+  uint32_t *count;   /* Molecules in the voxel of each slot */
+  struct voxel_count *sorted; /* Nonzero voxels in index order */
+};
+
+struct voxel_count {
+  uint64_t voxel;
+  uint32_t count;
+};
+
+#define VOXEL_COUNTS_MIN_SIZE 1024
+
+/*
+ * Allocate the slots of a voxel table of the given size.
+ */
+static int alloc_voxel_slots(struct voxel_counts *vc, u_int size) {
+  vc->voxel = CHECKED_MALLOC_ARRAY(uint64_t, size, "volume output voxels");
+  vc->count = CHECKED_MALLOC_ARRAY(uint32_t, size, "volume output voxels");
+  if (vc->voxel == NULL || vc->count == NULL)
+    return 1;
+  memset(vc->voxel, 0, size * sizeof(uint64_t));
+  vc->size = size;
+  vc->n_used = 0;
+  return 0;
+}
+
+static u_int voxel_slot(struct voxel_counts *vc, uint64_t key) {
+  u_int mask = vc->size - 1;
+  u_int slot = (u_int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  while (vc->voxel[slot] != 0 && vc->voxel[slot] != key)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+/*
+ * Add a molecule to a voxel.  The table is doubled once it is half full.
+ */
+static void add_to_voxel(struct voxel_counts *vc, uint64_t voxel) {
+  uint64_t key = voxel + 1;
+  u_int slot = voxel_slot(vc, key);
+  if (vc->voxel[slot] == key) {
+    ++vc->count[slot];
+    return;
+  }
+
+  if (2 * (vc->n_used + 1) > vc->size) {
+    uint64_t *old_voxel = vc->voxel;
+    uint32_t *old_count = vc->count;
+    u_int old_size = vc->size;
+    u_int n_used = vc->n_used;
+    if (alloc_voxel_slots(vc, 2 * old_size))
+      mcell_allocfailed("Failed to grow the voxels of a volume output.");
+    for (u_int i = 0; i < old_size; i++) {
+      if (old_voxel[i] != 0) {
+        u_int s = voxel_slot(vc, old_voxel[i]);
+        vc->voxel[s] = old_voxel[i];
+        vc->count[s] = old_count[i];
+      }
+    }
+    vc->n_used = n_used;
+    free(old_voxel);
+    free(old_count);
+    free(vc->sorted);
+    vc->sorted = NULL;
+    slot = voxel_slot(vc, key);
+  }
+
+  vc->voxel[slot] = key;
+  vc->count[slot] = 1;
+  ++vc->n_used;
+}
+
+static int compare_voxel_counts(void const *a, void const *b) {
+  uint64_t va = ((struct voxel_count const *)a)->voxel;
+  uint64_t vb = ((struct voxel_count const *)b)->voxel;
+  return (va < vb) ? -1 : (va > vb);
+}
+
+/*
+ * Sort the nonzero voxels of an item into vc->sorted and empty the table for
+ * the next output time.  Returns the number of nonzero voxels.
+ */
+static u_int sort_voxel_counts(struct voxel_counts *vc) {
+  if (vc->sorted == NULL)
+    vc->sorted = CHECKED_MALLOC_ARRAY(struct voxel_count, vc->size / 2 + 1,
+                                      "volume output voxels");
+
+  u_int n = 0;
+  for (u_int i = 0; i < vc->size && n < vc->n_used; i++) {
+    if (vc->voxel[i] != 0) {
+      vc->sorted[n].voxel = vc->voxel[i] - 1;
+      vc->sorted[n].count = vc->count[i];
+      vc->voxel[i] = 0;
+      n++;
+    }
+  }
+  vc->n_used = 0;
+  qsort(vc->sorted, n, sizeof(struct voxel_count), compare_voxel_counts);
+  return n;
+}
+
+/*
+ * Release the voxel table of an item.
+ */
+static void free_voxel_counts(struct voxel_counts *vc) {
+  if (vc == NULL)
+    return;
+  free(vc->voxel);
+  free(vc->count);
+  free(vc->sorted);
+  free(vc);
+}
+
+/*
+ * Produce this round's volume output, if any: the items due before
+ * 'not_yet'.  The items of a time slot of the scheduler are output together.
+ */
+void process_volume_output(struct volume *wrld, double not_yet) {
+  struct schedule_helper *sh = wrld->volume_output_scheduler;
+  do {
+    /* An item may be rescheduled into the slot we are working on */
+    while (sh->current != NULL) {
+      struct volume_output_item *due = NULL; /* linked through 'next' */
+      while (sh->current != NULL) {
+        struct volume_output_item *vo =
+            (struct volume_output_item *)schedule_next(sh);
+        vo->next = due;
+        due = vo;
+      }
+      if (update_volume_outputs(wrld, due))
+        mcell_error("Failed to update volume output.");
+    }
+
+    /* The slot is empty, so this moves on to the next one */
+    schedule_next(sh);
+  } while (not_yet >= sh->now);
+}
+
 /*
  * Output a block of volume data as requested by the 'vo' object.
  */
 int update_volume_output(struct volume *wrld, struct volume_output_item *vo) {
+  vo->next = NULL;
+  return update_volume_outputs(wrld, vo);
+}
+
+/*
+ * Output the volume items due at the current time, given as a list linked
+ * through their 'next' pointers.  The molecules are counted for all of them
+ * at once; each item is then written to its file and rescheduled.
+ */
+int update_volume_outputs(struct volume *wrld,
+                          struct volume_output_item *items) {
   int failure = 0;
   char *filename;
 
-  switch (wrld->notify->volume_output_report) {
-  case NOTIFY_NONE:
-    break;
+  for (struct volume_output_item *vo = items; vo != NULL; vo = vo->next) {
+    switch (wrld->notify->volume_output_report) {
+    case NOTIFY_NONE:
+      break;
 
-  case NOTIFY_BRIEF:
-  case NOTIFY_FULL:
-    mcell_log("Updating volume output '%s' scheduled at time %.15g on "
-              "iteration %lld.",
-              vo->filename_prefix, vo->t, wrld->current_iterations);
-    break;
+    case NOTIFY_BRIEF:
+    case NOTIFY_FULL:
+      mcell_log("Updating volume output '%s' scheduled at time %.15g on "
+                "iteration %lld.",
+                vo->filename_prefix, vo->t, wrld->current_iterations);
+      break;
 
-  default:
-    UNHANDLED_CASE(wrld->notify->volume_output_report);
+    default:
+      UNHANDLED_CASE(wrld->notify->volume_output_report);
+    }
   }
 
-  /* build the filename */
-  filename = CHECKED_SPRINTF("%s.%lld.dat", vo->filename_prefix, wrld->current_iterations);
+  if (count_volume_output_items(wrld, items))
+    return 1;
 
-  /* Try to make the directory if it doesn't exist */
-  if (make_parent_dir(filename)) {
+  struct volume_output_item *vo, *vonext;
+  for (vo = items; vo != NULL; vo = vonext) {
+    vonext = vo->next; /* schedule_add overwrites 'next' */
+
+    /* build the filename */
+    filename = CHECKED_SPRINTF("%s.%lld.dat", vo->filename_prefix,
+                               wrld->current_iterations);
+
+    /* Try to make the directory if it doesn't exist */
+    if (make_parent_dir(filename)) {
+      free(filename);
+      failure = 1;
+      continue;
+    }
+
+    /* Output the volume item */
+    int item_failure = write_volume_output_file(wrld, filename, vo);
     free(filename);
-    return 1;
-  }
 
-  /* Output the volume item */
-  failure = output_volume_output_item(wrld, filename, vo);
-  free(filename);
+    /* Reschedule this volume item, if appropriate */
+    if (!item_failure)
+      item_failure = reschedule_volume_output_item(wrld, vo);
 
-  /* Reschedule this volume item, if appropriate */
-  if (!failure)
-    failure = reschedule_volume_output_item(wrld, vo);
+    /* Should we return failure if we can't create the file?  Doing so will
+     * bring down the entire sim...
+     */
+    failure |= item_failure;
+  }
 
-  /* Should we return failure if we can't create the file?  Doing so will bring
-   * down the entire sim...
-   */
   return failure;
 }
 
@@ -99,20 +290,33 @@ int update_volume_output(struct volume *wrld, struct volume_output_item *vo) {
  */
 int output_volume_output_item(struct volume *wrld, char const *filename,
                               struct volume_output_item *vo) {
-  FILE *f = fopen(filename, "w");
+  vo->next = NULL;
+  if (count_volume_output_items(wrld, vo))
+    return 1;
+  return write_volume_output_file(wrld, filename, vo);
+}
+
+/*
+ * Write the counts of a volume item, which have already been made, to a
+ * file.
+ */
+static int write_volume_output_file(struct volume *wrld, char const *filename,
+                                    struct volume_output_item *vo) {
+  FILE *f = fopen(filename, wrld->use_binary_volume_output ? "wb" : "w");
   if (f == NULL) {
     mcell_perror_nodie(errno, "Couldn't open volume output file '%s'.",
                        filename);
     return 1;
   }
 
-  if (produce_item_header(f, vo))
+  if (write_volume_output_item(wrld, f, vo))
     goto failure;
 
-  if (produce_mol_counts(wrld, f, vo))
-    goto failure;
-
-  fclose(f);
+  if (fclose(f) != 0) {
+    mcell_perror_nodie(errno, "Couldn't write volume output file '%s'.",
+                       filename);
+    return 1;
+  }
   return 0;
 
 failure:
@@ -121,161 +325,127 @@ failure:
 }
 
 /*
- * Write the molecule counts to the file.
- *
- * XXX: Update this code to be smarter about the tradeoff between large slab
- * size (= large mem usage) and small slab size (= worse cache usage).
+ * Count the volume molecules in the voxels of a list of items in a single
+ * pass over the molecules of the species they ask for.
  */
-static int produce_mol_counts(struct volume *wrld, FILE *out_file,
-                              struct volume_output_item *vo) {
-  struct volume_molecule *curmol;
-  int *counters, *countersptr;
-  int k, u, v;
-  double z = vo->location.z, y = vo->location.y, x = vo->location.x;
-  double x_lim = x + vo->voxel_size.x * (double)vo->nvoxels_x;
-  double y_lim = y + vo->voxel_size.y * (double)vo->nvoxels_y;
-  struct subvolume *cur_partition_z;
-  double z_lim_part;
-
-  /* Allocate memory for counters. */
-  counters =
-      CHECKED_MALLOC_ARRAY(int, vo->nvoxels_x * vo->nvoxels_y, "voxel slab");
-
-  cur_partition_z = find_subvolume(wrld, &vo->location, NULL);
-  if (cur_partition_z == NULL) {
-    free(counters);
-    mcell_internal_error(
-        "While counting at [%g, %g, %g]: point isn't within a partition.", x, y,
-        z);
-    /*return 1;*/
+static int count_volume_output_items(struct volume *wrld,
+                                     struct volume_output_item *items) {
+  /* Items interested in each species: those of species i are
+     interested[first[i]] up to interested[first[i + 1]] */
+  int n_species = wrld->n_species;
+  int *first = CHECKED_MALLOC_ARRAY(int, n_species + 1, "volume output species");
+  memset(first, 0, (n_species + 1) * sizeof(int));
+  for (struct volume_output_item *vo = items; vo != NULL; vo = vo->next) {
+    if (vo->counts == NULL) {
+      vo->counts = CHECKED_MALLOC_STRUCT(struct voxel_counts,
+                                         "volume output voxels");
+      vo->counts->sorted = NULL;
+      if (alloc_voxel_slots(vo->counts, VOXEL_COUNTS_MIN_SIZE))
+        return 1;
+    }
+    for (int i = 0; i < vo->num_molecules; i++)
+      ++first[vo->molecules[i]->species_id + 1];
   }
-
-  z_lim_part = wrld->z_fineparts[cur_partition_z->urb.z];
-
-  /* For each slab: */
-  double r_voxsz_x = 1.0 / vo->voxel_size.x;
-  double r_voxsz_y = 1.0 / vo->voxel_size.y;
-  for (k = 0; k < vo->nvoxels_z; ++k) {
-    double z_lim_slab = z + vo->voxel_size.z;
-    struct subvolume *cur_partition_y;
-
-    /* reset counters for this slab */
-    memset(counters, 0, sizeof(int) * vo->nvoxels_x * vo->nvoxels_y);
-
-  /* Loop over relevant partitions */
-  keep_counting:
-    cur_partition_y = cur_partition_z;
-    while (cur_partition_y != NULL &&
-           wrld->y_fineparts[cur_partition_y->llf.y] < y_lim) {
-      struct subvolume *cur_partition = cur_partition_y;
-      while (cur_partition != NULL &&
-             wrld->x_fineparts[cur_partition->llf.x] < x_lim) {
-        /* Count molecules */
-        struct per_species_list *psl;
-        int check_nonreacting = 0;
-        int i = 0;
-        for (i = 0; i < vo->num_molecules; ++i) {
-          if (!(vo->molecules[i]->flags & CAN_VOLVOL)) {
-            check_nonreacting = 1;
-            break;
-          }
-        }
-        for (psl = cur_partition->species_head; psl != NULL; psl = psl->next) {
-          if (psl->properties == NULL) {
-            if (!check_nonreacting)
-              continue;
-            else {
-              for (curmol = psl->head; curmol != NULL;
-                   curmol = curmol->next_v) {
-                /* See if we're interested in this molecule */
-                if (vo->num_molecules == 1) {
-                  if (*vo->molecules != curmol->properties)
-                    continue;
-                } else {
-                  if ((find_species_in_array(vo->molecules, vo->num_molecules,
-                                             curmol->properties)) == -1)
-                    continue;
-                }
-
-                /* Skip molecules not in our slab */
-                if (curmol->pos.z < z || curmol->pos.z >= z_lim_slab)
-                  continue;
-
-                /* Skip molecules outside our domain */
-                if (curmol->pos.x < x || curmol->pos.x >= x_lim ||
-                    curmol->pos.y < y || curmol->pos.y >= y_lim)
-                  continue;
-
-                /* We've got a winner!  Add one to the appropriate voxel. */
-                ++counters[((int)floor((curmol->pos.y - y) * r_voxsz_y)) *
-                               vo->nvoxels_x +
-                           (int)floor((curmol->pos.x - x) * r_voxsz_x)];
-              }
-            }
-          } else {
-            /* See if we're interested in this molecule */
-            if (vo->num_molecules == 1) {
-              if (*vo->molecules != psl->properties)
-                continue;
-            } else {
-              if ((find_species_in_array(vo->molecules, vo->num_molecules,
-                                         psl->properties)) == -1)
-                continue;
-            }
-
-            for (curmol = psl->head; curmol != NULL; curmol = curmol->next_v) {
-              /* Skip molecules not in our slab */
-              if (curmol->pos.z < z || curmol->pos.z >= z_lim_slab)
-                continue;
-
-              /* Skip molecules outside our domain */
-              if (curmol->pos.x < x || curmol->pos.x >= x_lim ||
-                  curmol->pos.y < y || curmol->pos.y >= y_lim)
-                continue;
-
-              /* We've got a winner!  Add one to the appropriate voxel. */
-              ++counters[((int)floor((curmol->pos.y - y) * r_voxsz_y)) *
-                             vo->nvoxels_x +
-                         (int)floor((curmol->pos.x - x) * r_voxsz_x)];
-            }
-          }
-        }
-
-        /* Advance to next x-partition */
-        cur_partition =
-            traverse_subvol(cur_partition, X_POS, wrld->ny_parts,
-                            wrld->nz_parts);
+  for (int i = 0; i < n_species; i++)
+    first[i + 1] += first[i];
+
+  struct volume_output_item **interested = CHECKED_MALLOC_ARRAY(
+      struct volume_output_item *, first[n_species] + 1,
+      "volume output species");
+  int *fill = CHECKED_MALLOC_ARRAY(int, n_species, "volume output species");
+  memcpy(fill, first, n_species * sizeof(int));
+  for (struct volume_output_item *vo = items; vo != NULL; vo = vo->next) {
+    for (int i = 0; i < vo->num_molecules; i++)
+      interested[fill[vo->molecules[i]->species_id]++] = vo;
+  }
+  free(fill);
+
+  for (int i = 0; i < n_species; i++) {
+    if (first[i] == first[i + 1])
+      continue;
+
+    struct species *spec = wrld->species_list[i];
+    if (spec->flags & NOT_FREE)
+      continue;
+
+    for (u_int m = 0; m < spec->n_live_mols; m++) {
+      struct volume_molecule *vm =
+          (struct volume_molecule *)spec->live_mols[m];
+
+      for (int j = first[i]; j < first[i + 1]; j++) {
+        struct volume_output_item *vo = interested[j];
+
+        /* Skip molecules outside our domain */
+        double fx = (vm->pos.x - vo->location.x) / vo->voxel_size.x;
+        double fy = (vm->pos.y - vo->location.y) / vo->voxel_size.y;
+        double fz = (vm->pos.z - vo->location.z) / vo->voxel_size.z;
+        if (fx < 0.0 || fy < 0.0 || fz < 0.0 || fx >= vo->nvoxels_x ||
+            fy >= vo->nvoxels_y || fz >= vo->nvoxels_z)
+          continue;
+
+        /* We've got a winner!  Add one to the appropriate voxel. */
+        uint64_t voxel =
+            (uint64_t)(int)fx +
+            (uint64_t)vo->nvoxels_x *
+                ((uint64_t)(int)fy + (uint64_t)vo->nvoxels_y * (uint64_t)(int)fz);
+        add_to_voxel(vo->counts, voxel);
       }
-
-      /* Advance to next y-partition */
-      cur_partition_y =
-          traverse_subvol(cur_partition_y, Y_POS, wrld->ny_parts,
-                          wrld->nz_parts);
     }
+  }
 
-    /* If the slab crosses a Z boundary, keep on truckin' */
-    if (z_lim_slab >= z_lim_part) {
-      /* If we can get to the next partition, don't update slab and don't
-       * spill!
-       */
-      cur_partition_z =
-          traverse_subvol(cur_partition_z, Z_POS, wrld->ny_parts,
-                          wrld->nz_parts);
-
-      if (cur_partition_z != NULL) {
-        z_lim_part = wrld->z_fineparts[cur_partition_z->urb.z];
-        goto keep_counting;
-      }
-    } else {
-      z = z_lim_slab;
-      /* z_lim_slab will be updated on the next pass through the loop. */
+  free(interested);
+  free(first);
+  return 0;
+}
+
+/*
+ * Write the counts of an item to the file, either as text with a count for
+ * every voxel, slab by slab, or as the binary list of nonzero voxels.
+ */
+static int write_volume_output_item(struct volume *wrld, FILE *out_file,
+                                    struct volume_output_item *vo) {
+  u_int n_nonzero = sort_voxel_counts(vo->counts);
+  struct voxel_count *nonzero = vo->counts->sorted;
+
+  if (wrld->use_binary_volume_output) {
+    uint32_t dims[3] = { vo->nvoxels_x, vo->nvoxels_y, vo->nvoxels_z };
+    double geometry[7] = {
+      vo->t, vo->location.x * wrld->length_unit,
+      vo->location.y * wrld->length_unit, vo->location.z * wrld->length_unit,
+      vo->voxel_size.x * wrld->length_unit,
+      vo->voxel_size.y * wrld->length_unit,
+      vo->voxel_size.z * wrld->length_unit
+    };
+    uint32_t version = VOL_BIN_VERSION;
+    uint64_t n = n_nonzero;
+    if (fwrite(VOL_BIN_MAGIC, 1, 8, out_file) != 8 ||
+        fwrite(&version, sizeof(version), 1, out_file) != 1 ||
+        fwrite(dims, sizeof(uint32_t), 3, out_file) != 3 ||
+        fwrite(geometry, sizeof(double), 7, out_file) != 7 ||
+        fwrite(&n, sizeof(n), 1, out_file) != 1)
+      goto failure;
+    for (u_int i = 0; i < n_nonzero; i++) {
+      if (fwrite(&nonzero[i].voxel, sizeof(uint64_t), 1, out_file) != 1 ||
+          fwrite(&nonzero[i].count, sizeof(uint32_t), 1, out_file) != 1)
+        goto failure;
     }
+    return 0;
+  }
 
-    /* Spill our counts */
-    countersptr = counters;
-    for (u = 0; u < vo->nvoxels_y; ++u) {
-      for (v = 0; v < vo->nvoxels_x; ++v)
-        fprintf(out_file, "%d ", *countersptr++);
+  if (produce_item_header(out_file, vo))
+    return 1;
+
+  /* Spill our counts, slab by slab */
+  uint64_t voxel = 0;
+  u_int next = 0;
+  for (int k = 0; k < vo->nvoxels_z; ++k) {
+    for (int u = 0; u < vo->nvoxels_y; ++u) {
+      for (int v = 0; v < vo->nvoxels_x; ++v, ++voxel) {
+        uint32_t count = 0;
+        if (next < n_nonzero && nonzero[next].voxel == voxel)
+          count = nonzero[next++].count;
+        fprintf(out_file, "%u ", count);
+      }
       fprintf(out_file, "\n");
     }
 
@@ -283,30 +453,13 @@ static int produce_mol_counts(struct volume *wrld, FILE *out_file,
     fprintf(out_file, "\n");
   }
 
-  free(counters);
+  if (ferror(out_file))
+    goto failure;
   return 0;
-}
-
-/*
- * Binary search for a pointer in an array of pointers.
- */
-static int find_species_in_array(struct species **mols, int num_mols,
-                                 struct species *ptr) {
-  int lo = 0, hi = num_mols;
-  while (hi - lo > 1) {
-    int mid = (hi + lo) / 2;
-    if (mols[mid] > ptr)
-      hi = mid;
-    else if (mols[mid] < ptr)
-      lo = mid;
-    else
-      return mid;
-  }
 
-  if (mols[lo] == ptr)
-    return lo;
-  else
-    return -1;
+failure:
+  mcell_perror_nodie(errno, "Couldn't write volume output file.");
+  return 1;
 }
 
 /*
@@ -337,6 +490,7 @@ static int reschedule_volume_output_item(struct volume *wrld,
     if (vo->next_time == vo->times + vo->num_times) {
       free(vo->filename_prefix);
       free(vo->molecules);
+      free_voxel_counts(vo->counts);
       free(vo->times);
       free(vo);
       return 0;
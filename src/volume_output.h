@@ -25,6 +25,9 @@
 
 #include "mcell_structs.h"
 
+void process_volume_output(struct volume *wrld, double not_yet);
 int update_volume_output(struct volume *wrld, struct volume_output_item *vo);
+int update_volume_outputs(struct volume *wrld,
+                          struct volume_output_item *items);
 int output_volume_output_item(struct volume *wrld, char const *filename,
                               struct volume_output_item *vo);
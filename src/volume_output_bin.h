@@ -0,0 +1,46 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/* Binary volume output files, written with -binary_volume_output.
+ *
+ * Layout (native byte order):
+ *   char     magic[8]       "MCELLVOX"
+ *   uint32_t version        VOL_BIN_VERSION
+ *   uint32_t nx, ny, nz     number of voxels along each axis
+ *   double   time           output time, as in the text header
+ *   double   origin[3]      lower corner of the voxels, in microns
+ *   double   voxel_size[3]  size of a voxel, in microns
+ *   uint64_t n_nonzero      number of voxels holding molecules
+ *   per nonzero voxel, in increasing index order:
+ *     uint64_t voxel        x + nx * (y + ny * z)
+ *     uint32_t count        number of molecules in the voxel
+ *
+ * The converter vol_bin2txt prints a file in the text format MCell writes
+ * otherwise. */
+
+#define VOL_BIN_MAGIC "MCELLVOX"
+#define VOL_BIN_VERSION 1
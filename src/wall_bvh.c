@@ -0,0 +1,386 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+/* Bounding volume hierarchies over the walls of the subvolumes.
+ *
+ * ray_trace tests a molecule's displacement against every wall in its
+ * subvolume.  With -wall_bvh, subvolumes holding many walls get a binary
+ * tree of bounding boxes over them, and only the walls whose boxes the
+ * displacement passes through are handed to collide_wall.
+ *
+ * collide_wall reports a hit on a wall only if the plane of the wall is
+ * crossed less than twice the length of the displacement away, and the
+ * crossing is on the triangle or within rounding of its edges.  The boxes
+ * are enlarged by a margin that covers those rounding tolerances, and the
+ * query uses twice the displacement, so no wall that could be hit is
+ * culled.  The candidates are returned in wall_head order, so the walls
+ * are tested in the same order as without the hierarchy.  The one thing a
+ * culled wall can't do is ask for a displacement which starts exactly in
+ * its plane and runs exactly parallel to it to be jittered. */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "mcell_structs.h"
+#include "wall_bvh.h"
+
+/* Subvolumes with fewer walls than this just use the list */
+#define WALL_BVH_MIN_WALLS 16
+
+/* Most walls per leaf */
+#define WALL_BVH_LEAF_SIZE 4
+
+/* Deepest tree a query can walk */
+#define WALL_BVH_MAX_DEPTH 64
+
+struct wall_box {
+  struct vector3 llf;
+  struct vector3 urb;
+  struct vector3 cent;
+};
+
+/*************************************************************************
+wall_margin_box:
+  In: w: a wall
+      box: where to store its bounding box
+  Out: No return value.  The box holds the wall, enlarged by a margin which
+       covers every point collide_wall may count as on the wall.
+*************************************************************************/
+static void wall_margin_box(struct wall *w, struct wall_box *box) {
+  struct vector3 **v = w->vert;
+
+  box->llf = *v[0];
+  box->urb = *v[0];
+  for (int i = 1; i < 3; i++) {
+    box->llf.x = (v[i]->x < box->llf.x) ? v[i]->x : box->llf.x;
+    box->llf.y = (v[i]->y < box->llf.y) ? v[i]->y : box->llf.y;
+    box->llf.z = (v[i]->z < box->llf.z) ? v[i]->z : box->llf.z;
+    box->urb.x = (v[i]->x > box->urb.x) ? v[i]->x : box->urb.x;
+    box->urb.y = (v[i]->y > box->urb.y) ? v[i]->y : box->urb.y;
+    box->urb.z = (v[i]->z > box->urb.z) ? v[i]->z : box->urb.z;
+  }
+
+  double max_abs = 0.0;
+  double shortest = -1.0;
+  for (int i = 0; i < 3; i++) {
+    struct vector3 *a = v[i];
+    struct vector3 *b = v[(i + 1) % 3];
+    double len = sqrt((b->x - a->x) * (b->x - a->x) +
+                      (b->y - a->y) * (b->y - a->y) +
+                      (b->z - a->z) * (b->z - a->z));
+    if (shortest < 0.0 || len < shortest)
+      shortest = len;
+    if (fabs(a->x) > max_abs)
+      max_abs = fabs(a->x);
+    if (fabs(a->y) > max_abs)
+      max_abs = fabs(a->y);
+    if (fabs(a->z) > max_abs)
+      max_abs = fabs(a->z);
+  }
+  double diam = (box->urb.x - box->llf.x) + (box->urb.y - box->llf.y) +
+                (box->urb.z - box->llf.z);
+
+  /* The edge tests of collide_wall compare products of in-plane
+   * coordinates, so their tolerance grows with the square of the size of
+   * the wall and shrinks with the length of its edges. */
+  double margin = 16.0 * EPS_C * (1.0 + max_abs);
+  if (shortest > 0.0)
+    margin += 8.0 * EPS_C * (1.0 + 2.0 * diam * diam) / shortest;
+  else
+    margin += 1.0 + diam;
+
+  box->llf.x -= margin;
+  box->llf.y -= margin;
+  box->llf.z -= margin;
+  box->urb.x += margin;
+  box->urb.y += margin;
+  box->urb.z += margin;
+
+  box->cent.x = (v[0]->x + v[1]->x + v[2]->x) / 3.0;
+  box->cent.y = (v[0]->y + v[1]->y + v[2]->y) / 3.0;
+  box->cent.z = (v[0]->z + v[1]->z + v[2]->z) / 3.0;
+}
+
+static struct wall_box const *sort_boxes;
+static int sort_axis;
+
+static double box_centroid(int i) {
+  struct vector3 const *c = &sort_boxes[i].cent;
+  return (sort_axis == 0) ? c->x : ((sort_axis == 1) ? c->y : c->z);
+}
+
+static int compare_centroids(void const *a, void const *b) {
+  double ca = box_centroid(*(int const *)a);
+  double cb = box_centroid(*(int const *)b);
+  if (ca < cb)
+    return -1;
+  if (ca > cb)
+    return 1;
+  return *(int const *)a - *(int const *)b;
+}
+
+static int compare_indices(void const *a, void const *b) {
+  return *(int const *)a - *(int const *)b;
+}
+
+/*************************************************************************
+build_node:
+  In: bvh: hierarchy being built
+      boxes: enlarged bounding boxes of the walls
+      first: first entry of bvh->order to put below the node
+      count: number of entries to put below the node
+  Out: The index of the new node.  Its subtree is built as well, splitting
+       the walls at the median centroid along the longest axis.
+*************************************************************************/
+static int build_node(struct wall_bvh *bvh, struct wall_box const *boxes,
+                      int first, int count) {
+  int idx = bvh->n_nodes++;
+  struct wall_bvh_node *node = &bvh->nodes[idx];
+
+  /* Bounds of the walls and of their centroids */
+  struct wall_box const *b0 = &boxes[bvh->order[first]];
+  struct vector3 clo = b0->cent, chi = b0->cent;
+  node->llf = b0->llf;
+  node->urb = b0->urb;
+  for (int i = first + 1; i < first + count; i++) {
+    struct wall_box const *b = &boxes[bvh->order[i]];
+    node->llf.x = (b->llf.x < node->llf.x) ? b->llf.x : node->llf.x;
+    node->llf.y = (b->llf.y < node->llf.y) ? b->llf.y : node->llf.y;
+    node->llf.z = (b->llf.z < node->llf.z) ? b->llf.z : node->llf.z;
+    node->urb.x = (b->urb.x > node->urb.x) ? b->urb.x : node->urb.x;
+    node->urb.y = (b->urb.y > node->urb.y) ? b->urb.y : node->urb.y;
+    node->urb.z = (b->urb.z > node->urb.z) ? b->urb.z : node->urb.z;
+    clo.x = (b->cent.x < clo.x) ? b->cent.x : clo.x;
+    clo.y = (b->cent.y < clo.y) ? b->cent.y : clo.y;
+    clo.z = (b->cent.z < clo.z) ? b->cent.z : clo.z;
+    chi.x = (b->cent.x > chi.x) ? b->cent.x : chi.x;
+    chi.y = (b->cent.y > chi.y) ? b->cent.y : chi.y;
+    chi.z = (b->cent.z > chi.z) ? b->cent.z : chi.z;
+  }
+
+  if (count <= WALL_BVH_LEAF_SIZE) {
+    node->first = first;
+    node->count = count;
+    return idx;
+  }
+
+  double ext_x = chi.x - clo.x, ext_y = chi.y - clo.y, ext_z = chi.z - clo.z;
+  if (ext_x >= ext_y && ext_x >= ext_z)
+    sort_axis = 0;
+  else
+    sort_axis = (ext_y >= ext_z) ? 1 : 2;
+  sort_boxes = boxes;
+  qsort(bvh->order + first, count, sizeof(int), compare_centroids);
+
+  int half = count / 2;
+  node->count = 0;
+  build_node(bvh, boxes, first, half);
+  int right = build_node(bvh, boxes, first + half, count - half);
+  bvh->nodes[idx].first = right;
+  return idx;
+}
+
+/*************************************************************************
+build_wall_bvh:
+  In: sv: a subvolume
+      n_walls: number of walls in its wall list
+  Out: The hierarchy over the walls of the subvolume.
+*************************************************************************/
+static struct wall_bvh *build_wall_bvh(struct subvolume *sv, int n_walls) {
+  struct wall_bvh *bvh =
+      CHECKED_MALLOC_STRUCT(struct wall_bvh, "wall bounding volume hierarchy");
+  bvh->n_walls = n_walls;
+  bvh->links = CHECKED_MALLOC_ARRAY(struct wall_list, n_walls,
+                                    "wall bounding volume hierarchy");
+  bvh->order =
+      CHECKED_MALLOC_ARRAY(int, n_walls, "wall bounding volume hierarchy");
+  bvh->found =
+      CHECKED_MALLOC_ARRAY(int, n_walls, "wall bounding volume hierarchy");
+  bvh->nodes = CHECKED_MALLOC_ARRAY(struct wall_bvh_node, 2 * n_walls,
+                                    "wall bounding volume hierarchy");
+  bvh->n_nodes = 0;
+
+  struct wall_box *boxes = CHECKED_MALLOC_ARRAY(
+      struct wall_box, n_walls, "wall bounding volume hierarchy");
+  int i = 0;
+  for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next, i++) {
+    bvh->links[i].this_wall = wl->this_wall;
+    bvh->links[i].next = NULL;
+    bvh->order[i] = i;
+    wall_margin_box(wl->this_wall, &boxes[i]);
+  }
+
+  build_node(bvh, boxes, 0, n_walls);
+  free(boxes);
+  return bvh;
+}
+
+/*************************************************************************
+destroy_wall_bvh:
+  In: bvh: a hierarchy, or NULL
+  Out: No return value.  The hierarchy is freed.
+*************************************************************************/
+void destroy_wall_bvh(struct wall_bvh *bvh) {
+  if (bvh == NULL)
+    return;
+  free(bvh->links);
+  free(bvh->order);
+  free(bvh->found);
+  free(bvh->nodes);
+  free(bvh);
+}
+
+/*************************************************************************
+init_wall_bvhs:
+  In: world: simulation state
+  Out: 0 on success.  If hierarchies were asked for, every subvolume with
+       enough walls gets one.
+*************************************************************************/
+int init_wall_bvhs(struct volume *world) {
+  for (int i = 0; i < world->n_subvols; i++)
+    world->subvol[i].wall_bvh = NULL;
+  if (!world->use_wall_bvh)
+    return 0;
+
+  int n_built = 0;
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    int n_walls = 0;
+    for (struct wall_list *wl = sv->wall_head; wl != NULL; wl = wl->next)
+      n_walls++;
+    if (n_walls < WALL_BVH_MIN_WALLS)
+      continue;
+    sv->wall_bvh = build_wall_bvh(sv, n_walls);
+    n_built++;
+  }
+
+  if (world->notify->progress_report != NOTIFY_NONE)
+    mcell_log("Built wall hierarchies for %d of %d subvolumes.", n_built,
+              world->n_subvols);
+  return 0;
+}
+
+/*************************************************************************
+segment_hits_box:
+  In: pos: start of the segment
+      d: the segment
+      inv: reciprocals of the components of d
+      node: a node of the hierarchy
+  Out: 1 if the segment passes through the node's box, 0 if not.
+*************************************************************************/
+static int segment_hits_box(double const *pos, double const *d,
+                            double const *inv, struct wall_bvh_node *node) {
+  double llf[3] = { node->llf.x, node->llf.y, node->llf.z };
+  double urb[3] = { node->urb.x, node->urb.y, node->urb.z };
+  double t0 = 0.0, t1 = 1.0;
+  for (int a = 0; a < 3; a++) {
+    if (d[a] == 0.0) {
+      if (pos[a] < llf[a] || pos[a] > urb[a])
+        return 0;
+      continue;
+    }
+    double ta = (llf[a] - pos[a]) * inv[a];
+    double tb = (urb[a] - pos[a]) * inv[a];
+    if (ta > tb) {
+      double tmp = ta;
+      ta = tb;
+      tb = tmp;
+    }
+    if (ta > t0)
+      t0 = ta;
+    if (tb < t1)
+      t1 = tb;
+    if (t0 > t1)
+      return 0;
+  }
+  return 1;
+}
+
+/*************************************************************************
+wall_bvh_query:
+  In: bvh: hierarchy over the walls of a subvolume
+      pos: where the molecule starts
+      v: its displacement
+      notify: notification settings
+      culled: counter of walls left out
+  Out: A list of the walls the displacement may hit, in the order of the
+       subvolume's wall list, or NULL if there are none.  The list belongs
+       to the hierarchy and is overwritten by the next query.  The walls
+       left out are counted when ray-polygon tests are.
+*************************************************************************/
+struct wall_list *wall_bvh_query(struct wall_bvh *bvh, struct vector3 *pos,
+                                 struct vector3 *v,
+                                 struct notifications *notify,
+                                 long long *culled) {
+  double p[3] = { pos->x, pos->y, pos->z };
+  double d[3] = { 2.0 * v->x, 2.0 * v->y, 2.0 * v->z };
+  double inv[3];
+  for (int a = 0; a < 3; a++)
+    inv[a] = (d[a] != 0.0) ? 1.0 / d[a] : 0.0;
+
+  int stack[WALL_BVH_MAX_DEPTH];
+  int n_stack = 0;
+  int n_found = 0;
+  stack[n_stack++] = 0;
+  while (n_stack > 0) {
+    int idx = stack[--n_stack];
+    struct wall_bvh_node *node = &bvh->nodes[idx];
+    if (!segment_hits_box(p, d, inv, node))
+      continue;
+    if (node->count > 0) {
+      for (int i = node->first; i < node->first + node->count; i++)
+        bvh->found[n_found++] = bvh->order[i];
+    } else {
+      if (n_stack + 2 > WALL_BVH_MAX_DEPTH)
+        mcell_internal_error("Wall bounding volume hierarchy is too deep.");
+      stack[n_stack++] = node->first;
+      stack[n_stack++] = idx + 1;
+    }
+  }
+  if (notify->final_summary == NOTIFY_FULL)
+    *culled += bvh->n_walls - n_found;
+  if (n_found == 0)
+    return NULL;
+
+  /* Back into wall list order; there are usually only a few */
+  int *found = bvh->found;
+  if (n_found > 32) {
+    qsort(found, n_found, sizeof(int), compare_indices);
+  } else {
+    for (int i = 1; i < n_found; i++) {
+      int f = found[i];
+      int j = i;
+      for (; j > 0 && found[j - 1] > f; j--)
+        found[j] = found[j - 1];
+      found[j] = f;
+    }
+  }
+
+  for (int i = 0; i < n_found - 1; i++)
+    bvh->links[found[i]].next = &bvh->links[found[i + 1]];
+  bvh->links[found[n_found - 1]].next = NULL;
+  return &bvh->links[found[0]];
+}
@@ -0,0 +1,51 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2006-2017 by
+ * The Salk Institute for Biological Studies and
+ * Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+******************************************************************************/
+
+#pragma once
+
+#include "mcell_structs.h"
+
+/* Bounding volume hierarchy over the walls of a subvolume */
+struct wall_bvh_node {
+  struct vector3 llf; /* Bounding box of the walls below this node, */
+  struct vector3 urb; /* enlarged by their rounding margins */
+  int first; /* Leaf: first entry in order[]; inner node: right child */
+  int count; /* Leaf: number of walls; inner node: 0 (left child follows) */
+};
+
+struct wall_bvh {
+  int n_walls;
+  struct wall_list *links;     /* One per wall, in wall_head order */
+  int *order;                  /* Wall indices, grouped by leaf */
+  struct wall_bvh_node *nodes;
+  int n_nodes;
+  int *found;                  /* Scratch for queries */
+};
+
+int init_wall_bvhs(struct volume *world);
+void destroy_wall_bvh(struct wall_bvh *bvh);
+
+struct wall_list *wall_bvh_query(struct wall_bvh *bvh, struct vector3 *pos,
+                                 struct vector3 *v,
+                                 struct notifications *notify,
+                                 long long *culled);
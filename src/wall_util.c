@@ -41,6 +41,7 @@
 #include "react.h"
 #include "nfsim_func.h"
 #include "strfunc.h"
+#include "mol_index.h"
 
 /* tetrahedralVol returns the (signed) volume of the tetrahedron spanned by
  * the vertices a, b, c, and d.
@@ -1569,21 +1570,24 @@ struct wall *localize_wall(struct wall *w, struct storage *stor) {
   return ww;
 }
 
+/* Subvolumes a wall may intersect, found from its (slightly enlarged)
+ * bounding box */
+struct wall_subvol_range {
+  double leeway; /* Margin by which the boxes are enlarged */
+  int x_min, x_max, y_min, y_max, z_min, z_max; /* Partition index ranges */
+};
+
 /***************************************************************************
-distribute_wall:
-  In: a wall belonging to an object
-  Out: A pointer to the wall as copied into appropriate local memory, or
-       NULL on memory allocation error.  Also, the wall is added to the
-       appropriate wall lists for all subvolumes it intersects; if this
-       fails due to memory allocation errors, NULL is also returned.
+find_wall_subvol_range:
+  In: world: simulation state
+      w: a wall
+      range: to be filled in with the subvolumes the wall may intersect
+  Out: No return value.
 ***************************************************************************/
-static struct wall *distribute_wall(struct volume *world, struct wall *w) {
-  struct wall *where_am_i;       /* Version of the wall in local memory */
-  struct vector3 llf, urb, cent; /* Bounding box for wall */
-  int x_max, x_min, y_max, y_min, z_max,
-      z_min;           /* Enlarged box to avoid rounding */
-  int h, i, j, k;      /* Iteration variables for subvolumes */
-  double leeway = 1.0; /* Margin of error */
+static void find_wall_subvol_range(struct volume *world, struct wall *w,
+                                   struct wall_subvol_range *range) {
+  struct vector3 llf, urb; /* Bounding box for wall */
+  double leeway = 1.0;     /* Margin of error */
 
   wall_bounding_box(w, &llf, &urb);
 
@@ -1603,6 +1607,7 @@ static struct wall *distribute_wall(struct volume *world, struct wall *w) {
   if (world->use_expanded_list) {
     leeway += world->rx_radius_3d;
   }
+  range->leeway = leeway;
 
   llf.x -= leeway;
   llf.y -= leeway;
@@ -1611,62 +1616,51 @@ static struct wall *distribute_wall(struct volume *world, struct wall *w) {
   urb.y += leeway;
   urb.z += leeway;
 
-  cent.x = 0.33333333333 * (w->vert[0]->x + w->vert[1]->x + w->vert[2]->x);
-  cent.y = 0.33333333333 * (w->vert[0]->y + w->vert[1]->y + w->vert[2]->y);
-  cent.z = 0.33333333333 * (w->vert[0]->z + w->vert[1]->z + w->vert[2]->z);
-
-  x_min = bisect(world->x_partitions, world->nx_parts, llf.x);
-  if (urb.x < world->x_partitions[x_min + 1])
-    x_max = x_min + 1;
+  range->x_min = bisect(world->x_partitions, world->nx_parts, llf.x);
+  if (urb.x < world->x_partitions[range->x_min + 1])
+    range->x_max = range->x_min + 1;
   else
-    x_max = bisect(world->x_partitions, world->nx_parts, urb.x) + 1;
+    range->x_max = bisect(world->x_partitions, world->nx_parts, urb.x) + 1;
 
-  y_min = bisect(world->y_partitions, world->ny_parts, llf.y);
-  if (urb.y < world->y_partitions[y_min + 1])
-    y_max = y_min + 1;
+  range->y_min = bisect(world->y_partitions, world->ny_parts, llf.y);
+  if (urb.y < world->y_partitions[range->y_min + 1])
+    range->y_max = range->y_min + 1;
   else
-    y_max = bisect(world->y_partitions, world->ny_parts, urb.y) + 1;
+    range->y_max = bisect(world->y_partitions, world->ny_parts, urb.y) + 1;
 
-  z_min = bisect(world->z_partitions, world->nz_parts, llf.z);
-  if (urb.z < world->z_partitions[z_min + 1])
-    z_max = z_min + 1;
+  range->z_min = bisect(world->z_partitions, world->nz_parts, llf.z);
+  if (urb.z < world->z_partitions[range->z_min + 1])
+    range->z_max = range->z_min + 1;
   else
-    z_max = bisect(world->z_partitions, world->nz_parts, urb.z) + 1;
-
-  if ((z_max - z_min) * (y_max - y_min) * (x_max - x_min) == 1) {
-    h = z_min + (world->nz_parts - 1) * (y_min + (world->ny_parts - 1) * x_min);
-    where_am_i = localize_wall(w, world->subvol[h].local_storage);
-    if (where_am_i == NULL)
-      return NULL;
-
-    if (wall_to_vol(where_am_i, &(world->subvol[h])) == NULL)
-      return NULL;
+    range->z_max = bisect(world->z_partitions, world->nz_parts, urb.z) + 1;
+}
 
-    return where_am_i;
-  }
+/***************************************************************************
+wall_to_intersected_vols:
+  In: world: simulation state
+      w: a wall, in local memory
+      range: the subvolumes it may intersect
+  Out: 0 on success, 1 on memory allocation failure.  The wall is added to
+       the wall lists of all subvolumes it intersects.
+***************************************************************************/
+static int wall_to_intersected_vols(struct volume *world, struct wall *w,
+                                    struct wall_subvol_range *range) {
+  int h, i, j, k; /* Iteration variables for subvolumes */
+  struct vector3 llf, urb;
 
-  for (i = x_min; i < x_max; i++) {
-    if (cent.x < world->x_partitions[i])
-      break;
-  }
-  for (j = y_min; j < y_max; j++) {
-    if (cent.y < world->y_partitions[j])
-      break;
-  }
-  for (k = z_min; k < z_max; k++) {
-    if (cent.z < world->z_partitions[k])
-      break;
+  if ((range->z_max - range->z_min) * (range->y_max - range->y_min) *
+          (range->x_max - range->x_min) ==
+      1) {
+    h = range->z_min +
+        (world->nz_parts - 1) *
+            (range->y_min + (world->ny_parts - 1) * range->x_min);
+    return wall_to_vol(w, &(world->subvol[h])) == NULL;
   }
 
-  h = (k - 1) +
-      (world->nz_parts - 1) * ((j - 1) + (world->ny_parts - 1) * (i - 1));
-  where_am_i = localize_wall(w, world->subvol[h].local_storage);
-  if (where_am_i == NULL)
-    return NULL;
-
-  for (k = z_min; k < z_max; k++) {
-    for (j = y_min; j < y_max; j++) {
-      for (i = x_min; i < x_max; i++) {
+  double leeway = range->leeway;
+  for (k = range->z_min; k < range->z_max; k++) {
+    for (j = range->y_min; j < range->y_max; j++) {
+      for (i = range->x_min; i < range->x_max; i++) {
         h = k + (world->nz_parts - 1) * (j + (world->ny_parts - 1) * i);
         llf.x = world->x_fineparts[world->subvol[h].llf.x] - leeway;
         llf.y = world->y_fineparts[world->subvol[h].llf.y] - leeway;
@@ -1676,16 +1670,124 @@ static struct wall *distribute_wall(struct volume *world, struct wall *w) {
         urb.z = world->z_fineparts[world->subvol[h].urb.z] + leeway;
 
         if (wall_in_box(w->vert, &(w->normal), w->d, &llf, &urb)) {
-          if (wall_to_vol(where_am_i, &(world->subvol[h])) == NULL)
-            return NULL;
+          if (wall_to_vol(w, &(world->subvol[h])) == NULL)
+            return 1;
         }
       }
     }
   }
 
+  return 0;
+}
+
+/***************************************************************************
+distribute_wall:
+  In: a wall belonging to an object
+  Out: A pointer to the wall as copied into appropriate local memory, or
+       NULL on memory allocation error.  Also, the wall is added to the
+       appropriate wall lists for all subvolumes it intersects; if this
+       fails due to memory allocation errors, NULL is also returned.
+***************************************************************************/
+static struct wall *distribute_wall(struct volume *world, struct wall *w) {
+  struct wall *where_am_i; /* Version of the wall in local memory */
+  struct vector3 cent;     /* Center of the wall */
+  struct wall_subvol_range range;
+  int h, i, j, k; /* Iteration variables for subvolumes */
+
+  find_wall_subvol_range(world, w, &range);
+
+  if ((range.z_max - range.z_min) * (range.y_max - range.y_min) *
+          (range.x_max - range.x_min) ==
+      1) {
+    h = range.z_min +
+        (world->nz_parts - 1) *
+            (range.y_min + (world->ny_parts - 1) * range.x_min);
+  } else {
+    cent.x = 0.33333333333 * (w->vert[0]->x + w->vert[1]->x + w->vert[2]->x);
+    cent.y = 0.33333333333 * (w->vert[0]->y + w->vert[1]->y + w->vert[2]->y);
+    cent.z = 0.33333333333 * (w->vert[0]->z + w->vert[1]->z + w->vert[2]->z);
+
+    for (i = range.x_min; i < range.x_max; i++) {
+      if (cent.x < world->x_partitions[i])
+        break;
+    }
+    for (j = range.y_min; j < range.y_max; j++) {
+      if (cent.y < world->y_partitions[j])
+        break;
+    }
+    for (k = range.z_min; k < range.z_max; k++) {
+      if (cent.z < world->z_partitions[k])
+        break;
+    }
+
+    h = (k - 1) +
+        (world->nz_parts - 1) * ((j - 1) + (world->ny_parts - 1) * (i - 1));
+  }
+
+  where_am_i = localize_wall(w, world->subvol[h].local_storage);
+  if (where_am_i == NULL)
+    return NULL;
+
+  if (wall_to_intersected_vols(world, where_am_i, &range))
+    return NULL;
+
   return where_am_i;
 }
 
+/***************************************************************************
+redistribute_object_walls:
+  In: world: simulation state
+      parent: an object whose walls have been distributed
+  Out: 0 on success, 1 on memory allocation failure.  The object's walls
+       (and those of its children) are added to the wall lists of the
+       subvolumes they intersect.  They stay where they are in memory.
+***************************************************************************/
+static int redistribute_object_walls(struct volume *world,
+                                     struct object *parent) {
+  if (parent->object_type == BOX_OBJ || parent->object_type == POLY_OBJ) {
+    for (int i = 0; i < parent->n_walls; i++) {
+      struct wall *w = parent->wall_p[i];
+      if (w == NULL)
+        continue; /* Wall removed. */
+
+      struct wall_subvol_range range;
+      find_wall_subvol_range(world, w, &range);
+      if (wall_to_intersected_vols(world, w, &range))
+        return 1;
+    }
+  } else if (parent->object_type == META_OBJ) {
+    for (struct object *o = parent->first_child; o != NULL; o = o->next) {
+      if (redistribute_object_walls(world, o))
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+/***************************************************************************
+redistribute_walls:
+  In: world: simulation state, whose partitions have moved since the walls
+             were distributed
+  Out: 0 on success, 1 on memory allocation failure.  The wall lists of all
+       subvolumes are rebuilt.
+***************************************************************************/
+int redistribute_walls(struct volume *world) {
+  for (int i = 0; i < world->n_subvols; i++) {
+    struct subvolume *sv = &world->subvol[i];
+    if (sv->wall_head != NULL)
+      mem_put_list(sv->local_storage->list, sv->wall_head);
+    sv->wall_head = NULL;
+  }
+
+  for (struct object *o = world->root_instance; o != NULL; o = o->next) {
+    if (redistribute_object_walls(world, o))
+      return 1;
+  }
+
+  return 0;
+}
+
 /***************************************************************************
 distribute_object:
   In: an object
@@ -1950,11 +2052,13 @@ static int vacuum_from_regions(struct volume *world,
     if (rng_dbl(world->rng) < ((double)(-n)) / ((double)n_rrhd)) {
       smp = p->grid->sm_list[p->index]->sm;
       smp->properties->population--;
+      mol_index_remove(smp->properties, (struct abstract_molecule *)smp);
       if ((smp->properties->flags & (COUNT_CONTENTS | COUNT_ENCLOSED)) != 0)
         count_region_from_scratch(world, (struct abstract_molecule *)smp, NULL,
                                   -1, NULL, smp->grid->surface, smp->t, NULL);
       smp->properties = NULL;
       p->grid->sm_list[p->index]->sm = NULL;
+      update_tile_occupancy(p->grid, p->index);
       p->grid->n_occupied--;
       if (smp->flags & IN_SCHEDULE) {
         smp->grid->subvol->local_storage->timer->defunct_count++; /* Tally for
@@ -2223,12 +2327,7 @@ struct surface_molecule *place_single_molecule(struct volume *state,
   new_sm->s_pos.v = s_pos.v;
   new_sm->properties = spec;
   new_sm->graph_data = graph;
-  initialize_diffusion_function((struct abstract_molecule *)new_sm);
-  new_sm->periodic_box = CHECKED_MALLOC_STRUCT(struct periodic_image,
-    "periodic image descriptor");
-  new_sm->periodic_box->x = periodic_box->x;
-  new_sm->periodic_box->y = periodic_box->y;
-  new_sm->periodic_box->z = periodic_box->z;
+  new_sm->periodic_box = new_periodic_image(state, periodic_box);
 
   if (orientation == 0)
     new_sm->orient = (rng_uint(state->rng) & 1) ? 1 : -1;
@@ -2244,12 +2343,14 @@ struct surface_molecule *place_single_molecule(struct volume *state,
     w->grid->sm_list[grid_index] = sm_entry;
   }
   w->grid->sm_list[grid_index]->sm = new_sm;
+  update_tile_occupancy(w->grid, grid_index);
   w->grid->n_occupied++;
   new_sm->properties->population++;
+  mol_index_add((struct abstract_molecule *)new_sm);
 
   new_sm->flags = flags;
 
-  if (new_sm->get_space_step(new_sm) > 0)
+  if (mol_space_step(new_sm) > 0)
     new_sm->flags |= ACT_DIFFUSE;
 
   if ((new_sm->properties->flags & COUNT_ENCLOSED) != 0)
@@ -112,6 +112,8 @@ int distribute_object(struct volume *world, struct object *parent);
 
 int distribute_world(struct volume *world);
 
+int redistribute_walls(struct volume *world);
+
 void closest_pt_point_triangle(struct vector3 *p, struct vector3 *a,
                                struct vector3 *b, struct vector3 *c,
                                struct vector3 *final_result);